@@ -22,15 +22,56 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef __SPLITSTREAM_PRIVATE_H_INC
 typedef int SplitstreamTokenizerState;
 #endif
 
+/* A piece of a segmented document, laid out like `struct iovec` so that the segments of a
+   document can be passed to writev(2) as they are. */
+typedef struct {
+    const char* base;
+    size_t length;
+} SplitstreamSegment;
+
+#define SPLITSTREAM_SEGMENT_SIZE        16384
+
 typedef struct {
     const char* buffer;
     size_t length;
+    long long offset;   /* Stream offset of the first byte of the document */
+    int fragment;       /* SPLITSTREAM_FRAGMENT_*, see SplitstreamSetFragmentSize */
+    SplitstreamSegment* segments;   /* Set if the document is not contiguous, see SplitstreamSetSegmented */
+    size_t segmentCount;
+    int hasKey;         /* Set if the key was found, see SplitstreamSetKey */
+    unsigned long long keyHash;
+    size_t keyOffset, keyLength;    /* Position of the key value in the document */
+    unsigned long long hash;        /* Set if hashing, see SplitstreamSetHashing */
 } SplitstreamDocument;
 
+#define SPLITSTREAM_FRAGMENT_NONE       0   /* A whole document */
+#define SPLITSTREAM_FRAGMENT_START      1
+#define SPLITSTREAM_FRAGMENT_CONTINUE   2
+#define SPLITSTREAM_FRAGMENT_END        3
+
+typedef struct SplitstreamFilter SplitstreamFilter;
+typedef struct SplitstreamSampler SplitstreamSampler;
+typedef struct SplitstreamRing SplitstreamRing;
+typedef struct SplitstreamKey SplitstreamKey;
+typedef struct SplitstreamDedup SplitstreamDedup;
+typedef struct SplitstreamResync SplitstreamResync;
+typedef struct SplitstreamReadSize SplitstreamReadSize;
+typedef struct SplitstreamSeparator SplitstreamSeparator;
+
+typedef struct {
+    unsigned long long v[4], total;
+    unsigned char buffer[32];
+    size_t buffered;
+} SplitstreamHashState;
+
 typedef struct {
     int startDepth;
     int depth;
@@ -40,6 +81,29 @@ typedef struct {
     SplitstreamTokenizerState state;
     SplitstreamDocument doc;
     struct mempool* mempool;
+    long long offset;   /* Number of bytes fed to the tokenizer so far */
+    const SplitstreamFilter* filter;
+    int matchState;     /* Progress of `filter` on the current document */
+    unsigned matchCandidates;
+    size_t matchPosition;
+    SplitstreamSampler* sampler;
+    size_t fragmentSize;
+    int segmented;
+    SplitstreamRing* ring;
+    const SplitstreamKey* key;
+    int keyState;       /* Progress of `key` on the current document */
+    int keyFlags, keyNest;
+    size_t keyPosition, keyMatch, keyStart, keyLength;
+    unsigned long long keyHash;
+    int hashing;
+    SplitstreamDedup* dedup;
+    SplitstreamHashState hash;
+    SplitstreamResync* resync;
+    size_t resyncAt;
+    SplitstreamReadSize* readSize;
+    char delimiter;     /* See SplitstreamSetCSV */
+    int skipHeader;
+    const SplitstreamSeparator* separator;
 } SplitstreamState;
 
 #ifndef SPLITSTREAM_API
@@ -53,12 +117,425 @@ typedef size_t (*SplitstreamScanner)(SplitstreamState* ptr, const char* buf, siz
 size_t SPLITSTREAM_API SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
 size_t SPLITSTREAM_API SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
 size_t SPLITSTREAM_API SplitstreamUBJSONScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
+/* CSV (RFC 4180) and TSV records. Each record is a document, without its line break; blank
+   lines are skipped. A field that starts with a quote may contain delimiters and line breaks,
+   with quotes doubled. The last record of a stream, which may not be followed by a line break,
+   is returned by SplitstreamGetLastDocument. The CSV scanner's delimiter can be changed with
+   SplitstreamSetCSV. */
+size_t SPLITSTREAM_API SplitstreamCSVScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
+size_t SPLITSTREAM_API SplitstreamTSVScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
+/* Records framed by a separator rather than by their syntax, such as RFC 7464 JSON text
+   sequences (a record separator, 0x1e, before each text), NUL-terminated records or YAML
+   documents between "\n---\n" lines. The separator is set with SplitstreamSetSeparator and
+   is a line break by default. Empty records are skipped. The last record of the input, which
+   may not be followed by a separator, is returned by SplitstreamGetLastDocument. */
+size_t SPLITSTREAM_API SplitstreamSeparatorScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start);
 
 void SPLITSTREAM_API SplitstreamDocumentFree(SplitstreamState* state, SplitstreamDocument* doc);
 void SPLITSTREAM_API SplitstreamInit(SplitstreamState* state);
 void SPLITSTREAM_API SplitstreamInitDepth(SplitstreamState* state, int startDepth);
 void SPLITSTREAM_API SplitstreamFree(SplitstreamState* state);
+
+/* Builds documents that grow past SPLITSTREAM_SEGMENT_SIZE from a list of fixed-size
+   segments, instead of reallocating and copying the whole document every time it outgrows
+   its buffer. Such documents have `segmentCount` segments, `length` is their total length
+   and `buffer` only points to the first segment. Documents that fit in one segment are
+   returned contiguously as before, with `segmentCount` 0. Like the filter, the setting is
+   kept when the state is reinitialized. */
+void SPLITSTREAM_API SplitstreamSetSegmented(SplitstreamState* state, int segmented);
+/* Makes a segmented document contiguous, copying it once. Returns 0 on success and -1 if
+   out of memory, in which case the document is left as it was. */
+int SPLITSTREAM_API SplitstreamDocumentFlatten(SplitstreamState* state, SplitstreamDocument* doc);
+
+/* Sets the field delimiter of SplitstreamCSVScanner (',' if 0), and makes the CSV and TSV
+   scanners skip the first record of the stream, the header, if `skipHeader` is set. Like the
+   filter, these are kept when the state is reinitialized. */
+void SPLITSTREAM_API SplitstreamSetCSV(SplitstreamState* state, char delimiter, int skipHeader);
+
+/* The separator of SplitstreamSeparatorScanner. A separator may be split across inputs.
+   Unless `keep` is set, it is left out of the records; otherwise it stays at the end of the
+   record it ends. */
+#define SPLITSTREAM_SEPARATOR_MAX       32
+
+struct SplitstreamSeparator {
+    const char* bytes;
+    size_t length;      /* 1 to SPLITSTREAM_SEPARATOR_MAX */
+    int keep;
+    /* Private */
+    size_t anchor;      /* The byte searched for first */
+    unsigned char fallback[SPLITSTREAM_SEPARATOR_MAX + 1];
+};
+
+/* Applies `separator` (which must stay valid, with its bytes), or a line break if NULL. Like
+   the filter, it is kept when the state is reinitialized. Returns 0, or -1 if the length is
+   out of range. */
+int SPLITSTREAM_API SplitstreamSetSeparator(SplitstreamState* state, SplitstreamSeparator* separator);
+/* Ends the input, returning the document in progress if the end of the input completes it
+   (only the CSV, TSV and separator scanners do that), or a NULL document. Call it once no more
+   documents are returned. SplitstreamGetNextDocumentFromFile and
+   SplitstreamGetNextDocumentFromReader call it themselves at the end of the stream. */
+SplitstreamDocument SPLITSTREAM_API SplitstreamGetLastDocument(SplitstreamState* state, size_t max, SplitstreamScanner scan);
+
+/* Document filters select documents by their first element or key while they are scanned.
+   Documents that do not match are skipped without being buffered or copied.
+
+   SPLITSTREAM_FILTER_XML_ELEMENT matches documents whose (first) element has one of the local
+   names (without namespace prefix) in the NULL-terminated `names` list, at most 32 of them.
+   SPLITSTREAM_FILTER_JSON_KEY matches objects whose first key is `key` and, if `valuePrefix`
+   is set, whose value starts with `valuePrefix`. The raw document text is compared: `key` to
+   the text between the quotes of the key, and `valuePrefix` to the value including any quotes,
+   without decoding escapes. For example, key `type` with value prefix `"err` matches
+   `{"type": "error", ...}`. */
+#define SPLITSTREAM_FILTER_NONE         0
+#define SPLITSTREAM_FILTER_XML_ELEMENT  1
+#define SPLITSTREAM_FILTER_JSON_KEY     2
+
+struct SplitstreamFilter {
+    int type;
+    const char* const* names;
+    const char* key;
+    const char* valuePrefix;
+};
+
+/* Applies `filter` (which must stay valid) to the documents scanned from now on, or removes
+   the filter if it is NULL. The filter (like the sampler) is kept when the state is
+   reinitialized by SplitstreamStateDeserialize or SplitstreamIndexSeek. */
+void SPLITSTREAM_API SplitstreamSetFilter(SplitstreamState* state, const SplitstreamFilter* filter);
+
+/* Keys pick a value out of every document while it is scanned, for routing documents by it
+   without parsing them again. SPLITSTREAM_KEY_JSON_MEMBER takes the value of the member
+   `name` of a JSON object (at the top level of the document, in any position).
+   SPLITSTREAM_KEY_XML_ATTRIBUTE takes the value of the attribute `name` (including any
+   namespace prefix) of the element of the document. Names are compared with the raw text,
+   without decoding escapes or entities.
+
+   Documents with the key have `hasKey` set, the position of the raw value text in the document
+   in `keyOffset` and `keyLength` (for JSON this includes the quotes of a string and the whole
+   of an object or array; for XML it is the text between the quotes), and a 64-bit FNV-1a hash
+   of it in `keyHash`. Scanning for the key stops as soon as the value is complete. Like the
+   filter, the key must stay valid and is kept when the state is reinitialized, and the progress
+   on the document in progress is saved with the state. */
+#define SPLITSTREAM_KEY_NONE            0
+#define SPLITSTREAM_KEY_JSON_MEMBER     1
+#define SPLITSTREAM_KEY_XML_ATTRIBUTE   2
+
+struct SplitstreamKey {
+    int type;
+    const char* name;
+};
+
+void SPLITSTREAM_API SplitstreamSetKey(SplitstreamState* state, const SplitstreamKey* key);
+/* The partition (0 to partitions - 1) of a document by its key hash. Documents without a key
+   are in partition 0. */
+size_t SPLITSTREAM_API SplitstreamPartition(const SplitstreamDocument* doc, size_t partitions);
+
+/* Hashing computes a 64-bit hash (XXH64 with seed 0) of every document while it is scanned
+   and returns it in `hash`, with no second pass over the document. The hash of a fragmented
+   document is returned with its last fragment.
+
+   A duplicate filter drops documents whose hash was seen recently, counting them in
+   `duplicates`. It remembers up to `size` hashes in `table` (supplied by the caller and
+   cleared by SplitstreamDedupInit), forgetting older ones as new ones arrive, so exact
+   duplicates are only dropped within that window. SplitstreamDedupInit returns -1, leaving the
+   filter empty, if `size` hashes cannot be addressed. Setting it turns on hashing. Fragmented
+   documents are never dropped. Like the filter, hashing and the duplicate filter are kept
+   when the state is reinitialized. */
+struct SplitstreamDedup {
+    unsigned long long* table;
+    size_t size;
+    unsigned long long duplicates;
+};
+
+void SPLITSTREAM_API SplitstreamSetHashing(SplitstreamState* state, int hashing);
+int SPLITSTREAM_API SplitstreamDedupInit(SplitstreamDedup* dedup, unsigned long long* table, size_t size);
+void SPLITSTREAM_API SplitstreamSetDedup(SplitstreamState* state, SplitstreamDedup* dedup);
+
+/* A resync policy limits the damage done by malformed or truncated input. Without one, a
+   scanner that has lost track of the structure (after a stray quote, say) buffers everything
+   up to `max` and then starts over at an arbitrary byte.
+
+   With `lineStart` set, a line that begins with `{` or `[` (JSON) or `<` (XML) inside a
+   document is taken to be the start of the next document: the broken one is dropped and
+   scanning starts over at that line. After any resync, documents are only recognized at the
+   beginning of a line until one is found. This suits streams that have one document per line,
+   or whose documents at least indent their inner lines. `maxToken`, if not 0, is the length of
+   the longest string (JSON), or comment, CDATA section or processing instruction (XML) that is
+   accepted; a document with a longer one is dropped when it ends or at the end of the input
+   buffer, whichever comes first. Documents that outgrow `max` are dropped along with the rest
+   of the buffer, and the search for a line start begins after it.
+
+   Each dropped range is counted in `resyncs` and `bytes` and passed to `skipped`, if set, as
+   the stream offsets [start, end) of the document up to where scanning resumes. A fragmented
+   document that is dropped ends without a SPLITSTREAM_FRAGMENT_END fragment. UBJSON only
+   resyncs on `max`. Like the filter, the policy is kept when the state is reinitialized. */
+typedef void (*SplitstreamSkipped)(void* arg, long long start, long long end);
+
+struct SplitstreamResync {
+    int lineStart;
+    size_t maxToken;
+    SplitstreamSkipped skipped;
+    void* arg;
+
+    /* Updated by the tokenizer */
+    unsigned long long resyncs;     /* Ranges dropped */
+    unsigned long long bytes;       /* Total size of the dropped ranges */
+
+    /* Private */
+    long long start;
+};
+
+/* Applies `resync` (which must stay valid) to the documents scanned from now on, or removes it
+   if NULL. The counters are reset. */
+void SPLITSTREAM_API SplitstreamSetResync(SplitstreamState* state, SplitstreamResync* resync);
+
+/* Samplers decide which documents to return as soon as they start, so the others are skipped
+   without being buffered or copied. All documents (that pass the filter, if any) are counted,
+   so a sampler with `countOnly` set returns no documents at all, only totals.
+
+   Documents are selected by skipping the first `skip` documents and then taking every
+   `every`th document (0 and 1 take all of them). If `reservoir` is set, a uniformly random
+   sample of that many of the documents is selected instead, seeded by `seed`: each returned
+   document replaces the one previously returned for `slot`, and the sample is complete once
+   the stream is. */
+struct SplitstreamSampler {
+    unsigned long long skip, every;
+    size_t reservoir;
+    int countOnly;
+    unsigned long long seed;
+
+    /* Updated by the tokenizer */
+    unsigned long long documents;   /* Documents scanned */
+    unsigned long long bytes;       /* Total size of the scanned documents */
+    unsigned long long selected;    /* Documents returned */
+    size_t slot;                    /* Reservoir slot of the last returned document */
+
+    /* Private */
+    unsigned long long eligible, random;
+    long long start;
+};
+
+/* Applies `sampler` (which must stay valid) to the documents scanned from now on, or removes
+   it if NULL. The counters are reset. */
+void SPLITSTREAM_API SplitstreamSetSampler(SplitstreamState* state, SplitstreamSampler* sampler);
+
+/* Delivers documents that would need more than `fragmentSize` bytes of buffering as a
+   sequence of fragments instead of buffering them whole: the first one is marked
+   SPLITSTREAM_FRAGMENT_START, the last one SPLITSTREAM_FRAGMENT_END and any in between
+   SPLITSTREAM_FRAGMENT_CONTINUE. Each fragment is returned as soon as it is scanned, so at
+   most `fragmentSize` plus one input buffer is held however large the document is, and
+   `max` no longer discards documents. Fragments are freed like documents, and their offset
+   is the stream offset of their first byte. 0 (the default) turns fragmenting off. Like the
+   filter, the fragment size is kept when the state is reinitialized. */
+void SPLITSTREAM_API SplitstreamSetFragmentSize(SplitstreamState* state, size_t fragmentSize);
+
+/* Stores documents in a ring buffer supplied by the caller instead of allocating them. The
+   documents are written one after the other and must be released, by SplitstreamDocumentFree,
+   in the order they were returned; releasing a document releases all documents returned
+   before it, and freeing those afterwards does nothing. If there is no room for the input passed to SplitstreamGetNextDocument, it is
+   not consumed at all: a NULL document is returned with `full` set, and the same input has
+   to be passed again once documents have been released. SplitstreamGetNextDocumentFromReader
+   and SplitstreamGetNextDocumentFromFile keep the input themselves, so just call them again.
+   A document that does not fit in the empty ring is discarded like one larger than `max`, so
+   the ring should hold at least the largest document plus two input buffers. Documents in a
+   ring are never segmented. Like the filter, the ring is kept when the state is
+   reinitialized. */
+struct SplitstreamRing {
+    char* buffer;
+    size_t size;
+    int full;   /* Set when no document was returned because the ring was full */
+
+    /* Private */
+    size_t head, tail, end, reserved;
+    int wrapped;
+    const char* pending;
+    size_t pendingLength;
+};
+
+void SPLITSTREAM_API SplitstreamRingInit(SplitstreamRing* ring, void* buffer, size_t size);
+/* Uses `ring` (which must stay valid and may be shared by no other state) for the documents
+   scanned from now on, or the memory pool again if NULL. */
+void SPLITSTREAM_API SplitstreamSetRing(SplitstreamState* state, SplitstreamRing* ring);
+
+/* Saves the complete tokenizer state, including a partially buffered document and the number of
+   bytes consumed (`offset`), so a scan can be resumed in another process by feeding the stream
+   from `offset` on. Returns the number of bytes needed; nothing is written if `len` is too
+   small. Deserializing returns -1 if the data is not a state of a compatible version. */
+size_t SPLITSTREAM_API SplitstreamStateSerialize(const SplitstreamState* state, char* buf, size_t len);
+int SPLITSTREAM_API SplitstreamStateDeserialize(SplitstreamState* state, const char* buf, size_t len);
+
 SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocument(SplitstreamState* state, size_t max, const char* buf, size_t len, SplitstreamScanner scan);
 SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromFile(SplitstreamState* s, char* buf, size_t bufferSize, size_t max, FILE* file, SplitstreamScanner scanner);
 
+/* An adaptive read size makes SplitstreamGetNextDocumentFromFile choose how much to read each
+   time, between `min` and `max` (and at most `bufferSize`), instead of always filling the
+   buffer. Whatever follows a document in the buffer is copied to be scanned again, so reads
+   much larger than the documents cost more in copying than they save in calls, while reads
+   smaller than the documents make many calls per document. The read size is doubled after a
+   read that came back full, as long as it is below 4 times the document size (the moving
+   `average` of the documents found, or the size of the one in progress if larger), and halved
+   while it is above that. A short read means that the input had no more to give, so it never
+   grows the read size. Regular files are also advised with posix_fadvise(2) that they will be
+   read sequentially.
+
+   Callers that read by other means ask for `size` bytes and pass the outcome to
+   SplitstreamReadSizeUpdate. Like the filter, the read size is kept when the state is
+   reinitialized. */
+struct SplitstreamReadSize {
+    size_t min, max;    /* 0 for 4 KB and 1 MB */
+
+    /* Updated by the tokenizer */
+    size_t size;        /* Size of the next read */
+    size_t average;     /* Moving average of the document size */
+
+    /* Private */
+    int advised;
+};
+
+/* Applies `readSize` (which must stay valid) to the reads from now on, starting at `min`, or
+   removes it if NULL. */
+void SPLITSTREAM_API SplitstreamSetReadSize(SplitstreamState* state, SplitstreamReadSize* readSize);
+/* Adjusts the read size after a read that asked for `requested` bytes got `got` */
+void SPLITSTREAM_API SplitstreamReadSizeUpdate(SplitstreamState* state, size_t requested, size_t got);
+
+/* Finds the documents of an input that is entirely in memory without copying them. Scanning
+   starts at `*pos` and stops after `count` documents or at the end of `buf`, storing the bounds
+   of each document as [starts[i], ends[i]) and moving `*pos` past the last one. Returns the
+   number of documents found; once it is less than `count`, the rest of the buffer holds at most
+   an unfinished document. Filters, samplers, fragments and the other document storage settings
+   do not apply, since no document is stored. */
+size_t SPLITSTREAM_API SplitstreamScanBuffer(SplitstreamState* state, const char* buf, size_t len, size_t* pos,
+                                             SplitstreamScanner scan, size_t* starts, size_t* ends, size_t count);
+/* The same for input that arrives a buffer at a time, for callers that keep the input
+   themselves, such as a file they read again at the offsets found. The bounds are stream
+   offsets, so a document may start in an earlier buffer than the one it ends in. `pending` is
+   set to the stream offset of the start of an unfinished document, or -1 if none has started. */
+size_t SPLITSTREAM_API SplitstreamScanStream(SplitstreamState* state, const char* buf, size_t len, size_t* pos,
+                                             SplitstreamScanner scan, long long* starts, long long* ends, size_t count,
+                                             long long* pending);
+
+/* Readers deliver input in chunks from a file descriptor (or another source) and own their
+   read buffers. Keep calling SplitstreamGetNextDocumentFromReader until it returns a NULL
+   document, then check SplitstreamReaderError to tell end of stream from a read error. */
+typedef struct SplitstreamReader SplitstreamReader;
+
+/* You can implement your own input sources by providing a custom reader. `read` hands out the
+   next chunk of input, which must stay valid until the next call. It returns 1 when data is
+   available, 0 at end of stream and -1 on error (with `error` set to an errno value). */
+struct SplitstreamReader {
+    int (*read)(SplitstreamReader* reader, const char** buf, size_t* len);
+    void (*close)(SplitstreamReader* reader);
+    int error;
+};
+
+/* Reads `fd` from its current position. For regular files on Linux, `queueDepth` reads of
+   `bufferSize` bytes are kept in flight using io_uring. If io_uring is unavailable, or
+   `queueDepth` is less than 2, the reader falls back to pread(2). The descriptor is not closed
+   by the reader; closing the reader leaves a regular file positioned after the data handed
+   out, unless the descriptor no longer refers to that file. */
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenFd(int fd, size_t bufferSize, int queueDepth);
+/* Reads `fd` on a dedicated thread into a ring of `depth` buffers of `bufferSize` bytes, so
+   reading overlaps with scanning on any kind of descriptor. Closing the reader does not wait
+   for data on a pipe or socket, and leaves a regular file positioned after the data handed
+   out, as SplitstreamReaderOpenFd does. On platforms without threads this is the same as
+   SplitstreamReaderOpenFd. */
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenReadAhead(int fd, size_t bufferSize, int depth);
+
+/* Follows the file at `path` as it grows, like `tail -F`, starting at `s->offset` (so a
+   restored state continues where it left off). At the end of the file the reader waits for
+   more data, woken by inotify where available and otherwise checking every `pollInterval`
+   milliseconds. If the file is truncated, or rotated (the path is replaced by a new file
+   after the old one is drained), reading starts over at the beginning and the tokenizer
+   state `s` is reset, discarding any incomplete document. `idle` is called, if set, every
+   time the reader wakes up without new data; it returns 0 to keep waiting, a positive value
+   to end the stream or a negative value to fail with EINTR. */
+typedef int (*SplitstreamFollowIdle)(void* arg);
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenFollow(const char* path, size_t bufferSize, int pollInterval,
+                                                              SplitstreamState* s, SplitstreamFollowIdle idle, void* arg);
+
+#define SPLITSTREAM_COMPRESSION_NONE    0
+#define SPLITSTREAM_COMPRESSION_GZIP    1
+#define SPLITSTREAM_COMPRESSION_ZLIB    2
+#define SPLITSTREAM_COMPRESSION_ZSTD    3
+
+/* Decompresses the output of `source` into buffers of `bufferSize` bytes. The new reader takes
+   ownership of `source` and closes it when closed. Returns NULL if the library was built
+   without support for `compression`. */
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenDecompress(SplitstreamReader* source, int compression, size_t bufferSize);
+int SPLITSTREAM_API SplitstreamCompressionSupported(int compression);
+
+/* Document offset index. Build one by calling SplitstreamIndexAdd with every document returned
+   by the tokenizer, and save it as a sidecar file next to the stream. A loaded index can
+   reposition a tokenizer at any document (seek the input to the returned offset and continue
+   from there), or split the stream into ranges of whole documents for parallel workers. */
+typedef struct SplitstreamIndex SplitstreamIndex;
+
+typedef struct {
+    size_t first, count;    /* Documents in the range */
+    long long start, end;   /* Stream offsets of the range */
+} SplitstreamIndexRange;
+
+SplitstreamIndex* SPLITSTREAM_API SplitstreamIndexNew(const SplitstreamState* s, long long checkpointInterval);
+int SPLITSTREAM_API SplitstreamIndexAdd(SplitstreamIndex* index, const SplitstreamState* s, const SplitstreamDocument* doc);
+int SPLITSTREAM_API SplitstreamIndexSave(const SplitstreamIndex* index, const char* path);
+SplitstreamIndex* SPLITSTREAM_API SplitstreamIndexLoad(const char* path);
+void SPLITSTREAM_API SplitstreamIndexFree(SplitstreamIndex* index);
+size_t SPLITSTREAM_API SplitstreamIndexCount(const SplitstreamIndex* index);
+int SPLITSTREAM_API SplitstreamIndexGet(const SplitstreamIndex* index, size_t n, long long* start, long long* end);
+size_t SPLITSTREAM_API SplitstreamIndexFind(const SplitstreamIndex* index, long long offset);
+long long SPLITSTREAM_API SplitstreamIndexSeek(const SplitstreamIndex* index, size_t n, SplitstreamState* s);
+size_t SPLITSTREAM_API SplitstreamIndexPartition(const SplitstreamIndex* index, size_t parts, SplitstreamIndexRange* ranges);
+/* Splits many files on a pool of `threads` threads (the number of processors if 0), each with
+   its own tokenizer state. Files are split whole by one thread, so `callback` gets the
+   documents of a file in order, but is called concurrently for different files. Returning
+   nonzero from the callback stops all threads, and SplitstreamSplitFiles returns that value;
+   otherwise it returns 0, or -1 if it could not start. `results` (one per file) receives the
+   number of documents and the errno value of a failure for each file, and are filled in even
+   for files that could not be opened, which do not stop the others. */
+typedef int (*SplitstreamPoolCallback)(void* arg, size_t file, const SplitstreamDocument* doc);
+
+typedef struct {
+    unsigned long long documents;
+    int error;
+} SplitstreamFileResult;
+
+int SPLITSTREAM_API SplitstreamSplitFiles(const char* const* paths, size_t count, SplitstreamScanner scanner,
+                                          int startDepth, size_t max, size_t bufferSize, int threads,
+                                          SplitstreamPoolCallback callback, void* arg, SplitstreamFileResult* results);
+
+/* Splits one stream on the calling thread and hands the documents to `workers` threads (the
+   number of processors if 0) through a bounded lock-free queue of `queueSize` documents (1024
+   if 0). The scanner waits while the queue is full. `callback` is called concurrently on the
+   worker threads with the documents and their index in the stream, in any order, and the
+   documents are freed once it returns. Returning nonzero from the callback stops the pipeline,
+   and SplitstreamSplitPipeline returns that value; otherwise it returns 0 at the end of the
+   stream (check SplitstreamReaderError for read errors), or -1 if it could not start.
+
+   If `progress` is set, the documents are also tracked in order: progress(arg, documents,
+   offset) is called on the calling thread whenever the first `documents` documents have all
+   been handled, with the stream offset of the end of the last one (e.g. to commit a position
+   to resume from). The scanner then also waits while the oldest document in progress is more
+   than about twice the queue size behind. */
+typedef int (*SplitstreamPipelineCallback)(void* arg, unsigned long long index, const SplitstreamDocument* doc);
+typedef void (*SplitstreamPipelineProgress)(void* arg, unsigned long long documents, long long offset);
+
+int SPLITSTREAM_API SplitstreamSplitPipeline(SplitstreamReader* reader, SplitstreamScanner scanner, int startDepth,
+                                             size_t max, size_t queueSize, int workers,
+                                             SplitstreamPipelineCallback callback, SplitstreamPipelineProgress progress, void* arg);
+/* Like SplitstreamSplitPipeline, but routes the documents to `partitions` workers (the number
+   of processors if 0, at most 256) by their key (see SplitstreamSetKey), each with a queue of
+   its own: worker SplitstreamPartition(doc, partitions) gets the document. So all documents
+   with the same key are handled by the same thread, in stream order, while documents without
+   the key go to the first worker. */
+int SPLITSTREAM_API SplitstreamSplitPartitioned(SplitstreamReader* reader, SplitstreamScanner scanner, int startDepth,
+                                                size_t max, const SplitstreamKey* key, int partitions, size_t queueSize,
+                                                SplitstreamPipelineCallback callback, SplitstreamPipelineProgress progress, void* arg);
+
+void SPLITSTREAM_API SplitstreamReaderClose(SplitstreamReader* reader);
+int SPLITSTREAM_API SplitstreamReaderError(SplitstreamReader* reader);
+SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromReader(SplitstreamState* s, size_t max, SplitstreamReader* reader, SplitstreamScanner scanner);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __SPLITSTREAM_H_INC */
\ No newline at end of file
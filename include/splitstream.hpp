@@ -0,0 +1,571 @@
+/*
+ *   splitstream.hpp
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Header-only C++17 interface. splitstream::Splitter<Format, Options...> splits JSON or XML
+   like the C tokenizer with SplitstreamJSONScanner or SplitstreamXMLScanner, but the scanner
+   is a template instantiated for the format and the start depth, so it is inlined into the
+   caller and the checks for the start depth fold away where it is 0. It has no filter, key,
+   hash or resync support; use the C interface for those. test/c/hpp_test.cpp checks that the
+   scanners here find the same documents as the C ones.
+
+   Documents are std::string_view. Splitter::split returns the documents of a buffer that holds
+   the whole input as views into it, without copying. Splitter::feed takes a stream a chunk at
+   a time, and returns views into the chunk for the documents that are inside it; only a
+   document that spans chunks is copied, into a buffer owned by the splitter.
+
+       for(std::string_view doc : splitstream::Splitter<splitstream::Json>::split(input))
+           ...
+
+       splitstream::Splitter<splitstream::Xml, splitstream::StartDepth<1>> splitter;
+       while((n = read(fd, buf, sizeof(buf))) > 0)
+           for(std::string_view doc : splitter.feed(std::string_view(buf, n)))
+               ...
+*/
+
+#ifndef __SPLITSTREAM_HPP_INC
+#define __SPLITSTREAM_HPP_INC
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+namespace splitstream {
+
+/* Formats */
+struct Json {};
+struct Xml {};
+
+/* Option: the depth of the documents, like SplitstreamInitDepth */
+template <int N>
+struct StartDepth {
+    static_assert(N >= 0, "the start depth can not be negative");
+    static constexpr int value = N;
+};
+
+namespace detail {
+
+template <class... Options>
+struct StartDepthOf {
+    static constexpr int value = 0;
+};
+
+template <int N, class... Rest>
+struct StartDepthOf<StartDepth<N>, Rest...> {
+    static constexpr int value = N;
+};
+
+template <class First, class... Rest>
+struct StartDepthOf<First, Rest...> : StartDepthOf<Rest...> {};
+
+/* What the scanners keep between calls */
+struct ScanState {
+    int state = 0;          /* 0 is between documents in every scanner */
+    int depth = 0;
+    int counter = 0;        /* Backslashes in a row in JSON, dashes or brackets in XML */
+    bool array = false;     /* JSON: the container at the start depth is an array */
+    char last = 0;          /* XML: the last character of the previous input */
+};
+
+template <class Format, int Depth>
+struct Scanner;
+
+/* Scans buf[pos..len) to the end of the next document, like the C scanners. Returns true if
+   a document ended, with pos after it, and false with pos at len otherwise. start is set where
+   a document starts, and is left alone if none does. */
+
+template <int Depth>
+struct Scanner<Json, Depth> {
+    enum { Init, Document, String, Scalar, StrayString };
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    /* Advances i to the closing quote of a string, if it is in the buffer */
+    static bool StringEnd(const char* buf, size_t len, size_t& i, int& escapes) {
+        for(; i < len; ++i) {
+            char c = buf[i];
+            if(c == '\\') {
+                ++escapes;
+            } else {
+                bool closing = c == '"' && !(escapes & 1);
+                escapes = 0;
+                if(closing) return true;
+            }
+        }
+        return false;
+    }
+
+    static bool Scan(ScanState& s, const char* buf, size_t len, size_t& pos, size_t& start) {
+        int depth = s.depth, escapes = s.counter;
+        size_t i = pos;
+
+        switch(s.state) {
+            case Document: goto document;
+            case String: goto string;
+            case Scalar: goto scalar;
+            case StrayString: goto stray;
+            default: break;
+        }
+
+    init:
+        for(; i < len; ++i) {
+            char c = buf[i];
+            switch(c) {
+                case '[':
+                case '{':
+                    start = i;
+                    ++depth;
+                    if(Depth > 0 && depth == Depth) {
+                        /* Entering the container of the documents rather than starting one */
+                        s.array = (c == '[');
+                        if(s.array) break;
+                    }
+                    ++i;
+                    goto document;
+                case ']':
+                case '}':
+                    if(Depth > 0 && depth == Depth) {
+                        --depth;
+                        ++i;
+                        goto document;
+                    }
+                    break;
+                case '"':
+                    ++i;
+                    if(Depth > 0 && depth == Depth && s.array) {
+                        start = i - 1;
+                        goto string;
+                    }
+                    goto stray;
+                case ',':
+                case ' ':
+                case '\t':
+                case '\r':
+                case '\n':
+                    break;
+                default:
+                    if(Depth > 0 && depth == Depth && s.array) {
+                        start = i++;
+                        goto scalar;
+                    }
+                    break;
+            }
+        }
+        s.state = Init;
+        goto more;
+
+    document:
+        for(; i < len; ++i) {
+            char c = buf[i];
+            switch(c) {
+                case '[':
+                case '{':
+                    if(Depth > 0 && depth == Depth) start = i;
+                    ++depth;
+                    if(Depth > 0 && depth == Depth) {
+                        s.array = (c == '[');
+                        if(s.array) {
+                            ++i;
+                            goto init;
+                        }
+                    }
+                    break;
+                case ']':
+                case '}':
+                    if(--depth == Depth) {
+                        pos = i + 1;
+                        goto found;
+                    }
+                    break;
+                case '"':
+                    ++i;
+                    goto string;
+            }
+        }
+        s.state = Document;
+        goto more;
+
+    string:
+        if(!StringEnd(buf, len, i, escapes)) {
+            s.state = String;
+            goto more;
+        }
+        if(Depth > 0 && depth == Depth && s.array) {
+            /* A string element */
+            pos = i + 1;
+            goto found;
+        }
+        ++i;
+        goto document;
+
+    stray:
+        /* A string between documents */
+        if(!StringEnd(buf, len, i, escapes)) {
+            s.state = StrayString;
+            goto more;
+        }
+        ++i;
+        goto init;
+
+    scalar:
+        /* A number, true, false or null, which only ends at the character after it */
+        for(; i < len; ++i) {
+            char c = buf[i];
+            if(c == ',' || c == ']' || c == '}' || IsSpace(c)) {
+                pos = i;
+                goto found;
+            }
+        }
+        s.state = Scalar;
+        goto more;
+
+    found:
+        s.state = Init;
+        s.depth = depth;
+        s.counter = 0;
+        return true;
+
+    more:
+        pos = len;
+        s.depth = depth;
+        s.counter = escapes;
+        return false;
+    }
+};
+
+template <int Depth>
+struct Scanner<Xml, Depth> {
+    enum { Init, Document, ElementOrComment, CommentOrInstruction, BeginElement, EndElement,
+           Comment, Instruction, Cdata };
+
+    static bool Scan(ScanState& s, const char* buf, size_t len, size_t& pos, size_t& start) {
+        int depth = s.depth, counter = s.counter, state = s.state;
+        size_t i = pos;
+
+        if(i == len) goto more;
+
+        switch(state) {
+            case ElementOrComment: goto elementOrComment;
+            case CommentOrInstruction: goto commentOrInstruction;
+            case BeginElement: goto beginElement;
+            case EndElement: goto endElement;
+            case Comment: goto comment;
+            case Instruction: goto instruction;
+            case Cdata: goto cdata;
+            default: break;
+        }
+
+    document:
+        for(; i < len; ++i) {
+            if(buf[i] == '<') {
+                if(state == Init || (Depth > 0 && depth == Depth)) start = i;
+                ++i;
+                goto elementOrComment;
+            }
+        }
+        goto more;
+
+    elementOrComment:
+        if(i == len) {
+            state = ElementOrComment;
+            goto more;
+        }
+        switch(buf[i++]) {
+            case '>':
+                ++depth;
+                state = Document;
+                goto document;
+            case '/':
+                goto endElement;
+            case '?':
+                goto instruction;
+            case '!':
+                counter = 0;
+                goto commentOrInstruction;
+            default:
+                goto beginElement;
+        }
+
+    commentOrInstruction:
+        for(; i < len; ++i) {
+            switch(buf[i]) {
+                case '-':
+                    if(counter++ > 0) {
+                        counter = 0;
+                        ++i;
+                        goto comment;
+                    }
+                    break;
+                case '>':
+                    ++i;
+                    state = Document;
+                    goto document;
+                case '[':
+                    counter = 0;
+                    ++i;
+                    goto cdata;
+                default:
+                    ++i;
+                    goto instruction;
+            }
+        }
+        state = CommentOrInstruction;
+        goto more;
+
+    beginElement:
+        for(; i < len; ++i) {
+            if(buf[i] == '>') {
+                char prev = i ? buf[i - 1] : s.last;
+                ++i;
+                if(prev != '/') {
+                    ++depth;
+                    state = Document;
+                    goto document;
+                }
+                if(depth == Depth) goto found;
+                state = Document;
+                goto document;
+            }
+        }
+        state = BeginElement;
+        goto more;
+
+    endElement:
+        for(; i < len; ++i) {
+            if(buf[i] == '>') {
+                ++i;
+                if(--depth == Depth) goto found;
+                state = Document;
+                goto document;
+            }
+        }
+        state = EndElement;
+        goto more;
+
+    comment:
+        for(; i < len; ++i) {
+            char c = buf[i];
+            if(c == '-') {
+                ++counter;
+            } else if(c == '>' && counter >= 2) {
+                counter = 0;
+                ++i;
+                state = Document;
+                goto document;
+            } else {
+                counter = 0;
+            }
+        }
+        state = Comment;
+        goto more;
+
+    instruction:
+        for(; i < len; ++i) {
+            if(buf[i] == '>') {
+                ++i;
+                state = Document;
+                goto document;
+            }
+        }
+        state = Instruction;
+        goto more;
+
+    cdata:
+        for(; i < len; ++i) {
+            char c = buf[i];
+            if(c == ']') {
+                ++counter;
+            } else if(c == '>' && counter >= 2) {
+                counter = 0;
+                ++i;
+                state = Document;
+                goto document;
+            } else {
+                counter = 0;
+            }
+        }
+        state = Cdata;
+        goto more;
+
+    found:
+        pos = i;
+        s.state = Init;
+        s.depth = depth;
+        s.counter = 0;
+        if(i) s.last = buf[i - 1];
+        return true;
+
+    more:
+        pos = len;
+        s.state = state;
+        s.depth = depth;
+        s.counter = counter;
+        if(len) s.last = buf[len - 1];
+        return false;
+    }
+};
+
+} /* namespace detail */
+
+template <class Format, class... Options>
+class Splitter {
+public:
+    static constexpr int startDepth = detail::StartDepthOf<Options...>::value;
+    using Scanner = detail::Scanner<Format, startDepth>;
+
+    /* A range of documents, which is consumed as it is iterated */
+    class Documents {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const std::string_view*;
+            using reference = const std::string_view&;
+
+            iterator() = default;
+            reference operator*() const { return docs_->current_; }
+            pointer operator->() const { return &docs_->current_; }
+            iterator& operator++() {
+                if(!docs_->Next()) docs_ = nullptr;
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+            bool operator==(const iterator& other) const { return docs_ == other.docs_; }
+            bool operator!=(const iterator& other) const { return docs_ != other.docs_; }
+
+        private:
+            friend class Documents;
+            explicit iterator(Documents* docs) : docs_(docs) {}
+            Documents* docs_ = nullptr;
+        };
+
+        Documents(const Documents&) = delete;
+        Documents& operator=(const Documents&) = delete;
+
+        iterator begin() { return Next() ? iterator(this) : iterator(); }
+        iterator end() { return iterator(); }
+
+    private:
+        friend class Splitter;
+
+        Documents(Splitter* owner, std::string_view input) : owner_(owner), input_(input) {}
+
+        detail::ScanState& State() { return owner_ ? owner_->state_ : state_; }
+
+        bool Next() {
+            detail::ScanState& s = State();
+            if(copied_) {
+                owner_->carry_.clear();
+                copied_ = false;
+            }
+            while(pos_ < input_.size()) {
+                size_t start = std::string_view::npos, from = pos_;
+                bool found = Scanner::Scan(s, input_.data(), input_.size(), pos_, start);
+                if(found && start != std::string_view::npos) {
+                    if(owner_) Drop();
+                    current_ = input_.substr(start, pos_ - start);
+                    return true;
+                }
+                if(found) {
+                    /* Started before this input, which split() can not return */
+                    if(!owner_ || !owner_->started_) continue;
+                    owner_->carry_.append(input_.data() + from, pos_ - from);
+                    owner_->started_ = false;
+                    current_ = owner_->carry_;
+                    copied_ = true;
+                    return true;
+                }
+                if(owner_) Keep(start, from);
+            }
+            return false;
+        }
+
+        /* Keeps the unfinished document at the end of the input for the next one */
+        void Keep(size_t start, size_t from) {
+            std::string& carry = owner_->carry_;
+            if(start != std::string_view::npos) {
+                carry.assign(input_.data() + start, input_.size() - start);
+                owner_->started_ = true;
+            } else if(owner_->started_) {
+                carry.append(input_.data() + from, input_.size() - from);
+            }
+            if(carry.size() > owner_->max_) {
+                /* Too large, like the C tokenizer's max */
+                Drop();
+                owner_->state_.state = 0;
+            }
+        }
+
+        void Drop() {
+            owner_->carry_.clear();
+            owner_->started_ = false;
+        }
+
+        Splitter* owner_;
+        detail::ScanState state_;
+        std::string_view input_, current_;
+        size_t pos_ = 0;
+        bool copied_ = false;
+    };
+
+    explicit Splitter(size_t max = 100 * 1024 * 1024) : max_(max) {}
+
+    Splitter(const Splitter&) = delete;
+    Splitter& operator=(const Splitter&) = delete;
+    Splitter(Splitter&&) = default;
+    Splitter& operator=(Splitter&&) = default;
+
+    /* The documents of input, which holds all of it, as views into input. An unfinished
+       document at the end is not returned. */
+    static Documents split(std::string_view input) {
+        return Documents(nullptr, input);
+    }
+
+    /* The documents completed by the next chunk of a stream. The views are valid until the
+       next call to feed and as long as chunk is. Only one range may be in use at a time. */
+    Documents feed(std::string_view chunk) {
+        offset_ += (long long)chunk.size();
+        return Documents(this, chunk);
+    }
+
+    /* Number of bytes fed so far */
+    long long offset() const { return offset_; }
+
+    /* Drops the document in progress and starts over, as for a new stream */
+    void reset() {
+        state_ = detail::ScanState();
+        carry_.clear();
+        started_ = false;
+        offset_ = 0;
+    }
+
+private:
+    detail::ScanState state_;
+    std::string carry_;
+    bool started_ = false;
+    size_t max_;
+    long long offset_ = 0;
+};
+
+} /* namespace splitstream */
+
+#endif
@@ -35,9 +35,63 @@ typedef enum {
     State_LengthType,
     State_Length,
 
+    State_Scalar,
+
+    State_Record,
+    State_Quoted,
+    State_QuotedQuote,
+
     State_Rescan
 } SplitstreamTokenizerState;
 
 #include "splitstream.h"
 
+#define SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT  8
+#define SPLITSTREAM_STATE_FLAG_FILE_EOF             16
+#define SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT        32
+#define SPLITSTREAM_STATE_FLAG_ACCEPTED             64
+#define SPLITSTREAM_STATE_FLAG_FRAGMENTED           128
+#define SPLITSTREAM_STATE_FLAG_RESYNC               256 /* The scanner gave up on the document at resyncAt */
+#define SPLITSTREAM_STATE_FLAG_RESYNC_WAIT          512 /* Documents only start at the beginning of a line */
+#define SPLITSTREAM_STATE_FLAG_ENDED                1024 /* The document ended at the start of the input */
+#define SPLITSTREAM_STATE_FLAG_HEADER               2048 /* The CSV header has been seen */
+#define SPLITSTREAM_STATE_FLAG_STRIP                4096 /* The document found ends with the separator, which is left out */
+#define SPLITSTREAM_STATE_FLAG_END_OF_INPUT         8192 /* No input follows the buffer scanned */
+#define SPLITSTREAM_STATE_FLAG_STARTED              16384 /* A document started at doc.offset, when only scanning */
+
+/* Length of the string, comment or similar token in progress, see SplitstreamResync */
+#define SPLITSTREAM_COUNTER_TOKEN                   2
+/* Set if the container at the start depth is an array, whose scalars are documents (JSON) */
+#define SPLITSTREAM_COUNTER_ARRAY                   3
+
+SplitstreamReader* uring_ReaderNew(int fd, size_t bufferSize, int queueDepth);
+void Reader_Seek(int fd, unsigned long long dev, unsigned long long ino, long long offset);
+void State_Restart(SplitstreamState* s, int startDepth);
+void Filter_Begin(SplitstreamState* s);
+int Filter_Match(SplitstreamState* s, const char* buf, size_t len);
+int Sampler_Select(SplitstreamSampler* sampler);
+void Key_Begin(SplitstreamState* s);
+void Key_Scan(SplitstreamState* s, const char* buf, size_t len);
+void Key_Get(const SplitstreamState* s, SplitstreamDocument* doc);
+int Key_Valid(const SplitstreamState* s);
+void Hash_Begin(SplitstreamState* s);
+void Hash_Update(SplitstreamState* s, const char* buf, size_t len);
+void Hash_Restore(SplitstreamState* s);
+unsigned long long Hash_Digest(const SplitstreamState* s);
+int Dedup_Seen(SplitstreamDedup* dedup, unsigned long long hash);
+size_t Resync_Restart(SplitstreamState* s, const char* buf, size_t at);
+void Resync_Reset(SplitstreamState* s);
+void Resync_Discard(SplitstreamState* s);
+void Resync_Skip(SplitstreamState* s, long long end);
+void Resync_Report(SplitstreamResync* resync, long long start, long long end);
+void ReadSize_Document(SplitstreamReadSize* readSize, size_t length);
+void ReadSize_Advise(SplitstreamReadSize* readSize, FILE* file);
+const char* Search_Any(const char* p, const char* end, char a, char b, char c);
+size_t Separator_Length(const SplitstreamState* s);
+int Ring_Contains(const SplitstreamRing* r, const char* p);
+int Ring_Prepare(SplitstreamState* s, size_t len);
+void Ring_Append(SplitstreamState* s, SplitstreamDocument* dest, const char* ptr, size_t length);
+void Ring_Commit(SplitstreamRing* r);
+void Ring_Free(SplitstreamRing* r, const char* p, size_t length);
+
 #endif /* __SPLITSTREAM_PRIVATE_H_INC */
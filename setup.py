@@ -6,6 +6,37 @@ from setuptools import setup, Extension
 ROOT_DIR = os.path.dirname(__file__)
 SOURCE_DIR = os.path.join(ROOT_DIR)
 
+
+def have_library(header, library, function):
+    """Check whether an optional C library can be compiled and linked against."""
+    import shutil
+    import tempfile
+    from distutils.ccompiler import new_compiler
+    from distutils.sysconfig import customize_compiler
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    tmpdir = tempfile.mkdtemp()
+    try:
+        source = os.path.join(tmpdir, "check.c")
+        with open(source, "w") as f:
+            f.write("#include <%s>\nint main(void) { return (int)(size_t)&%s; }\n" % (header, function))
+        objects = compiler.compile([source], output_dir=tmpdir)
+        compiler.link_executable(objects, os.path.join(tmpdir, "check"), libraries=[library])
+        return True
+    except Exception:
+        return False
+    finally:
+        shutil.rmtree(tmpdir, ignore_errors=True)
+
+# Optional decompression support for splitfile(..., compression=...)
+define_macros = []
+libraries = []
+for header, library, function, macro in [("zlib.h", "z", "inflate", "HAVE_ZLIB"),
+                                         ("zstd.h", "zstd", "ZSTD_decompressStream", "HAVE_ZSTD")]:
+    if have_library(header, library, function):
+        define_macros.append((macro, "1"))
+        libraries.append(library)
+
 test_requirements = []
 requirements = []
 
@@ -25,9 +56,28 @@ setup(
             'src/splitstream_xml.c',
             'src/splitstream_json.c',
             'src/splitstream_ubjson.c',
+            'src/splitstream_reader.c',
+            'src/splitstream_uring.c',
+            'src/splitstream_readahead.c',
+            'src/splitstream_decompress.c',
+            'src/splitstream_index.c',
+            'src/splitstream_follow.c',
+            'src/splitstream_filter.c',
+            'src/splitstream_pool.c',
+            'src/splitstream_ring.c',
+            'src/splitstream_pipeline.c',
+            'src/splitstream_key.c',
+            'src/splitstream_hash.c',
+            'src/splitstream_resync.c',
+            'src/splitstream_readsize.c',
+            'src/splitstream_csv.c',
+            'src/splitstream_search.c',
+            'src/splitstream_separator.c',
             'src/mempool.c'
         ],
-        include_dirs=["include/"])],
+        include_dirs=["include/"],
+        define_macros=define_macros,
+        libraries=libraries)],
     headers=['include/splitstream.h', 'include/splitstream_private.h'],
     install_requires=requirements + test_requirements,
     zip_safe=False,
@@ -19,30 +19,99 @@
 #include <Python.h>
 #include <bytesobject.h>
 #include <splitstream.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 const static int SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT = 8;
 const static int SPLITSTREAM_STATE_FLAG_FILE_EOF = 16;
+const static int SPLITSTREAM_STATE_FLAG_END_OF_INPUT = 8192;
  
 static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs);
+static PyObject* splitfiles(PyObject* self, PyObject* args, PyObject* kwargs);
+static PyObject* split_buffer(PyObject* self, PyObject* args, PyObject* kwargs);
 static int call_callback(SplitstreamDocument* doc, PyObject* callback);
+static int call_callback_object(PyObject* val, PyObject* callback);
 static PyObject* as_python_object(SplitstreamDocument* doc);
 static int splitfile_pure_once(SplitstreamState* s, PyObject* read, PyObject* readargs, long max, SplitstreamScanner scanner, SplitstreamDocument* doc);
+static int open_path(PyObject* path);
+static SplitstreamReader* pyread_reader_new(PyObject* read, long bufsize);
+static SplitstreamReader* follow_reader_new(PyObject* path, long bufsize, SplitstreamState* s);
+static int make_filter(PyObject* obj, const char* fmt, SplitstreamFilter* filter, char*** strings);
+static int make_delimiter(PyObject* obj, const char* fmt, char** delimiter, size_t* length);
+static void generator_skipped(void* arg, long long start, long long end);
+static int add_types(PyObject* m);
+#if PY_VERSION_HEX >= 0x03050000
+#define HAVE_ASYNC
+static PyObject* asplit(PyObject* self, PyObject* args, PyObject* kwargs);
+#endif
 
 typedef struct {
 	PyObject_HEAD
-	PyObject* read, *callback;
+	PyObject* read, *callback, *path, *filterObj;
 	SplitstreamScanner scanner;
+	const char* format;
 	SplitstreamState state;
 	int eof, fileeof, preambleDoc;
 	FILE* f;
+	int fd, ownfd;
+	SplitstreamReader* reader;
 	long bufsize, max;
-	char* preamble;
+	int readahead, compression, follow;
+	char* preamble, *origPreamble;
 	char* buf;
+	SplitstreamFilter filter;
+	char** filterStrings;
+	SplitstreamSampler sampler;
+	int sampling;
+	PyObject* reservoir;
+	Py_ssize_t reservoirPos;
+	Py_ssize_t fragmentSize;
+	int hash;
+	SplitstreamDedup dedup;
+	SplitstreamResync resync;
+	long long* skipped;
+	size_t skippedCount, skippedSize;
+	int adaptive;
+	SplitstreamReadSize readSize;
+	char* delimiter;
+	size_t delimiterLength;
+	int header;
+	SplitstreamSeparator separator;
+	int keepDelimiter;
+	int busy;
 } Generator;
 
 static Generator* splitstream_generator_new(PyTypeObject *type, PyObject *args, PyObject *kwargs);
 static void splitstream_generator_dealloc(Generator* state);
 static PyObject* splitstream_generator_next(Generator *state);
+static PyObject* splitstream_generator_next_doc(Generator *state);
+static int enter_busy(int* busy, const char* name);
+static PyObject* splitstream_generator_getstate(Generator* state, PyObject* unused);
+static PyObject* splitstream_generator_duplicates(Generator* state, void* closure);
+static PyObject* splitstream_generator_skipped(Generator* state, void* closure);
+static PyObject* splitstream_generator_reduce(Generator* state, PyObject* unused);
+static PyObject* splitstream_generator_offset(Generator* state, void* closure);
+
+static PyMethodDef generator_methods[] = {
+	{"getstate", (PyCFunction)splitstream_generator_getstate, METH_NOARGS, "Return the tokenizer state as bytes, for resuming with splitfile(..., state=...)."},
+	{"__reduce__", (PyCFunction)splitstream_generator_reduce, METH_NOARGS, NULL},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef generator_getset[] = {
+	{"offset", (getter)splitstream_generator_offset, NULL, "Number of bytes consumed from the stream (including any preamble).", NULL},
+	{"duplicates", (getter)splitstream_generator_duplicates, NULL, "Number of duplicate documents dropped (see dedup).", NULL},
+	{"skipped", (getter)splitstream_generator_skipped, NULL, "List of the (start, end) stream offsets of malformed documents dropped (see resync).", NULL},
+	{NULL, NULL, NULL, NULL, NULL}
+};
 
 /*
  Module definition
@@ -50,20 +119,105 @@ static PyObject* splitstream_generator_next(Generator *state);
  
 static PyMethodDef methods[] = {
     {"splitfile", (PyCFunction)splitfile, METH_VARARGS | METH_KEYWORDS, "Split a file object.\n\n"
-    "splitfile(file, format[, callback][, startdepth][, bufsize][, maxdocsize][, preamble])"
+    "splitfile(file, format[, callback][, startdepth][, bufsize][, maxdocsize][, preamble][, readahead][, compression][, state][, follow][, filter][, skip][, every][, sample][, count][, seed][, fragmentsize][, hash][, dedup][, resync][, maxtoken][, adaptive][, delimiter][, header][, keepdelimiter])"
     " -> Split the file, optionally specifying a callback that will be called with each object.\n\n"
+    "The file may be a file object, a path or a file descriptor.\n"
     "If callback is not specified, the function instead returns a list of the string chunks.\n\n"
     "Optional keyword arguments:\n"
     "  startdepth  - Initial hierarchy depth (skip to this depth)\n"
     "  bufsize     - Size of read buffer\n"
     "  maxdocsize  - Maximum document size\n"
-    "  preamble    - Prepend file with this data (use when header already read)"},
+    "  preamble    - Prepend file with this data (use when header already read)\n"
+    "  readahead   - Number of buffers to read ahead on a separate thread (file descriptors only)\n"
+    "  compression - Decompress the file first (\"gzip\", \"zlib\" or \"zstd\", see `compressions`)\n"
+    "  state       - Resume from the state returned by getstate() of an earlier generator\n"
+    "  follow      - Keep waiting for data at the end of the file, like `tail -F` (paths only)\n"
+    "  filter      - Only return XML documents whose element has one of these local names, or\n"
+    "                JSON objects whose first key is this key, or this (key, value prefix) pair\n"
+    "  skip        - Skip this many documents first\n"
+    "  every       - Only return every n:th document\n"
+    "  sample      - Return a random sample of this many documents once the file is split\n"
+    "  count       - Return a (documents, bytes) tuple instead of the documents\n"
+    "  seed        - Random seed for sample\n"
+    "  fragmentsize - Return documents larger than this in fragments, as (FRAGMENT_*, data) tuples\n"
+    "  hash        - Return (hash, document) tuples with the 64-bit XXH64 hash of each document\n"
+    "  dedup       - Drop documents identical to one of about this many recent documents\n"
+    "  resync      - Take a line starting with { or [ (JSON) or < (XML) inside a document as the start of a new one\n"
+    "  maxtoken    - Drop documents with a longer string, comment or CDATA section\n"
+    "  adaptive    - Size each read by the documents found, up to bufsize (1 MB by default)\n"
+    "  delimiter   - Field delimiter of CSV (a comma by default), or the record separator of\n"
+    "                \"delimited\" (up to 32 bytes, a line break by default)\n"
+    "  header      - Skip the first record of CSV or TSV\n"
+    "  keepdelimiter - Leave the separator at the end of each \"delimited\" record"},
+    {"splitfiles", (PyCFunction)splitfiles, METH_VARARGS | METH_KEYWORDS, "Split many files in parallel.\n\n"
+    "splitfiles(paths, format[, callback][, startdepth][, bufsize][, maxdocsize][, threads])"
+    " -> Split the files on a pool of threads, returning one result per file.\n\n"
+    "The result is the list of documents of the file, or the number of documents if callback is\n"
+    "specified, or an IOError if the file could not be read. callback(index, document) is called\n"
+    "with the documents of each file in order, but the files are split in any order.\n\n"
+    "Optional keyword arguments:\n"
+    "  startdepth  - Initial hierarchy depth (skip to this depth)\n"
+    "  bufsize     - Size of read buffer\n"
+    "  maxdocsize  - Maximum document size\n"
+    "  threads     - Number of threads (default is the number of processors)"},
+    {"split_buffer", (PyCFunction)split_buffer, METH_VARARGS | METH_KEYWORDS, "Split data that is already in memory.\n\n"
+    "split_buffer(data, format[, startdepth][, offsets])"
+    " -> List of memoryview slices of data (any bytes-like object, such as bytes or mmap)\n"
+    "for the documents, which are found without copying them. An unfinished document at the end is ignored.\n\n"
+    "Optional keyword arguments:\n"
+    "  startdepth  - Initial hierarchy depth (skip to this depth)\n"
+    "  offsets     - Return a (starts, ends) tuple of array('Q') document offsets instead"},
+#ifdef HAVE_ASYNC
+    {"asplit", (PyCFunction)asplit, METH_VARARGS | METH_KEYWORDS, "Split an asyncio stream.\n\n"
+    "asplit(reader, format[, startdepth][, bufsize][, maxdocsize][, batch])"
+    " -> Async iterator over the documents read from reader, which is an asyncio.StreamReader\n"
+    "or any object whose read(n) method is awaitable.\n\n"
+    "Optional keyword arguments:\n"
+    "  startdepth  - Initial hierarchy depth (skip to this depth)\n"
+    "  bufsize     - Size of each read\n"
+    "  maxdocsize  - Maximum document size\n"
+    "  batch       - Return the list of documents completed by each read instead of one at a time"},
+#endif
     {NULL, NULL, 0, NULL}
 };
 
 #define MODULE_NAME "splitstream"
 #define MODULE_DESC "Splitting of (XML, JSON) objects from a continuous stream"
  
+static const struct {
+	const char* name;
+	int compression;
+} compressions[] = {
+	{"gzip", SPLITSTREAM_COMPRESSION_GZIP},
+	{"zlib", SPLITSTREAM_COMPRESSION_ZLIB},
+	{"zstd", SPLITSTREAM_COMPRESSION_ZSTD},
+	{NULL, 0}
+};
+
+static int add_constants(PyObject* m)
+{
+	PyObject* supported = PyList_New(0);
+	int i;
+	if(!supported) return -1;
+	for(i = 0; compressions[i].name; ++i) {
+		if(SplitstreamCompressionSupported(compressions[i].compression)) {
+			PyObject* name = PyUnicode_FromString(compressions[i].name);
+			if(!name || PyList_Append(supported, name) < 0) {
+				Py_XDECREF(name);
+				Py_DECREF(supported);
+				return -1;
+			}
+			Py_DECREF(name);
+		}
+	}
+	if(PyModule_AddObject(m, "compressions", supported) < 0) return -1;
+	if(PyModule_AddIntConstant(m, "FRAGMENT_NONE", SPLITSTREAM_FRAGMENT_NONE) < 0 ||
+	   PyModule_AddIntConstant(m, "FRAGMENT_START", SPLITSTREAM_FRAGMENT_START) < 0 ||
+	   PyModule_AddIntConstant(m, "FRAGMENT_CONTINUE", SPLITSTREAM_FRAGMENT_CONTINUE) < 0 ||
+	   PyModule_AddIntConstant(m, "FRAGMENT_END", SPLITSTREAM_FRAGMENT_END) < 0) return -1;
+	return 0;
+}
+
 #if PY_MAJOR_VERSION >= 3
 PyObject* PyInit_splitstream(void) 
 {
@@ -78,13 +232,22 @@ PyObject* PyInit_splitstream(void)
         NULL,
         NULL
 	};
-	return PyModule_Create(&moduledef);
+	PyObject* m = PyModule_Create(&moduledef);
+	if(m && (add_constants(m) < 0 || add_types(m) < 0)) {
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
 }
 #else
 PyMODINIT_FUNC
 initsplitstream(void)
 {
-    (void) Py_InitModule3(MODULE_NAME, methods, MODULE_DESC);
+    PyObject* m = Py_InitModule3(MODULE_NAME, methods, MODULE_DESC);
+    if(m) {
+    	add_constants(m);
+    	add_types(m);
+    }
 }
 #endif
 
@@ -96,10 +259,13 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
     PyObject* file, *ret = Py_None;
     PyObject* file_read = NULL, *file_fileno = NULL, *file_fileobj = NULL, *noargs = NULL;
     const char* fmt = NULL;
-    const char* preamble = NULL;
-    PyObject* callback = NULL;
+    const char* preamble = NULL, *compressionName = NULL;
+    PyObject* callback = NULL, *stateObj = NULL, *filterObj = NULL, *delimiterObj = NULL;
+    unsigned long long skip = 0, every = 0, seed = 0;
+    Py_ssize_t sample = 0, fragmentSize = 0, dedup = 0, maxToken = 0;
+    int count = 0, hash = 0, resync = 0, adaptive = 0, header = 0, keepDelimiter = 0;
     long bufsize = 0, max = 0, startDepth = 0;
-    int fileno = -1;
+    int fileno = -1, ownfd = 0, readahead = 0, compression = SPLITSTREAM_COMPRESSION_NONE, follow = 0;
     SplitstreamScanner scanner;
     Generator* g;
     static int gt = 0;
@@ -115,29 +281,35 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
 	    gentype.tp_iternext = (iternextfunc)splitstream_generator_next;
     	gentype.tp_alloc = PyType_GenericAlloc;
 	    gentype.tp_new = (newfunc)splitstream_generator_new;
+	    gentype.tp_methods = generator_methods;
+	    gentype.tp_getset = generator_getset;
 	    if(PyType_Ready(&gentype) < 0)
 	    	return NULL;
 	    Py_INCREF(&gentype);
     	gt = 1;
     }
     
-    static char* kwarg_list[] = {"file", "format", "callback", "startdepth", "bufsize", "maxdocsize", "preamble", NULL};
+    static char* kwarg_list[] = {"file", "format", "callback", "startdepth", "bufsize", "maxdocsize", "preamble", "readahead", "compression", "state", "follow", "filter", "skip", "every", "sample", "count", "seed", "fragmentsize", "hash", "dedup", "resync", "maxtoken", "adaptive", "delimiter", "header", "keepdelimiter", NULL};
  
  
 	noargs = PyTuple_Pack(0);
 	if(!noargs) return NULL;
 	#if PY_MAJOR_VERSION >= 3
-	#define FMT "Os|Oiiiy"
+	#define FMT "Os|OiiiyizOiOKKniKnininiOii"
 	#else
-	#define FMT "Os|Oiiis"
+	#define FMT "Os|OiiisizOiOKKniKnininiOii"
 	#endif
 	
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, FMT, kwarg_list, &file, &fmt, &callback, &startDepth, &bufsize, &max, &preamble))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, FMT, kwarg_list, &file, &fmt, &callback, &startDepth, &bufsize, &max, &preamble, &readahead, &compressionName, &stateObj, &follow, &filterObj, &skip, &every, &sample, &count, &seed, &fragmentSize, &hash, &dedup, &resync, &maxToken, &adaptive, &delimiterObj, &header, &keepDelimiter))
         return NULL;
     
     #undef FMT
     
     if(preamble && !preamble[0]) preamble = NULL;
+    if(callback == Py_None) callback = NULL;
+    if(stateObj == Py_None) stateObj = NULL;
+    if(filterObj == Py_None) filterObj = NULL;
+    if(delimiterObj == Py_None) delimiterObj = NULL;
     
     if(!file || file == Py_None) {
     	PyErr_SetString(PyExc_TypeError, "file argument not set"); 
@@ -147,45 +319,76 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
     Py_XINCREF(callback);
     
     do {
-    	file_read = PyObject_GetAttrString(file, "read");
-	    if(!file_read) { ret = NULL; break; }
-    
-    	file_fileobj = PyObject_GetAttrString(file, "fileobj");
-		if(!file_fileobj) {
-			PyErr_Clear();
-			file_fileno = PyObject_GetAttrString(file, "fileno");
-			if(file_fileno) {
-				PyObject* fn = PyObject_Call(file_fileno, noargs, NULL);
-				#if PY_MAJOR_VERSION >= 3
-				if(fn) {
-				#else
-				if(!fn) { ret = NULL; break; }
-				#endif
-				
-				fileno = (int)PyLong_AsLong(fn);
-				if(fileno < 0) {
-					if(!PyErr_Occurred()) {
-						PyErr_Format(PyExc_ValueError, "Invalid fileno %d.", fileno); 
+    	if(PyLong_Check(file)
+    	#if PY_MAJOR_VERSION < 3
+    	   || PyInt_Check(file)
+    	#endif
+    	   ) {
+    		fileno = (int)PyLong_AsLong(file);
+    		if(fileno < 0) {
+    			if(!PyErr_Occurred()) {
+    				PyErr_Format(PyExc_ValueError, "Invalid fileno %d.", fileno); 
+    			}
+    			ret = NULL; break;
+    		}
+    	} else if(PyUnicode_Check(file) || PyBytes_Check(file)) {
+    		fileno = open_path(file);
+    		if(fileno < 0) { ret = NULL; break; }
+    		ownfd = 1;
+    	} else {
+	    	file_read = PyObject_GetAttrString(file, "read");
+		    if(!file_read) { ret = NULL; break; }
+	    
+	    	file_fileobj = PyObject_GetAttrString(file, "fileobj");
+			if(!file_fileobj) {
+				PyErr_Clear();
+				file_fileno = PyObject_GetAttrString(file, "fileno");
+				if(file_fileno) {
+					PyObject* fn = PyObject_Call(file_fileno, noargs, NULL);
+					#if PY_MAJOR_VERSION >= 3
+					if(fn) {
+					#else
+					if(!fn) { ret = NULL; break; }
+					#endif
+					
+					fileno = (int)PyLong_AsLong(fn);
+					if(fileno < 0) {
+						if(!PyErr_Occurred()) {
+							PyErr_Format(PyExc_ValueError, "Invalid fileno %d.", fileno); 
+						}
+						ret = NULL; break;
 					}
-					ret = NULL; break;
-				}
-				#if PY_MAJOR_VERSION >= 3
+					#if PY_MAJOR_VERSION >= 3
+					} else PyErr_Clear();
+					#endif
 				} else PyErr_Clear();
-				#endif
-			} else PyErr_Clear();
-		}
+			}
+    	}
     
 	    if(!strcmp(fmt, "xml")) {
     		scanner = SplitstreamXMLScanner;
+    		fmt = "xml";
 	    } else if(!strcmp(fmt, "json")) {
     		scanner = SplitstreamJSONScanner;
+    		fmt = "json";
 	    } else if(!strcmp(fmt, "ubjson")) {
     		scanner = SplitstreamUBJSONScanner;
+    		fmt = "ubjson";
+	    } else if(!strcmp(fmt, "csv")) {
+    		scanner = SplitstreamCSVScanner;
+    		fmt = "csv";
+	    } else if(!strcmp(fmt, "tsv")) {
+    		scanner = SplitstreamTSVScanner;
+    		fmt = "tsv";
+	    } else if(!strcmp(fmt, "delimited")) {
+    		scanner = SplitstreamSeparatorScanner;
+    		fmt = "delimited";
 	    } else {
     		PyErr_SetString(PyExc_ValueError, "Invalid object format name specified"); 
 		    ret = NULL; break;
 	    }
-	    if(bufsize <= 0) bufsize = 1024;
+	    /* With an adaptive read size, bufsize is the largest read */
+	    if(bufsize <= 0) bufsize = adaptive ? 1024*1024 : 1024;
     	if(bufsize > 1024*1024*100) {
 	    	PyErr_Format(PyExc_ValueError, "Buffer size %ld out of range.", bufsize); 
 		    ret = NULL; break;
@@ -195,11 +398,191 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
     		PyErr_Format(PyExc_ValueError, "Max document size %ld out of range.", max); 
 		    ret = NULL; break;
     	}
+    	if(readahead < 0 || readahead > 64) {
+    		PyErr_Format(PyExc_ValueError, "Read-ahead depth %d out of range.", readahead); 
+		    ret = NULL; break;
+    	}
+    	if(compressionName && compressionName[0]) {
+    		int i;
+    		for(i = 0; compressions[i].name && strcmp(compressions[i].name, compressionName); ++i);
+    		if(!compressions[i].name) {
+    			PyErr_Format(PyExc_ValueError, "Invalid compression \"%s\" specified.", compressionName); 
+			    ret = NULL; break;
+    		}
+    		compression = compressions[i].compression;
+    		if(!SplitstreamCompressionSupported(compression)) {
+    			PyErr_Format(PyExc_ValueError, "Compression \"%s\" is not supported by this build.", compressionName); 
+			    ret = NULL; break;
+    		}
+    	}
+    	if(sample < 0 || (count && callback)) {
+    		PyErr_SetString(PyExc_ValueError, sample < 0 ? "Sample size out of range." : "count cannot be combined with a callback."); 
+		    ret = NULL; break;
+    	}
+    	if(fragmentSize < 0 || (fragmentSize && sample)) {
+    		PyErr_SetString(PyExc_ValueError, fragmentSize < 0 ? "Fragment size out of range." : "fragmentsize cannot be combined with sample."); 
+		    ret = NULL; break;
+    	}
+    	if(dedup < 0 || dedup > 1<<24 || (hash && fragmentSize)) {
+    		PyErr_SetString(PyExc_ValueError, !hash || !fragmentSize ? "Dedup size out of range." : "hash cannot be combined with fragmentsize."); 
+		    ret = NULL; break;
+    	}
+    	if(maxToken < 0) {
+    		PyErr_SetString(PyExc_ValueError, "Maximum token length out of range."); 
+		    ret = NULL; break;
+    	}
+    	if(header && strcmp(fmt, "csv") && strcmp(fmt, "tsv")) {
+    		PyErr_SetString(PyExc_ValueError, "header requires the csv or tsv format."); 
+		    ret = NULL; break;
+    	}
+    	if(keepDelimiter && strcmp(fmt, "delimited")) {
+    		PyErr_SetString(PyExc_ValueError, "keepdelimiter requires the delimited format."); 
+		    ret = NULL; break;
+    	}
+    	if(adaptive && (readahead > 0 || compression || follow)) {
+    		PyErr_SetString(PyExc_ValueError, "adaptive cannot be combined with readahead, compression or follow."); 
+		    ret = NULL; break;
+    	}
+    	if(follow && (!ownfd || readahead > 0 || compression)) {
+    		PyErr_SetString(PyExc_ValueError, "follow requires an uncompressed file opened by path and cannot be combined with readahead."); 
+		    ret = NULL; break;
+    	}
     
     	g = splitstream_generator_new(&gentype, PyTuple_Pack(0), NULL);
 	    if(!g) { ret = NULL; break; }
+	    g->fd = fileno;
+	    g->ownfd = ownfd;
+	    ownfd = 0;
+	    g->format = fmt;
+	    g->readahead = readahead;
+	    g->compression = compression;
+	    g->follow = follow;
+	    if(g->ownfd) {
+	    	/* Opened from a path, which makes the generator picklable */
+	    	g->path = file;
+	    	Py_INCREF(file);
+	    }
+	    SplitstreamInitDepth(&g->state, (int)startDepth);
+	    SplitstreamSetSegmented(&g->state, 1);
+	    g->fragmentSize = fragmentSize;
+	    SplitstreamSetFragmentSize(&g->state, (size_t)fragmentSize);
+	    g->hash = hash;
+	    SplitstreamSetHashing(&g->state, hash);
+	    if(dedup) {
+	    	/* Rounded up to whole buckets of four */
+	    	size_t size = ((size_t)dedup + 3) & ~(size_t)3;
+	    	unsigned long long* table = malloc(size * sizeof(unsigned long long));
+	    	if(!table) {
+		    	Py_DECREF((PyObject*)g);
+		    	PyErr_NoMemory();
+				ret = NULL; break;
+	    	}
+	    	if(SplitstreamDedupInit(&g->dedup, table, size)) {
+	    		free(table);
+		    	Py_DECREF((PyObject*)g);
+		    	PyErr_SetString(PyExc_ValueError, "Dedup size out of range.");
+				ret = NULL; break;
+	    	}
+	    	SplitstreamSetDedup(&g->state, &g->dedup);
+	    }
+	    if(resync || maxToken) {
+	    	g->resync.lineStart = resync;
+	    	g->resync.maxToken = (size_t)maxToken;
+	    	g->resync.skipped = generator_skipped;
+	    	g->resync.arg = g;
+	    	SplitstreamSetResync(&g->state, &g->resync);
+	    }
+	    if(delimiterObj && make_delimiter(delimiterObj, fmt, &g->delimiter, &g->delimiterLength) < 0) {
+		    Py_DECREF((PyObject*)g);
+			ret = NULL; break;
+	    }
+	    g->header = header;
+	    g->keepDelimiter = keepDelimiter;
+	    if(scanner == SplitstreamSeparatorScanner) {
+	    	g->separator.bytes = g->delimiter ? g->delimiter : "\n";
+	    	g->separator.length = g->delimiter ? g->delimiterLength : 1;
+	    	g->separator.keep = keepDelimiter;
+	    	SplitstreamSetSeparator(&g->state, &g->separator);
+	    } else {
+	    	SplitstreamSetCSV(&g->state, g->delimiter ? g->delimiter[0] : 0, header);
+	    }
+	    g->adaptive = adaptive;
+	    if(adaptive) {
+	    	g->readSize.min = bufsize < 4096 ? (size_t)bufsize : 0;
+	    	g->readSize.max = (size_t)bufsize;
+	    	SplitstreamSetReadSize(&g->state, &g->readSize);
+	    }
+	    if(filterObj) {
+	    	if(make_filter(filterObj, fmt, &g->filter, &g->filterStrings) < 0) {
+		    	Py_DECREF((PyObject*)g);
+				ret = NULL; break;
+	    	}
+	    	g->filterObj = filterObj;
+	    	Py_INCREF(filterObj);
+	    	SplitstreamSetFilter(&g->state, &g->filter);
+	    }
+	    if(skip || every > 1 || sample || count) {
+	    	g->sampler.skip = skip;
+	    	g->sampler.every = every;
+	    	g->sampler.reservoir = (size_t)sample;
+	    	g->sampler.countOnly = count;
+	    	g->sampler.seed = seed;
+	    	g->sampling = 1;
+	    	if(sample && !(g->reservoir = PyList_New(0))) {
+		    	Py_DECREF((PyObject*)g);
+				ret = NULL; break;
+	    	}
+	    }
+	    if(preamble) g->origPreamble = strdup(preamble);
 	    
-	    if(fileno >= 0) {
+	    if(stateObj) {
+	    	char* data;
+	    	Py_ssize_t len;
+	    	if(compression) {
+		    	Py_DECREF((PyObject*)g);
+	    		PyErr_SetString(PyExc_ValueError, "Cannot resume splitting a compressed stream."); 
+				ret = NULL; break;
+	    	}
+	    	if(PyBytes_AsStringAndSize(stateObj, &data, &len) < 0 ||
+	    	   SplitstreamStateDeserialize(&g->state, data, (size_t)len) < 0) {
+		    	Py_DECREF((PyObject*)g);
+		    	if(!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "Invalid or incompatible state."); 
+				ret = NULL; break;
+	    	}
+	    	/* The preamble is part of the consumed data, so it is not fed again */
+	    	if(g->ownfd && lseek(fileno, (long)(g->state.offset - (preamble ? (long long)strlen(preamble) : 0)), SEEK_SET) < 0) {
+		    	Py_DECREF((PyObject*)g);
+		    	PyErr_SetFromErrno(PyExc_IOError);
+				ret = NULL; break;
+	    	}
+	    	preamble = NULL;
+	    }
+	    
+	    if(follow) {
+	    	/* The reader starts at the state offset, which counts the preamble */
+	    	long long plen = (stateObj && g->origPreamble) ? (long long)strlen(g->origPreamble) : 0;
+	    	g->state.offset -= plen;
+			g->reader = follow_reader_new(file, bufsize, &g->state);
+	    	g->state.offset += plen;
+	    } else if(fileno >= 0 && readahead > 0) {
+			g->reader = SplitstreamReaderOpenReadAhead(fileno, bufsize, readahead);
+	    } else if(fileno >= 0 && compression) {
+			g->reader = SplitstreamReaderOpenFd(fileno, bufsize, 0);
+	    } else if(compression) {
+			g->reader = pyread_reader_new(file_read, bufsize);
+	    }
+	    if(compression && g->reader) {
+			SplitstreamReader* source = g->reader;
+			g->reader = SplitstreamReaderOpenDecompress(source, compression, bufsize);
+			if(!g->reader) SplitstreamReaderClose(source);
+	    }
+	    if(g->reader || readahead > 0 || compression || follow) {
+			if(!g->reader) {
+		    	Py_DECREF((PyObject*)g);
+		    	if(!PyErr_Occurred()) PyErr_SetString(PyExc_IOError, "Unable to open reader."); 
+				ret = NULL; break;
+			}
+	    } else if(fileno >= 0) {
 			g->f = fdopen(fileno, "r");
 			if(!g->f) {
 		    	Py_DECREF((PyObject*)g);
@@ -213,18 +596,30 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
 	    g->bufsize = bufsize;
 	    g->max = max;
 	    if(preamble) g->preamble = strdup(preamble);
-	    SplitstreamInitDepth(&g->state, (int)startDepth);
+	    /* After deserializing, so the counters start from here */
+	    if(g->sampling) SplitstreamSetSampler(&g->state, &g->sampler);
 	    
-	    if(!callback) {
+	    if(count) {
+	    	while(!g->eof) {
+	    		if(!splitstream_generator_next(g) && PyErr_Occurred()) break;
+	    	}
+	    	if(!PyErr_Occurred()) ret = Py_BuildValue("(KK)", g->sampler.documents, g->sampler.bytes);
+	    	else ret = NULL;
+	    	Py_DECREF((PyObject*)g);
+	    } else if(!callback) {
 	    	ret = (PyObject*)g;
 	    } else {
 	    	while(!g->eof) {
-	    		splitstream_generator_next(g);
+	    		if(!splitstream_generator_next(g) && PyErr_Occurred()) {
+	    			ret = NULL;
+	    			break;
+	    		}
 	    	}
 	    	Py_DECREF((PyObject*)g);
 	    }
 	} while(0);
 	
+    if(ownfd) close(fileno);
     Py_XDECREF(file_fileno);
     Py_XDECREF(file_fileobj);
     Py_XDECREF(file_read);
@@ -235,6 +630,728 @@ static PyObject* splitfile(PyObject* self, PyObject* args, PyObject* kwargs)
     return ret;
 }
 
+/*
+ 'splitfiles' Entry point
+ */
+typedef struct {
+	PyObject* callback;
+	PyObject* results;
+	PyObject* errorType, *errorValue, *errorTraceback;
+} PoolContext;
+
+/* Called on the worker threads, which only hold the GIL while handling a document */
+static int pool_callback(void* arg, size_t file, const SplitstreamDocument* doc)
+{
+	PoolContext* ctx = arg;
+	PyGILState_STATE gil = PyGILState_Ensure();
+	PyObject* val = PyBytes_FromStringAndSize(doc->buffer, doc->length), *ret;
+	int rc = 0;
+
+	if(val && ctx->callback) {
+		ret = PyObject_CallFunction(ctx->callback, "nO", (Py_ssize_t)file, val);
+		Py_XDECREF(ret);
+		rc = ret ? 0 : 1;
+	} else if(val) {
+		rc = PyList_Append(PyList_GET_ITEM(ctx->results, file), val) < 0;
+	} else {
+		rc = 1;
+	}
+	Py_XDECREF(val);
+	if(rc && !ctx->errorType) {
+		/* The thread state of a worker goes away with the GIL, so keep the first exception */
+		PyErr_Fetch(&ctx->errorType, &ctx->errorValue, &ctx->errorTraceback);
+	}
+	PyErr_Clear();
+	PyGILState_Release(gil);
+	return rc;
+}
+
+static PyObject* splitfiles(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* pathsObj, *seq = NULL, *callback = NULL, **names = NULL, *ret = NULL;
+	const char* fmt = NULL;
+	const char** paths = NULL;
+	long bufsize = 0, max = 0, startDepth = 0;
+	int threads = 0, rc;
+	Py_ssize_t i, n = 0;
+	SplitstreamScanner scanner;
+	SplitstreamFileResult* results = NULL;
+	PoolContext ctx;
+	static char* kwarg_list[] = {"paths", "format", "callback", "startdepth", "bufsize", "maxdocsize", "threads", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os|Ollli", kwarg_list, &pathsObj, &fmt, &callback, &startDepth, &bufsize, &max, &threads))
+		return NULL;
+	if(callback == Py_None) callback = NULL;
+	memset(&ctx, 0, sizeof(ctx));
+
+	if(!strcmp(fmt, "xml")) scanner = SplitstreamXMLScanner;
+	else if(!strcmp(fmt, "json")) scanner = SplitstreamJSONScanner;
+	else if(!strcmp(fmt, "ubjson")) scanner = SplitstreamUBJSONScanner;
+	else if(!strcmp(fmt, "csv")) scanner = SplitstreamCSVScanner;
+	else if(!strcmp(fmt, "tsv")) scanner = SplitstreamTSVScanner;
+	else if(!strcmp(fmt, "delimited")) scanner = SplitstreamSeparatorScanner;
+	else {
+		PyErr_SetString(PyExc_ValueError, "Invalid object format name specified"); 
+		return NULL;
+	}
+	if(bufsize < 0 || bufsize > 1024*1024*100 || max < 0 || max > 1<<30 || threads < 0) {
+		PyErr_SetString(PyExc_ValueError, "Argument out of range."); 
+		return NULL;
+	}
+
+	do {
+		seq = PySequence_Fast(pathsObj, "paths must be a sequence of paths.");
+		if(!seq) break;
+		n = PySequence_Fast_GET_SIZE(seq);
+		names = calloc((size_t)n + 1, sizeof(PyObject*));
+		paths = calloc((size_t)n + 1, sizeof(const char*));
+		results = calloc((size_t)n + 1, sizeof(SplitstreamFileResult));
+		ctx.results = PyList_New(n);
+		if(!names || !paths || !results || !ctx.results) {
+			if(!PyErr_Occurred()) PyErr_NoMemory();
+			break;
+		}
+		for(i = 0; i < n; ++i) {
+			#if PY_MAJOR_VERSION >= 3
+			if(!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, i), &names[i])) break;
+			paths[i] = PyBytes_AS_STRING(names[i]);
+			#else
+			names[i] = PySequence_Fast_GET_ITEM(seq, i);
+			Py_INCREF(names[i]);
+			if(!(paths[i] = PyString_AsString(names[i]))) break;
+			#endif
+			PyList_SET_ITEM(ctx.results, i, callback ? (Py_INCREF(Py_None), Py_None) : PyList_New(0));
+			if(!PyList_GET_ITEM(ctx.results, i)) break;
+		}
+		if(i < n) break;
+
+		ctx.callback = callback;
+		Py_BEGIN_ALLOW_THREADS
+		rc = SplitstreamSplitFiles(paths, (size_t)n, scanner, (int)startDepth, (size_t)max, (size_t)bufsize, threads,
+			pool_callback, &ctx, results);
+		Py_END_ALLOW_THREADS
+		if(ctx.errorType) {
+			PyErr_Restore(ctx.errorType, ctx.errorValue, ctx.errorTraceback);
+			break;
+		}
+		if(rc < 0) {
+			PyErr_NoMemory();
+			break;
+		}
+
+		for(i = 0; i < n; ++i) {
+			PyObject* result = NULL;
+			if(results[i].error) {
+				result = PyObject_CallFunction(PyExc_IOError, "isO", results[i].error, strerror(results[i].error),
+					PySequence_Fast_GET_ITEM(seq, i));
+			} else if(callback) {
+				result = PyLong_FromUnsignedLongLong(results[i].documents);
+			}
+			if(result) PyList_SetItem(ctx.results, i, result);
+			else if(PyErr_Occurred()) break;
+		}
+		if(i < n) break;
+		ret = ctx.results;
+		ctx.results = NULL;
+	} while(0);
+
+	for(i = 0; names && i < n; ++i) Py_XDECREF(names[i]);
+	free(names);
+	free(paths);
+	free(results);
+	Py_XDECREF(ctx.results);
+	Py_XDECREF(seq);
+	return ret;
+}
+
+/**
+*** Splitter object
+**/
+
+typedef struct {
+	PyObject_HEAD
+	SplitstreamScanner scanner;
+	SplitstreamState state;
+	int startDepth;
+	size_t max;
+	int busy;
+	/* The unfinished document at the end of the data fed so far */
+	char* carry;
+	size_t carryLength, carrySize;
+} Splitter;
+
+#define SPLITTER_BATCH	1024
+
+static PyObject* splitter_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+	const char* fmt;
+	long startDepth = 0, max = 0;
+	SplitstreamScanner scanner;
+	Splitter* self;
+	static char* kwarg_list[] = {"format", "startdepth", "maxdocsize", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|ll", kwarg_list, &fmt, &startDepth, &max))
+		return NULL;
+	if(!strcmp(fmt, "xml")) scanner = SplitstreamXMLScanner;
+	else if(!strcmp(fmt, "json")) scanner = SplitstreamJSONScanner;
+	else if(!strcmp(fmt, "ubjson")) scanner = SplitstreamUBJSONScanner;
+	else if(!strcmp(fmt, "csv")) scanner = SplitstreamCSVScanner;
+	else if(!strcmp(fmt, "tsv")) scanner = SplitstreamTSVScanner;
+	else if(!strcmp(fmt, "delimited")) scanner = SplitstreamSeparatorScanner;
+	else {
+		PyErr_SetString(PyExc_ValueError, "Invalid object format name specified"); 
+		return NULL;
+	}
+	if(max <= 0) max = 100*1024*1024;
+	if(max > 1<<30) {
+		PyErr_Format(PyExc_ValueError, "Max document size %ld out of range.", max); 
+		return NULL;
+	}
+	self = (Splitter*)type->tp_alloc(type, 0);
+	if(!self) return NULL;
+	self->scanner = scanner;
+	self->startDepth = (int)startDepth;
+	self->max = (size_t)max;
+	self->carry = NULL;
+	self->carryLength = self->carrySize = 0;
+	SplitstreamInitDepth(&self->state, (int)startDepth);
+	return (PyObject*)self;
+}
+
+static void splitter_dealloc(Splitter* self)
+{
+	SplitstreamFree(&self->state);
+	free(self->carry);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/* Appends to the carried document. Returns 0 or -1 if out of memory. */
+static int splitter_carry(Splitter* self, const char* buf, size_t len)
+{
+	if(self->carryLength + len > self->carrySize) {
+		size_t size = self->carrySize ? self->carrySize : 4096;
+		char* p;
+		while(size < self->carryLength + len) size *= 2;
+		p = realloc(self->carry, size);
+		if(!p) return -1;
+		self->carry = p;
+		self->carrySize = size;
+	}
+	memcpy(self->carry + self->carryLength, buf, len);
+	self->carryLength += len;
+	return 0;
+}
+
+/* The document at stream offsets [start, end) of the data fed so far, where `buf` is the data
+   from stream offset `base` on */
+static PyObject* splitter_document(Splitter* self, const char* buf, long long base, long long start, long long end)
+{
+	PyObject* obj;
+	long long length;
+	if(start >= base) return PyBytes_FromStringAndSize(buf + (start - base), (Py_ssize_t)(end - start));
+	/* Started in an earlier call, so its beginning was carried over. A separator left out of
+	   it may have begun in the carried part too. */
+	length = (long long)self->carryLength + (end - base);
+	obj = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)length);
+	if(obj) {
+		memcpy(PyBytes_AS_STRING(obj), self->carry, end > base ? self->carryLength : (size_t)length);
+		if(end > base) memcpy(PyBytes_AS_STRING(obj) + self->carryLength, buf, (size_t)(end - base));
+	}
+	self->carryLength = 0;
+	return obj;
+}
+
+/* Scans the caller's buffer in place for document bounds, and only copies out the documents
+   found and the unfinished one at the end, which the next call completes */
+static PyObject* splitter_feed(Splitter* self, PyObject* arg)
+{
+	Py_buffer view;
+	long long starts[SPLITTER_BATCH], ends[SPLITTER_BATCH], base, pending = -1;
+	const char* buf;
+	size_t len, pos = 0, n, i, from;
+	PyObject* ret, *obj;
+
+	if(enter_busy(&self->busy, "Splitter") < 0) return NULL;
+	if(PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0) {
+		self->busy = 0;
+		return NULL;
+	}
+	ret = PyList_New(0);
+	buf = view.buf;
+	len = (size_t)view.len;
+	base = self->state.offset;
+	while(ret) {
+		Py_BEGIN_ALLOW_THREADS
+		n = SplitstreamScanStream(&self->state, buf, len, &pos, self->scanner, starts, ends, SPLITTER_BATCH, &pending);
+		Py_END_ALLOW_THREADS
+		for(i = 0; ret && i < n; ++i) {
+			obj = splitter_document(self, buf, base, starts[i], ends[i]);
+			if(!obj || PyList_Append(ret, obj) < 0) Py_CLEAR(ret);
+			Py_XDECREF(obj);
+		}
+		if(n < SPLITTER_BATCH) break;
+	}
+	if(ret && pending >= 0) {
+		from = pending >= base ? (size_t)(pending - base) : 0;
+		/* Like the tokenizer, start over from here rather than keep more than `max` */
+		if(pending >= base || self->carryLength + len > self->max) self->carryLength = 0;
+		if(splitter_carry(self, buf + from, len - from) < 0) {
+			Py_CLEAR(ret);
+			PyErr_NoMemory();
+		}
+	} else if(ret) {
+		self->carryLength = 0;
+	}
+	PyBuffer_Release(&view);
+	self->busy = 0;
+	return ret;
+}
+
+/* Only the last record of "csv", "tsv" or "delimited" is completed by the end of the input. It
+   is the carried document, scanned again as the whole input. */
+static PyObject* splitter_finish(Splitter* self, PyObject* unused)
+{
+	SplitstreamState s;
+	size_t start, end, pos = 0, n;
+	long long offset;
+	PyObject* ret, *obj;
+
+	if(enter_busy(&self->busy, "Splitter") < 0) return NULL;
+	ret = PyList_New(0);
+	if(!ret || !self->carryLength) {
+		self->busy = 0;
+		return ret;
+	}
+	SplitstreamInitDepth(&s, self->startDepth);
+	s.flags |= SPLITSTREAM_STATE_FLAG_END_OF_INPUT;
+	n = SplitstreamScanBuffer(&s, self->carry, self->carryLength, &pos, self->scanner, &start, &end, 1);
+	SplitstreamFree(&s);
+	if(n) {
+		obj = PyBytes_FromStringAndSize(self->carry + start, (Py_ssize_t)(end - start));
+		if(!obj || PyList_Append(ret, obj) < 0) Py_CLEAR(ret);
+		Py_XDECREF(obj);
+		/* The record is over, so the next input starts a new one */
+		offset = self->state.offset;
+		SplitstreamFree(&self->state);
+		SplitstreamInitDepth(&self->state, self->startDepth);
+		self->state.offset = offset;
+		self->carryLength = 0;
+	}
+	self->busy = 0;
+	return ret;
+}
+
+static PyObject* splitter_offset(Splitter* self, void* closure)
+{
+	return PyLong_FromLongLong(self->state.offset);
+}
+
+static PyMethodDef splitter_methods[] = {
+	{"feed", (PyCFunction)splitter_feed, METH_O, "feed(data) -> list of the documents completed by data (any bytes-like object)."},
+	{"finish", (PyCFunction)splitter_finish, METH_NOARGS, "finish() -> list of the document completed by the end of the input, the last record of \"csv\", \"tsv\" or \"delimited\"."},
+	{NULL}
+};
+
+static PyGetSetDef splitter_getset[] = {
+	{"offset", (getter)splitter_offset, NULL, "Number of bytes fed so far.", NULL},
+	{NULL}
+};
+
+static PyTypeObject splitter_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	MODULE_NAME ".Splitter",
+	sizeof(Splitter)
+};
+
+/**
+*** In-memory buffers
+**/
+
+typedef struct {
+	unsigned long long* starts, *ends;
+	size_t count, size;
+} Offsets;
+
+/* Runs without the GIL. Returns 0 or -1 if out of memory. */
+static int scan_offsets(SplitstreamState* s, const char* buf, size_t len, SplitstreamScanner scanner, Offsets* o)
+{
+	size_t starts[1024], ends[1024], pos = 0, n, i;
+	do {
+		n = SplitstreamScanBuffer(s, buf, len, &pos, scanner, starts, ends, 1024);
+		if(o->count + n > o->size) {
+			size_t size = o->size ? o->size * 2 : 4096;
+			unsigned long long* p = realloc(o->starts, size * sizeof(unsigned long long));
+			if(!p) return -1;
+			o->starts = p;
+			p = realloc(o->ends, size * sizeof(unsigned long long));
+			if(!p) return -1;
+			o->ends = p;
+			o->size = size;
+		}
+		for(i = 0; i < n; ++i) {
+			o->starts[o->count] = starts[i];
+			o->ends[o->count++] = ends[i];
+		}
+	} while(n == 1024);
+	return 0;
+}
+
+static PyObject* offset_array(PyObject* arrayModule, const unsigned long long* values, size_t count)
+{
+	PyObject* data = PyBytes_FromStringAndSize((const char*)values, (Py_ssize_t)(count * sizeof(unsigned long long)));
+	PyObject* ret;
+	if(!data) return NULL;
+	ret = PyObject_CallMethod(arrayModule, "array", "sO", "Q", data);
+	Py_DECREF(data);
+	return ret;
+}
+
+static PyObject* split_buffer(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* obj, *offsets = NULL, *ret = NULL, *view, *doc;
+	const char* fmt;
+	long startDepth = 0;
+	SplitstreamScanner scanner;
+	SplitstreamState s;
+	Py_buffer buffer;
+	Offsets o;
+	size_t i;
+	int rc;
+	static char* kwarg_list[] = {"data", "format", "startdepth", "offsets", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os|lO", kwarg_list, &obj, &fmt, &startDepth, &offsets))
+		return NULL;
+	if(!strcmp(fmt, "xml")) scanner = SplitstreamXMLScanner;
+	else if(!strcmp(fmt, "json")) scanner = SplitstreamJSONScanner;
+	else if(!strcmp(fmt, "ubjson")) scanner = SplitstreamUBJSONScanner;
+	else if(!strcmp(fmt, "csv")) scanner = SplitstreamCSVScanner;
+	else if(!strcmp(fmt, "tsv")) scanner = SplitstreamTSVScanner;
+	else if(!strcmp(fmt, "delimited")) scanner = SplitstreamSeparatorScanner;
+	else {
+		PyErr_SetString(PyExc_ValueError, "Invalid object format name specified"); 
+		return NULL;
+	}
+	if(PyObject_GetBuffer(obj, &buffer, PyBUF_SIMPLE) < 0) return NULL;
+
+	memset(&o, 0, sizeof(o));
+	Py_BEGIN_ALLOW_THREADS
+	SplitstreamInitDepth(&s, (int)startDepth);
+	/* The buffer is the whole input, so it also ends the last record of "csv", "tsv" or "delimited" */
+	s.flags |= SPLITSTREAM_STATE_FLAG_END_OF_INPUT;
+	rc = scan_offsets(&s, buffer.buf, (size_t)buffer.len, scanner, &o);
+	SplitstreamFree(&s);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&buffer);
+	if(rc < 0) {
+		PyErr_NoMemory();
+	} else if(offsets && PyObject_IsTrue(offsets)) {
+		PyObject* arrayModule = PyImport_ImportModule("array");
+		if(arrayModule) {
+			PyObject* starts = offset_array(arrayModule, o.starts, o.count);
+			PyObject* ends = starts ? offset_array(arrayModule, o.ends, o.count) : NULL;
+			if(ends) ret = PyTuple_Pack(2, starts, ends);
+			Py_XDECREF(starts);
+			Py_XDECREF(ends);
+			Py_DECREF(arrayModule);
+		}
+	} else {
+		/* Slices of a byte view, whatever the item format of the buffer is */
+		view = PyMemoryView_FromObject(obj);
+		if(view) {
+			PyObject* bytes = PyObject_CallMethod(view, "cast", "s", "B");
+			Py_DECREF(view);
+			view = bytes;
+		}
+		if(view) ret = PyList_New((Py_ssize_t)o.count);
+		for(i = 0; ret && i < o.count; ++i) {
+			doc = PySequence_GetSlice(view, (Py_ssize_t)o.starts[i], (Py_ssize_t)o.ends[i]);
+			if(!doc) Py_CLEAR(ret);
+			else PyList_SET_ITEM(ret, (Py_ssize_t)i, doc);
+		}
+		Py_XDECREF(view);
+	}
+	free(o.starts);
+	free(o.ends);
+	return ret;
+}
+
+#ifdef HAVE_ASYNC
+
+/**
+*** Async iterator
+**/
+
+/* asplit() is an async iterator whose __anext__ returns an awaitable (ASplitNext). Awaiting
+   it first hands out documents left from the previous read, and only when there are none
+   does it call reader.read() and run the awaitable returned, passing whatever it yields up
+   to the event loop. The data it returns is fed to a Splitter. So the event loop is only
+   involved once per read, not once per document. */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject* read;
+	Splitter* splitter;
+	long bufsize;
+	int batch, eof;
+	PyObject* pending;
+	Py_ssize_t pendingPos;
+} ASplit;
+
+typedef struct {
+	PyObject_HEAD
+	ASplit* parent;
+	PyObject* inner;
+} ASplitNext;
+
+static PyTypeObject asplit_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	MODULE_NAME ".asplit",
+	sizeof(ASplit)
+};
+
+static PyTypeObject asplitnext_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	MODULE_NAME ".asplit_next",
+	sizeof(ASplitNext)
+};
+
+static PyObject* asplit(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* reader, *splitterArgs, *splitterKwargs;
+	const char* fmt;
+	long startDepth = 0, bufsize = 65536, max = 0;
+	int batch = 0;
+	ASplit* ret;
+	static char* kwarg_list[] = {"reader", "format", "startdepth", "bufsize", "maxdocsize", "batch", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os|llli", kwarg_list, &reader, &fmt, &startDepth, &bufsize, &max, &batch))
+		return NULL;
+	if(bufsize <= 0 || bufsize > 1<<30) {
+		PyErr_Format(PyExc_ValueError, "Buffer size %ld out of range.", bufsize); 
+		return NULL;
+	}
+	ret = (ASplit*)asplit_type.tp_alloc(&asplit_type, 0);
+	if(!ret) return NULL;
+	ret->bufsize = bufsize;
+	ret->batch = batch;
+	ret->read = PyObject_GetAttrString(reader, "read");
+	splitterArgs = Py_BuildValue("(s)", fmt);
+	splitterKwargs = Py_BuildValue("{s:l,s:l}", "startdepth", startDepth, "maxdocsize", max);
+	if(ret->read && splitterArgs && splitterKwargs)
+		ret->splitter = (Splitter*)splitter_new(&splitter_type, splitterArgs, splitterKwargs);
+	Py_XDECREF(splitterArgs);
+	Py_XDECREF(splitterKwargs);
+	if(!ret->splitter) {
+		Py_DECREF(ret);
+		return NULL;
+	}
+	return (PyObject*)ret;
+}
+
+static void asplit_dealloc(ASplit* self)
+{
+	Py_XDECREF(self->read);
+	Py_XDECREF(self->splitter);
+	Py_XDECREF(self->pending);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* asplit_aiter(PyObject* self)
+{
+	Py_INCREF(self);
+	return self;
+}
+
+static PyObject* asplit_anext(ASplit* self)
+{
+	ASplitNext* ret = (ASplitNext*)asplitnext_type.tp_alloc(&asplitnext_type, 0);
+	if(!ret) return NULL;
+	Py_INCREF(self);
+	ret->parent = self;
+	return (PyObject*)ret;
+}
+
+static void asplitnext_dealloc(ASplitNext* self)
+{
+	Py_XDECREF(self->parent);
+	Py_XDECREF(self->inner);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* asplitnext_await(PyObject* self)
+{
+	Py_INCREF(self);
+	return self;
+}
+
+/* Completes the await with the next document, if there is one */
+static int asplitnext_result(ASplit* p)
+{
+	PyObject* val;
+	if(p->pending && p->pendingPos < PyList_GET_SIZE(p->pending)) {
+		if(p->batch) {
+			val = p->pending;
+			p->pending = NULL;
+		} else {
+			val = PyList_GET_ITEM(p->pending, p->pendingPos++);
+			Py_INCREF(val);
+		}
+		/* Wrap the value so that it is not taken as the exception arguments */
+		val = PyObject_CallFunctionObjArgs(PyExc_StopIteration, val, NULL);
+		if(val) PyErr_SetObject(PyExc_StopIteration, val);
+		Py_XDECREF(val);
+		return 1;
+	}
+	if(p->eof) {
+		PyErr_SetNone(PyExc_StopAsyncIteration);
+		return 1;
+	}
+	return 0;
+}
+
+/* Handles the outcome of resuming the read: either it yielded something for the event loop,
+   or it failed, or it returned the data. */
+static PyObject* asplitnext_step(ASplitNext* self, PyObject* res)
+{
+	ASplit* p = self->parent;
+	PyObject* type, *value, *tb, *data = NULL, *docs;
+
+	while(!res) {
+		if(self->inner) {
+			if(PyErr_Occurred()) {
+				if(!PyErr_ExceptionMatches(PyExc_StopIteration)) {
+					Py_CLEAR(self->inner);
+					return NULL;
+				}
+				PyErr_Fetch(&type, &value, &tb);
+				PyErr_NormalizeException(&type, &value, &tb);
+				data = value ? PyObject_GetAttrString(value, "value") : NULL;
+				Py_XDECREF(type);
+				Py_XDECREF(value);
+				Py_XDECREF(tb);
+			} else {
+				data = Py_None;
+				Py_INCREF(data);
+			}
+			Py_CLEAR(self->inner);
+			if(!data) return NULL;
+			if(PyObject_Length(data) == 0) {
+				PyErr_Clear();
+				p->eof = 1;
+				docs = splitter_finish(p->splitter, NULL);
+			} else {
+				docs = splitter_feed(p->splitter, data);
+			}
+			if(!docs) {
+				Py_DECREF(data);
+				return NULL;
+			}
+			Py_XDECREF(p->pending);
+			p->pending = docs;
+			p->pendingPos = 0;
+			Py_DECREF(data);
+		}
+		if(asplitnext_result(p)) return NULL;
+
+		data = PyObject_CallFunction(p->read, "l", p->bufsize);
+		if(!data) return NULL;
+		self->inner = PyObject_CallMethod(data, "__await__", NULL);
+		Py_DECREF(data);
+		if(!self->inner) return NULL;
+		res = Py_TYPE(self->inner)->tp_iternext(self->inner);
+	}
+	return res;
+}
+
+static PyObject* asplitnext_iternext(ASplitNext* self)
+{
+	if(!self->inner) return asplitnext_step(self, NULL);
+	return asplitnext_step(self, Py_TYPE(self->inner)->tp_iternext(self->inner));
+}
+
+static PyObject* asplitnext_send(ASplitNext* self, PyObject* value)
+{
+	if(value == Py_None || !self->inner) return asplitnext_iternext(self);
+	return asplitnext_step(self, PyObject_CallMethod(self->inner, "send", "O", value));
+}
+
+/* Cancellation is passed on to the read in progress */
+static PyObject* asplitnext_throw(ASplitNext* self, PyObject* args)
+{
+	PyObject* type, *value = NULL, *tb = NULL;
+	if(!PyArg_ParseTuple(args, "O|OO", &type, &value, &tb)) return NULL;
+	if(self->inner) {
+		PyObject* throw = PyObject_GetAttrString(self->inner, "throw"), *res = NULL;
+		if(throw) res = PyObject_Call(throw, args, NULL);
+		Py_XDECREF(throw);
+		return asplitnext_step(self, res);
+	}
+	if(PyExceptionInstance_Check(type)) PyErr_SetObject((PyObject*)Py_TYPE(type), type);
+	else PyErr_SetObject(type, value);
+	return NULL;
+}
+
+static PyObject* asplitnext_close(ASplitNext* self, PyObject* args)
+{
+	PyObject* inner = self->inner;
+	self->inner = NULL;
+	if(inner) {
+		PyObject* res = PyObject_CallMethod(inner, "close", NULL);
+		Py_DECREF(inner);
+		if(!res) return NULL;
+		Py_DECREF(res);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef asplitnext_methods[] = {
+	{"send", (PyCFunction)asplitnext_send, METH_O, NULL},
+	{"throw", (PyCFunction)asplitnext_throw, METH_VARARGS, NULL},
+	{"close", (PyCFunction)asplitnext_close, METH_NOARGS, NULL},
+	{NULL}
+};
+
+static PyAsyncMethods asplit_async = { 0, asplit_aiter, (unaryfunc)asplit_anext };
+static PyAsyncMethods asplitnext_async = { asplitnext_await, 0, 0 };
+
+static int add_async_types(void)
+{
+	asplit_type.tp_dealloc = (destructor)asplit_dealloc;
+	asplit_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	asplit_type.tp_as_async = &asplit_async;
+	asplit_type.tp_alloc = PyType_GenericAlloc;
+	asplitnext_type.tp_dealloc = (destructor)asplitnext_dealloc;
+	asplitnext_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	asplitnext_type.tp_as_async = &asplitnext_async;
+	asplitnext_type.tp_iter = asplitnext_await;
+	asplitnext_type.tp_iternext = (iternextfunc)asplitnext_iternext;
+	asplitnext_type.tp_methods = asplitnext_methods;
+	asplitnext_type.tp_alloc = PyType_GenericAlloc;
+	if(PyType_Ready(&asplit_type) < 0 || PyType_Ready(&asplitnext_type) < 0) return -1;
+	return 0;
+}
+
+#endif
+
+static int add_types(PyObject* m)
+{
+	splitter_type.tp_dealloc = (destructor)splitter_dealloc;
+	splitter_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	splitter_type.tp_doc = "Splitter(format[, startdepth][, maxdocsize])\n\n"
+		"Push-style splitter. feed() scans each chunk of data as it arrives, keeping the\n"
+		"state of the document in progress between calls, and returns the completed documents.";
+	splitter_type.tp_methods = splitter_methods;
+	splitter_type.tp_getset = splitter_getset;
+	splitter_type.tp_alloc = PyType_GenericAlloc;
+	splitter_type.tp_new = splitter_new;
+	if(PyType_Ready(&splitter_type) < 0) return -1;
+#ifdef HAVE_ASYNC
+	if(add_async_types() < 0) return -1;
+#endif
+	Py_INCREF(&splitter_type);
+	return PyModule_AddObject(m, "Splitter", (PyObject*)&splitter_type);
+}
+
 /**
 *** Generator object
 **/
@@ -244,9 +1361,23 @@ static Generator* splitstream_generator_new(PyTypeObject *type, PyObject *args,
 	Generator* state = (Generator *)type->tp_alloc(type, 0);
 	if (!state) return NULL;
 	
-	state->read = state->callback = NULL;
+	state->read = state->callback = state->path = state->filterObj = NULL;
+	state->filterStrings = NULL;
+	state->reservoir = NULL;
+	state->sampling = 0;
+	state->hash = 0;
+	memset(&state->dedup, 0, sizeof(state->dedup));
+	memset(&state->resync, 0, sizeof(state->resync));
+	state->skipped = NULL;
+	state->skippedCount = state->skippedSize = 0;
+	state->format = NULL;
+	state->preamble = state->origPreamble = NULL;
 	state->eof = state->fileeof = 0;
+	state->busy = 0;
 	state->f = NULL;
+	state->fd = -1;
+	state->ownfd = 0;
+	state->reader = NULL;
 	state->buf = NULL;
 	memset(&state->state, 0, sizeof(state->state));
 
@@ -257,6 +1388,37 @@ static void splitstream_generator_dealloc(Generator* state)
 {
 	Py_XDECREF(state->read); state->read = NULL;
 	Py_XDECREF(state->callback); state->callback = NULL;
+	Py_XDECREF(state->path); state->path = NULL;
+	Py_XDECREF(state->filterObj); state->filterObj = NULL;
+	if(state->filterStrings) {
+		char** p;
+		for(p = state->filterStrings; *p; ++p) free(*p);
+		free(state->filterStrings);
+	}
+	state->filterStrings = NULL;
+	Py_XDECREF(state->reservoir); state->reservoir = NULL;
+	free(state->dedup.table);
+	state->dedup.table = NULL;
+	free(state->skipped);
+	state->skipped = NULL;
+	if(state->origPreamble) free(state->origPreamble);
+	state->origPreamble = NULL;
+	free(state->delimiter);
+	state->delimiter = NULL;
+	if(state->reader && state->readahead > 0) {
+		/* Joins the reader thread, which needs no Python objects */
+		Py_BEGIN_ALLOW_THREADS
+		SplitstreamReaderClose(state->reader);
+		Py_END_ALLOW_THREADS
+	} else if(state->reader) {
+		SplitstreamReaderClose(state->reader);
+	}
+	state->reader = NULL;
+	if(state->ownfd) {
+		if(state->f) fclose(state->f);
+		else close(state->fd);
+	}
+	state->f = NULL;
 	SplitstreamFree(&state->state);
 	if(state->buf) free(state->buf);
 	if(state->preamble) free(state->preamble);
@@ -264,8 +1426,130 @@ static void splitstream_generator_dealloc(Generator* state)
 	Py_TYPE(state)->tp_free(state);
 }
 
+static PyObject* splitstream_generator_getstate(Generator* state, PyObject* unused)
+{
+	size_t len;
+	PyObject* ret = NULL;
+	if(enter_busy(&state->busy, "Generator") < 0) return NULL;
+	len = SplitstreamStateSerialize(&state->state, NULL, 0);
+	ret = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)len);
+	if(ret) SplitstreamStateSerialize(&state->state, PyBytes_AS_STRING(ret), len);
+	state->busy = 0;
+	return ret;
+}
+
+static PyObject* splitstream_generator_offset(Generator* state, void* closure)
+{
+	return PyLong_FromLongLong(state->state.offset);
+}
+
+static PyObject* splitstream_generator_duplicates(Generator* state, void* closure)
+{
+	return PyLong_FromUnsignedLongLong(state->dedup.duplicates);
+}
+
+/* Called by the tokenizer, possibly without the GIL */
+static void generator_skipped(void* arg, long long start, long long end)
+{
+	Generator* state = (Generator*)arg;
+	if(state->skippedCount == state->skippedSize) {
+		size_t size = state->skippedSize ? 2 * state->skippedSize : 16;
+		long long* skipped = realloc(state->skipped, 2 * size * sizeof(long long));
+		/* The ranges are still counted by the policy */
+		if(!skipped) return;
+		state->skipped = skipped;
+		state->skippedSize = size;
+	}
+	state->skipped[2 * state->skippedCount] = start;
+	state->skipped[2 * state->skippedCount + 1] = end;
+	state->skippedCount++;
+}
+
+static PyObject* splitstream_generator_skipped(Generator* state, void* closure)
+{
+	PyObject* ret = PyList_New((Py_ssize_t)state->skippedCount);
+	size_t i;
+	if(!ret) return NULL;
+	for(i = 0; i < state->skippedCount; ++i) {
+		PyObject* range = Py_BuildValue("(LL)", state->skipped[2 * i], state->skipped[2 * i + 1]);
+		if(!range) {
+			Py_DECREF(ret);
+			return NULL;
+		}
+		PyList_SET_ITEM(ret, (Py_ssize_t)i, range);
+	}
+	return ret;
+}
+
+static PyObject* splitstream_generator_reduce(Generator* state, PyObject* unused)
+{
+	PyObject* module, *func, *tokenizerState, *ret;
+	if(!state->path || state->callback || state->compression || state->sampling) {
+		PyErr_SetString(PyExc_TypeError, "Only generators over an uncompressed file opened by path, without sampling, can be pickled. "
+			"Use getstate() and splitfile(..., state=...) instead.");
+		return NULL;
+	}
+	if(!(module = PyImport_ImportModule(MODULE_NAME))) return NULL;
+	func = PyObject_GetAttrString(module, "splitfile");
+	Py_DECREF(module);
+	if(!func) return NULL;
+	tokenizerState = splitstream_generator_getstate(state, NULL);
+	if(!tokenizerState) {
+		Py_DECREF(func);
+		return NULL;
+	}
+	#if PY_MAJOR_VERSION >= 3
+	#define FMT "O(OsOlllyiOOiOKKniKnininiNii)"
+	#else
+	#define FMT "O(OsOlllsiOOiOKKniKnininiNii)"
+	#endif
+	ret = Py_BuildValue(FMT, func, state->path, state->format, Py_None,
+		(long)state->state.startDepth, state->bufsize, state->max,
+		state->origPreamble ? state->origPreamble : "",
+		state->readahead, Py_None, tokenizerState, state->follow,
+		state->filterObj ? state->filterObj : Py_None,
+		0ULL, 0ULL, (Py_ssize_t)0, 0, 0ULL, state->fragmentSize, state->hash, (Py_ssize_t)state->dedup.size,
+		state->resync.lineStart, (Py_ssize_t)state->resync.maxToken, state->adaptive,
+		state->delimiter ? PyBytes_FromStringAndSize(state->delimiter, (Py_ssize_t)state->delimiterLength) : (Py_INCREF(Py_None), Py_None),
+		state->header, state->keepDelimiter);
+	#undef FMT
+	Py_DECREF(func);
+	Py_DECREF(tokenizerState);
+	return ret;
+}
+
+/* The document as returned: its data, or a tuple of the data and its fragment or hash */
+static PyObject* doc_item(Generator *state, SplitstreamDocument* doc) {
+	PyObject* data = as_python_object(doc);
+	if(!data) return NULL;
+	/* Fragments are only meaningful together with their position in the document */
+	if(state->fragmentSize) return Py_BuildValue("(iN)", doc->fragment, data);
+	if(state->hash) return Py_BuildValue("(KN)", doc->hash, data);
+	return data;
+}
+
 static PyObject* handle_doc(Generator *state, SplitstreamDocument* doc) {
-	if(state->callback) {
+	if(state->reservoir) {
+		/* Replaces an earlier sample, if any */
+		PyObject* obj = doc_item(state, doc);
+		Py_ssize_t slot = (Py_ssize_t)state->sampler.slot;
+		if(!obj) return NULL;
+		if(slot < PyList_GET_SIZE(state->reservoir)) {
+			PyList_SetItem(state->reservoir, slot, obj);
+		} else {
+			int rc = PyList_Append(state->reservoir, obj);
+			Py_DECREF(obj);
+			if(rc < 0) return NULL;
+		}
+		return Py_None;
+	} else if(state->fragmentSize || state->hash) {
+		PyObject* obj = doc_item(state, doc);
+		int rc;
+		if(!obj || !state->callback) return obj;
+		rc = call_callback_object(obj, state->callback);
+		Py_DECREF(obj);
+		return rc < 0 ? NULL : Py_None;
+	} else if(state->callback) {
 		if(call_callback(doc, state->callback) < 0)
 			return NULL;
 		return Py_None;
@@ -274,7 +1558,36 @@ static PyObject* handle_doc(Generator *state, SplitstreamDocument* doc) {
 	}
 }
 
+static PyObject* splitstream_generator_next_sample(Generator *state)
+{
+	PyObject* item;
+	if(!state->reservoir) return splitstream_generator_next_doc(state);
+
+	/* The sample is not known until the whole file has been split */
+	while(!state->eof) {
+		if(!splitstream_generator_next_doc(state) && PyErr_Occurred()) return NULL;
+	}
+	while(state->reservoirPos < PyList_GET_SIZE(state->reservoir)) {
+		item = PyList_GET_ITEM(state->reservoir, state->reservoirPos++);
+		if(!state->callback) {
+			Py_INCREF(item);
+			return item;
+		}
+		if(call_callback_object(item, state->callback) < 0) return NULL;
+	}
+	return NULL;
+}
+
 static PyObject* splitstream_generator_next(Generator *state)
+{
+	PyObject* ret;
+	if(enter_busy(&state->busy, "Generator") < 0) return NULL;
+	ret = splitstream_generator_next_sample(state);
+	state->busy = 0;
+	return ret;
+}
+
+static PyObject* splitstream_generator_next_doc(Generator *state)
 {
     SplitstreamDocument doc;
     doc.buffer = NULL;
@@ -285,7 +1598,7 @@ static PyObject* splitstream_generator_next(Generator *state)
 	if(state->eof) {
 		return NULL;
 	}
-	PyObject* readargs = state->f ? NULL : Py_BuildValue("(i)", state->bufsize);
+	PyObject* readargs = (state->f || state->reader) ? NULL : Py_BuildValue("(i)", state->bufsize);
 	PyObject* ret = NULL;
 	do {
 	
@@ -311,7 +1624,22 @@ static PyObject* splitstream_generator_next(Generator *state)
 		}
 		if(doc.buffer) break;
     
-		if(state->f) {
+		if(state->reader) {
+			Py_BEGIN_ALLOW_THREADS
+			doc = SplitstreamGetNextDocumentFromReader(&state->state, state->max, state->reader, state->scanner);
+			Py_END_ALLOW_THREADS
+			if(doc.buffer) {
+				ret = handle_doc(state, &doc);
+				break;
+			}
+			state->eof = 1;
+			if(PyErr_Occurred()) {
+				/* Raised by read() of a Python file object */
+			} else if(SplitstreamReaderError(state->reader)) {
+				errno = SplitstreamReaderError(state->reader);
+				PyErr_SetFromErrno(PyExc_IOError);
+			}
+		} else if(state->f) {
 			if(!state->buf) state->buf = malloc(state->bufsize);
 			if(!state->buf) {
 				PyErr_SetString(PyExc_MemoryError, "Unable to allocate buffer."); 
@@ -359,6 +1687,19 @@ static PyObject* splitstream_generator_next(Generator *state)
 *** Helpers
 **/
 
+/* The tokenizer runs without the GIL while it reads or scans, so another thread could call
+   into the same object meanwhile. The flag is only changed with the GIL held, which turns
+   that (and a callback calling back in) into an error instead of a corrupted state. */
+static int enter_busy(int* busy, const char* name)
+{
+	if(*busy) {
+		PyErr_Format(PyExc_RuntimeError, "%s is already running.", name);
+		return -1;
+	}
+	*busy = 1;
+	return 0;
+}
+
 static int splitfile_pure_once(SplitstreamState* s, PyObject* read, PyObject* readargs, long max, SplitstreamScanner scanner, SplitstreamDocument* doc)
 {
 	int eof = 1;
@@ -371,13 +1712,24 @@ static int splitfile_pure_once(SplitstreamState* s, PyObject* read, PyObject* re
     }
 
     while(read) {
-	    Py_ssize_t len;
+	    Py_ssize_t len, request = 0;
 	    char* buf;
-        PyObject* data = PyObject_Call(read, readargs, NULL);
+	    PyObject* data;
+	    if(s->readSize) {
+	    	/* The read size changes from one read to the next */
+	    	request = (Py_ssize_t)s->readSize->size;
+	    	readargs = Py_BuildValue("(n)", request);
+	    	if(!readargs) return -1;
+	    	data = PyObject_Call(read, readargs, NULL);
+	    	Py_DECREF(readargs);
+	    } else {
+	        data = PyObject_Call(read, readargs, NULL);
+	    }
         if(!data) return -1;
         
         if(PyBytes_AsStringAndSize(data, &buf, &len) < 0) return -1;
         eof = len == 0;
+        if(s->readSize) SplitstreamReadSizeUpdate(s, (size_t)request, (size_t)len);
 
         *doc = SplitstreamGetNextDocument(s, max, buf, len, scanner);
         Py_DECREF(data);
@@ -388,40 +1740,249 @@ static int splitfile_pure_once(SplitstreamState* s, PyObject* read, PyObject* re
         if(eof) break;
     }
     s->flags &= ~SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
+    if(eof && !doc->buffer) *doc = SplitstreamGetLastDocument(s, max, scanner);
 
     return eof;
 }
 
+static int open_path(PyObject* path)
+{
+	int fd = -1;
+	#if PY_MAJOR_VERSION >= 3
+	PyObject* bytes = NULL;
+	if(!PyUnicode_FSConverter(path, &bytes)) return -1;
+	fd = open(PyBytes_AS_STRING(bytes), O_RDONLY | O_BINARY);
+	Py_DECREF(bytes);
+	#else
+	const char* name = PyString_AsString(path);
+	if(!name) return -1;
+	fd = open(name, O_RDONLY | O_BINARY);
+	#endif
+	if(fd < 0) PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, path);
+	return fd;
+}
+
+/* Reader on top of the read() method of a Python file object. It is driven with the GIL
+   released, so it takes the GIL back for the duration of each call. */
+typedef struct {
+	SplitstreamReader base;
+	PyObject* read, *readargs, *data;
+} PyReadReader;
+
+static int pyread_reader_read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+	PyReadReader* r = (PyReadReader*)reader;
+	PyGILState_STATE gil = PyGILState_Ensure();
+	Py_ssize_t n;
+	char* p;
+	int ret = -1;
+
+	Py_XDECREF(r->data);
+	r->data = PyObject_Call(r->read, r->readargs, NULL);
+	if(r->data && PyBytes_AsStringAndSize(r->data, &p, &n) == 0) {
+		*buf = p;
+		*len = (size_t)n;
+		ret = n > 0;
+	} else {
+		reader->error = EIO;
+	}
+	PyGILState_Release(gil);
+	return ret;
+}
+
+static void pyread_reader_close(SplitstreamReader* reader)
+{
+	PyReadReader* r = (PyReadReader*)reader;
+	Py_XDECREF(r->read);
+	Py_XDECREF(r->readargs);
+	Py_XDECREF(r->data);
+	free(r);
+}
+
+static SplitstreamReader* pyread_reader_new(PyObject* read, long bufsize)
+{
+	PyReadReader* r;
+	if(!read) return NULL;
+	r = calloc(1, sizeof(PyReadReader));
+	if(!r) return NULL;
+	r->base.read = pyread_reader_read;
+	r->base.close = pyread_reader_close;
+	r->readargs = Py_BuildValue("(l)", bufsize);
+	if(!r->readargs) {
+		free(r);
+		return NULL;
+	}
+	r->read = read;
+	Py_INCREF(read);
+	return &r->base;
+}
+
+static char* dup_string(PyObject* obj)
+{
+	const char* str = NULL;
+	char* ret;
+	#if PY_MAJOR_VERSION >= 3
+	if(PyUnicode_Check(obj)) str = PyUnicode_AsUTF8(obj);
+	else
+	#endif
+	if(PyBytes_Check(obj)) str = PyBytes_AS_STRING(obj);
+	if(!str) {
+		if(!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "Filter values must be strings.");
+		return NULL;
+	}
+	ret = strdup(str);
+	if(!ret) PyErr_NoMemory();
+	return ret;
+}
+
+/* Copies the delimiter, given as bytes or a string, after checking that it suits the format */
+static int make_delimiter(PyObject* obj, const char* fmt, char** delimiter, size_t* length)
+{
+	PyObject* bytes = PyUnicode_Check(obj) ? PyUnicode_AsUTF8String(obj) : (Py_INCREF(obj), obj);
+	char* data;
+	Py_ssize_t len;
+
+	if(!bytes) return -1;
+	if(PyBytes_AsStringAndSize(bytes, &data, &len) < 0) {
+		Py_DECREF(bytes);
+		return -1;
+	}
+	if(strcmp(fmt, "csv") && strcmp(fmt, "delimited")) {
+		PyErr_Format(PyExc_ValueError, "A delimiter is not supported for %s.", fmt);
+	} else if(!strcmp(fmt, "delimited") && (len < 1 || len > SPLITSTREAM_SEPARATOR_MAX)) {
+		PyErr_Format(PyExc_ValueError, "The delimiter must be 1 to %d bytes long.", SPLITSTREAM_SEPARATOR_MAX);
+	} else if(!strcmp(fmt, "csv") && (len != 1 || data[0] == '"' || data[0] == '\r' || data[0] == '\n')) {
+		PyErr_SetString(PyExc_ValueError, "The CSV delimiter must be a single character other than a quote or line break.");
+	} else if(!(*delimiter = malloc((size_t)len))) {
+		PyErr_NoMemory();
+	} else {
+		memcpy(*delimiter, data, (size_t)len);
+		*length = (size_t)len;
+	}
+	Py_DECREF(bytes);
+	return PyErr_Occurred() ? -1 : 0;
+}
+
+/* Builds the filter from a name or a list of names (XML), or a key or (key, value prefix)
+   tuple (JSON). The strings are copied into a NULL-terminated array owned by the caller. */
+static int make_filter(PyObject* obj, const char* fmt, SplitstreamFilter* filter, char*** strings)
+{
+	PyObject* seq;
+	Py_ssize_t i, n;
+	int isString = PyBytes_Check(obj) || PyUnicode_Check(obj);
+
+	memset(filter, 0, sizeof(*filter));
+	if(!strcmp(fmt, "xml")) {
+		filter->type = SPLITSTREAM_FILTER_XML_ELEMENT;
+	} else if(!strcmp(fmt, "json")) {
+		filter->type = SPLITSTREAM_FILTER_JSON_KEY;
+	} else {
+		PyErr_Format(PyExc_ValueError, "Filters are not supported for %s.", fmt);
+		return -1;
+	}
+	seq = isString ? PyTuple_Pack(1, obj) : PySequence_Fast(obj, "Filter must be a string or a sequence of strings.");
+	if(!seq) return -1;
+	n = PySequence_Fast_GET_SIZE(seq);
+	if(n < 1 || (filter->type == SPLITSTREAM_FILTER_XML_ELEMENT && n > 32) ||
+	   (filter->type == SPLITSTREAM_FILTER_JSON_KEY && n > 2)) {
+		PyErr_SetString(PyExc_ValueError, filter->type == SPLITSTREAM_FILTER_JSON_KEY ?
+			"JSON filter must be a key or a (key, value prefix) tuple." : "XML filter must have 1 to 32 names.");
+		Py_DECREF(seq);
+		return -1;
+	}
+	*strings = calloc((size_t)n + 1, sizeof(char*));
+	if(!*strings) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return -1;
+	}
+	for(i = 0; i < n; ++i) {
+		if(!((*strings)[i] = dup_string(PySequence_Fast_GET_ITEM(seq, i)))) {
+			Py_DECREF(seq);
+			return -1;
+		}
+	}
+	Py_DECREF(seq);
+	if(filter->type == SPLITSTREAM_FILTER_XML_ELEMENT) {
+		filter->names = (const char* const*)*strings;
+	} else {
+		filter->key = (*strings)[0];
+		filter->valuePrefix = (*strings)[1];
+	}
+	return 0;
+}
+
+/* Lets a follow reader waiting for data with the GIL released notice KeyboardInterrupt */
+static int follow_idle(void* arg)
+{
+	PyGILState_STATE gil = PyGILState_Ensure();
+	int ret = PyErr_CheckSignals() < 0 ? -1 : 0;
+	PyGILState_Release(gil);
+	return ret;
+}
+
+static SplitstreamReader* follow_reader_new(PyObject* path, long bufsize, SplitstreamState* s)
+{
+	SplitstreamReader* r;
+	#if PY_MAJOR_VERSION >= 3
+	PyObject* bytes = NULL;
+	if(!PyUnicode_FSConverter(path, &bytes)) return NULL;
+	r = SplitstreamReaderOpenFollow(PyBytes_AS_STRING(bytes), (size_t)bufsize, 200, s, follow_idle, NULL);
+	Py_DECREF(bytes);
+	#else
+	const char* name = PyString_AsString(path);
+	if(!name) return NULL;
+	r = SplitstreamReaderOpenFollow(name, (size_t)bufsize, 200, s, follow_idle, NULL);
+	#endif
+	return r;
+}
+
 static int call_callback(SplitstreamDocument* doc, PyObject* callback)
 {
-	PyObject* ret = NULL;
 	if(doc->buffer) {
-		PyObject* val, *vals;
+		PyObject* val;
+		int rc;
 	
-		val = PyBytes_FromStringAndSize(doc->buffer, doc->length);
+		val = as_python_object(doc);
 		if(!val) return -1;
-		vals = PyTuple_Pack(1, val);
-		if(!vals) {
-			Py_DECREF(val);
-			return -1;
-		}
-		
-		ret = PyObject_Call(callback, vals, NULL);
-		
-		Py_DECREF(vals);
+		rc = call_callback_object(val, callback);
 		Py_DECREF(val);
-		if(ret) {
-			Py_DECREF(ret);
-			return 0;
-		}
+		return rc;
 	
     } else PyErr_SetString(PyExc_ValueError, "Invalid object"); 
 	return -1;
 }
 
+static int call_callback_object(PyObject* val, PyObject* callback)
+{
+	PyObject* ret, *vals = PyTuple_Pack(1, val);
+	if(!vals) return -1;
+	
+	ret = PyObject_Call(callback, vals, NULL);
+	
+	Py_DECREF(vals);
+	if(ret) {
+		Py_DECREF(ret);
+		return 0;
+	}
+	return -1;
+}
+
 static PyObject* as_python_object(SplitstreamDocument* doc)
 {
-	if(doc->buffer) {
+	if(doc->segmentCount) {
+		/* Large documents are copied once, straight from their segments */
+		PyObject* ret = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)doc->length);
+		char* p;
+		size_t i;
+		if(!ret) return NULL;
+		p = PyBytes_AS_STRING(ret);
+		for(i = 0; i < doc->segmentCount; ++i) {
+			memcpy(p, doc->segments[i].base, doc->segments[i].length);
+			p += doc->segments[i].length;
+		}
+		return ret;
+	} else if(doc->buffer) {
 		return PyBytes_FromStringAndSize(doc->buffer, doc->length);
 	} else {
 		return Py_None;
@@ -20,9 +20,8 @@
 #include <string.h>
 
 static void AppendDoc(SplitstreamState* state, SplitstreamDocument* dest, const void* ptr, size_t length);
-
-const static int SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT = 8;
-const static int SPLITSTREAM_STATE_FLAG_FILE_EOF = 16;
+static void AppendSegments(SplitstreamState* state, SplitstreamDocument* dest, const char* ptr, size_t length);
+static void TruncateDoc(SplitstreamState* state, SplitstreamDocument* doc, size_t length);
 
 struct mempool* mempool_New(void);
 void mempool_Destroy(struct mempool* pool, int check);
@@ -31,15 +30,19 @@ void* mempool_ReAlloc(struct mempool* pool, void* ptr, size_t oldSize, size_t ne
 void mempool_Free(struct mempool* pool, void* ptr, size_t size);
 
 SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocument(SplitstreamState* s, size_t max, const char* buf, size_t len, SplitstreamScanner scan) {
-    size_t start = (size_t)-1, end;
-    int didSetStart = 0;
+    size_t start, end, docEnd, strip;
+    int didSetStart, found;
     SplitstreamDocument doc = { NULL, 0 };
     SplitstreamDocument rescanDoc = { NULL, 0 };
+    long long base = s->offset; /* Stream offset of buf[0] */
 
+    if(s->ring && Ring_Prepare(s, buf ? len : 0) < 0) return doc;
+    s->offset += (buf ? len : 0);
     if(s->state == State_Rescan) {
+        /* Always contiguous, since it is scanned again */
         rescanDoc = s->doc;
-        s->doc.buffer = NULL;
-        s->doc.length = 0;
+        base -= (long long)rescanDoc.length;
+        memset(&s->doc, 0, sizeof(s->doc));
         if(buf && len) {
             AppendDoc(s, &rescanDoc, buf, len);
         }
@@ -47,43 +50,284 @@ SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocument(SplitstreamState*
         buf = rescanDoc.buffer;
         len = rescanDoc.length;
     }
-    end = scan(s, buf, len, &start);
-    if(start != (size_t)-1) didSetStart = 1;
-    else start = 0;
+    for(;;) {
+        start = (size_t)-1;
+        didSetStart = 0;
+        end = scan(s, buf, len, &start);
+        if(start != (size_t)-1) didSetStart = 1;
+        else start = 0;
+        found = end > 0;
+        if(s->flags & SPLITSTREAM_STATE_FLAG_ENDED) {
+            /* The document ended with the previous input, which the scanner could only tell now */
+            s->flags &= ~SPLITSTREAM_STATE_FLAG_ENDED;
+            found = 1;
+        }
+        docEnd = end;
+        strip = 0;
+        if(found && (s->flags & SPLITSTREAM_STATE_FLAG_STRIP)) {
+            /* Leave out the separator, whose beginning may already be in the document */
+            strip = Separator_Length(s);
+            s->flags &= ~SPLITSTREAM_STATE_FLAG_STRIP;
+            if(strip > end - start) {
+                TruncateDoc(s, &s->doc, strip - (end - start));
+                if(s->hashing) Hash_Restore(s);
+                docEnd = start;
+            } else {
+                docEnd = end - strip;
+            }
+        }
 
-    if(end > 0) { /* Did find a document */
-        doc = s->doc;
-        s->doc.buffer = NULL;
-        s->doc.length = 0;
-        if(buf && len) {
-            AppendDoc(s, &doc, buf + start, end - start);
-        }
-        s->state = (end < len) ? State_Rescan : State_Init;
-        start = end;
-    }
-    if(s->state != State_Init && start < len) {
-        if(didSetStart) {
-            SplitstreamDocumentFree(s, &s->doc);
-        } else if(end == 0 &&  // No document was found.
-                  s->doc.length + len - start > max) {
-            // If we scanned more than `max` without finishing a document,
-            // discard what we have read so far and start over.
-            SplitstreamDocumentFree(s, &s->doc);
-            s->state = State_Init;
+        if(s->resync) {
+            if(didSetStart) s->resync->start = base + (long long)start;
+            if(s->flags & SPLITSTREAM_STATE_FLAG_RESYNC) {
+                /* The scanner gave up on the document; drop it and carry on where it stopped */
+                size_t at = s->resyncAt;
+                s->flags &= ~SPLITSTREAM_STATE_FLAG_RESYNC;
+                Resync_Skip(s, base + (long long)at);
+                if(at < len) {
+                    base += (long long)at;
+                    buf += at;
+                    len -= at;
+                    continue;
+                }
+                break;
+            }
+            if(found) s->resync->start = -1;
         }
-        if(buf && len) {
-            AppendDoc(s, &s->doc, buf + start, len - start);
+
+        if(s->filter || s->sampler) {
+            int accept = 0, skip = 0;
+            if(didSetStart) {
+                s->flags &= ~(SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT | SPLITSTREAM_STATE_FLAG_ACCEPTED);
+                if(s->sampler) s->sampler->start = base + (long long)start;
+                if(s->filter) Filter_Begin(s);
+                else accept = 1;
+            }
+            if(s->matchState && buf) {
+                int match = Filter_Match(s, buf + start, (found ? docEnd : len) - start);
+                if(match > 0) accept = 1;
+                else if(match == 0 || found) skip = 1;
+            }
+            if(accept && s->sampler) {
+                s->flags |= SPLITSTREAM_STATE_FLAG_ACCEPTED;
+                if(!Sampler_Select(s->sampler)) skip = 1;
+            }
+            if(skip) {
+                s->flags |= SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT;
+                SplitstreamDocumentFree(s, &s->doc);
+            }
+            if(found && (s->flags & SPLITSTREAM_STATE_FLAG_ACCEPTED)) {
+                s->flags &= ~SPLITSTREAM_STATE_FLAG_ACCEPTED;
+                s->sampler->documents++;
+                s->sampler->bytes += (unsigned long long)(base + (long long)end - s->sampler->start);
+            }
+            if(found && (s->flags & SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT)) {
+                /* Skipped document; carry on with the rest of the buffer without copying it */
+                s->flags &= ~SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT;
+                s->matchState = 0;
+                s->state = State_Init;
+                if(end < len) {
+                    base += (long long)end;
+                    buf += end;
+                    len -= end;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        if(s->key && buf) {
+            if(didSetStart) Key_Begin(s);
+            Key_Scan(s, buf + start, (found ? docEnd : len) - start);
+        }
+        if(s->hashing && buf) {
+            if(didSetStart) Hash_Begin(s);
+            Hash_Update(s, buf + start, (found ? docEnd : len) - start);
+        }
+
+        if(found) { /* Did find a document */
+            if(didSetStart) {
+                /* Anything buffered so far precedes the start of this document */
+                SplitstreamDocumentFree(s, &s->doc);
+            }
+            doc = s->doc;
+            memset(&s->doc, 0, sizeof(s->doc));
+            if(buf && docEnd > start) {
+                if(s->ring) Ring_Append(s, &doc, buf + start, docEnd - start);
+                else if(s->segmented) AppendSegments(s, &doc, buf + start, docEnd - start);
+                else AppendDoc(s, &doc, buf + start, docEnd - start);
+            }
+            if(s->hashing) {
+                doc.hash = Hash_Digest(s);
+                if(s->dedup && !(s->flags & SPLITSTREAM_STATE_FLAG_FRAGMENTED) && Dedup_Seen(s->dedup, doc.hash)) {
+                    /* Duplicate; carry on with the rest of the buffer like a skipped document */
+                    SplitstreamDocumentFree(s, &doc);
+                    memset(&doc, 0, sizeof(doc));
+                    s->state = State_Init;
+                    if(end < len) {
+                        base += (long long)end;
+                        buf += end;
+                        len -= end;
+                        continue;
+                    }
+                    break;
+                }
+            }
+            if(s->ring && Ring_Contains(s->ring, doc.buffer)) Ring_Commit(s->ring);
+            doc.offset = base + (long long)end - (long long)strip - (long long)doc.length;
+            if(s->readSize) ReadSize_Document(s->readSize, doc.length);
+            if(s->key) Key_Get(s, &doc);
+            if(s->flags & SPLITSTREAM_STATE_FLAG_FRAGMENTED) {
+                s->flags &= ~SPLITSTREAM_STATE_FLAG_FRAGMENTED;
+                doc.fragment = SPLITSTREAM_FRAGMENT_END;
+            }
+            s->state = (end < len) ? State_Rescan : State_Init;
+            start = end;
+        }
+        if(s->state != State_Init && start < len) {
+            if(didSetStart) {
+                SplitstreamDocumentFree(s, &s->doc);
+            } else if(!found &&  // No document was found.
+                      (!s->fragmentSize || s->matchState) &&
+                      s->doc.length + len - start > max) {
+                // If we scanned more than `max` without finishing a document,
+                // discard what we have read so far and start over.
+                if(s->resync) {
+                    /* Drop the rest of the buffer too, and look for a likely document start */
+                    Resync_Skip(s, base + (long long)len);
+                    Resync_Reset(s);
+                    break;
+                }
+                SplitstreamDocumentFree(s, &s->doc);
+                s->state = State_Init;
+                s->matchState = 0;
+                s->flags &= ~SPLITSTREAM_STATE_FLAG_ACCEPTED;
+            }
+            if(buf && len && !(s->flags & SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT)) {
+                if(s->state == State_Rescan) AppendDoc(s, &s->doc, buf + start, len - start);
+                else if(s->ring) Ring_Append(s, &s->doc, buf + start, len - start);
+                else if(s->segmented) AppendSegments(s, &s->doc, buf + start, len - start);
+                else AppendDoc(s, &s->doc, buf + start, len - start);
+            }
+            if(!found && s->fragmentSize && s->doc.length > s->fragmentSize && !s->matchState) {
+                /* Hand out the part scanned so far rather than buffering any more of it. The
+                   filter must have decided first, so no fragment of a skipped document escapes. */
+                doc = s->doc;
+                memset(&s->doc, 0, sizeof(s->doc));
+                if(s->ring && Ring_Contains(s->ring, doc.buffer)) Ring_Commit(s->ring);
+                doc.offset = base + (long long)len - (long long)doc.length;
+                doc.fragment = (s->flags & SPLITSTREAM_STATE_FLAG_FRAGMENTED) ? SPLITSTREAM_FRAGMENT_CONTINUE : SPLITSTREAM_FRAGMENT_START;
+                s->flags |= SPLITSTREAM_STATE_FLAG_FRAGMENTED;
+            }
         }
+        break;
     }
     SplitstreamDocumentFree(s, &rescanDoc);
     return doc;
 }
 
+/* Scans from buf[*pos] to the end of the next document, setting its stream bounds, or to the
+   end of `buf`. Returns 1 if a document was found. Since no document is stored, the stream
+   offset of the start of a document in progress is kept in s->doc.offset. */
+static int Scan_Next(SplitstreamState* s, const char* buf, size_t len, size_t* pos, SplitstreamScanner scan,
+                     long long* docStart, long long* docEnd) {
+    while(*pos < len) {
+        size_t start = (size_t)-1;
+        size_t end = scan(s, buf + *pos, len - *pos, &start);
+        if(start != (size_t)-1) {
+            s->doc.offset = s->offset + (long long)start;
+            s->flags |= SPLITSTREAM_STATE_FLAG_STARTED;
+        }
+        if(s->flags & SPLITSTREAM_STATE_FLAG_ENDED) {
+            /* The document ended with the previous input */
+            s->flags &= ~SPLITSTREAM_STATE_FLAG_ENDED;
+            s->state = State_Init;
+            if(!(s->flags & SPLITSTREAM_STATE_FLAG_STARTED)) continue;
+            s->flags &= ~SPLITSTREAM_STATE_FLAG_STARTED;
+            *docStart = s->doc.offset;
+            *docEnd = s->offset;
+            return 1;
+        }
+        if(s->flags & SPLITSTREAM_STATE_FLAG_RESYNC) {
+            /* Nothing is stored, so only report the document given up on */
+            size_t at = s->resyncAt;
+            s->flags &= ~(SPLITSTREAM_STATE_FLAG_RESYNC | SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT | SPLITSTREAM_STATE_FLAG_STARTED);
+            if(start != (size_t)-1) s->resync->start = s->offset + (long long)start;
+            if(s->resync->start >= 0) Resync_Report(s->resync, s->resync->start, s->offset + (long long)at);
+            s->resync->start = -1;
+            s->offset += (long long)at;
+            *pos += at;
+            continue;
+        }
+        if(end == 0) {
+            if(s->resync && start != (size_t)-1) s->resync->start = s->offset + (long long)start;
+            s->offset += (long long)(len - *pos);
+            *pos = len;
+            break;
+        }
+        if(s->resync) s->resync->start = -1;
+        *docStart = (s->flags & SPLITSTREAM_STATE_FLAG_STARTED) ? s->doc.offset : s->offset;
+        *docEnd = s->offset + (long long)end;
+        s->flags &= ~SPLITSTREAM_STATE_FLAG_STARTED;
+        if(s->flags & SPLITSTREAM_STATE_FLAG_STRIP) {
+            long long strip = (long long)Separator_Length(s);
+            s->flags &= ~SPLITSTREAM_STATE_FLAG_STRIP;
+            *docEnd -= (strip < *docEnd - *docStart) ? strip : *docEnd - *docStart;
+        }
+        s->offset += (long long)end;
+        *pos += end;
+        s->state = State_Init;
+        return 1;
+    }
+    return 0;
+}
+
+size_t SPLITSTREAM_API SplitstreamScanBuffer(SplitstreamState* s, const char* buf, size_t len, size_t* pos,
+                                             SplitstreamScanner scan, size_t* starts, size_t* ends, size_t count) {
+    long long base = s->offset - (long long)*pos; /* Stream offset of buf[0] */
+    long long start, end;
+    size_t found = 0;
+    while(found < count && Scan_Next(s, buf, len, pos, scan, &start, &end)) {
+        /* A document that started with the previous input is not in this one */
+        if(start < base) continue;
+        starts[found] = (size_t)(start - base);
+        ends[found++] = (size_t)(end - base);
+    }
+    return found;
+}
+
+size_t SPLITSTREAM_API SplitstreamScanStream(SplitstreamState* s, const char* buf, size_t len, size_t* pos,
+                                             SplitstreamScanner scan, long long* starts, long long* ends, size_t count,
+                                             long long* pending) {
+    size_t found = 0;
+    while(found < count && Scan_Next(s, buf, len, pos, scan, &starts[found], &ends[found])) ++found;
+    *pending = (s->flags & SPLITSTREAM_STATE_FLAG_STARTED) ? s->doc.offset : -1;
+    return found;
+}
+
+SplitstreamDocument SPLITSTREAM_API SplitstreamGetLastDocument(SplitstreamState* s, size_t max, SplitstreamScanner scan) {
+    SplitstreamDocument doc;
+    s->flags |= SPLITSTREAM_STATE_FLAG_END_OF_INPUT;
+    doc = SplitstreamGetNextDocument(s, max, "", 0, scan);
+    s->flags &= ~SPLITSTREAM_STATE_FLAG_END_OF_INPUT;
+    return doc;
+}
+
 SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromFile(SplitstreamState* s, char* buf, size_t bufferSize, size_t max, FILE* file, SplitstreamScanner scanner) {
     if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 1024;
 
     if(s->flags & SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT) {
         SplitstreamDocument doc = SplitstreamGetNextDocument(s, max, NULL, 0, scanner);
+        if(doc.buffer || (s->ring && s->ring->full)) {
+            s->flags |= SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
+            return doc;
+        }
+    }
+    if(s->ring && s->ring->pending) {
+        /* Still in `buf` from the last call */
+        SplitstreamDocument doc = SplitstreamGetNextDocument(s, max, s->ring->pending, s->ring->pendingLength, scanner);
+        if(s->ring->full) return doc;
+        s->ring->pending = NULL;
         if(doc.buffer) {
             s->flags |= SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
             return doc;
@@ -91,11 +335,16 @@ SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromFile(Splitstre
     }
 
     while(file) {
-        size_t len = fread(buf, 1, bufferSize, file);
+        size_t request = bufferSize, len;
+        if(s->readSize) {
+            ReadSize_Advise(s->readSize, file);
+            if(s->readSize->size < request) request = s->readSize->size;
+        }
+        len = fread(buf, 1, request, file);
+        if(s->readSize) SplitstreamReadSizeUpdate(s, request, len);
         if(len == 0) {
         	s->flags |= SPLITSTREAM_STATE_FLAG_FILE_EOF;
-            SplitstreamDocument doc = {NULL, 0};
-            return doc;
+            return SplitstreamGetLastDocument(s, max, scanner);
         }
 
         SplitstreamDocument doc = SplitstreamGetNextDocument(s, max, buf, len, scanner);
@@ -103,6 +352,11 @@ SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromFile(Splitstre
             s->flags |= SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
             return doc;
         }
+        if(s->ring && s->ring->full) {
+            s->ring->pending = buf;
+            s->ring->pendingLength = len;
+            return doc;
+        }
     }
     s->flags &= ~SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
 
@@ -111,13 +365,57 @@ SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromFile(Splitstre
 
 }
 
+/* The first segment of a document is allocated to its length, like a contiguous document,
+   and the others to SPLITSTREAM_SEGMENT_SIZE. The segment list has room for a power of 2
+   of segments. */
+static size_t SegmentListSize(size_t count) {
+    size_t capacity = 2;
+    while(capacity < count) capacity *= 2;
+    return capacity * sizeof(SplitstreamSegment);
+}
+
+static void FreeSegments(SplitstreamState* state, SplitstreamDocument* doc) {
+    size_t i;
+    for(i = 0; i < doc->segmentCount; ++i) {
+        mempool_Free(state->mempool, (void*)doc->segments[i].base, i ? SPLITSTREAM_SEGMENT_SIZE : doc->segments[0].length);
+    }
+    mempool_Free(state->mempool, doc->segments, SegmentListSize(doc->segmentCount));
+    doc->segments = NULL;
+    doc->segmentCount = 0;
+}
+
 void SPLITSTREAM_API SplitstreamDocumentFree(SplitstreamState* state, SplitstreamDocument* doc) {
-    if(doc->buffer) {
+    if(state && state->ring && Ring_Contains(state->ring, doc->buffer)) {
+        Ring_Free(state->ring, doc->buffer, doc->length);
+    } else if(doc->segmentCount) {
+        if(state && state->mempool) FreeSegments(state, doc);
+    } else if(doc->buffer) {
     	if(state && state->mempool)
     		mempool_Free(state->mempool, (void*)doc->buffer, doc->length);
     }
     doc->buffer = NULL;
     doc->length = 0;
+    doc->segments = NULL;
+    doc->segmentCount = 0;
+}
+
+int SPLITSTREAM_API SplitstreamDocumentFlatten(SplitstreamState* state, SplitstreamDocument* doc) {
+    char* buffer, *p;
+    size_t i;
+    if(!doc->segmentCount) return 0;
+    buffer = p = mempool_Alloc(state->mempool, doc->length);
+    if(!buffer) return -1;
+    for(i = 0; i < doc->segmentCount; ++i) {
+        memcpy(p, doc->segments[i].base, doc->segments[i].length);
+        p += doc->segments[i].length;
+    }
+    FreeSegments(state, doc);
+    doc->buffer = buffer;
+    return 0;
+}
+
+void SPLITSTREAM_API SplitstreamSetSegmented(SplitstreamState* state, int segmented) {
+    state->segmented = segmented;
 }
 
 void SPLITSTREAM_API SplitstreamInit(SplitstreamState* state) {
@@ -129,6 +427,39 @@ void SPLITSTREAM_API SplitstreamInitDepth(SplitstreamState* state, int startDept
     if(startDepth > 0) state->startDepth = startDepth;
 }
 
+/* Starts the state over at the beginning of a stream, like SplitstreamInitDepth, but keeps the
+   configuration (filter, sampler, fragment size, segmenting, ring, key, hashing, duplicate filter,
+   resync policy, read size, CSV options and separator) and the memory pool, so documents already
+   returned stay valid. The progress of the filter, key, hash and resync policy on the document in
+   progress is dropped with it. */
+void State_Restart(SplitstreamState* state, int startDepth) {
+    SplitstreamState config;
+    SplitstreamDocumentFree(state, &state->doc);
+    config = *state;
+    SplitstreamInitDepth(state, startDepth);
+    state->mempool = config.mempool;
+    state->filter = config.filter;
+    state->sampler = config.sampler;
+    state->fragmentSize = config.fragmentSize;
+    state->segmented = config.segmented;
+    state->ring = config.ring;
+    state->key = config.key;
+    state->hashing = config.hashing;
+    state->dedup = config.dedup;
+    state->resync = config.resync;
+    state->readSize = config.readSize;
+    state->delimiter = config.delimiter;
+    state->skipHeader = config.skipHeader;
+    state->separator = config.separator;
+    if(state->resync) state->resync->start = -1;
+    /* A new file has not been advised yet */
+    if(state->readSize) state->readSize->advised = 0;
+}
+
+void SPLITSTREAM_API SplitstreamSetFragmentSize(SplitstreamState* state, size_t fragmentSize) {
+    state->fragmentSize = fragmentSize;
+}
+
 void SPLITSTREAM_API SplitstreamFree(SplitstreamState* state) {
     SplitstreamDocumentFree(state, &state->doc);
     if(state->mempool) mempool_Destroy(state->mempool, 1);
@@ -136,6 +467,129 @@ void SPLITSTREAM_API SplitstreamFree(SplitstreamState* state) {
 }
 
 
+/* Serialized state layout (all integers little endian):
+
+      "SSST" version(u8)
+      startDepth(i32) depth(i32) counter[4](i32) last(u8) flags(i32) state(i32)
+      offset(i64) matchState(i32) matchCandidates(u32) matchPosition(u64)
+      keyState(i32) keyFlags(i32) keyNest(i32) keyPosition(u64) keyMatch(u64) keyStart(u64)
+      keyLength(u64) keyHash(u64)
+      resyncAt(u64) resyncStart(i64)
+      docLength(u64) doc bytes
+
+   The version must be bumped whenever the layout or the meaning of the tokenizer states
+   changes, since they are stored as is. The hash of the document in progress is not stored,
+   since it is computed again from the buffered document. */
+#define STATE_MAGIC         "SSST"
+#define STATE_VERSION       5
+#define STATE_HEADER_SIZE   (4 + 1 + 4 * 8 + 1 + 8 + 4 + 4 + 8 + 4 * 3 + 8 * 5 + 8 + 8 + 8)
+
+static char* PutInt(char* p, unsigned long long v, int bytes) {
+    int i;
+    for(i = 0; i < bytes; ++i) *p++ = (char)((v >> (8 * i)) & 0xff);
+    return p;
+}
+
+static const char* GetInt(const char* p, unsigned long long* v, int bytes) {
+    int i;
+    *v = 0;
+    for(i = 0; i < bytes; ++i) *v |= (unsigned long long)(unsigned char)*p++ << (8 * i);
+    return p;
+}
+
+size_t SPLITSTREAM_API SplitstreamStateSerialize(const SplitstreamState* state, char* buf, size_t len) {
+    size_t needed = STATE_HEADER_SIZE + state->doc.length;
+    char* p = buf;
+    int i;
+    if(!buf || len < needed) return needed;
+
+    memcpy(p, STATE_MAGIC, 4); p += 4;
+    *p++ = STATE_VERSION;
+    p = PutInt(p, (unsigned)state->startDepth, 4);
+    p = PutInt(p, (unsigned)state->depth, 4);
+    for(i = 0; i < 4; ++i) p = PutInt(p, (unsigned)state->counter[i], 4);
+    *p++ = state->last;
+    p = PutInt(p, (unsigned)(state->flags & ~SPLITSTREAM_STATE_FLAG_FILE_EOF), 4);
+    p = PutInt(p, (unsigned)state->state, 4);
+    p = PutInt(p, (unsigned long long)state->offset, 8);
+    p = PutInt(p, (unsigned)state->matchState, 4);
+    p = PutInt(p, state->matchCandidates, 4);
+    p = PutInt(p, state->matchPosition, 8);
+    p = PutInt(p, (unsigned)state->keyState, 4);
+    p = PutInt(p, (unsigned)state->keyFlags, 4);
+    p = PutInt(p, (unsigned)state->keyNest, 4);
+    p = PutInt(p, state->keyPosition, 8);
+    p = PutInt(p, state->keyMatch, 8);
+    p = PutInt(p, state->keyStart, 8);
+    p = PutInt(p, state->keyLength, 8);
+    p = PutInt(p, state->keyHash, 8);
+    p = PutInt(p, state->resyncAt, 8);
+    p = PutInt(p, (unsigned long long)(state->resync ? state->resync->start : -1), 8);
+    p = PutInt(p, state->doc.length, 8);
+    if(state->doc.segmentCount) {
+        for(i = 0; i < (int)state->doc.segmentCount; ++i) {
+            memcpy(p, state->doc.segments[i].base, state->doc.segments[i].length);
+            p += state->doc.segments[i].length;
+        }
+    } else if(state->doc.length) {
+        memcpy(p, state->doc.buffer, state->doc.length);
+    }
+    return needed;
+}
+
+int SPLITSTREAM_API SplitstreamStateDeserialize(SplitstreamState* state, const char* buf, size_t len) {
+    unsigned long long v[23], docLength;
+    const char* p = buf;
+    int i;
+
+    if(!buf || len < STATE_HEADER_SIZE || memcmp(p, STATE_MAGIC, 4) || p[4] != STATE_VERSION) return -1;
+    p += 5;
+    for(i = 0; i < 6; ++i) p = GetInt(p, &v[i], 4);
+    v[6] = (unsigned char)*p++;
+    for(i = 7; i < 9; ++i) p = GetInt(p, &v[i], 4);
+    p = GetInt(p, &v[9], 8);
+    p = GetInt(p, &v[10], 4);
+    p = GetInt(p, &v[11], 4);
+    p = GetInt(p, &v[12], 8);
+    for(i = 13; i < 16; ++i) p = GetInt(p, &v[i], 4);
+    for(i = 16; i < 23; ++i) p = GetInt(p, &v[i], 8);
+    p = GetInt(p, &docLength, 8);
+    if(docLength != len - STATE_HEADER_SIZE || v[8] > State_Rescan) return -1;
+
+    /* The configuration is kept, since it is not part of the saved state */
+    SplitstreamFree(state);
+    State_Restart(state, 0);
+    state->startDepth = (int)v[0];
+    state->depth = (int)v[1];
+    for(i = 0; i < 4; ++i) state->counter[i] = (int)v[2 + i];
+    state->last = (char)v[6];
+    state->flags = (int)v[7];
+    state->state = (SplitstreamTokenizerState)v[8];
+    state->offset = (long long)v[9];
+    state->matchState = state->filter ? (int)v[10] : 0;
+    state->matchCandidates = (unsigned)v[11];
+    state->matchPosition = (size_t)v[12];
+    if(state->key) {
+        state->keyState = (int)v[13];
+        state->keyFlags = (int)v[14];
+        state->keyNest = (int)v[15];
+        state->keyPosition = (size_t)v[16];
+        state->keyMatch = (size_t)v[17];
+        state->keyStart = (size_t)v[18];
+        state->keyLength = (size_t)v[19];
+        state->keyHash = v[20];
+        if(!Key_Valid(state)) {
+            /* Scanning for the key of the document in progress starts over with the next one */
+            state->keyState = 0;
+        }
+    }
+    state->resyncAt = (size_t)v[21];
+    if(state->resync) state->resync->start = (long long)v[22];
+    if(docLength) AppendDoc(state, &state->doc, p, (size_t)docLength);
+    if(state->hashing) Hash_Restore(state);
+    return 0;
+}
+
 static void AppendDoc(SplitstreamState* state, SplitstreamDocument* dest, const void* ptr, size_t length) {
     if(!length) return;
 
@@ -152,3 +606,76 @@ static void AppendDoc(SplitstreamState* state, SplitstreamDocument* dest, const
     if(!dest->buffer) abort();
     memcpy(((char*)dest->buffer) + prevLength, ptr, length);
 }
+
+static void AppendSegments(SplitstreamState* state, SplitstreamDocument* dest, const char* ptr, size_t length) {
+    SplitstreamSegment* last;
+    if(!dest->segmentCount) {
+        /* Grow the first segment like a contiguous document, so small documents cost the same */
+        size_t n = (dest->length < SPLITSTREAM_SEGMENT_SIZE) ? SPLITSTREAM_SEGMENT_SIZE - dest->length : 0;
+        if(n > length) n = length;
+        AppendDoc(state, dest, ptr, n);
+        ptr += n;
+        length -= n;
+        if(!length) return;
+        dest->segments = mempool_Alloc(state->mempool, SegmentListSize(1));
+        if(!dest->segments) abort();
+        dest->segments[0].base = dest->buffer;
+        dest->segments[0].length = dest->length;
+        dest->segmentCount = 1;
+    }
+    while(length) {
+        size_t n;
+        last = &dest->segments[dest->segmentCount - 1];
+        if(dest->segmentCount == 1 || last->length == SPLITSTREAM_SEGMENT_SIZE) {
+            size_t size = SegmentListSize(dest->segmentCount);
+            if(SegmentListSize(dest->segmentCount + 1) != size) {
+                dest->segments = mempool_ReAlloc(state->mempool, dest->segments, size, SegmentListSize(dest->segmentCount + 1));
+                if(!dest->segments) abort();
+            }
+            last = &dest->segments[dest->segmentCount++];
+            last->base = mempool_Alloc(state->mempool, SPLITSTREAM_SEGMENT_SIZE);
+            last->length = 0;
+            if(!last->base) abort();
+        }
+        n = SPLITSTREAM_SEGMENT_SIZE - last->length;
+        if(n > length) n = length;
+        memcpy((char*)last->base + last->length, ptr, n);
+        last->length += n;
+        dest->length += n;
+        ptr += n;
+        length -= n;
+    }
+}
+
+/* Drops the end of a document. The pool does not shrink allocations, so the first segment (or
+   a contiguous document) is copied to one of its new length; the others just get shorter. */
+static void TruncateDoc(SplitstreamState* state, SplitstreamDocument* doc, size_t length) {
+    size_t i, n;
+    char* p;
+
+    if(length > doc->length) length = doc->length;
+    if(!length) return;
+    doc->length -= length;
+    if(state->ring && Ring_Contains(state->ring, doc->buffer)) {
+        state->ring->reserved -= length;
+        return;
+    }
+    for(i = doc->segmentCount; i > 1 && length; --i) {
+        n = doc->segments[i - 1].length < length ? doc->segments[i - 1].length : length;
+        doc->segments[i - 1].length -= n;
+        length -= n;
+    }
+    if(!length) return;
+    n = doc->segmentCount ? doc->segments[0].length : doc->length + length;
+    p = (n > length) ? mempool_Alloc(state->mempool, n - length) : NULL;
+    if(n > length) {
+        if(!p) abort();
+        memcpy(p, doc->buffer, n - length);
+    }
+    mempool_Free(state->mempool, (void*)doc->buffer, n);
+    doc->buffer = p;
+    if(doc->segmentCount) {
+        doc->segments[0].base = p;
+        doc->segments[0].length = n - length;
+    }
+}
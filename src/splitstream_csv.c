@@ -0,0 +1,156 @@
+/*
+ *   splitstream_csv.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the CSV and TSV scanners. Only quotes and line breaks matter for
+   finding the end of a record, so outside quotes the scanner skips to the next of those with
+   Search_Any, and inside quotes to the next quote with memchr. Delimiters are only looked at
+   when a quote is found, since a quote only opens a quoted field at the start of a field: at
+   the start of the record or right after a delimiter (which may be s->last at the start of the
+   buffer). Elsewhere it is taken as part of the field, as most readers do.
+
+   A record ends before its line break (CR, LF or CRLF), so that the line break is left out of
+   the document; the scanner returns the position of the line break and skips it as a blank
+   line when it is called again. If the line break is the first byte of a buffer, the record
+   ended with the previous one, which is signalled with SPLITSTREAM_STATE_FLAG_ENDED. As RFC
+   4180 allows, the last record need not end with a line break: at the end of the input
+   (SPLITSTREAM_STATE_FLAG_END_OF_INPUT), a record in progress ends with it.
+
+   The header, if skipped, is scanned like any other record but never sets the start of a
+   document, so it is dropped by the tokenizer when the next record starts. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+static const int COUNTER_IN_HEADER = 0;
+
+void SPLITSTREAM_API SplitstreamSetCSV(SplitstreamState* s, char delimiter, int skipHeader)
+{
+    s->delimiter = delimiter;
+    s->skipHeader = skipHeader;
+}
+
+static size_t CSV_Scan(SplitstreamState* s, const char* buf, size_t len, size_t* start, char delimiter)
+{
+    SplitstreamTokenizerState state = s->state;
+    const char* end = buf + len, *cp = buf;
+
+    switch(state) {
+        case State_Init:
+            goto h_Init;
+        case State_Record:
+            goto h_Record;
+        case State_Quoted:
+            goto h_Quoted;
+        case State_QuotedQuote:
+            goto h_QuotedQuote;
+        default:
+            abort();
+    }
+
+h_Init:
+    for(; cp != end; ++cp) {
+        if(*cp == '\r' || *cp == '\n') continue;
+        if(s->skipHeader && !(s->flags & SPLITSTREAM_STATE_FLAG_HEADER)) {
+            s->flags |= SPLITSTREAM_STATE_FLAG_HEADER;
+            s->counter[COUNTER_IN_HEADER] = 1;
+        } else {
+            *start = (size_t)(cp - buf);
+        }
+        state = (*cp == '"') ? State_Quoted : State_Record;
+        ++cp;
+        if(state == State_Quoted) goto h_Quoted;
+        goto h_Record;
+    }
+    goto h_End;
+
+h_Record:
+    for(;;) {
+        cp = Search_Any(cp, end, '"', '\r', '\n');
+        if(cp == end) goto h_End;
+        if(*cp == '"') {
+            if((cp != buf ? cp[-1] : s->last) == delimiter) {
+                state = State_Quoted;
+                ++cp;
+                goto h_Quoted;
+            }
+            ++cp;
+            continue;
+        }
+        /* The end of the record */
+        state = State_Init;
+        if(s->counter[COUNTER_IN_HEADER]) {
+            s->counter[COUNTER_IN_HEADER] = 0;
+            goto h_Init;
+        }
+        s->state = state;
+        if(cp == buf) {
+            /* It ended with the previous input */
+            s->flags |= SPLITSTREAM_STATE_FLAG_ENDED;
+            return 0;
+        }
+        return (size_t)(cp - buf);
+    }
+
+h_Quoted:
+    if(cp == end) goto h_End;
+    cp = memchr(cp, '"', (size_t)(end - cp));
+    if(!cp) {
+        cp = end;
+        goto h_End;
+    }
+    state = State_QuotedQuote;
+    ++cp;
+
+h_QuotedQuote:
+    /* Either the closing quote or the first of two */
+    if(cp == end) goto h_End;
+    if(*cp == '"') {
+        state = State_Quoted;
+        ++cp;
+        goto h_Quoted;
+    }
+    state = State_Record;
+    goto h_Record;
+
+h_End:
+    if(len) s->last = end[-1];
+    if((s->flags & SPLITSTREAM_STATE_FLAG_END_OF_INPUT) && state != State_Init) {
+        /* The last record, which is not followed by a line break */
+        s->state = State_Init;
+        if(s->counter[COUNTER_IN_HEADER]) {
+            /* A header alone is not a record */
+            s->counter[COUNTER_IN_HEADER] = 0;
+            return 0;
+        }
+        if(!len) {
+            s->flags |= SPLITSTREAM_STATE_FLAG_ENDED;
+            return 0;
+        }
+        return len;
+    }
+    s->state = state;
+    return 0;
+}
+
+size_t SplitstreamCSVScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start) {
+    return CSV_Scan(s, buf, len, start, s->delimiter ? s->delimiter : ',');
+}
+
+size_t SplitstreamTSVScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start) {
+    return CSV_Scan(s, buf, len, start, '\t');
+}
@@ -0,0 +1,249 @@
+/*
+ *   splitstream_decompress.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements a decompressing reader that sits between another reader and the
+   scanner. Compressed chunks are pulled from the source reader and decoded straight into the
+   buffer that is handed to the scanner, so no intermediate copy is made.
+
+   Define HAVE_ZLIB to support gzip and zlib streams (the header is detected automatically,
+   and concatenated gzip members are decoded one after the other like gzip(1) does), and
+   HAVE_ZSTD to support Zstandard. Without them, SplitstreamReaderOpenDecompress fails for
+   that format. */
+
+#include <splitstream_private.h>
+#include <errno.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+typedef struct {
+    SplitstreamReader base;
+    SplitstreamReader* source;
+    int compression;
+    int inFrame, sourceEof;
+    size_t bufferSize;
+    char* buf;
+    const char* in;
+    size_t inLength;
+#ifdef HAVE_ZLIB
+    z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zstd;
+#endif
+} DecompressReader;
+
+/* Makes sure there is compressed input to work on. Returns 1 if there is, 0 at end of the
+   source stream and -1 on error. */
+static int Decompress_Fill(DecompressReader* r)
+{
+    int rc;
+    if(r->inLength) return 1;
+    if(r->sourceEof) return 0;
+    rc = r->source->read(r->source, &r->in, &r->inLength);
+    if(rc < 0) {
+        r->base.error = r->source->error;
+        return -1;
+    }
+    if(rc == 0) {
+        r->sourceEof = 1;
+        r->inLength = 0;
+    }
+    return rc;
+}
+
+#ifdef HAVE_ZLIB
+
+static size_t Decompress_Inflate(DecompressReader* r)
+{
+    int z;
+    r->zs.next_in = (Bytef*)r->in;
+    r->zs.avail_in = (uInt)r->inLength;
+    r->zs.next_out = (Bytef*)r->buf;
+    r->zs.avail_out = (uInt)r->bufferSize;
+    r->inFrame = 1;
+
+    z = inflate(&r->zs, Z_NO_FLUSH);
+
+    r->in = (const char*)r->zs.next_in;
+    r->inLength = r->zs.avail_in;
+    if(z == Z_STREAM_END) {
+        /* Another gzip member may follow */
+        inflateReset(&r->zs);
+        r->inFrame = 0;
+    } else if(z != Z_OK && z != Z_BUF_ERROR) {
+        r->base.error = (z == Z_MEM_ERROR) ? ENOMEM : EILSEQ;
+    }
+    return r->bufferSize - r->zs.avail_out;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+static size_t Decompress_Zstd(DecompressReader* r)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t rc;
+
+    in.src = r->in;
+    in.size = r->inLength;
+    in.pos = 0;
+    out.dst = r->buf;
+    out.size = r->bufferSize;
+    out.pos = 0;
+
+    rc = ZSTD_decompressStream(r->zstd, &out, &in);
+    r->in += in.pos;
+    r->inLength -= in.pos;
+    if(ZSTD_isError(rc)) r->base.error = EILSEQ;
+    else r->inFrame = rc != 0;
+    return out.pos;
+}
+
+#endif
+
+static int Decompress_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    DecompressReader* r = (DecompressReader*)reader;
+    size_t produced = 0;
+
+    while(!produced) {
+        int rc;
+        if(reader->error) return -1;
+
+        rc = Decompress_Fill(r);
+        if(rc < 0) return -1;
+        /* At the end of the source, the decoder may still hold output from the last chunk */
+        if(rc == 0 && !r->inFrame) return 0;
+
+        switch(r->compression) {
+#ifdef HAVE_ZLIB
+            case SPLITSTREAM_COMPRESSION_GZIP:
+            case SPLITSTREAM_COMPRESSION_ZLIB:
+                produced = Decompress_Inflate(r);
+                break;
+#endif
+#ifdef HAVE_ZSTD
+            case SPLITSTREAM_COMPRESSION_ZSTD:
+                produced = Decompress_Zstd(r);
+                break;
+#endif
+            default:
+                reader->error = EINVAL;
+                return -1;
+        }
+        if(reader->error && !produced) return -1;
+        if(rc == 0 && !produced) {
+            /* The compressed stream was truncated */
+            reader->error = EIO;
+            return -1;
+        }
+    }
+    *buf = r->buf;
+    *len = produced;
+    return 1;
+}
+
+static void Decompress_Close(SplitstreamReader* reader)
+{
+    DecompressReader* r = (DecompressReader*)reader;
+#ifdef HAVE_ZLIB
+    if(r->compression == SPLITSTREAM_COMPRESSION_GZIP || r->compression == SPLITSTREAM_COMPRESSION_ZLIB)
+        inflateEnd(&r->zs);
+#endif
+#ifdef HAVE_ZSTD
+    if(r->zstd) ZSTD_freeDStream(r->zstd);
+#endif
+    SplitstreamReaderClose(r->source);
+    free(r->buf);
+    free(r);
+}
+
+int SPLITSTREAM_API SplitstreamCompressionSupported(int compression)
+{
+    switch(compression) {
+        case SPLITSTREAM_COMPRESSION_NONE:
+            return 1;
+#ifdef HAVE_ZLIB
+        case SPLITSTREAM_COMPRESSION_GZIP:
+        case SPLITSTREAM_COMPRESSION_ZLIB:
+            return 1;
+#endif
+#ifdef HAVE_ZSTD
+        case SPLITSTREAM_COMPRESSION_ZSTD:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenDecompress(SplitstreamReader* source, int compression, size_t bufferSize)
+{
+    DecompressReader* r;
+
+    if(!source) return NULL;
+    if(compression == SPLITSTREAM_COMPRESSION_NONE) return source;
+    if(!SplitstreamCompressionSupported(compression)) return NULL;
+    if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 1024;
+
+    r = calloc(1, sizeof(DecompressReader));
+    if(!r) return NULL;
+    r->base.read = Decompress_Read;
+    r->base.close = Decompress_Close;
+    r->source = source;
+    r->compression = compression;
+    r->bufferSize = bufferSize;
+    r->buf = malloc(bufferSize);
+    if(!r->buf) {
+        free(r);
+        return NULL;
+    }
+
+    switch(compression) {
+#ifdef HAVE_ZLIB
+        case SPLITSTREAM_COMPRESSION_GZIP:
+        case SPLITSTREAM_COMPRESSION_ZLIB:
+            /* 32 enables automatic detection of the gzip or zlib header */
+            if(inflateInit2(&r->zs, 15 + 32) != Z_OK) {
+                free(r->buf);
+                free(r);
+                return NULL;
+            }
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case SPLITSTREAM_COMPRESSION_ZSTD:
+            r->zstd = ZSTD_createDStream();
+            if(!r->zstd || ZSTD_isError(ZSTD_initDStream(r->zstd))) {
+                if(r->zstd) ZSTD_freeDStream(r->zstd);
+                free(r->buf);
+                free(r);
+                return NULL;
+            }
+            break;
+#endif
+    }
+    return &r->base;
+}
@@ -0,0 +1,217 @@
+/*
+ *   splitstream_filter.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements document filters and samplers. The tokenizer feeds the beginning of every document
+   to Filter_Match as it is scanned, which works through it one character at a time and keeps
+   its progress in the state, so a document may start in one buffer and be decided in the
+   next. Only the first element name or key/value pair is looked at, after which the rest of
+   the document is either kept or skipped.
+
+   Samplers are asked once a document has passed the filter (or has started, without one),
+   and only look at the number of documents seen so far. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+enum {
+    Match_Idle,
+
+    Match_XmlOpen,
+    Match_XmlName,
+    Match_XmlMarkupStart,
+    Match_XmlMarkup,
+    Match_XmlComment,
+
+    Match_JsonOpen,
+    Match_JsonKeyQuote,
+    Match_JsonKey,
+    Match_JsonColon,
+    Match_JsonValue
+};
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+void SPLITSTREAM_API SplitstreamSetFilter(SplitstreamState* s, const SplitstreamFilter* filter)
+{
+    s->filter = (filter && filter->type != SPLITSTREAM_FILTER_NONE) ? filter : NULL;
+    s->matchState = Match_Idle;
+    s->flags &= ~SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT;
+}
+
+void Filter_Begin(SplitstreamState* s)
+{
+    const SplitstreamFilter* f = s->filter;
+    s->matchPosition = 0;
+    s->matchCandidates = 0;
+    if(f->type == SPLITSTREAM_FILTER_XML_ELEMENT) {
+        unsigned n = 0;
+        while(f->names && f->names[n] && n < 32) ++n;
+        s->matchCandidates = (n == 32) ? ~0u : (1u << n) - 1;
+        s->matchState = Match_XmlOpen;
+    } else if(f->type == SPLITSTREAM_FILTER_JSON_KEY) {
+        s->matchState = Match_JsonOpen;
+    } else {
+        s->matchState = Match_Idle;
+    }
+}
+
+/* The local name seen so far is the first `matchPosition` characters of the candidate names.
+   Nothing is decided before the end of the name, since it may turn out to be a prefix. */
+static int Filter_XmlNameChar(SplitstreamState* s, char c)
+{
+    const char* const* names = s->filter->names;
+    int atEnd = IS_SPACE(c) || c == '/' || c == '>';
+    unsigned i;
+    for(i = 0; i < 32; ++i) {
+        if(!(s->matchCandidates & (1u << i))) continue;
+        if(atEnd) {
+            if(!names[i][s->matchPosition]) return 1;
+        } else if(!names[i][s->matchPosition] || names[i][s->matchPosition] != c) {
+            s->matchCandidates &= ~(1u << i);
+        }
+    }
+    ++s->matchPosition;
+    return atEnd ? 0 : -1;
+}
+
+/* Returns 1 if the document matches, 0 if it does not and -1 if more input is needed */
+int Filter_Match(SplitstreamState* s, const char* buf, size_t len)
+{
+    const SplitstreamFilter* f = s->filter;
+    const char* end = buf + len, *cp = buf;
+    int ret = -1;
+
+    for(; cp != end && ret < 0; ++cp) {
+        char c = *cp;
+        switch(s->matchState) {
+            case Match_XmlOpen:
+                if(c == '<') s->matchState = Match_XmlName;
+                else if(!IS_SPACE(c)) ret = 0;
+                break;
+            case Match_XmlName:
+                if(s->matchPosition == 0 && c == '?') {
+                    s->matchState = Match_XmlMarkup;
+                } else if(s->matchPosition == 0 && c == '!') {
+                    s->matchState = Match_XmlMarkupStart;
+                } else if(c == ':') {
+                    /* Namespace prefix; the local name follows */
+                    Filter_Begin(s);
+                    s->matchState = Match_XmlName;
+                } else {
+                    ret = Filter_XmlNameChar(s, c);
+                }
+                break;
+            case Match_XmlMarkupStart:
+                s->matchState = (c == '-') ? Match_XmlComment : Match_XmlMarkup;
+                break;
+            case Match_XmlMarkup:
+                /* Declaration or processing instruction before the element */
+                if(c == '>') Filter_Begin(s);
+                break;
+            case Match_XmlComment:
+                if(c == '>' && s->matchPosition >= 2) Filter_Begin(s);
+                else s->matchPosition = (c == '-') ? s->matchPosition + 1 : 0;
+                break;
+
+            case Match_JsonOpen:
+                if(c == '{') s->matchState = Match_JsonKeyQuote;
+                else if(!IS_SPACE(c)) ret = 0;
+                break;
+            case Match_JsonKeyQuote:
+                if(c == '"') s->matchState = Match_JsonKey;
+                else if(!IS_SPACE(c)) ret = 0;
+                break;
+            case Match_JsonKey: {
+                const char* key = f->key ? f->key : "";
+                /* Everything up to here equals the key, so it tells whether a quote is escaped */
+                size_t n = s->matchPosition, backslashes = 0;
+                while(n > 0 && key[n - 1] == '\\') { --n; ++backslashes; }
+                if(c == '"' && !(backslashes & 1)) {
+                    if(key[s->matchPosition]) ret = 0;
+                    else s->matchState = Match_JsonColon;
+                } else if(key[s->matchPosition] != c) {
+                    ret = 0;
+                } else {
+                    ++s->matchPosition;
+                }
+                break;
+            }
+            case Match_JsonColon:
+                if(c == ':') {
+                    s->matchState = Match_JsonValue;
+                    s->matchPosition = 0;
+                    if(!f->valuePrefix || !f->valuePrefix[0]) ret = 1;
+                } else if(!IS_SPACE(c)) {
+                    ret = 0;
+                }
+                break;
+            case Match_JsonValue:
+                if(s->matchPosition == 0 && IS_SPACE(c)) break;
+                if(f->valuePrefix[s->matchPosition] != c) ret = 0;
+                else if(!f->valuePrefix[++s->matchPosition]) ret = 1;
+                break;
+
+            default:
+                ret = 0;
+                break;
+        }
+    }
+    if(ret >= 0) s->matchState = Match_Idle;
+    return ret;
+}
+
+void SPLITSTREAM_API SplitstreamSetSampler(SplitstreamState* s, SplitstreamSampler* sampler)
+{
+    s->sampler = sampler;
+    s->flags &= ~(SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT | SPLITSTREAM_STATE_FLAG_ACCEPTED);
+    if(!sampler) return;
+    sampler->documents = sampler->bytes = sampler->selected = sampler->eligible = 0;
+    sampler->slot = 0;
+    sampler->start = s->offset;
+    sampler->random = sampler->seed ? sampler->seed : 0x9e3779b97f4a7c15ULL;
+}
+
+/* xorshift64* */
+static unsigned long long Sampler_Random(SplitstreamSampler* sampler)
+{
+    unsigned long long x = sampler->random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sampler->random = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Decides whether the next document (number `documents`) is returned */
+int Sampler_Select(SplitstreamSampler* sampler)
+{
+    unsigned long long n = sampler->documents;
+    if(sampler->countOnly || n < sampler->skip) return 0;
+    if(sampler->every > 1 && (n - sampler->skip) % sampler->every) return 0;
+    if(sampler->reservoir) {
+        /* Algorithm R: the n:th eligible document replaces a random slot with probability k/n */
+        unsigned long long i = sampler->eligible++;
+        if(i >= sampler->reservoir) {
+            i = Sampler_Random(sampler) % (i + 1);
+            if(i >= sampler->reservoir) return 0;
+        }
+        sampler->slot = (size_t)i;
+    }
+    sampler->selected++;
+    return 1;
+}
@@ -0,0 +1,249 @@
+/*
+ *   splitstream_follow.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements a reader that follows a growing file, like `tail -F`. At the end of
+   the file it blocks until more data is written instead of reporting end of stream. On Linux
+   it sleeps on inotify events for the file and its directory, elsewhere (or if inotify is
+   unavailable) it checks the file every `pollInterval` milliseconds.
+
+   Whenever there is nothing to read, the file is checked for truncation (the size dropped
+   below the read position) and rotation (the path now names another file). A truncated file
+   is read again from the beginning, a rotated one is drained and then replaced by the new
+   file. In both cases a partially scanned document cannot be completed any more, so the
+   tokenizer state is reset. */
+
+#include <splitstream_private.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS  (IN_CREATE | IN_MOVED_TO)
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+typedef struct {
+    SplitstreamReader base;
+    char* path;
+    int fd;
+    long long offset;
+    size_t bufferSize;
+    char* buf;
+    int pollInterval;
+    SplitstreamState* state;
+    SplitstreamFollowIdle idle;
+    void* arg;
+    int inotify, fileWatch, dirWatch;
+} FollowReader;
+
+static int Follow_Open(FollowReader* r)
+{
+#ifdef _WIN32
+    r->fd = _open(r->path, O_RDONLY | O_BINARY);
+#else
+    r->fd = open(r->path, O_RDONLY | O_BINARY);
+#endif
+#ifdef __linux__
+    if(r->fd >= 0 && r->inotify >= 0) {
+        if(r->fileWatch >= 0) inotify_rm_watch(r->inotify, r->fileWatch);
+        r->fileWatch = inotify_add_watch(r->inotify, r->path, FILE_EVENTS);
+    }
+#endif
+    return r->fd;
+}
+
+static void Follow_Close(FollowReader* r)
+{
+    if(r->fd >= 0) close(r->fd);
+    r->fd = -1;
+}
+
+/* Restarts the tokenizer at the beginning of a new (or truncated) file. Documents already
+   returned stay valid, since the memory pool is kept. */
+static void Follow_Restart(FollowReader* r)
+{
+    r->offset = 0;
+    if(r->state) State_Restart(r->state, r->state->startDepth);
+}
+
+static long long Follow_ReadAt(FollowReader* r)
+{
+    long long n;
+    if(r->fd < 0) return 0;
+    do {
+#ifdef _WIN32
+        if(_lseeki64(r->fd, r->offset, SEEK_SET) < 0) n = -1;
+        else n = _read(r->fd, r->buf, (unsigned int)r->bufferSize);
+#else
+        n = pread(r->fd, r->buf, r->bufferSize, (off_t)r->offset);
+#endif
+    } while(n < 0 && errno == EINTR);
+    if(n > 0) r->offset += n;
+    return n;
+}
+
+/* Called at the end of the file. Returns 1 if there may be new data to read right away. */
+static int Follow_Check(FollowReader* r)
+{
+    struct stat st, current;
+    int isOpen = r->fd >= 0 && !fstat(r->fd, &st);
+    if(isOpen && st.st_size < r->offset) {
+        Follow_Restart(r);
+        return 1;
+    }
+    if(stat(r->path, &current)) return 0; /* Wait for the file to be (re)created */
+#ifndef _WIN32
+    if(isOpen && current.st_dev == st.st_dev && current.st_ino == st.st_ino) return 0;
+#else
+    if(isOpen) return 0; /* No inode numbers to detect rotation by */
+#endif
+    /* Finish the old file if it was written to after our last read */
+    if(isOpen && st.st_size > r->offset) return 1;
+    Follow_Close(r);
+    if(Follow_Open(r) < 0) return 0;
+    Follow_Restart(r);
+    return 1;
+}
+
+static void Follow_Wait(FollowReader* r)
+{
+#ifdef __linux__
+    if(r->inotify >= 0) {
+        struct pollfd pfd;
+        char events[4096];
+        pfd.fd = r->inotify;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, r->pollInterval) > 0) {
+            /* The events only wake us up, what changed is found out by Follow_Check */
+            while(read(r->inotify, events, sizeof(events)) > 0);
+        }
+        return;
+    }
+#endif
+#ifdef _WIN32
+    Sleep((DWORD)r->pollInterval);
+#else
+    poll(NULL, 0, r->pollInterval);
+#endif
+}
+
+static int Follow_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    FollowReader* r = (FollowReader*)reader;
+    long long n;
+
+    while((n = Follow_ReadAt(r)) == 0) {
+        int rc;
+        if(Follow_Check(r)) continue;
+        Follow_Wait(r);
+        if(r->idle && (rc = r->idle(r->arg)) != 0) {
+            if(rc > 0) return 0;
+            reader->error = EINTR;
+            return -1;
+        }
+    }
+    if(n < 0) {
+        reader->error = errno;
+        return -1;
+    }
+    *buf = r->buf;
+    *len = (size_t)n;
+    return 1;
+}
+
+static void Follow_Free(SplitstreamReader* reader)
+{
+    FollowReader* r = (FollowReader*)reader;
+    Follow_Close(r);
+#ifdef __linux__
+    if(r->inotify >= 0) close(r->inotify);
+#endif
+    free(r->path);
+    free(r->buf);
+    free(r);
+}
+
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenFollow(const char* path, size_t bufferSize, int pollInterval,
+                                                              SplitstreamState* s, SplitstreamFollowIdle idle, void* arg)
+{
+    FollowReader* r;
+
+    if(!path) return NULL;
+    if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 1024;
+    if(pollInterval <= 0) pollInterval = 1000;
+
+    r = calloc(1, sizeof(FollowReader));
+    if(!r) return NULL;
+    r->base.read = Follow_Read;
+    r->base.close = Follow_Free;
+    r->fd = r->inotify = r->fileWatch = r->dirWatch = -1;
+    r->bufferSize = bufferSize;
+    r->pollInterval = pollInterval;
+    r->state = s;
+    r->idle = idle;
+    r->arg = arg;
+    /* Continue where a restored state left off */
+    r->offset = s ? s->offset : 0;
+    r->path = malloc(strlen(path) + 1);
+    r->buf = malloc(bufferSize);
+    if(!r->path || !r->buf) {
+        Follow_Free(&r->base);
+        return NULL;
+    }
+    strcpy(r->path, path);
+
+#ifdef __linux__
+    r->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(r->inotify >= 0) {
+        /* Watching the directory catches the file being recreated after a rotation */
+        const char* slash = strrchr(path, '/');
+        if(!slash) {
+            r->dirWatch = inotify_add_watch(r->inotify, ".", DIR_EVENTS);
+        } else if(slash == path) {
+            r->dirWatch = inotify_add_watch(r->inotify, "/", DIR_EVENTS);
+        } else {
+            char* dir = malloc((size_t)(slash - path) + 1);
+            if(dir) {
+                memcpy(dir, path, (size_t)(slash - path));
+                dir[slash - path] = 0;
+                r->dirWatch = inotify_add_watch(r->inotify, dir, DIR_EVENTS);
+                free(dir);
+            }
+        }
+    }
+#endif
+    if(Follow_Open(r) < 0) {
+        Follow_Free(&r->base);
+        return NULL;
+    }
+    return &r->base;
+}
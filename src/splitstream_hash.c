@@ -0,0 +1,206 @@
+/*
+ *   splitstream_hash.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements document hashes and the duplicate filter. The tokenizer feeds every
+   document to Hash_Update as it is scanned, while the bytes are in the cache anyway, so the
+   hash is ready when the document ends, even if it spans many buffers. The hash is XXH64
+   (seed 0), computed in 32-byte stripes with the partial stripe kept in the state.
+
+   The duplicate filter is a set of recent hashes in a table supplied by the caller, organized
+   as buckets of four. When a bucket is full, a new hash replaces a random one of them (picked
+   by the hash itself), so the memory is bounded and old documents are forgotten first, more
+   or less. Only exact duplicates are dropped; a hash collision between different documents is
+   as unlikely as it gets with 64 bits. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static unsigned long long Read64(const unsigned char* p)
+{
+    return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16) |
+           ((unsigned long long)p[3] << 24) | ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40) |
+           ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+}
+
+static unsigned long long Read32(const unsigned char* p)
+{
+    return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16) |
+           ((unsigned long long)p[3] << 24);
+}
+
+static unsigned long long Round(unsigned long long acc, unsigned long long input)
+{
+    acc += input * P2;
+    acc = ROTL(acc, 31);
+    return acc * P1;
+}
+
+static unsigned long long MergeRound(unsigned long long acc, unsigned long long val)
+{
+    acc ^= Round(0, val);
+    return acc * P1 + P4;
+}
+
+static void Hash_Stripe(SplitstreamHashState* h, const unsigned char* p)
+{
+    h->v[0] = Round(h->v[0], Read64(p));
+    h->v[1] = Round(h->v[1], Read64(p + 8));
+    h->v[2] = Round(h->v[2], Read64(p + 16));
+    h->v[3] = Round(h->v[3], Read64(p + 24));
+}
+
+void SPLITSTREAM_API SplitstreamSetHashing(SplitstreamState* s, int hashing)
+{
+    s->hashing = hashing;
+}
+
+int SPLITSTREAM_API SplitstreamDedupInit(SplitstreamDedup* dedup, unsigned long long* table, size_t size)
+{
+    dedup->duplicates = 0;
+    if(size > (size_t)-1 / sizeof(unsigned long long)) {
+        /* More than fits in memory; an empty filter is safer than indexing past the table */
+        dedup->table = NULL;
+        dedup->size = 0;
+        return -1;
+    }
+    dedup->table = table;
+    dedup->size = size;
+    if(table) memset(table, 0, size * sizeof(unsigned long long));
+    else dedup->size = 0;
+    return 0;
+}
+
+void SPLITSTREAM_API SplitstreamSetDedup(SplitstreamState* s, SplitstreamDedup* dedup)
+{
+    s->dedup = dedup;
+    if(dedup) s->hashing = 1;
+}
+
+void Hash_Begin(SplitstreamState* s)
+{
+    SplitstreamHashState* h = &s->hash;
+    h->v[0] = P1 + P2;
+    h->v[1] = P2;
+    h->v[2] = 0;
+    h->v[3] = 0 - P1;
+    h->total = 0;
+    h->buffered = 0;
+}
+
+void Hash_Update(SplitstreamState* s, const char* buf, size_t len)
+{
+    SplitstreamHashState* h = &s->hash;
+    const unsigned char* p = (const unsigned char*)buf, *end = p + len;
+
+    h->total += len;
+    if(h->buffered) {
+        size_t n = 32 - h->buffered;
+        if(n > len) n = len;
+        memcpy(h->buffer + h->buffered, p, n);
+        h->buffered += n;
+        p += n;
+        if(h->buffered < 32) return;
+        Hash_Stripe(h, h->buffer);
+        h->buffered = 0;
+    }
+    for(; end - p >= 32; p += 32) Hash_Stripe(h, p);
+    memcpy(h->buffer, p, (size_t)(end - p));
+    h->buffered = (size_t)(end - p);
+}
+
+/* Rehashes the document in progress, after it was restored by SplitstreamStateDeserialize */
+void Hash_Restore(SplitstreamState* s)
+{
+    const SplitstreamDocument* doc = &s->doc;
+    size_t i;
+    Hash_Begin(s);
+    if(!doc->segmentCount) {
+        if(doc->buffer) Hash_Update(s, doc->buffer, doc->length);
+        return;
+    }
+    for(i = 0; i < doc->segmentCount; ++i) Hash_Update(s, doc->segments[i].base, doc->segments[i].length);
+}
+
+unsigned long long Hash_Digest(const SplitstreamState* s)
+{
+    const SplitstreamHashState* h = &s->hash;
+    const unsigned char* p = h->buffer, *end = p + h->buffered;
+    unsigned long long x;
+
+    if(h->total >= 32) {
+        x = ROTL(h->v[0], 1) + ROTL(h->v[1], 7) + ROTL(h->v[2], 12) + ROTL(h->v[3], 18);
+        x = MergeRound(x, h->v[0]);
+        x = MergeRound(x, h->v[1]);
+        x = MergeRound(x, h->v[2]);
+        x = MergeRound(x, h->v[3]);
+    } else {
+        x = P5;
+    }
+    x += h->total;
+    for(; end - p >= 8; p += 8) {
+        x ^= Round(0, Read64(p));
+        x = ROTL(x, 27) * P1 + P4;
+    }
+    if(end - p >= 4) {
+        x ^= Read32(p) * P1;
+        x = ROTL(x, 23) * P2 + P3;
+        p += 4;
+    }
+    for(; p < end; ++p) {
+        x ^= (*p) * P5;
+        x = ROTL(x, 11) * P1;
+    }
+    x ^= x >> 33;
+    x *= P2;
+    x ^= x >> 29;
+    x *= P3;
+    x ^= x >> 32;
+    return x;
+}
+
+/* Returns 1 if the hash was seen recently, and remembers it otherwise */
+int Dedup_Seen(SplitstreamDedup* dedup, unsigned long long hash)
+{
+    size_t buckets = dedup->size / 4, i;
+    unsigned long long* bucket;
+    if(!buckets) return 0;
+    if(!hash) hash = 1; /* 0 marks an empty slot */
+    bucket = dedup->table + (size_t)(hash % buckets) * 4;
+    for(i = 0; i < 4; ++i) {
+        if(bucket[i] == hash) {
+            dedup->duplicates++;
+            return 1;
+        }
+    }
+    for(i = 0; i < 4; ++i) {
+        if(!bucket[i]) {
+            bucket[i] = hash;
+            return 0;
+        }
+    }
+    bucket[hash >> 62] = hash;
+    return 0;
+}
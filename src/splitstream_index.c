@@ -0,0 +1,393 @@
+/*
+ *   splitstream_index.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the document offset index. An index is built by adding every document
+   returned by the tokenizer, and records where each document starts and ends in the stream.
+   Every `checkpointInterval` bytes, and whenever the tokenizer state at a document boundary is
+   not the one last recorded (such as when the start depth is inside a new enclosing array), a
+   checkpoint with that state is recorded as well, which is what a resumed scan is initialized
+   from. Every boundary between two checkpoints thus has the state of the first. The first
+   checkpoint is the state the index was created with, so document 0 resumes exactly where the
+   scan began. The others are taken right after a document, where the rest of the input buffer
+   is scanned again, so a checkpoint holds the state that returns to rather than State_Rescan.
+
+   The sidecar file is written in a compact format where all numbers are LEB128 varints:
+
+      "SSIX" version
+      startDepth documentCount checkpointCount
+      documentCount * { start - previous end, end - start }
+      checkpointCount * { document - previous document, offset, depth, last, state, flags,
+                          counter[0..3] }
+
+   Signed numbers are zigzag encoded. The counts come from the file, so they are checked
+   against the number of bytes left in it before anything is allocated. */
+
+#include <splitstream_private.h>
+#include <string.h>
+#include <limits.h>
+
+#define INDEX_MAGIC     "SSIX"
+#define INDEX_VERSION   2
+
+/* Smallest encoding of a document and of a checkpoint, one byte per varint */
+#define INDEX_DOCUMENT_BYTES    2
+#define INDEX_CHECKPOINT_BYTES  10
+
+/* Flags that carry over from one document to the next */
+#define INDEX_FLAGS     SPLITSTREAM_STATE_FLAG_HEADER
+
+typedef struct {
+    size_t document;
+    long long offset;       /* Where the scan resumes for `document` */
+    int depth;
+    int counter[4];
+    char last;
+    int state;
+    int flags;
+} Checkpoint;
+
+struct SplitstreamIndex {
+    int startDepth;
+    long long checkpointInterval;
+    size_t count, capacity;
+    long long* offsets;     /* start, end pairs */
+    size_t checkpointCount, checkpointCapacity;
+    Checkpoint* checkpoints;
+};
+
+static int Index_AddCheckpoint(SplitstreamIndex* index, size_t document, long long offset, const SplitstreamState* s);
+
+SplitstreamIndex* SPLITSTREAM_API SplitstreamIndexNew(const SplitstreamState* s, long long checkpointInterval)
+{
+    SplitstreamIndex* index = calloc(1, sizeof(SplitstreamIndex));
+    if(!index) return NULL;
+    index->startDepth = s ? s->startDepth : 0;
+    index->checkpointInterval = checkpointInterval > 0 ? checkpointInterval : 1024*1024;
+    /* Between documents, the state the scan begins with is the first checkpoint */
+    if(s && (s->state == State_Init || s->state == State_Rescan) &&
+       Index_AddCheckpoint(index, 0, s->offset - (long long)s->doc.length, s) < 0) {
+        SplitstreamIndexFree(index);
+        return NULL;
+    }
+    return index;
+}
+
+void SPLITSTREAM_API SplitstreamIndexFree(SplitstreamIndex* index)
+{
+    if(!index) return;
+    free(index->offsets);
+    free(index->checkpoints);
+    free(index);
+}
+
+static int Index_Grow(void** ptr, size_t* capacity, size_t needed, size_t size)
+{
+    void* p;
+    size_t n = *capacity ? *capacity : 256;
+    if(needed <= *capacity) return 0;
+    if(needed > (size_t)-1 / size) return -1;
+    while(n < needed) n = (n > (size_t)-1 / 2) ? needed : n * 2;
+    if(n > (size_t)-1 / size) n = needed;
+    p = realloc(*ptr, n * size);
+    if(!p) return -1;
+    *ptr = p;
+    *capacity = n;
+    return 0;
+}
+
+/* Records the state `s` at `offset`, or the initial state if there is none */
+static int Index_AddCheckpoint(SplitstreamIndex* index, size_t document, long long offset, const SplitstreamState* s)
+{
+    Checkpoint* cp;
+    if(Index_Grow((void**)&index->checkpoints, &index->checkpointCapacity, index->checkpointCount + 1, sizeof(Checkpoint)) < 0)
+        return -1;
+    cp = &index->checkpoints[index->checkpointCount++];
+    cp->document = document;
+    cp->offset = offset;
+    cp->depth = s ? s->depth : 0;
+    cp->last = s ? s->last : 0;
+    cp->state = (s && s->state != State_Rescan) ? (int)s->state : State_Init;
+    cp->flags = s ? (s->flags & INDEX_FLAGS) : 0;
+    if(s) memcpy(cp->counter, s->counter, sizeof(cp->counter));
+    else memset(cp->counter, 0, sizeof(cp->counter));
+    return 0;
+}
+
+/* Whether the boundary state `s` is the one recorded by `cp`, apart from the last byte scanned,
+   which only matters to the scanners within a document or at the start of a line */
+static int Index_SameState(const Checkpoint* cp, const SplitstreamState* s)
+{
+    int state = (s->state != State_Rescan) ? (int)s->state : State_Init;
+    return cp->depth == s->depth && cp->state == state && cp->flags == (s->flags & INDEX_FLAGS) &&
+           !memcmp(cp->counter, s->counter, sizeof(cp->counter));
+}
+
+int SPLITSTREAM_API SplitstreamIndexAdd(SplitstreamIndex* index, const SplitstreamState* s, const SplitstreamDocument* doc)
+{
+    long long start = doc->offset, end = doc->offset + (long long)doc->length;
+    size_t n = index->count;
+    const Checkpoint* cp;
+
+    if(n && start < index->offsets[2 * n - 1]) return -1; /* Documents must be added in order */
+    if(Index_Grow((void**)&index->offsets, &index->capacity, 2 * (n + 1), sizeof(long long)) < 0)
+        return -1;
+    if(!index->checkpointCount) {
+        /* Without the state the scan began with, assume it began at the start of the stream */
+        if(Index_AddCheckpoint(index, 0, 0, NULL) < 0) return -1;
+    }
+    index->offsets[2 * n] = start;
+    index->offsets[2 * n + 1] = end;
+    index->count = n + 1;
+
+    /* The tokenizer has just completed a document, so it is at a document boundary */
+    cp = &index->checkpoints[index->checkpointCount - 1];
+    if(end - cp->offset >= index->checkpointInterval || (s && !Index_SameState(cp, s)))
+        return Index_AddCheckpoint(index, n + 1, end, s);
+    return 0;
+}
+
+size_t SPLITSTREAM_API SplitstreamIndexCount(const SplitstreamIndex* index)
+{
+    return index ? index->count : 0;
+}
+
+int SPLITSTREAM_API SplitstreamIndexGet(const SplitstreamIndex* index, size_t n, long long* start, long long* end)
+{
+    if(!index || n >= index->count) return -1;
+    if(start) *start = index->offsets[2 * n];
+    if(end) *end = index->offsets[2 * n + 1];
+    return 0;
+}
+
+size_t SPLITSTREAM_API SplitstreamIndexFind(const SplitstreamIndex* index, long long offset)
+{
+    /* Binary search for the first document ending after `offset` */
+    size_t lo = 0, hi = index ? index->count : 0;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(index->offsets[2 * mid + 1] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+long long SPLITSTREAM_API SplitstreamIndexSeek(const SplitstreamIndex* index, size_t n, SplitstreamState* s)
+{
+    const Checkpoint* cp;
+    size_t lo = 0, hi;
+    long long offset;
+
+    if(!index || !index->checkpointCount || n > index->count) return -1;
+
+    /* Latest checkpoint at or before document n */
+    hi = index->checkpointCount;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(index->checkpoints[mid].document <= n) lo = mid;
+        else hi = mid;
+    }
+    cp = &index->checkpoints[lo];
+    /* At a checkpoint, the scan resumes where it was taken. In between, it resumes at the end of
+       the previous document, where the state is the same since a new checkpoint is taken when
+       it changes. */
+    offset = (cp->document == n) ? cp->offset : index->offsets[2 * n - 1];
+
+    SplitstreamFree(s);
+    State_Restart(s, index->startDepth);
+    s->depth = cp->depth;
+    s->last = cp->last;
+    s->state = (SplitstreamTokenizerState)cp->state;
+    s->flags = cp->flags;
+    memcpy(s->counter, cp->counter, sizeof(s->counter));
+    s->offset = offset;
+    return offset;
+}
+
+size_t SPLITSTREAM_API SplitstreamIndexPartition(const SplitstreamIndex* index, size_t parts, SplitstreamIndexRange* ranges)
+{
+    size_t i, first = 0, used = 0;
+    long long total, begin;
+
+    if(!index || !index->count || !parts) return 0;
+    begin = index->offsets[0];
+    total = index->offsets[2 * index->count - 1] - begin;
+
+    /* Split by bytes rather than by document count, so workers get similar amounts of data */
+    for(i = 0; i < parts && first < index->count; ++i) {
+        long long target = begin + total * (long long)(i + 1) / (long long)parts;
+        size_t last = SplitstreamIndexFind(index, target - 1);
+        if(last >= index->count || i == parts - 1) last = index->count - 1;
+        if(last < first) last = first;
+        ranges[used].first = first;
+        ranges[used].count = last - first + 1;
+        ranges[used].start = index->offsets[2 * first];
+        ranges[used].end = index->offsets[2 * last + 1];
+        ++used;
+        first = last + 1;
+    }
+    return used;
+}
+
+/* Serialization */
+
+static int Index_PutVarint(FILE* f, unsigned long long v)
+{
+    do {
+        unsigned char c = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if(v) c |= 0x80;
+        if(putc(c, f) == EOF) return -1;
+    } while(v);
+    return 0;
+}
+
+static int Index_GetVarint(FILE* f, unsigned long long* v)
+{
+    int c, shift = 0;
+    *v = 0;
+    do {
+        if((c = getc(f)) == EOF || shift > 63) return -1;
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        shift += 7;
+    } while(c & 0x80);
+    return 0;
+}
+
+static unsigned long long Index_Zigzag(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long Index_Unzigzag(unsigned long long v)
+{
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+int SPLITSTREAM_API SplitstreamIndexSave(const SplitstreamIndex* index, const char* path)
+{
+    FILE* f;
+    size_t i;
+    long long prevEnd = 0;
+    size_t prevDocument = 0;
+    int rc = 0;
+
+    if(!index || !(f = fopen(path, "wb"))) return -1;
+    if(fwrite(INDEX_MAGIC, 1, 4, f) != 4 || putc(INDEX_VERSION, f) == EOF) rc = -1;
+    rc |= Index_PutVarint(f, Index_Zigzag(index->startDepth));
+    rc |= Index_PutVarint(f, index->count);
+    rc |= Index_PutVarint(f, index->checkpointCount);
+    for(i = 0; i < index->count && !rc; ++i) {
+        rc |= Index_PutVarint(f, (unsigned long long)(index->offsets[2 * i] - prevEnd));
+        rc |= Index_PutVarint(f, (unsigned long long)(index->offsets[2 * i + 1] - index->offsets[2 * i]));
+        prevEnd = index->offsets[2 * i + 1];
+    }
+    for(i = 0; i < index->checkpointCount && !rc; ++i) {
+        const Checkpoint* cp = &index->checkpoints[i];
+        int j;
+        rc |= Index_PutVarint(f, cp->document - prevDocument);
+        rc |= Index_PutVarint(f, Index_Zigzag(cp->offset));
+        rc |= Index_PutVarint(f, Index_Zigzag(cp->depth));
+        rc |= Index_PutVarint(f, (unsigned char)cp->last);
+        rc |= Index_PutVarint(f, (unsigned)cp->state);
+        rc |= Index_PutVarint(f, (unsigned)cp->flags);
+        for(j = 0; j < 4; ++j) rc |= Index_PutVarint(f, Index_Zigzag(cp->counter[j]));
+        prevDocument = cp->document;
+    }
+    if(fclose(f)) rc = -1;
+    return rc ? -1 : 0;
+}
+
+/* Reads a zigzag encoded varint that has to fit in an int */
+static int Index_GetInt(FILE* f, int* v)
+{
+    unsigned long long u;
+    long long x;
+    if(Index_GetVarint(f, &u)) return -1;
+    x = Index_Unzigzag(u);
+    if(x < INT_MIN || x > INT_MAX) return -1;
+    *v = (int)x;
+    return 0;
+}
+
+SplitstreamIndex* SPLITSTREAM_API SplitstreamIndexLoad(const char* path)
+{
+    SplitstreamIndex* index;
+    unsigned long long v, count, checkpoints, remaining;
+    char magic[5] = { 0 };
+    long long prevEnd = 0, size, pos;
+    size_t i, prevDocument = 0;
+    FILE* f;
+
+    if(!(f = fopen(path, "rb"))) return NULL;
+    if(fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) ||
+       fread(magic, 1, 4, f) != 4 || strcmp(magic, INDEX_MAGIC) || getc(f) != INDEX_VERSION ||
+       Index_GetVarint(f, &v) || Index_GetVarint(f, &count) || Index_GetVarint(f, &checkpoints) ||
+       (pos = ftell(f)) < 0) {
+        fclose(f);
+        return NULL;
+    }
+    /* Every document and checkpoint takes some bytes, which bounds the counts */
+    remaining = (unsigned long long)(size - pos);
+    if(count > remaining / INDEX_DOCUMENT_BYTES ||
+       checkpoints > (remaining - count * INDEX_DOCUMENT_BYTES) / INDEX_CHECKPOINT_BYTES ||
+       Index_Unzigzag(v) < 0 || Index_Unzigzag(v) > INT_MAX ||
+       (count && !checkpoints) || !(index = SplitstreamIndexNew(NULL, 0))) {
+        fclose(f);
+        return NULL;
+    }
+    index->startDepth = (int)Index_Unzigzag(v);
+    if(Index_Grow((void**)&index->offsets, &index->capacity, 2 * (size_t)count, sizeof(long long)) < 0 ||
+       Index_Grow((void**)&index->checkpoints, &index->checkpointCapacity, (size_t)checkpoints, sizeof(Checkpoint)) < 0)
+        goto fail;
+    for(i = 0; i < count; ++i) {
+        unsigned long long gap, length;
+        if(Index_GetVarint(f, &gap) || Index_GetVarint(f, &length)) goto fail;
+        if(gap > (unsigned long long)(LLONG_MAX - prevEnd) ||
+           length > (unsigned long long)(LLONG_MAX - prevEnd) - gap) goto fail;
+        index->offsets[2 * i] = prevEnd + (long long)gap;
+        index->offsets[2 * i + 1] = prevEnd = index->offsets[2 * i] + (long long)length;
+    }
+    index->count = (size_t)count;
+    for(i = 0; i < checkpoints; ++i) {
+        Checkpoint* cp = &index->checkpoints[i];
+        unsigned long long document, offset, last, state, flags;
+        int j;
+        if(Index_GetVarint(f, &document) || Index_GetVarint(f, &offset) || Index_GetInt(f, &cp->depth) ||
+           Index_GetVarint(f, &last) || Index_GetVarint(f, &state) || Index_GetVarint(f, &flags)) goto fail;
+        /* Checkpoints start with the first document and are in order */
+        if(document > index->count - prevDocument || (!i && document) || (i && !document) ||
+           last > 0xff || state >= State_Rescan || (flags & ~(unsigned long long)INDEX_FLAGS)) goto fail;
+        cp->document = prevDocument += (size_t)document;
+        cp->offset = Index_Unzigzag(offset);
+        cp->last = (char)last;
+        cp->state = (int)state;
+        cp->flags = (int)flags;
+        for(j = 0; j < 4; ++j) {
+            if(Index_GetInt(f, &cp->counter[j])) goto fail;
+        }
+        index->checkpointCount = i + 1;
+    }
+    if(getc(f) != EOF) goto fail;
+    fclose(f);
+    return index;
+
+fail:
+    fclose(f);
+    SplitstreamIndexFree(index);
+    return NULL;
+}
@@ -17,11 +17,28 @@
  */
 
 #include <splitstream_private.h>
+#include <limits.h>
+
+/* Set if the current character starts a line. The previous character is s->last at the
+   start of the buffer. */
+#define AT_LINE_START (cp != buf ? cp[-1] == '\n' : s->last == '\n')
+/* Set if the current character starts a line inside a document (or a stray string between
+   documents), which the resync policy takes as the start of a new document */
+#define RESYNC_ANCHOR (lineStart && s->depth >= s->startDepth && AT_LINE_START)
+/* Set between the elements of an array at the start depth, where strings and other scalars
+   are documents as well */
+#define IN_ARRAY (s->depth == s->startDepth && s->startDepth > 0 && s->counter[SPLITSTREAM_COUNTER_ARRAY])
 
 size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start) {
 	int escapeCounter = s->counter[0];
     SplitstreamTokenizerState state = s->state;
     const char* end = buf + len, *cp = buf;
+    /* Resync policy, see SplitstreamSetResync */
+    int lineStart = s->resync && s->resync->lineStart;
+    size_t maxToken = s->resync ? s->resync->maxToken : 0;
+    const char* token = buf;
+    size_t tokenLength = (size_t)s->counter[SPLITSTREAM_COUNTER_TOKEN];
+    if(maxToken >= INT_MAX) maxToken = INT_MAX - 1;
     
     #define LOOP_BEGIN \
 	    for(; cp != end; ++cp) { \
@@ -46,6 +63,8 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
 				goto h_Document;
 			case State_String:
 				goto h_String;
+			case State_Scalar:
+				goto h_Scalar;
 			default:
 				abort();
 		}
@@ -54,13 +73,46 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
 		LOOP_BEGIN
 		case '[':
 		case '{':
+			if(s->flags & SPLITSTREAM_STATE_FLAG_RESYNC_WAIT) {
+				/* After a resync, documents only start at the beginning of a line */
+				if(!AT_LINE_START) break;
+				s->flags &= ~SPLITSTREAM_STATE_FLAG_RESYNC_WAIT;
+			}
             *start = (cp - buf);
-            ++s->depth;
+            if(++s->depth == s->startDepth) {
+				/* Entering the container of the documents rather than starting one */
+				s->counter[SPLITSTREAM_COUNTER_ARRAY] = (c == '[');
+				if(c == '[') { TRANSITION(Init) }
+			}
             TRANSITION(Document)
 			break;
+		case ']':
+		case '}':
+			if(s->depth == s->startDepth && s->startDepth > 0) {
+				/* The end of the container of the documents */
+				--s->depth;
+				TRANSITION(Document)
+			}
+			break;
         case '"':
+			if(s->flags & SPLITSTREAM_STATE_FLAG_RESYNC_WAIT) break;
+			if(IN_ARRAY) *start = (cp - buf);
+			token = cp + 1;
+			tokenLength = 0;
         	TRANSITION(String);
         	break;
+		case ',':
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		default:
+			if(IN_ARRAY && !(s->flags & SPLITSTREAM_STATE_FLAG_RESYNC_WAIT)) {
+				*start = (cp - buf);
+				TRANSITION(Scalar)
+			}
+			break;
 		LOOP_END
 		
 	h_Document:
@@ -69,8 +121,13 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
 		case '{':
 		    if (s->depth == s->startDepth && s->startDepth > 0) {
 				*start = (cp - buf);
+			} else if(RESYNC_ANCHOR) {
+				return Resync_Restart(s, buf, (size_t)(cp - buf));
+			}
+            if(++s->depth == s->startDepth) {
+				s->counter[SPLITSTREAM_COUNTER_ARRAY] = (c == '[');
+				if(c == '[') { TRANSITION(Init) }
 			}
-            ++s->depth;
             break;
 		case ']':
 		case '}':
@@ -82,6 +139,8 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
 			}
             break;
         case '"':
+			token = cp + 1;
+			tokenLength = 0;
         	TRANSITION(String);
         	break;
 		LOOP_END
@@ -94,6 +153,16 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
             case '"':
                 if(!(escapeCounter & 1)) {
 					escapeCounter = 0;
+					if(maxToken && tokenLength + (size_t)(cp - token) > maxToken) {
+						return Resync_Restart(s, buf, (size_t)(cp - buf + 1));
+					}
+					if(IN_ARRAY) {
+						/* A string element */
+						s->last = c;
+						s->state = state;
+						s->counter[0] = 0;
+						return (cp - buf + 1);
+					}
                 	TRANSITION(Document)
                 }
 				escapeCounter = 0;
@@ -101,10 +170,45 @@ size_t SplitstreamJSONScanner(SplitstreamState* s, const char* buf, size_t len,
             case '\\':
             	++escapeCounter;
             	break;
+			case '[':
+			case '{':
+				/* A raw newline is not valid in a string anyway */
+				if(RESYNC_ANCHOR) return Resync_Restart(s, buf, (size_t)(cp - buf));
+				escapeCounter = 0;
+				break;
+		LOOP_END
+
+	h_Scalar:
+		/* A number, true, false or null, which only ends at the character after it */
+		LOOP_BEGIN
+		case ',':
+		case ']':
+		case '}':
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			s->state = state;
+			if(cp == buf) {
+				/* It ended with the previous input */
+				s->flags |= SPLITSTREAM_STATE_FLAG_ENDED;
+				return 0;
+			}
+			return (cp - buf);
 		LOOP_END
 		
     h_End:
 		s->state = state;
     	s->counter[0] = escapeCounter;
+		if(maxToken && state == State_String) {
+			tokenLength += (size_t)(end - token);
+			if(tokenLength > maxToken) {
+				/* Stop buffering the document now, and give up on it when the string ends */
+				tokenLength = maxToken + 1;
+				Resync_Discard(s);
+			}
+			s->counter[SPLITSTREAM_COUNTER_TOKEN] = (int)tokenLength;
+		}
+		if(lineStart && len) s->last = end[-1];
     return 0;
 }
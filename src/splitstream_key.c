@@ -0,0 +1,302 @@
+/*
+ *   splitstream_key.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements extracting a key from every document while it is scanned. Like the
+   filter, the tokenizer feeds the document to Key_Scan as it passes, which works through it
+   one character at a time and keeps its progress in the state, so a key may span buffers.
+
+   Unlike the filter, the key may be anywhere among the members of a JSON object or the
+   attributes of the XML element, so Key_Scan follows the top level of the document (skipping
+   nested values and strings) until it finds the key or the top level ends. It stops looking
+   at the document as soon as the value is complete, so the rest is not looked at twice. The
+   value is hashed as it goes, since it may not be contiguous in the document (see
+   SplitstreamSetSegmented), and only its position is kept. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+enum {
+    Key_Idle,
+    Key_Found,
+
+    Key_XmlOpen,
+    Key_XmlName,
+    Key_XmlMarkupStart,
+    Key_XmlMarkup,
+    Key_XmlComment,
+    Key_XmlElementName,
+    Key_XmlAttributes,
+    Key_XmlAttributeName,
+    Key_XmlEquals,
+    Key_XmlQuote,
+    Key_XmlValue,
+
+    Key_JsonOpen,
+    Key_JsonMember,
+    Key_JsonName,
+    Key_JsonColon,
+    Key_JsonValueStart,
+    Key_JsonString,
+    Key_JsonNested,
+    Key_JsonBare
+};
+
+#define KEY_FLAG_ESCAPED    1   /* The previous character was an unescaped backslash */
+#define KEY_FLAG_MATCHED    2   /* The current name is the key, so its value is captured */
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+void SPLITSTREAM_API SplitstreamSetKey(SplitstreamState* s, const SplitstreamKey* key)
+{
+    s->key = (key && key->type != SPLITSTREAM_KEY_NONE && key->name) ? key : NULL;
+    s->keyState = Key_Idle;
+}
+
+size_t SPLITSTREAM_API SplitstreamPartition(const SplitstreamDocument* doc, size_t partitions)
+{
+    unsigned long long h = doc->keyHash;
+    if(!doc->hasKey || partitions <= 1) return 0;
+    /* Mix the bits, so that partitions that are a power of two use all of the hash */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)(h % partitions);
+}
+
+void Key_Begin(SplitstreamState* s)
+{
+    s->keyState = (s->key->type == SPLITSTREAM_KEY_XML_ATTRIBUTE) ? Key_XmlOpen : Key_JsonOpen;
+    s->keyFlags = 0;
+    s->keyNest = 0;
+    s->keyPosition = 0;
+    s->keyMatch = 0;
+    s->keyStart = 0;
+    s->keyHash = FNV_OFFSET;
+}
+
+/* Whether the progress restored from a saved state is one that Key_Scan can continue */
+int Key_Valid(const SplitstreamState* s)
+{
+    int first = (s->key && s->key->type == SPLITSTREAM_KEY_XML_ATTRIBUTE) ? Key_XmlOpen : Key_JsonOpen;
+    int last = (first == Key_XmlOpen) ? Key_XmlValue : Key_JsonBare;
+    if(s->keyState > Key_Found && (!s->key || s->keyState < first || s->keyState > last)) return 0;
+    /* The length is only set once the value is complete */
+    return s->keyState >= Key_Idle && s->keyStart <= s->keyPosition &&
+           (s->keyState != Key_Found || s->keyLength <= s->keyPosition - s->keyStart);
+}
+
+void Key_Get(const SplitstreamState* s, SplitstreamDocument* doc)
+{
+    if(s->keyState != Key_Found) return;
+    doc->hasKey = 1;
+    doc->keyHash = s->keyHash;
+    doc->keyOffset = s->keyStart;
+    doc->keyLength = s->keyLength;
+}
+
+/* Compares the next character of a name with the key; keyMatch is (size_t)-1 on mismatch */
+static void Key_NameChar(SplitstreamState* s, char c)
+{
+    const char* name = s->key->name;
+    if(s->keyMatch == (size_t)-1) return;
+    if(name[s->keyMatch] == c) ++s->keyMatch;
+    else s->keyMatch = (size_t)-1;
+}
+
+static int Key_NameEnd(SplitstreamState* s)
+{
+    return s->keyMatch != (size_t)-1 && !s->key->name[s->keyMatch];
+}
+
+/* Starts a value at the current position */
+static void Key_ValueStart(SplitstreamState* s)
+{
+    s->keyStart = s->keyPosition;
+    s->keyHash = FNV_OFFSET;
+}
+
+/* The value ended before the current position. Returns 1 if it was the key. */
+static int Key_ValueEnd(SplitstreamState* s)
+{
+    if(!(s->keyFlags & KEY_FLAG_MATCHED)) return 0;
+    s->keyLength = s->keyPosition - s->keyStart;
+    s->keyState = Key_Found;
+    return 1;
+}
+
+void Key_Scan(SplitstreamState* s, const char* buf, size_t len)
+{
+    const char* end = buf + len, *cp = buf;
+
+    for(; cp != end && s->keyState > Key_Found; ++cp, ++s->keyPosition) {
+        char c = *cp;
+        if((s->keyFlags & KEY_FLAG_MATCHED) && s->keyState >= Key_JsonString) {
+            /* Inside the value of the key (Key_JsonBare checks for its end first) */
+            if(s->keyState != Key_JsonBare || !(IS_SPACE(c) || c == ',' || c == '}' || c == ']'))
+                s->keyHash = (s->keyHash ^ (unsigned char)c) * FNV_PRIME;
+        }
+        switch(s->keyState) {
+            case Key_XmlOpen:
+                if(c == '<') {
+                    s->keyState = Key_XmlName;
+                    s->keyMatch = 0;
+                } else if(!IS_SPACE(c)) {
+                    s->keyState = Key_Idle;
+                }
+                break;
+            case Key_XmlName:
+                if(c == '?') s->keyState = Key_XmlMarkup;
+                else if(c == '!') s->keyState = Key_XmlMarkupStart;
+                else s->keyState = Key_XmlElementName;
+                break;
+            case Key_XmlMarkupStart:
+                s->keyState = (c == '-') ? Key_XmlComment : Key_XmlMarkup;
+                break;
+            case Key_XmlMarkup:
+                /* Declaration or processing instruction before the element */
+                if(c == '>') s->keyState = Key_XmlOpen;
+                break;
+            case Key_XmlComment:
+                if(c == '>' && s->keyMatch >= 2) s->keyState = Key_XmlOpen;
+                else s->keyMatch = (c == '-') ? s->keyMatch + 1 : 0;
+                break;
+            case Key_XmlElementName:
+                if(IS_SPACE(c)) s->keyState = Key_XmlAttributes;
+                else if(c == '>' || c == '/') s->keyState = Key_Idle;
+                break;
+            case Key_XmlAttributes:
+                if(c == '>' || c == '/') {
+                    s->keyState = Key_Idle;
+                } else if(!IS_SPACE(c)) {
+                    s->keyMatch = 0;
+                    Key_NameChar(s, c);
+                    s->keyState = Key_XmlAttributeName;
+                }
+                break;
+            case Key_XmlAttributeName:
+                if(c == '=' || IS_SPACE(c)) {
+                    if(Key_NameEnd(s)) s->keyFlags |= KEY_FLAG_MATCHED;
+                    s->keyState = (c == '=') ? Key_XmlQuote : Key_XmlEquals;
+                } else {
+                    Key_NameChar(s, c);
+                }
+                break;
+            case Key_XmlEquals:
+                if(c == '=') s->keyState = Key_XmlQuote;
+                else if(!IS_SPACE(c)) s->keyState = Key_Idle;
+                break;
+            case Key_XmlQuote:
+                if(c == '"' || c == '\'') {
+                    /* The quote is kept in keyNest */
+                    s->keyNest = c;
+                    s->keyState = Key_XmlValue;
+                    Key_ValueStart(s);
+                    ++s->keyStart;
+                } else if(!IS_SPACE(c)) {
+                    s->keyState = Key_Idle;
+                }
+                break;
+            case Key_XmlValue:
+                if(c == s->keyNest) {
+                    if(!Key_ValueEnd(s)) s->keyState = Key_XmlAttributes;
+                } else if(s->keyFlags & KEY_FLAG_MATCHED) {
+                    s->keyHash = (s->keyHash ^ (unsigned char)c) * FNV_PRIME;
+                }
+                break;
+
+            case Key_JsonOpen:
+                if(c == '{') s->keyState = Key_JsonMember;
+                else if(!IS_SPACE(c)) s->keyState = Key_Idle;
+                break;
+            case Key_JsonMember:
+                if(c == '"') {
+                    s->keyState = Key_JsonName;
+                    s->keyMatch = 0;
+                } else if(c == '}') {
+                    s->keyState = Key_Idle;
+                }
+                break;
+            case Key_JsonName:
+                /* The raw text of the name is compared, without decoding escapes */
+                if(c == '"' && !(s->keyFlags & KEY_FLAG_ESCAPED)) {
+                    if(Key_NameEnd(s)) s->keyFlags |= KEY_FLAG_MATCHED;
+                    s->keyState = Key_JsonColon;
+                } else {
+                    s->keyFlags = (c == '\\' && !(s->keyFlags & KEY_FLAG_ESCAPED)) ? KEY_FLAG_ESCAPED : 0;
+                    Key_NameChar(s, c);
+                }
+                break;
+            case Key_JsonColon:
+                if(c == ':') s->keyState = Key_JsonValueStart;
+                break;
+            case Key_JsonValueStart:
+                if(IS_SPACE(c)) break;
+                Key_ValueStart(s);
+                if(s->keyFlags & KEY_FLAG_MATCHED) s->keyHash = (s->keyHash ^ (unsigned char)c) * FNV_PRIME;
+                s->keyNest = 0;
+                if(c == '"') s->keyState = Key_JsonString;
+                else if(c == '{' || c == '[') {
+                    s->keyNest = 1;
+                    s->keyState = Key_JsonNested;
+                } else {
+                    s->keyState = Key_JsonBare;
+                }
+                break;
+            case Key_JsonString:
+                if(c == '"' && !(s->keyFlags & KEY_FLAG_ESCAPED)) {
+                    if(s->keyNest) {
+                        s->keyState = Key_JsonNested;
+                    } else {
+                        ++s->keyPosition;
+                        if(Key_ValueEnd(s)) return;
+                        --s->keyPosition;
+                        s->keyState = Key_JsonMember;
+                    }
+                } else {
+                    s->keyFlags = (s->keyFlags & KEY_FLAG_MATCHED) |
+                                  ((c == '\\' && !(s->keyFlags & KEY_FLAG_ESCAPED)) ? KEY_FLAG_ESCAPED : 0);
+                }
+                break;
+            case Key_JsonNested:
+                if(c == '"') {
+                    s->keyState = Key_JsonString;
+                } else if(c == '{' || c == '[') {
+                    ++s->keyNest;
+                } else if((c == '}' || c == ']') && --s->keyNest == 0) {
+                    ++s->keyPosition;
+                    if(Key_ValueEnd(s)) return;
+                    --s->keyPosition;
+                    s->keyState = Key_JsonMember;
+                }
+                break;
+            case Key_JsonBare:
+                if(IS_SPACE(c) || c == ',' || c == '}') {
+                    if(Key_ValueEnd(s)) return;
+                    s->keyState = (c == '}') ? Key_Idle : Key_JsonMember;
+                }
+                break;
+
+            default:
+                s->keyState = Key_Idle;
+                break;
+        }
+    }
+}
@@ -0,0 +1,415 @@
+/*
+ *   splitstream_pipeline.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements fanning out the documents of one stream to a number of worker threads.
+   The calling thread splits the stream and pushes the documents into a bounded queue, which
+   the workers drain. Every document is handled by exactly one worker, in any order.
+
+   The queue is the bounded MPMC array queue by Dmitry Vyukov: every cell has a sequence number
+   telling whether it is ready to be written or read for a given lap around the array, so
+   pushing and popping are a compare-and-swap on the position and no lock is taken while
+   documents flow. Only a thread that finds the queue empty (or, for the scanner, full) takes
+   the mutex to sleep, and the other side takes it to wake it only if it is known to sleep.
+
+   Documents are allocated from the memory pool of the tokenizer state, which only the scanner
+   thread may touch. So workers do not free documents; they push them to a second queue that
+   the scanner drains before splitting the next document, which makes a document freed by any
+   thread go back to the pool it came from.
+
+   Partitioned pipelines give every worker a queue of its own and route the documents to them
+   by the hash of their key, so all documents with a key go to the same worker, in order.
+
+   Completion tracking (when there is a progress callback) records the index of every document
+   handled in a window of slots, from which the scanner advances the number of documents that
+   have all been handled. The scanner waits if the oldest document in progress falls more than
+   the window behind. */
+
+#include <splitstream_private.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+typedef struct {
+    size_t seq;
+    unsigned long long index;
+    SplitstreamDocument doc;
+} Cell;
+
+typedef struct {
+    Cell* cells;
+    size_t mask;
+    char pad1[64];
+    size_t tail;    /* Written by the producers */
+    char pad2[64];
+    size_t head;    /* Written by the consumers */
+    char pad3[64];
+} Queue;
+
+/* A queue of documents to handle, shared by all workers or for one partition */
+typedef struct {
+    Queue queue;
+#ifndef _WIN32
+    pthread_cond_t notEmpty;
+    int waiting;    /* Number of workers sleeping on it */
+#endif
+} Lane;
+
+typedef struct {
+    SplitstreamPipelineCallback callback;
+    SplitstreamPipelineProgress progress;
+    void* arg;
+    int partitioned;
+
+    Lane* lanes;
+    int laneCount;
+    Queue freed;
+    int stop, stopValue;
+
+    /* Completion tracking, used when `progress` is set */
+    unsigned long long* handled;   /* Index + 1 of the document handled in each slot */
+    long long* ends;                /* Stream offset of the end of that document */
+    size_t window;
+    unsigned long long produced, completed;
+
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    int producerWaiting, finished;
+#endif
+} Pipeline;
+
+static int Queue_Init(Queue* q, size_t size)
+{
+    size_t n = 2, i;
+    while(n < size) n *= 2;
+    memset(q, 0, sizeof(Queue));
+    q->cells = calloc(n, sizeof(Cell));
+    if(!q->cells) return -1;
+    for(i = 0; i < n; ++i) q->cells[i].seq = i;
+    q->mask = n - 1;
+    return 0;
+}
+
+#ifdef _WIN32
+
+static int Pipeline_Run(Pipeline* p, SplitstreamState* s, SplitstreamReader* reader, size_t max, SplitstreamScanner scanner, int workers)
+{
+    /* No threads on this platform; handle the documents as they are split */
+    SplitstreamDocument doc;
+    int rc = 0;
+    while(!rc && (doc = SplitstreamGetNextDocumentFromReader(s, max, reader, scanner)).buffer) {
+        rc = p->callback(p->arg, p->produced++, &doc);
+        if(!rc && p->progress) p->progress(p->arg, p->produced, doc.offset + (long long)doc.length);
+        SplitstreamDocumentFree(s, &doc);
+    }
+    return rc;
+}
+
+#else
+
+static int Queue_Push(Queue* q, unsigned long long index, const SplitstreamDocument* doc)
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for(;;) {
+        Cell* c = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                c->index = index;
+                c->doc = *doc;
+                __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if(diff < 0) {
+            return 0; /* Full */
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int Queue_Pop(Queue* q, unsigned long long* index, SplitstreamDocument* doc)
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for(;;) {
+        Cell* c = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - (pos + 1));
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *index = c->index;
+                *doc = c->doc;
+                __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if(diff < 0) {
+            return 0; /* Empty */
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Only meaningful for the single producer */
+static int Queue_HasRoom(Queue* q)
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    return __atomic_load_n(&q->cells[pos & q->mask].seq, __ATOMIC_ACQUIRE) == pos;
+}
+
+#define PIPELINE_STOPPED(p) __atomic_load_n(&(p)->stop, __ATOMIC_RELAXED)
+
+static void Pipeline_Stop(Pipeline* p, int value)
+{
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&p->stop, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        p->stopValue = value;
+}
+
+/* Called by a worker once it is done with a document. Documents dropped after stopping are
+   not counted as handled. */
+static void Pipeline_Done(Pipeline* p, unsigned long long index, SplitstreamDocument* doc, int handled)
+{
+    if(p->handled && handled) {
+        size_t slot = (size_t)(index % p->window);
+        p->ends[slot] = doc->offset + (long long)doc->length;
+        __atomic_store_n(&p->handled[slot], index + 1, __ATOMIC_RELEASE);
+    }
+    while(!Queue_Push(&p->freed, index, doc)) sched_yield();
+}
+
+/* Run by the scanner: frees the documents the workers are done with and reports progress */
+static void Pipeline_Collect(Pipeline* p, SplitstreamState* s)
+{
+    SplitstreamDocument doc;
+    unsigned long long index, completed = p->completed;
+    long long offset = 0;
+
+    while(Queue_Pop(&p->freed, &index, &doc)) SplitstreamDocumentFree(s, &doc);
+    if(!p->handled) return;
+    while(completed < p->produced &&
+          __atomic_load_n(&p->handled[completed % p->window], __ATOMIC_ACQUIRE) == completed + 1) {
+        offset = p->ends[completed % p->window];
+        ++completed;
+    }
+    if(completed != p->completed) {
+        p->completed = completed;
+        p->progress(p->arg, completed, offset);
+    }
+}
+
+/* Whether the scanner may push the next document. Once stopped, documents are no longer
+   completed, so only the queue counts. */
+static int Pipeline_HasRoom(Pipeline* p, Lane* lane)
+{
+    if(p->handled && !PIPELINE_STOPPED(p) && p->produced - p->completed >= p->window &&
+       __atomic_load_n(&p->handled[p->completed % p->window], __ATOMIC_ACQUIRE) != p->completed + 1)
+        return 0;
+    return Queue_HasRoom(&lane->queue);
+}
+
+static void Pipeline_Handle(Pipeline* p, unsigned long long index, SplitstreamDocument* doc)
+{
+    int rc = 0, handled = 0;
+    if(!PIPELINE_STOPPED(p)) {
+        rc = p->callback(p->arg, index, doc);
+        handled = !rc;
+    }
+    if(rc) Pipeline_Stop(p, rc);
+    Pipeline_Done(p, index, doc, handled);
+}
+
+/* Wakes the other side if it sleeps. The fence orders the queue operation just done before
+   reading the flag, pairing with the fence of the sleeper between setting it and checking
+   the queue again, so either the sleeper sees the change or this thread sees the flag. */
+static void Pipeline_Wake(Pipeline* p, int* waiting, pthread_cond_t* cond)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+static int Pipeline_Pop(Pipeline* p, Lane* lane, unsigned long long* index, SplitstreamDocument* doc)
+{
+    int found = Queue_Pop(&lane->queue, index, doc);
+    if(!found) {
+        pthread_mutex_lock(&p->lock);
+        __atomic_add_fetch(&lane->waiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while(!(found = Queue_Pop(&lane->queue, index, doc)) && !p->finished)
+            pthread_cond_wait(&lane->notEmpty, &p->lock);
+        __atomic_sub_fetch(&lane->waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&p->lock);
+    }
+    if(found) Pipeline_Wake(p, &p->producerWaiting, &p->notFull);
+    return found;
+}
+
+typedef struct {
+    Pipeline* pipeline;
+    Lane* lane;
+    pthread_t thread;
+} Worker;
+
+static void* Pipeline_Worker(void* arg)
+{
+    Worker* w = arg;
+    Pipeline* p = w->pipeline;
+    SplitstreamDocument doc;
+    unsigned long long index;
+    while(Pipeline_Pop(p, w->lane, &index, &doc)) {
+        Pipeline_Handle(p, index, &doc);
+        /* The scanner may be waiting for completion or for documents to free */
+        if(p->handled || PIPELINE_STOPPED(p)) Pipeline_Wake(p, &p->producerWaiting, &p->notFull);
+    }
+    return NULL;
+}
+
+static void Pipeline_WaitForRoom(Pipeline* p, SplitstreamState* s, Lane* lane)
+{
+    for(;;) {
+        Pipeline_Collect(p, s);
+        if(Pipeline_HasRoom(p, lane)) return;
+        pthread_mutex_lock(&p->lock);
+        __atomic_store_n(&p->producerWaiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(!Pipeline_HasRoom(p, lane)) pthread_cond_wait(&p->notFull, &p->lock);
+        __atomic_store_n(&p->producerWaiting, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+static int Pipeline_Run(Pipeline* p, SplitstreamState* s, SplitstreamReader* reader, size_t max, SplitstreamScanner scanner, int workers)
+{
+    Worker* threads = calloc((size_t)workers, sizeof(Worker));
+    SplitstreamDocument doc;
+    int started, i;
+
+    if(!threads) return -1;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->notFull, NULL);
+    for(i = 0; i < p->laneCount; ++i) pthread_cond_init(&p->lanes[i].notEmpty, NULL);
+    for(started = 0; started < workers; ++started) {
+        threads[started].pipeline = p;
+        threads[started].lane = &p->lanes[started % p->laneCount];
+        if(pthread_create(&threads[started].thread, NULL, Pipeline_Worker, &threads[started])) break;
+    }
+
+    /* A partition without a worker would never be drained */
+    if(started == workers || (started && !p->partitioned)) {
+        while(!PIPELINE_STOPPED(p) && (doc = SplitstreamGetNextDocumentFromReader(s, max, reader, scanner)).buffer) {
+            Lane* lane = &p->lanes[p->partitioned ? SplitstreamPartition(&doc, (size_t)p->laneCount) : 0];
+            Pipeline_WaitForRoom(p, s, lane);
+            Queue_Push(&lane->queue, p->produced++, &doc);
+            Pipeline_Wake(p, &lane->waiting, &lane->notEmpty);
+        }
+    } else {
+        Pipeline_Stop(p, -1);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->finished = 1;
+    for(i = 0; i < p->laneCount; ++i) pthread_cond_broadcast(&p->lanes[i].notEmpty);
+    pthread_mutex_unlock(&p->lock);
+    for(i = 0; i < started; ++i) pthread_join(threads[i].thread, NULL);
+    Pipeline_Collect(p, s);
+
+    for(i = 0; i < p->laneCount; ++i) pthread_cond_destroy(&p->lanes[i].notEmpty);
+    pthread_cond_destroy(&p->notFull);
+    pthread_mutex_destroy(&p->lock);
+    free(threads);
+    return p->stopValue;
+}
+
+#endif
+
+static int Pipeline_Split(SplitstreamReader* reader, SplitstreamScanner scanner, int startDepth, size_t max,
+                          const SplitstreamKey* key, size_t queueSize, int workers,
+                          SplitstreamPipelineCallback callback, SplitstreamPipelineProgress progress, void* arg)
+{
+    Pipeline p;
+    SplitstreamState s;
+    size_t capacity = 0;
+    int rc = -1, i;
+
+    if(!reader || !scanner || !callback) return -1;
+    if(workers <= 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if(workers <= 0) workers = 4;
+    }
+    if(workers > 256) workers = 256;
+    if(!queueSize) queueSize = 1024;
+
+    memset(&p, 0, sizeof(p));
+    p.callback = callback;
+    p.progress = progress;
+    p.arg = arg;
+    p.partitioned = key != NULL;
+    p.laneCount = key ? workers : 1;
+    p.lanes = calloc((size_t)p.laneCount, sizeof(Lane));
+    if(!p.lanes) return -1;
+    for(i = 0; i < p.laneCount; ++i) {
+        if(Queue_Init(&p.lanes[i].queue, queueSize) < 0) goto done;
+        capacity += p.lanes[i].queue.mask + 1;
+    }
+    /* Every document in flight (queued, being handled or waiting to be freed) fits in `freed` */
+    if(Queue_Init(&p.freed, capacity + (size_t)workers + 1) < 0) goto done;
+    if(progress) {
+        p.window = 2 * (capacity + (size_t)workers);
+        p.handled = calloc(p.window, sizeof(unsigned long long));
+        p.ends = calloc(p.window, sizeof(long long));
+        if(!p.handled || !p.ends) goto done;
+    }
+
+    SplitstreamInitDepth(&s, startDepth);
+    SplitstreamSetKey(&s, key);
+    rc = Pipeline_Run(&p, &s, reader, max ? max : 100*1024*1024, scanner, workers);
+    SplitstreamFree(&s);
+
+done:
+    for(i = 0; i < p.laneCount; ++i) free(p.lanes[i].queue.cells);
+    free(p.lanes);
+    free(p.freed.cells);
+    free(p.handled);
+    free(p.ends);
+    return rc;
+}
+
+int SPLITSTREAM_API SplitstreamSplitPipeline(SplitstreamReader* reader, SplitstreamScanner scanner, int startDepth,
+                                             size_t max, size_t queueSize, int workers,
+                                             SplitstreamPipelineCallback callback, SplitstreamPipelineProgress progress, void* arg)
+{
+    return Pipeline_Split(reader, scanner, startDepth, max, NULL, queueSize, workers, callback, progress, arg);
+}
+
+int SPLITSTREAM_API SplitstreamSplitPartitioned(SplitstreamReader* reader, SplitstreamScanner scanner, int startDepth,
+                                                size_t max, const SplitstreamKey* key, int partitions, size_t queueSize,
+                                                SplitstreamPipelineCallback callback, SplitstreamPipelineProgress progress, void* arg)
+{
+    if(!key || key->type == SPLITSTREAM_KEY_NONE || !key->name) return -1;
+    return Pipeline_Split(reader, scanner, startDepth, max, key, queueSize, partitions, callback, progress, arg);
+}
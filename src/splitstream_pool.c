@@ -0,0 +1,244 @@
+/*
+ *   splitstream_pool.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements splitting many files on a pool of threads. A file is the unit of work,
+   so documents of one file are always delivered in order by a single thread, while different
+   files are split in parallel and finish in any order.
+
+   The files are dealt out to the workers up front as contiguous ranges. A worker takes files
+   from the front of its own range, and when it runs out it steals from the back of the range
+   of another worker, so a few huge files do not leave the other threads idle. Taking a file
+   is rare compared to splitting it, so each range is simply protected by its own mutex. Every
+   worker keeps one tokenizer state, and its memory pool, for all the files it splits. */
+
+#include <splitstream_private.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    size_t head, tail;      /* Files [head, tail) are left to split */
+} Range;
+
+typedef struct {
+    const char* const* paths;
+    size_t count;
+    SplitstreamScanner scanner;
+    int startDepth;
+    size_t max, bufferSize;
+    SplitstreamPoolCallback callback;
+    void* arg;
+    SplitstreamFileResult* results;
+
+    int workers;
+    Range* ranges;
+    int stop, stopValue;
+} Pool;
+
+#ifdef _WIN32
+#define POOL_STOPPED(p) ((p)->stop)
+#else
+#define POOL_STOPPED(p) __atomic_load_n(&(p)->stop, __ATOMIC_RELAXED)
+#endif
+
+static int Pool_SplitFile(Pool* p, SplitstreamState* s, size_t file)
+{
+    SplitstreamFileResult* result = &p->results[file];
+    SplitstreamReader* reader;
+    SplitstreamDocument doc;
+    int fd, rc = 0;
+
+#ifdef _WIN32
+    fd = _open(p->paths[file], O_RDONLY | O_BINARY);
+#else
+    fd = open(p->paths[file], O_RDONLY | O_BINARY);
+#endif
+    if(fd < 0) {
+        result->error = errno;
+        return 0;
+    }
+    reader = SplitstreamReaderOpenFd(fd, p->bufferSize, 0);
+    if(!reader) {
+        result->error = ENOMEM;
+        close(fd);
+        return 0;
+    }
+    /* Starts over on a new file, keeping the memory pool of the state */
+    State_Restart(s, p->startDepth);
+    while((doc = SplitstreamGetNextDocumentFromReader(s, p->max, reader, p->scanner)).buffer) {
+        result->documents++;
+        if(p->callback) rc = p->callback(p->arg, file, &doc);
+        SplitstreamDocumentFree(s, &doc);
+        if(rc || POOL_STOPPED(p)) break;
+    }
+    if(!rc) result->error = SplitstreamReaderError(reader);
+    SplitstreamReaderClose(reader);
+    close(fd);
+    return rc;
+}
+
+#ifdef _WIN32
+
+static int Pool_Run(Pool* p)
+{
+    /* No threads on this platform; split the files one after the other */
+    SplitstreamState s;
+    size_t file;
+    int rc = 0;
+    SplitstreamInit(&s);
+    for(file = 0; file < p->count && !rc; ++file) rc = Pool_SplitFile(p, &s, file);
+    SplitstreamFree(&s);
+    return rc;
+}
+
+#else
+
+typedef struct {
+    Pool* pool;
+    int index;
+    pthread_t thread;
+} Worker;
+
+static void Pool_Stop(Pool* p, int value)
+{
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&p->stop, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        p->stopValue = value;
+}
+
+static int Pool_Take(Pool* p, int self, size_t* file)
+{
+    int i;
+    for(i = 0; i < p->workers; ++i) {
+        Range* r = &p->ranges[(self + i) % p->workers];
+        int found = 0;
+        pthread_mutex_lock(&r->lock);
+        if(r->head < r->tail) {
+            /* Own files from the front, stolen ones from the back */
+            *file = (i == 0) ? r->head++ : --r->tail;
+            found = 1;
+        }
+        pthread_mutex_unlock(&r->lock);
+        if(found) return 1;
+    }
+    return 0;
+}
+
+static void* Pool_Worker(void* arg)
+{
+    Worker* w = arg;
+    Pool* p = w->pool;
+    SplitstreamState s;
+    size_t file;
+
+    SplitstreamInit(&s);
+    while(!POOL_STOPPED(p) && Pool_Take(p, w->index, &file)) {
+        int rc = Pool_SplitFile(p, &s, file);
+        if(rc) Pool_Stop(p, rc);
+    }
+    SplitstreamFree(&s);
+    return NULL;
+}
+
+static int Pool_Run(Pool* p)
+{
+    Worker* workers;
+    size_t per, extra, next = 0;
+    int i, started;
+
+    workers = calloc((size_t)p->workers, sizeof(Worker));
+    p->ranges = calloc((size_t)p->workers, sizeof(Range));
+    if(!workers || !p->ranges) {
+        free(workers);
+        free(p->ranges);
+        return -1;
+    }
+    per = p->count / (size_t)p->workers;
+    extra = p->count % (size_t)p->workers;
+    for(i = 0; i < p->workers; ++i) {
+        Range* r = &p->ranges[i];
+        pthread_mutex_init(&r->lock, NULL);
+        r->head = next;
+        next += per + ((size_t)i < extra ? 1 : 0);
+        r->tail = next;
+        workers[i].pool = p;
+        workers[i].index = i;
+    }
+
+    /* The calling thread is worker 0. Workers that fail to start leave their files to be
+       stolen by the others. */
+    for(started = 1; started < p->workers; ++started) {
+        if(pthread_create(&workers[started].thread, NULL, Pool_Worker, &workers[started])) break;
+    }
+    Pool_Worker(&workers[0]);
+    for(i = 1; i < started; ++i) pthread_join(workers[i].thread, NULL);
+
+    for(i = 0; i < p->workers; ++i) pthread_mutex_destroy(&p->ranges[i].lock);
+    free(p->ranges);
+    free(workers);
+    return p->stopValue;
+}
+
+#endif
+
+int SPLITSTREAM_API SplitstreamSplitFiles(const char* const* paths, size_t count, SplitstreamScanner scanner,
+                                          int startDepth, size_t max, size_t bufferSize, int threads,
+                                          SplitstreamPoolCallback callback, void* arg, SplitstreamFileResult* results)
+{
+    Pool p;
+
+    if(!results || !scanner) return -1;
+    memset(results, 0, count * sizeof(SplitstreamFileResult));
+    if(!count) return 0;
+
+    memset(&p, 0, sizeof(p));
+    p.paths = paths;
+    p.count = count;
+    p.scanner = scanner;
+    p.startDepth = startDepth;
+    p.max = max ? max : 100*1024*1024;
+    p.bufferSize = bufferSize ? bufferSize : 65536;
+    p.callback = callback;
+    p.arg = arg;
+    p.results = results;
+
+    if(threads <= 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if(threads <= 0) threads = 4;
+    }
+    if((size_t)threads > count) threads = (int)count;
+    if(threads > 256) threads = 256;
+    p.workers = threads;
+
+    return Pool_Run(&p);
+}
@@ -0,0 +1,253 @@
+/*
+ *   splitstream_readahead.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements a portable read-ahead reader. A dedicated thread reads the file
+   descriptor into a ring of `depth` buffers while the scanner works on the oldest filled one.
+
+   The ring is a single-producer/single-consumer queue driven by two counters: `tail` is only
+   written by the reader thread and counts filled buffers, `head` is only written by the
+   scanner and counts released buffers. Handing a buffer over is a single atomic store. The
+   mutex and condition variable are only used to put a side to sleep when the ring is full
+   (reader) or empty (scanner) after a short spin, and are never touched while data is
+   flowing in both directions.
+
+   The thread waits for the descriptor with poll(2) together with the read end of a pipe that
+   closing the reader writes to, so a close never waits on a pipe or socket that has no data.
+   As the thread reads ahead with read(2), a regular file is moved back to just after the data
+   handed out to the scanner when the reader is closed. */
+
+#include <splitstream_private.h>
+
+#if defined(_WIN32)
+
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenReadAhead(int fd, size_t bufferSize, int depth)
+{
+    /* No reader thread on this platform; read synchronously instead */
+    (void)depth;
+    return SplitstreamReaderOpenFd(fd, bufferSize, 0);
+}
+
+#else
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPIN_COUNT  256
+
+typedef struct {
+    SplitstreamReader base;
+    int fd, wakeup[2];
+    int seekable;
+    long long offset;           /* Of the end of the data handed out, if seekable */
+    unsigned long long dev, ino;
+    unsigned depth;
+    size_t bufferSize;
+    char* buffers;
+    size_t* lengths;
+
+    unsigned head, tail;
+    int done, stop, holding;
+    int readerWaiting, scannerWaiting;
+    int readError;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ReadAheadReader;
+
+static void ReadAhead_Wake(ReadAheadReader* r, int* waiting)
+{
+    if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+static int ReadAhead_CanFill(ReadAheadReader* r)
+{
+    return __atomic_load_n(&r->stop, __ATOMIC_SEQ_CST) ||
+        r->tail - __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) < r->depth;
+}
+
+static int ReadAhead_CanConsume(ReadAheadReader* r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) != r->head ||
+        __atomic_load_n(&r->done, __ATOMIC_SEQ_CST);
+}
+
+static void ReadAhead_Wait(ReadAheadReader* r, int* waiting, int (*ready)(ReadAheadReader*))
+{
+    int spin;
+    for(spin = 0; spin < SPIN_COUNT; ++spin) {
+        if(ready(r)) return;
+    }
+    pthread_mutex_lock(&r->lock);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while(!ready(r)) pthread_cond_wait(&r->cond, &r->lock);
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Waits until `fd` can be read without blocking, or the reader is closed */
+static int ReadAhead_Poll(ReadAheadReader* r)
+{
+    struct pollfd fds[2];
+    fds[0].fd = r->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = r->wakeup[0];
+    fds[1].events = POLLIN;
+    for(;;) {
+        fds[0].revents = fds[1].revents = 0;
+        if(poll(fds, 2, -1) >= 0) break;
+        /* Let the read report anything but an interruption */
+        if(errno != EINTR) return 1;
+    }
+    return !fds[1].revents;
+}
+
+static void* ReadAhead_Thread(void* arg)
+{
+    ReadAheadReader* r = arg;
+    for(;;) {
+        unsigned slot;
+        ssize_t n;
+
+        ReadAhead_Wait(r, &r->readerWaiting, ReadAhead_CanFill);
+        if(__atomic_load_n(&r->stop, __ATOMIC_SEQ_CST)) break;
+
+        if(!ReadAhead_Poll(r)) break;
+        slot = r->tail % r->depth;
+        do {
+            n = read(r->fd, r->buffers + slot * r->bufferSize, r->bufferSize);
+        } while(n < 0 && errno == EINTR);
+        if(n <= 0) {
+            if(n < 0) r->readError = errno;
+            break;
+        }
+        r->lengths[slot] = (size_t)n;
+        __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+        ReadAhead_Wake(r, &r->scannerWaiting);
+    }
+    __atomic_store_n(&r->done, 1, __ATOMIC_SEQ_CST);
+    ReadAhead_Wake(r, &r->scannerWaiting);
+    return NULL;
+}
+
+static int ReadAhead_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    ReadAheadReader* r = (ReadAheadReader*)reader;
+    unsigned slot;
+
+    if(r->holding) {
+        /* Hand the buffer the scanner just finished with back to the reader thread */
+        r->holding = 0;
+        __atomic_store_n(&r->head, r->head + 1, __ATOMIC_SEQ_CST);
+        ReadAhead_Wake(r, &r->readerWaiting);
+    }
+
+    ReadAhead_Wait(r, &r->scannerWaiting, ReadAhead_CanConsume);
+    if(__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == r->head) {
+        /* The reader thread is done and everything it read has been consumed */
+        if(r->readError) {
+            reader->error = r->readError;
+            return -1;
+        }
+        return 0;
+    }
+
+    slot = r->head % r->depth;
+    *buf = r->buffers + slot * r->bufferSize;
+    *len = r->lengths[slot];
+    r->offset += (long long)*len;
+    r->holding = 1;
+    return 1;
+}
+
+static void ReadAhead_Free(ReadAheadReader* r)
+{
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    if(r->wakeup[0] >= 0) close(r->wakeup[0]);
+    if(r->wakeup[1] >= 0) close(r->wakeup[1]);
+    free(r->buffers);
+    free(r->lengths);
+    free(r);
+}
+
+static void ReadAhead_Close(SplitstreamReader* reader)
+{
+    ReadAheadReader* r = (ReadAheadReader*)reader;
+    char c = 0;
+    __atomic_store_n(&r->stop, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    while(write(r->wakeup[1], &c, 1) < 0 && errno == EINTR);
+    pthread_join(r->thread, NULL);
+    /* Leave the descriptor positioned after the data handed out, as read(2) would have */
+    if(r->seekable) Reader_Seek(r->fd, r->dev, r->ino, r->offset);
+    ReadAhead_Free(r);
+}
+
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenReadAhead(int fd, size_t bufferSize, int depth)
+{
+    ReadAheadReader* r;
+
+    if(fd < 0) return NULL;
+    if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 1024;
+    if(depth < 2) depth = 2;
+    if(depth > 64) depth = 64;
+
+    r = calloc(1, sizeof(ReadAheadReader));
+    if(!r) return NULL;
+    r->base.read = ReadAhead_Read;
+    r->base.close = ReadAhead_Close;
+    r->fd = fd;
+    r->depth = (unsigned)depth;
+    r->bufferSize = bufferSize;
+    r->buffers = malloc(r->depth * bufferSize);
+    r->lengths = malloc(r->depth * sizeof(size_t));
+    r->wakeup[0] = r->wakeup[1] = -1;
+    {
+        struct stat st;
+        if(!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            if(pos >= 0) {
+                r->seekable = 1;
+                r->offset = pos;
+                r->dev = (unsigned long long)st.st_dev;
+                r->ino = (unsigned long long)st.st_ino;
+            }
+        }
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if(!r->buffers || !r->lengths || pipe(r->wakeup) ||
+       pthread_create(&r->thread, NULL, ReadAhead_Thread, r)) {
+        ReadAhead_Free(r);
+        return NULL;
+    }
+    return &r->base;
+}
+
+#endif
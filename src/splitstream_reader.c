@@ -0,0 +1,181 @@
+/*
+ *   splitstream_reader.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the generic reader driver and the synchronous file descriptor reader.
+   Regular files are read with pread(2) from a tracked offset, anything else (pipes, sockets,
+   terminals) with read(2). */
+
+#include <splitstream_private.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+    SplitstreamReader base;
+    int fd, seekable;
+    long long offset;
+    unsigned long long dev, ino;
+    size_t bufferSize;
+    char* buf;
+} FdReader;
+
+/* Moves `fd` to `offset`, or to the end of the file if it is negative. The caller may already
+   have closed the descriptor and the number may belong to another file by now, so it is only
+   moved if it still refers to the file the reader was opened on. */
+void Reader_Seek(int fd, unsigned long long dev, unsigned long long ino, long long offset)
+{
+#ifndef _WIN32
+    struct stat st;
+    if(fstat(fd, &st) || (unsigned long long)st.st_dev != dev || (unsigned long long)st.st_ino != ino) return;
+    if(offset < 0) lseek(fd, 0, SEEK_END);
+    else lseek(fd, (off_t)offset, SEEK_SET);
+#else
+    (void)fd; (void)dev; (void)ino; (void)offset;
+#endif
+}
+
+static int FdReader_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    FdReader* r = (FdReader*)reader;
+    long long n;
+    do {
+#ifdef _WIN32
+        n = _read(r->fd, r->buf, (unsigned int)r->bufferSize);
+#else
+        if(r->seekable) n = pread(r->fd, r->buf, r->bufferSize, (off_t)r->offset);
+        else n = read(r->fd, r->buf, r->bufferSize);
+#endif
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0) {
+        reader->error = errno;
+        return -1;
+    }
+    r->offset += n;
+    *buf = r->buf;
+    *len = (size_t)n;
+    return n > 0;
+}
+
+static void FdReader_Close(SplitstreamReader* reader)
+{
+    FdReader* r = (FdReader*)reader;
+#ifndef _WIN32
+    /* Leave the descriptor positioned after the data we consumed, as read(2) would have */
+    if(r->seekable) Reader_Seek(r->fd, r->dev, r->ino, r->offset);
+#endif
+    free(r->buf);
+    free(r);
+}
+
+static SplitstreamReader* FdReader_New(int fd, size_t bufferSize)
+{
+    FdReader* r = malloc(sizeof(FdReader));
+    if(!r) return NULL;
+    r->buf = malloc(bufferSize);
+    if(!r->buf) {
+        free(r);
+        return NULL;
+    }
+    r->base.read = FdReader_Read;
+    r->base.close = FdReader_Close;
+    r->base.error = 0;
+    r->fd = fd;
+    r->bufferSize = bufferSize;
+    r->seekable = 0;
+    r->offset = 0;
+#ifndef _WIN32
+    {
+        struct stat st;
+        if(!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            if(pos >= 0) {
+                r->seekable = 1;
+                r->offset = pos;
+                r->dev = (unsigned long long)st.st_dev;
+                r->ino = (unsigned long long)st.st_ino;
+            }
+        }
+    }
+#endif
+    return &r->base;
+}
+
+SplitstreamReader* SPLITSTREAM_API SplitstreamReaderOpenFd(int fd, size_t bufferSize, int queueDepth)
+{
+    SplitstreamReader* r = NULL;
+    if(fd < 0) return NULL;
+    if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 1024;
+    if(queueDepth > 1) r = uring_ReaderNew(fd, bufferSize, queueDepth);
+    if(!r) r = FdReader_New(fd, bufferSize);
+    return r;
+}
+
+void SPLITSTREAM_API SplitstreamReaderClose(SplitstreamReader* reader)
+{
+    if(reader) reader->close(reader);
+}
+
+int SPLITSTREAM_API SplitstreamReaderError(SplitstreamReader* reader)
+{
+    return reader ? reader->error : EINVAL;
+}
+
+SplitstreamDocument SPLITSTREAM_API SplitstreamGetNextDocumentFromReader(SplitstreamState* s, size_t max, SplitstreamReader* reader, SplitstreamScanner scanner)
+{
+    SplitstreamDocument doc = { NULL, 0 };
+    const char* buf;
+    size_t len;
+    int rc = 1;
+
+    if(s->flags & SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT) {
+        doc = SplitstreamGetNextDocument(s, max, NULL, 0, scanner);
+        if(doc.buffer || (s->ring && s->ring->full)) return doc;
+        s->flags &= ~SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
+    }
+    if(s->ring && s->ring->pending) {
+        /* Input that did not fit in the ring last time; the reader has not been called since */
+        doc = SplitstreamGetNextDocument(s, max, s->ring->pending, s->ring->pendingLength, scanner);
+        if(s->ring->full) return doc;
+        s->ring->pending = NULL;
+        if(doc.buffer) {
+            s->flags |= SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
+            return doc;
+        }
+    }
+
+    while(reader && (rc = reader->read(reader, &buf, &len)) > 0) {
+        doc = SplitstreamGetNextDocument(s, max, buf, len, scanner);
+        if(doc.buffer) {
+            s->flags |= SPLITSTREAM_STATE_FLAG_DID_RETURN_DOCUMENT;
+            return doc;
+        }
+        if(s->ring && s->ring->full) {
+            s->ring->pending = buf;
+            s->ring->pendingLength = len;
+            return doc;
+        }
+    }
+    if(reader && !rc) doc = SplitstreamGetLastDocument(s, max, scanner);
+    return doc;
+}
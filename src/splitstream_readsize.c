@@ -0,0 +1,87 @@
+/*
+ *   splitstream_readsize.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the adaptive read size. The tokenizer passes the length of every
+   document it returns to ReadSize_Document, which keeps a moving average of 1/8 weight, and
+   the reader reports each read to SplitstreamReadSizeUpdate, which moves the read size one
+   step (a factor of 2) towards 4 times the document size. Steps keep a single odd document
+   from swinging the read size, and the factor of 4 was found to be about where the copying
+   of the rest of the buffer after each document starts to cost more than the calls saved. */
+
+#include <splitstream_private.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#define DEFAULT_MIN     4096
+#define DEFAULT_MAX     (1024 * 1024)
+
+void SPLITSTREAM_API SplitstreamSetReadSize(SplitstreamState* s, SplitstreamReadSize* readSize)
+{
+    s->readSize = readSize;
+    if(!readSize) return;
+    if(!readSize->min) readSize->min = DEFAULT_MIN;
+    if(!readSize->max) readSize->max = DEFAULT_MAX;
+    if(readSize->max < readSize->min) readSize->max = readSize->min;
+    readSize->size = readSize->min;
+    readSize->average = 0;
+    readSize->advised = 0;
+}
+
+void SPLITSTREAM_API SplitstreamReadSizeUpdate(SplitstreamState* s, size_t requested, size_t got)
+{
+    SplitstreamReadSize* rs = s->readSize;
+    size_t docSize, target;
+
+    if(!rs) return;
+    /* A large document in progress counts before it ends, or the reads would only grow once
+       it is done */
+    docSize = rs->average > s->doc.length ? rs->average : s->doc.length;
+    target = docSize < rs->max / 4 ? docSize * 4 : rs->max;
+
+    if(got >= requested && rs->size < target) rs->size *= 2;
+    else if(rs->size / 2 >= target) rs->size /= 2;
+    if(rs->size < rs->min) rs->size = rs->min;
+    if(rs->size > rs->max) rs->size = rs->max;
+}
+
+void ReadSize_Document(SplitstreamReadSize* rs, size_t length)
+{
+    if(!rs->average) rs->average = length;
+    else rs->average = rs->average - rs->average / 8 + length / 8;
+}
+
+/* Tells the kernel that a regular file will be read sequentially, once */
+void ReadSize_Advise(SplitstreamReadSize* rs, FILE* file)
+{
+    if(rs->advised) return;
+    rs->advised = 1;
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+    {
+        struct stat st;
+        int fd = fileno(file);
+        if(fd >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode)) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+#else
+    (void)file;
+#endif
+}
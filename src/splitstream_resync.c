@@ -0,0 +1,90 @@
+/*
+ *   splitstream_resync.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements recovering from malformed input. The scanners know when a document
+   has gone wrong (a line start inside it, or a string that is too long), but not where it
+   began or what has been buffered of it, so they call Resync_Restart to reset themselves to
+   the state between documents and return with SPLITSTREAM_STATE_FLAG_RESYNC set and the
+   position to resume at in resyncAt. The tokenizer then drops the document with Resync_Skip,
+   which reports the range from the start of the document (kept in the policy, since the
+   document may have started many buffers ago), and goes on scanning from that position.
+
+   A token that is too long is only noticed at its end or at the end of a buffer. In the latter
+   case, the scanner stays in the token, so that scanning resumes after it, but stops the
+   document from being buffered any further with Resync_Discard, which marks it skipped like
+   the filter does. */
+
+#include <splitstream_private.h>
+
+void SPLITSTREAM_API SplitstreamSetResync(SplitstreamState* s, SplitstreamResync* resync)
+{
+    s->resync = resync;
+    s->flags &= ~(SPLITSTREAM_STATE_FLAG_RESYNC | SPLITSTREAM_STATE_FLAG_RESYNC_WAIT);
+    if(resync) {
+        resync->resyncs = 0;
+        resync->bytes = 0;
+        resync->start = -1;
+    }
+}
+
+void Resync_Reset(SplitstreamState* s)
+{
+    s->state = State_Init;
+    s->depth = s->startDepth;
+    /* The kind of container at the start depth is kept */
+    s->counter[0] = s->counter[1] = s->counter[SPLITSTREAM_COUNTER_TOKEN] = 0;
+    if(s->resync->lineStart) s->flags |= SPLITSTREAM_STATE_FLAG_RESYNC_WAIT;
+}
+
+/* Called by a scanner to give up on the document and resume scanning at buf[at] */
+size_t Resync_Restart(SplitstreamState* s, const char* buf, size_t at)
+{
+    Resync_Reset(s);
+    if(at) s->last = buf[at - 1];
+    s->resyncAt = at;
+    s->flags |= SPLITSTREAM_STATE_FLAG_RESYNC;
+    return 0;
+}
+
+/* Called by a scanner to stop buffering a document that it will give up on later */
+void Resync_Discard(SplitstreamState* s)
+{
+    s->flags |= SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT;
+    SplitstreamDocumentFree(s, &s->doc);
+}
+
+void Resync_Report(SplitstreamResync* resync, long long start, long long end)
+{
+    if(end <= start) return;
+    resync->resyncs++;
+    resync->bytes += (unsigned long long)(end - start);
+    if(resync->skipped) resync->skipped(resync->arg, start, end);
+}
+
+/* Drops the document in progress, if any, which was given up on at stream offset `end`. Text
+   between documents (such as a stray string) is dropped without being reported. */
+void Resync_Skip(SplitstreamState* s, long long end)
+{
+    SplitstreamResync* resync = s->resync;
+
+    if(resync->start >= 0) Resync_Report(resync, resync->start, end);
+    resync->start = -1;
+    SplitstreamDocumentFree(s, &s->doc);
+    s->matchState = 0;
+    s->flags &= ~(SPLITSTREAM_STATE_FLAG_SKIP_DOCUMENT | SPLITSTREAM_STATE_FLAG_ACCEPTED | SPLITSTREAM_STATE_FLAG_FRAGMENTED);
+}
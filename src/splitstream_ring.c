@@ -0,0 +1,153 @@
+/*
+ *   splitstream_ring.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements document storage in a ring buffer supplied by the caller. Documents
+   are stored one after the other and released in the order they were returned, so storing
+   one is a matter of moving the head and releasing one a matter of moving the tail.
+
+   The document being scanned is a reservation at the head of the ring, which grows in place
+   as input arrives and becomes a returned document by moving the head past it. A document
+   is always contiguous, so if the reservation does not fit before the end of the buffer it
+   is moved to the beginning, and the ring wraps: the documents are then stored in
+   [tail, end) followed by [0, head). Input kept for rescanning is not stored in the ring.
+
+   Before any input is scanned, the ring must have room for all of it, since scanning cannot
+   be undone. If it does not, the input is left alone and the caller is told that the ring
+   is full. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+void SPLITSTREAM_API SplitstreamRingInit(SplitstreamRing* ring, void* buffer, size_t size)
+{
+    memset(ring, 0, sizeof(SplitstreamRing));
+    ring->buffer = buffer;
+    ring->size = size;
+}
+
+void SPLITSTREAM_API SplitstreamSetRing(SplitstreamState* state, SplitstreamRing* ring)
+{
+    state->ring = ring;
+}
+
+int Ring_Contains(const SplitstreamRing* r, const char* p)
+{
+    return p && p >= r->buffer && p < r->buffer + r->size;
+}
+
+static int Ring_IsEmpty(const SplitstreamRing* r)
+{
+    return !r->wrapped && r->tail == r->head;
+}
+
+/* Makes room for a reservation of `length` bytes in total, moving the current reservation
+   if needed. Returns the start of the reservation or NULL if there is no room. */
+static char* Ring_Reserve(SplitstreamRing* r, size_t length)
+{
+    if(r->wrapped) return (length <= r->tail - r->head) ? r->buffer + r->head : NULL;
+    if(length <= r->size - r->head) return r->buffer + r->head;
+    if(Ring_IsEmpty(r)) {
+        if(length > r->size) return NULL;
+        memmove(r->buffer, r->buffer + r->head, r->reserved);
+        r->head = r->tail = 0;
+        return r->buffer;
+    }
+    if(length > r->tail) return NULL;
+    memcpy(r->buffer, r->buffer + r->head, r->reserved);
+    r->end = r->head;
+    r->head = 0;
+    r->wrapped = 1;
+    return r->buffer;
+}
+
+/* Called before scanning `len` more bytes. Everything appended to the reservation while
+   they are scanned comes from them or from the current document (which may be input kept
+   for rescanning, stored outside the ring), so this is enough room for the whole call. */
+int Ring_Prepare(SplitstreamState* s, size_t len)
+{
+    SplitstreamRing* r = s->ring;
+    char* p = Ring_Reserve(r, s->doc.length + len);
+    if(!p && Ring_IsEmpty(r) && s->state != State_Rescan) {
+        /* The document will never fit; drop it like a document larger than `max`. None of it
+           is scanned any more, so the scan starts over at the start depth. */
+        SplitstreamDocumentFree(s, &s->doc);
+        s->state = State_Init;
+        s->depth = s->startDepth;
+        /* The kind of container at the start depth is kept */
+        s->counter[0] = s->counter[1] = s->counter[SPLITSTREAM_COUNTER_TOKEN] = 0;
+        s->matchState = 0;
+        s->flags &= ~(SPLITSTREAM_STATE_FLAG_ACCEPTED | SPLITSTREAM_STATE_FLAG_FRAGMENTED);
+        p = Ring_Reserve(r, len);
+    }
+    r->full = !p;
+    if(!p) return -1;
+    if(r->reserved) s->doc.buffer = p;
+    return 0;
+}
+
+/* Appends to the reservation, which has room after Ring_Prepare */
+void Ring_Append(SplitstreamState* s, SplitstreamDocument* dest, const char* ptr, size_t length)
+{
+    SplitstreamRing* r = s->ring;
+    char* p = r->buffer + r->head;
+    if(!length) return;
+    if(dest->buffer && !Ring_Contains(r, dest->buffer)) {
+        /* A document restored by SplitstreamStateDeserialize moves into the ring */
+        memcpy(p, dest->buffer, dest->length);
+        r->reserved = dest->length;
+        SplitstreamDocumentFree(s, dest);
+        dest->length = r->reserved;
+    }
+    dest->buffer = p;
+    memcpy(p + dest->length, ptr, length);
+    dest->length += length;
+    r->reserved += length;
+}
+
+/* The reservation becomes a returned document */
+void Ring_Commit(SplitstreamRing* r)
+{
+    r->head += r->reserved;
+    r->reserved = 0;
+}
+
+/* Whether the document at `pos` has been returned and not released yet */
+static int Ring_IsHeld(const SplitstreamRing* r, size_t pos)
+{
+    if(r->wrapped) return pos >= r->tail || pos < r->head;
+    return pos >= r->tail && pos < r->head;
+}
+
+void Ring_Free(SplitstreamRing* r, const char* p, size_t length)
+{
+    size_t pos = (size_t)(p - r->buffer);
+    if(r->reserved && pos == r->head) {
+        r->reserved = 0;
+        return;
+    }
+    /* Already released along with a document returned after it */
+    if(!Ring_IsHeld(r, pos)) return;
+    /* Releasing a document releases everything returned before it */
+    if(r->wrapped && pos < r->tail) r->wrapped = 0;
+    r->tail = pos + length;
+    if(r->wrapped && r->tail == r->end) {
+        r->tail = 0;
+        r->wrapped = 0;
+    }
+    if(Ring_IsEmpty(r) && !r->reserved) r->head = r->tail = 0;
+}
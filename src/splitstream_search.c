@@ -0,0 +1,68 @@
+/*
+ *   splitstream_search.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the byte searches of the scanners that skip over runs of bytes they
+   have no interest in, rather than switching on every byte. With SSE2 (always there on x86-64),
+   16 bytes are compared at a time; otherwise 8 bytes at a time in a 64-bit word, using the
+   usual test for a zero byte on the word XORed with the byte searched for. Define
+   SPLITSTREAM_NO_SIMD to use the latter everywhere. */
+
+#include <splitstream_private.h>
+#include <string.h>
+#if defined(__SSE2__) && !defined(SPLITSTREAM_NO_SIMD)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ONES    0x0101010101010101ULL
+#define HIGHS   0x8080808080808080ULL
+/* Nonzero if a byte of x is zero */
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+/* Returns the first of the bytes a, b or c in [p, end), or end */
+const char* Search_Any(const char* p, const char* end, char a, char b, char c)
+{
+#ifdef USE_SSE2
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+    while(end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                                  _mm_cmpeq_epi8(v, vc)));
+        if(mask) {
+            while(!(mask & 1)) {
+                mask >>= 1;
+                ++p;
+            }
+            return p;
+        }
+        p += 16;
+    }
+#else
+    unsigned long long wa = ONES * (unsigned char)a, wb = ONES * (unsigned char)b, wc = ONES * (unsigned char)c;
+    while(end - p >= 8) {
+        unsigned long long w;
+        memcpy(&w, p, 8);
+        if(HAS_ZERO(w ^ wa) | HAS_ZERO(w ^ wb) | HAS_ZERO(w ^ wc)) break;
+        p += 8;
+    }
+#endif
+    for(; p != end; ++p) {
+        if(*p == a || *p == b || *p == c) break;
+    }
+    return p;
+}
@@ -0,0 +1,159 @@
+/*
+ *   splitstream_separator.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the separator scanner. Within a buffer, the separator is found by
+   searching for one of its bytes with memchr, which the C library vectorizes, and comparing
+   the rest with memcmp. The anchor byte is the first one that is not white space, since a
+   separator like "\n---\n" would otherwise stop at every line. When the buffer ends with the
+   beginning of a separator, the number of bytes matched is kept in the state, and the next
+   buffer continues the match byte by byte (with the usual KMP fallback table, so overlapping
+   separators are found) until it is complete or cannot be.
+
+   A record always starts at the first byte after a separator and ends after the next one,
+   which is where the scanner returns. If the separator is not kept, the tokenizer is told
+   with SPLITSTREAM_STATE_FLAG_STRIP to leave it out, including the part of it that it may
+   already have buffered. A record that holds nothing but the separator is dropped like the
+   CSV header, by starting the next one. */
+
+#include <splitstream_private.h>
+#include <string.h>
+
+static const int COUNTER_MATCHED = 0;   /* Bytes of the separator at the end of the input so far */
+static const int COUNTER_LENGTH = 1;    /* Length of the record so far, up to the separator length + 1 */
+
+static const SplitstreamSeparator NEWLINE = { "\n", 1 };
+
+static const SplitstreamSeparator* Separator_Get(const SplitstreamState* s)
+{
+    return s->separator ? s->separator : &NEWLINE;
+}
+
+size_t Separator_Length(const SplitstreamState* s)
+{
+    return Separator_Get(s)->length;
+}
+
+int SPLITSTREAM_API SplitstreamSetSeparator(SplitstreamState* s, SplitstreamSeparator* separator)
+{
+    const char* bytes;
+    size_t i, k;
+
+    if(separator) {
+        bytes = separator->bytes;
+        if(!bytes || !separator->length || separator->length > SPLITSTREAM_SEPARATOR_MAX) return -1;
+        /* fallback[n] is the longest proper prefix of the separator that ends its first n bytes */
+        separator->fallback[0] = separator->fallback[1] = 0;
+        for(i = 1, k = 0; i < separator->length; ++i) {
+            while(k && bytes[i] != bytes[k]) k = separator->fallback[k];
+            if(bytes[i] == bytes[k]) ++k;
+            separator->fallback[i + 1] = (unsigned char)k;
+        }
+        separator->anchor = 0;
+        for(i = 0; i < separator->length; ++i) {
+            if(!strchr(" \t\r\n", bytes[i]) || !bytes[i]) {
+                separator->anchor = i;
+                break;
+            }
+        }
+    }
+    s->separator = separator;
+    return 0;
+}
+
+/* Returns the first separator that starts in [p, end), or end, in which case `matched` is set
+   to the length of the longest end of the buffer that begins the separator */
+static const char* Separator_Find(const SplitstreamSeparator* sep, const char* p, const char* end, size_t* matched)
+{
+    const char* bytes = sep->bytes;
+    size_t length = sep->length, anchor = sep->anchor;
+
+    *matched = 0;
+    if((size_t)(end - p) >= length) {
+        const char* q = p + anchor, *last = end - length + anchor + 1;
+        while(q < last && (q = memchr(q, bytes[anchor], (size_t)(last - q)))) {
+            if(!memcmp(q - anchor, bytes, length)) return q - anchor;
+            ++q;
+        }
+        /* No whole separator starts before this */
+        p = end - length + 1;
+    }
+    for(; p != end; ++p) {
+        if(*p == bytes[0] && !memcmp(p, bytes, (size_t)(end - p))) {
+            *matched = (size_t)(end - p);
+            break;
+        }
+    }
+    return end;
+}
+
+size_t SplitstreamSeparatorScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start)
+{
+    const SplitstreamSeparator* sep = Separator_Get(s);
+    const char* bytes = sep->bytes, *end = buf + len, *cp = buf, *record = buf;
+    size_t matched = (size_t)s->counter[COUNTER_MATCHED];
+    size_t length = (size_t)s->counter[COUNTER_LENGTH];
+
+    for(;;) {
+        if(s->state == State_Init) {
+            if(cp == end) break;
+            *start = (size_t)(cp - buf);
+            record = cp;
+            length = 0;
+            s->state = State_Record;
+        }
+        /* Continue the separator begun by the previous input until it is complete or gone */
+        while(matched && matched < sep->length && cp != end) {
+            while(matched && bytes[matched] != *cp) matched = sep->fallback[matched];
+            if(bytes[matched] == *cp) ++matched;
+            ++cp;
+        }
+        if(matched < sep->length) {
+            if(cp == end) break;
+            cp = Separator_Find(sep, cp, end, &matched);
+            if(cp == end) break;
+            cp += sep->length;
+        }
+
+        /* The end of the record */
+        length += (size_t)(cp - record);
+        matched = 0;
+        s->state = State_Init;
+        if(length == sep->length) continue;   /* Nothing but the separator */
+        s->counter[COUNTER_MATCHED] = s->counter[COUNTER_LENGTH] = 0;
+        if(!sep->keep) s->flags |= SPLITSTREAM_STATE_FLAG_STRIP;
+        return (size_t)(cp - buf);
+    }
+
+    if(s->state == State_Record) {
+        length += (size_t)(end - record);
+        if(length > sep->length) length = sep->length + 1;
+        if(s->flags & SPLITSTREAM_STATE_FLAG_END_OF_INPUT) {
+            /* The last record, which is not followed by a separator */
+            s->state = State_Init;
+            s->counter[COUNTER_MATCHED] = s->counter[COUNTER_LENGTH] = 0;
+            if(!len) {
+                s->flags |= SPLITSTREAM_STATE_FLAG_ENDED;
+                return 0;
+            }
+            return len;
+        }
+    }
+    s->counter[COUNTER_MATCHED] = (int)matched;
+    s->counter[COUNTER_LENGTH] = (int)length;
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ *   splitstream_uring.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements a read-ahead file reader on top of Linux io_uring. The file is read
+   into a ring of `queueDepth` buffers which are registered with the kernel, and all buffers
+   that are not currently handed out to the scanner have a read queued on them. Reads are
+   issued at increasing file offsets and consumed strictly in order, so a completion that
+   arrives early simply waits in its slot.
+
+   The system calls are made directly, so there is no dependency on liburing. Whenever the
+   kernel (or a seccomp policy) refuses to set up the ring, uring_ReaderNew returns NULL and
+   the caller falls back to the synchronous pread(2) reader. Only regular files are handled
+   here since queued reads on pipes or sockets would not complete in stream order. */
+
+#include <splitstream_private.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define SLOT_PENDING    (-1 - 0x7fffffff)
+
+typedef struct {
+    SplitstreamReader base;
+    int fd, ring;
+    unsigned depth, head, inflight;
+    int current, eof;
+    size_t bufferSize;
+    long long nextOffset;
+    unsigned long long dev, ino;
+    char* buffers;
+    int* results;
+    long long* offsets;
+
+    void* sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize, sqesSize;
+    struct io_uring_sqe* sqes;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe* cqes;
+} UringReader;
+
+static int uring_Setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_Enter(int ring, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uring_Register(int ring, unsigned opcode, const void* arg, unsigned nargs)
+{
+    return (int)syscall(__NR_io_uring_register, ring, opcode, arg, nargs);
+}
+
+static void uring_Reap(UringReader* r)
+{
+    unsigned head = *r->cqHead;
+    unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    while(head != tail) {
+        struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+        r->results[cqe->user_data] = cqe->res;
+        --r->inflight;
+        ++head;
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static int uring_Submit(UringReader* r, unsigned slot)
+{
+    unsigned tail = *r->sqTail, index = tail & *r->sqMask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    int rc;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = r->fd;
+    sqe->addr = (unsigned long)(r->buffers + slot * r->bufferSize);
+    sqe->len = (unsigned)r->bufferSize;
+    sqe->off = (unsigned long long)r->nextOffset;
+    sqe->buf_index = (unsigned short)slot;
+    sqe->user_data = slot;
+    r->sqArray[index] = index;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    r->results[slot] = SLOT_PENDING;
+    r->offsets[slot] = r->nextOffset;
+    r->nextOffset += (long long)r->bufferSize;
+
+    do {
+        rc = uring_Enter(r->ring, 1, 0, 0);
+    } while(rc < 0 && errno == EINTR);
+    if(rc < 0 && __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == tail) {
+        /* The kernel did not take the entry. Take it back, or the next submission would pick
+           it up as well and complete a read nobody waits for. The slot keeps its offset and
+           is read with pread(2) when its turn comes. */
+        r->results[slot] = -errno;
+        __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+        return -1;
+    }
+    ++r->inflight;
+    return 0;
+}
+
+static int uring_Wait(UringReader* r, unsigned slot)
+{
+    uring_Reap(r);
+    while(r->results[slot] == SLOT_PENDING) {
+        if(uring_Enter(r->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            r->results[slot] = -errno;
+            break;
+        }
+        uring_Reap(r);
+    }
+    return r->results[slot];
+}
+
+static int uring_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    UringReader* r = (UringReader*)reader;
+    char* data;
+    int res;
+
+    if(r->eof) return 0;
+
+    /* The scanner is done with the buffer we handed out last time; queue the next read on it.
+       If that fails, the slot holds the error and is filled below when it is due. */
+    if(r->current >= 0) {
+        uring_Submit(r, (unsigned)r->current);
+        r->current = -1;
+    }
+
+    res = uring_Wait(r, r->head);
+    data = r->buffers + r->head * r->bufferSize;
+    if(res < 0) {
+        /* Let the synchronous path have a go at it; it gives a proper errno when it fails too */
+        res = 0;
+    }
+    if((size_t)res < r->bufferSize) {
+        /* Short read: fill the rest of the buffer so the stream stays contiguous with the
+           reads already queued behind this one. */
+        long long off = r->offsets[r->head];
+        while((size_t)res < r->bufferSize) {
+            ssize_t n = pread(r->fd, data + res, r->bufferSize - res, (off_t)(off + res));
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0) {
+                reader->error = errno;
+                r->eof = 1;
+                return -1;
+            }
+            if(n == 0) {
+                r->eof = 1;
+                break;
+            }
+            res += (int)n;
+        }
+        if(!res) return 0;
+    }
+
+    *buf = data;
+    *len = (size_t)res;
+    r->current = (int)r->head;
+    r->head = (r->head + 1) % r->depth;
+    return 1;
+}
+
+static void uring_Free(UringReader* r)
+{
+    while(r->inflight > 0) {
+        if(uring_Enter(r->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) break;
+        uring_Reap(r);
+    }
+    if(r->sqes) munmap(r->sqes, r->sqesSize);
+    if(r->cqMap && r->cqMap != r->sqMap) munmap(r->cqMap, r->cqMapSize);
+    if(r->sqMap) munmap(r->sqMap, r->sqMapSize);
+    if(r->ring >= 0) close(r->ring);
+    free(r->buffers);
+    free(r->results);
+    free(r->offsets);
+    free(r);
+}
+
+static void uring_Close(SplitstreamReader* reader)
+{
+    UringReader* r = (UringReader*)reader;
+
+    /* Leave the descriptor positioned after the data handed to the scanner */
+    if(r->eof) Reader_Seek(r->fd, r->dev, r->ino, -1);
+    else if(r->current >= 0) Reader_Seek(r->fd, r->dev, r->ino, r->offsets[r->current] + (long long)r->bufferSize);
+    else Reader_Seek(r->fd, r->dev, r->ino, r->offsets[r->head]);
+    uring_Free(r);
+}
+
+SplitstreamReader* uring_ReaderNew(int fd, size_t bufferSize, int queueDepth)
+{
+    struct io_uring_params p;
+    struct iovec* iov;
+    struct stat st;
+    UringReader* r;
+    off_t pos;
+    unsigned i;
+
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)) return NULL;
+    if((pos = lseek(fd, 0, SEEK_CUR)) < 0) return NULL;
+    if(bufferSize > 0x7fffffff) return NULL;
+    if(queueDepth > 64) queueDepth = 64;
+
+    r = calloc(1, sizeof(UringReader));
+    if(!r) return NULL;
+    r->base.read = uring_Read;
+    r->base.close = uring_Close;
+    r->fd = fd;
+    r->ring = -1;
+    r->current = -1;
+    r->depth = (unsigned)queueDepth;
+    r->bufferSize = bufferSize;
+    r->nextOffset = pos;
+    r->dev = (unsigned long long)st.st_dev;
+    r->ino = (unsigned long long)st.st_ino;
+
+    memset(&p, 0, sizeof(p));
+    r->ring = uring_Setup(r->depth, &p);
+    if(r->ring < 0) goto fail;
+
+    r->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(r->cqMapSize > r->sqMapSize) r->sqMapSize = r->cqMapSize;
+        r->cqMapSize = r->sqMapSize;
+    }
+    r->sqMap = mmap(NULL, r->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring, IORING_OFF_SQ_RING);
+    if(r->sqMap == MAP_FAILED) { r->sqMap = NULL; goto fail; }
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqMap = r->sqMap;
+    } else {
+        r->cqMap = mmap(NULL, r->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring, IORING_OFF_CQ_RING);
+        if(r->cqMap == MAP_FAILED) { r->cqMap = NULL; goto fail; }
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED) { r->sqes = NULL; goto fail; }
+    r->depth = p.sq_entries < r->depth ? p.sq_entries : r->depth;
+
+    r->sqHead = (unsigned*)((char*)r->sqMap + p.sq_off.head);
+    r->sqTail = (unsigned*)((char*)r->sqMap + p.sq_off.tail);
+    r->sqMask = (unsigned*)((char*)r->sqMap + p.sq_off.ring_mask);
+    r->sqArray = (unsigned*)((char*)r->sqMap + p.sq_off.array);
+    r->cqHead = (unsigned*)((char*)r->cqMap + p.cq_off.head);
+    r->cqTail = (unsigned*)((char*)r->cqMap + p.cq_off.tail);
+    r->cqMask = (unsigned*)((char*)r->cqMap + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cqMap + p.cq_off.cqes);
+
+    r->results = malloc(r->depth * sizeof(int));
+    r->offsets = malloc(r->depth * sizeof(long long));
+    if(posix_memalign((void**)&r->buffers, 4096, r->depth * bufferSize)) r->buffers = NULL;
+    iov = malloc(r->depth * sizeof(struct iovec));
+    if(!r->results || !r->offsets || !r->buffers || !iov) {
+        free(iov);
+        goto fail;
+    }
+    for(i = 0; i < r->depth; ++i) {
+        iov[i].iov_base = r->buffers + i * bufferSize;
+        iov[i].iov_len = bufferSize;
+    }
+    i = uring_Register(r->ring, IORING_REGISTER_BUFFERS, iov, r->depth) < 0;
+    free(iov);
+    if(i) goto fail;
+
+    for(i = 0; i < r->depth; ++i) {
+        if(uring_Submit(r, i) < 0) goto fail;
+    }
+    return &r->base;
+
+fail:
+    uring_Free(r);
+    return NULL;
+}
+
+#else /* HAVE_IO_URING */
+
+SplitstreamReader* uring_ReaderNew(int fd, size_t bufferSize, int queueDepth)
+{
+    (void)fd; (void)bufferSize; (void)queueDepth;
+    return NULL;
+}
+
+#endif /* HAVE_IO_URING */
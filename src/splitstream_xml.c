@@ -17,14 +17,46 @@
  */
 
 #include <splitstream_private.h>
+#include <limits.h>
 
 const int COUNTER_DASH = 0;
 const int COUNTER_CLOSING_BRACKET = 1;
 
+/* Set if the current character starts a line. The previous character is s->last at the
+   start of the buffer. */
+#define AT_LINE_START (cp != buf ? cp[-1] == '\n' : s->last == '\n')
+/* Set if the current character starts a line inside a document (below the start depth, or in
+   any markup), which the resync policy takes as the start of a new document */
+#define RESYNC_ANCHOR (lineStart && (s->depth > s->startDepth || state != State_Document) && AT_LINE_START)
+
+/* Starts a comment, CDATA section or processing instruction, whose length may be limited */
+#define TOKEN_BEGIN \
+		token = cp + 1; \
+		tokenLength = 0;
+
+/* Ends a token at the current character, giving up on the document if it was too long */
+#define TOKEN_END \
+		if(maxToken && tokenLength + (size_t)(cp - token) > maxToken) { \
+			return Resync_Restart(s, buf, (size_t)(cp - buf + 1)); \
+		}
+
+/* Continues with the next case unless the character is an anchor. Where that case is not a
+   break, mark the fall through after the macro: a comment in the macro body is stripped
+   before the compiler looks for it */
+#define CHECK_ANCHOR \
+		case '<': \
+			if(RESYNC_ANCHOR) return Resync_Restart(s, buf, (size_t)(cp - buf));
+
 size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, size_t* start) {
     int dashCounter = s->counter[COUNTER_DASH], bracketCounter = s->counter[COUNTER_CLOSING_BRACKET];
     SplitstreamTokenizerState state = s->state;
     const char* end = buf + len, *cp = buf;
+    /* Resync policy, see SplitstreamSetResync */
+    int lineStart = s->resync && s->resync->lineStart;
+    size_t maxToken = s->resync ? s->resync->maxToken : 0;
+    const char* token = buf;
+    size_t tokenLength = (size_t)s->counter[SPLITSTREAM_COUNTER_TOKEN];
+    if(maxToken >= INT_MAX) maxToken = INT_MAX - 1;
     
     #define LOOP_BEGIN \
 	    for(; cp != end; ++cp) { \
@@ -39,6 +71,7 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 	
 	#define TRANSITION(x) \
 		state = State_##x; \
+		s->last = c; \
 		++cp; \
 		goto h_##x;
 	
@@ -79,8 +112,15 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 	h_Document:
 		LOOP_BEGIN
 		case '<': 
+			if(state == State_Init && (s->flags & SPLITSTREAM_STATE_FLAG_RESYNC_WAIT)) {
+				/* After a resync, documents only start at the beginning of a line */
+				if(!AT_LINE_START) break;
+				s->flags &= ~SPLITSTREAM_STATE_FLAG_RESYNC_WAIT;
+			}
 			if(state == State_Init || (s->depth == s->startDepth && s->startDepth > 0)) {
 				*start = (cp - buf);
+			} else if(RESYNC_ANCHOR) {
+				return Resync_Restart(s, buf, (size_t)(cp - buf));
 			}
 			TRANSITION(ElementOrComment)
 			break;
@@ -101,6 +141,7 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 			TRANSITION(EndElement)
 			break;
 		case '?':
+			TOKEN_BEGIN
 			TRANSITION(Instruction)
 			break;
 		case '!':
@@ -112,11 +153,13 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 		LOOP_BEGIN
 		default:
 			dashCounter = 0;
+			TOKEN_BEGIN
 			TRANSITION(Instruction)
 			break;
 		case '-':
 			if(dashCounter > 0) {
 				dashCounter = 0;
+				TOKEN_BEGIN
 				TRANSITION(Comment)
 			}
 			++dashCounter;
@@ -127,6 +170,7 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 			break;
 		case '[':
 			dashCounter = 0;
+			TOKEN_BEGIN
 			TRANSITION(Cdata)
 			break;
 		LOOP_END
@@ -139,6 +183,8 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 			else { CHECK_END }
 			TRANSITION(Document)
 			break;
+		CHECK_ANCHOR
+			break;
 		LOOP_END
 		
 	h_EndElement:
@@ -147,17 +193,21 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 			--s->depth;
 			CHECK_END
 			break;
-			
+		CHECK_ANCHOR
+			break;
 		LOOP_END
 		
 	h_Comment:
 		LOOP_BEGIN
+		CHECK_ANCHOR
+			/* fall through */
 		default:
 			dashCounter = 0;
 			break;
         case '>':
         	if(dashCounter >= 2) {
 				dashCounter = 0;
+				TOKEN_END
 				TRANSITION(Document)
         	}
         	break;
@@ -169,18 +219,24 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 	h_Instruction:
 		LOOP_BEGIN
         case '>':
+			TOKEN_END
 			TRANSITION(Document)
 			break;
+		CHECK_ANCHOR
+			break;
 		LOOP_END
 		
 	h_Cdata:
 		LOOP_BEGIN
+		CHECK_ANCHOR
+			/* fall through */
 		default:
 			bracketCounter = 0;
 			break;
         case '>':
         	if(bracketCounter >= 2) {
 				bracketCounter = 0;
+				TOKEN_END
 				TRANSITION(Document)
         	}
 			bracketCounter = 0;
@@ -194,5 +250,15 @@ size_t SplitstreamXMLScanner(SplitstreamState* s, const char* buf, size_t len, s
 		s->state = state;
 		s->counter[COUNTER_DASH] = dashCounter;
 		s->counter[COUNTER_CLOSING_BRACKET] = bracketCounter;
+		if(maxToken && (state == State_Comment || state == State_Cdata || state == State_Instruction)) {
+			tokenLength += (size_t)(end - token);
+			if(tokenLength > maxToken) {
+				/* Stop buffering the document now, and give up on it when the token ends */
+				tokenLength = maxToken + 1;
+				Resync_Discard(s);
+			}
+			s->counter[SPLITSTREAM_COUNTER_TOKEN] = (int)tokenLength;
+		}
+		if(lineStart && len) s->last = end[-1];
 		return 0;
 }
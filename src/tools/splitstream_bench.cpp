@@ -0,0 +1,200 @@
+/*
+ *   splitstream_bench.cpp
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file compares the C tokenizer, which calls the scanner through a function pointer,
+   with the templates of splitstream.hpp on generated input held in memory. Each case is run
+   both on the whole input (SplitstreamScanBuffer against Splitter::split) and as a stream of
+   chunks (SplitstreamGetNextDocument against Splitter::feed). The documents found are checked
+   to be the same before the times are printed.
+
+   Usage: splitstream_bench [megabytes [chunk size]] */
+
+#include <splitstream.h>
+#include <splitstream.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace {
+
+/* Sum of the document lengths and a checksum of their bounds, to compare the results by */
+struct Result {
+    size_t count = 0, bytes = 0;
+    unsigned long long check = 0;
+
+    void Add(size_t offset, size_t length) {
+        ++count;
+        bytes += length;
+        check = check * 31 + offset * 7 + length;
+    }
+    bool operator==(const Result& o) const { return count == o.count && bytes == o.bytes && check == o.check; }
+};
+
+std::string JsonLines(size_t size)
+{
+    std::string out;
+    char line[256];
+    for(unsigned n = 0; out.size() < size; ++n) {
+        snprintf(line, sizeof(line),
+                 "{\"id\": %u, \"user\": \"user-%u\", \"tags\": [\"a\", \"b\\\"c\"], \"pos\": {\"x\": %u, \"y\": %d}, \"ok\": true}\n",
+                 n, n % 977, n * 7 % 1000, -(int)(n % 13));
+        out += line;
+    }
+    return out;
+}
+
+std::string JsonArray(size_t size)
+{
+    std::string out = "[";
+    char item[128];
+    for(unsigned n = 0; out.size() < size; ++n) {
+        if(n % 3 == 0) snprintf(item, sizeof(item), "%s{\"n\": %u, \"v\": [%u, %u]}", n ? ", " : "", n, n, n + 1);
+        else if(n % 3 == 1) snprintf(item, sizeof(item), ", \"item %u\"", n);
+        else snprintf(item, sizeof(item), ", %u.5", n);
+        out += item;
+    }
+    return out + "]\n";
+}
+
+std::string XmlRecords(size_t size)
+{
+    std::string out;
+    char record[256];
+    for(unsigned n = 0; out.size() < size; ++n) {
+        snprintf(record, sizeof(record),
+                 "<record id=\"%u\"><!-- note --><name>item %u</name><empty/><data><![CDATA[a > b]]></data></record>\n",
+                 n, n % 977);
+        out += record;
+    }
+    return out;
+}
+
+double Seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+Result ScanC(const std::string& input, int startDepth, SplitstreamScanner scanner)
+{
+    SplitstreamState state;
+    size_t starts[1024], ends[1024], pos = 0, n, i;
+    Result r;
+
+    SplitstreamInitDepth(&state, startDepth);
+    do {
+        n = SplitstreamScanBuffer(&state, input.data(), input.size(), &pos, scanner, starts, ends, 1024);
+        for(i = 0; i < n; ++i) r.Add(starts[i], ends[i] - starts[i]);
+    } while(n == 1024);
+    SplitstreamFree(&state);
+    return r;
+}
+
+Result StreamC(const std::string& input, int startDepth, SplitstreamScanner scanner, size_t chunk)
+{
+    SplitstreamState state;
+    SplitstreamDocument doc;
+    Result r;
+
+    SplitstreamInitDepth(&state, startDepth);
+    for(size_t at = 0; at < input.size(); at += chunk) {
+        const char* buf = input.data() + at;
+        size_t len = input.size() - at < chunk ? input.size() - at : chunk;
+        for(;;) {
+            doc = SplitstreamGetNextDocument(&state, 1 << 20, buf, len, scanner);
+            buf = NULL;
+            len = 0;
+            if(!doc.buffer) break;
+            r.Add(0, doc.length);
+            SplitstreamDocumentFree(&state, &doc);
+        }
+    }
+    SplitstreamFree(&state);
+    return r;
+}
+
+template <class S>
+Result ScanCpp(const std::string& input)
+{
+    Result r;
+    for(std::string_view doc : S::split(input)) r.Add((size_t)(doc.data() - input.data()), doc.size());
+    return r;
+}
+
+template <class S>
+Result StreamCpp(const std::string& input, size_t chunk)
+{
+    S splitter(1 << 20);
+    Result r;
+    for(size_t at = 0; at < input.size(); at += chunk) {
+        std::string_view piece(input.data() + at, input.size() - at < chunk ? input.size() - at : chunk);
+        for(std::string_view doc : splitter.feed(piece)) {
+            /* A document that spans chunks is a copy, so only the lengths are compared */
+            r.Add(0, doc.size());
+        }
+    }
+    return r;
+}
+
+template <class S>
+int Run(const char* name, const std::string& input, SplitstreamScanner scanner, size_t chunk)
+{
+    const double mb = (double)input.size() / (1024 * 1024);
+    auto t = std::chrono::steady_clock::now();
+    Result c = ScanC(input, S::startDepth, scanner);
+    double tc = Seconds(t);
+    t = std::chrono::steady_clock::now();
+    Result cpp = ScanCpp<S>(input);
+    double tcpp = Seconds(t);
+
+    t = std::chrono::steady_clock::now();
+    Result sc = StreamC(input, S::startDepth, scanner, chunk);
+    double tsc = Seconds(t);
+    t = std::chrono::steady_clock::now();
+    Result scpp = StreamCpp<S>(input, chunk);
+    double tscpp = Seconds(t);
+
+    if(!(c == cpp) || sc.count != scpp.count || sc.bytes != scpp.bytes || sc.count != c.count) {
+        fprintf(stderr, "%s: results differ (%zu/%zu/%zu/%zu documents)\n", name, c.count, cpp.count, sc.count, scpp.count);
+        return 1;
+    }
+    printf("%-12s %9zu docs  buffer: C %7.1f MB/s  C++ %7.1f MB/s  (x%.2f)   stream: C %7.1f MB/s  C++ %7.1f MB/s  (x%.2f)\n",
+           name, c.count, mb / tc, mb / tcpp, tc / tcpp, mb / tsc, mb / tscpp, tsc / tscpp);
+    return 0;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+    size_t size = (size_t)((argc > 1 ? atof(argv[1]) : 64) * 1024 * 1024);
+    size_t chunk = argc > 2 ? (size_t)atol(argv[2]) : 65536;
+    int failed = 0;
+
+    if(!size || !chunk) {
+        fprintf(stderr, "Usage: %s [megabytes [chunk size]]\n", argv[0]);
+        return 2;
+    }
+
+    using namespace splitstream;
+    failed |= Run<Splitter<Json>>("json lines", JsonLines(size), SplitstreamJSONScanner, chunk);
+    failed |= Run<Splitter<Json, StartDepth<1>>>("json array", JsonArray(size), SplitstreamJSONScanner, chunk);
+    failed |= Run<Splitter<Xml>>("xml", XmlRecords(size), SplitstreamXMLScanner, chunk);
+    return failed;
+}
@@ -0,0 +1,506 @@
+/*
+ *   splitstream_cli.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* This file implements the splitstream command line tool, which splits a file or standard
+   input into documents and writes them to numbered files, to a set of outputs in turn, or to
+   standard output with a separator.
+
+   The scanner has to see every byte, but the documents are not copied out of what it reads.
+   Where the input can be read again, it is only scanned for the offsets of the documents
+   (SplitstreamScanStream), and those byte ranges are then transferred from the input. A
+   regular file is sent to the output with sendfile(2), or read again with pread(2) where the
+   output refuses it. On Linux, a pipe is duplicated with tee(2) into a pipe of our own before
+   each read, and once the read has been scanned, the documents in it are spliced from that
+   pipe to the output and the bytes between them to /dev/null. A document that does not end in
+   the read is kept in the pipe while it takes at most half of it; beyond that it is spliced as
+   far as it goes, so documents larger than the pipe are not limited. Other inputs, and pipes
+   with a maximum document size above half the pipe, are split by the tokenizer and written
+   from its copy, in fragments. */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <splitstream.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define MAX_OUTPUTS     64
+
+enum {
+    Source_Copy,    /* Write documents from memory */
+    Source_File,    /* sendfile(2) from the input file */
+    Source_Pipe     /* splice(2) from a tee(2) of the input pipe */
+};
+
+typedef struct {
+    SplitstreamReader base;
+    int fd, keep[2];
+    size_t bufferSize, capacity;
+    char* buf;
+    long long keepOffset, keepEnd;  /* Stream offsets of the bytes held in `keep` */
+    int devnull;
+} TeeReader;
+
+typedef struct {
+    int source, in;
+    long long start;                /* File offset of the beginning of the stream */
+    TeeReader* tee;
+    int outputs[MAX_OUTPUTS];
+    int outputCount, next, current;
+    int open;                       /* The current document has been begun */
+    size_t max;
+    const char* pattern;
+    unsigned long long count;
+    char* separator;
+    size_t separatorLength;
+} Cli;
+
+static void Cli_Fail(const char* what)
+{
+    fprintf(stderr, "splitstream: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static int Cli_WriteAll(int fd, const char* p, size_t len)
+{
+    while(len) {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+
+/* Moves the bytes of `keep` before stream offset `upTo` to `out` */
+static int Tee_Move(TeeReader* t, int out, long long upTo)
+{
+    char scratch[4096];
+    while(t->keepOffset < upTo) {
+        size_t want = (size_t)(upTo - t->keepOffset);
+        ssize_t n = splice(t->keep[0], NULL, out, NULL, want, SPLICE_F_MOVE);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EINVAL) {
+            /* An output that splice(2) cannot write to */
+            n = read(t->keep[0], scratch, want < sizeof(scratch) ? want : sizeof(scratch));
+            if(n > 0 && Cli_WriteAll(out, scratch, (size_t)n) < 0) return -1;
+        }
+        if(n <= 0) return -1;
+        t->keepOffset += n;
+    }
+    return 0;
+}
+
+/* Pipe buffers are kept as they were written, so many small writes can fill the pipe long
+   before its capacity in bytes. Rewriting the bytes packs them into full pages. */
+static int Tee_Compact(TeeReader* t)
+{
+    size_t pending = (size_t)(t->keepEnd - t->keepOffset), got = 0;
+    char* tmp = malloc(pending ? pending : 1);
+    int rc = 0;
+    if(!tmp) return -1;
+    while(got < pending) {
+        ssize_t n = read(t->keep[0], tmp + got, pending - got);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) { rc = -1; break; }
+        got += (size_t)n;
+    }
+    if(!rc) rc = Cli_WriteAll(t->keep[1], tmp, pending);
+    free(tmp);
+    return rc;
+}
+
+static int Tee_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    TeeReader* t = (TeeReader*)reader;
+    struct pollfd pfd;
+    size_t got = 0;
+    ssize_t n;
+    int compacted = 0;
+
+    /* The caller keeps at most half the pipe, so that compacting always leaves room */
+    if((size_t)(t->keepEnd - t->keepOffset) > t->capacity / 2) {
+        errno = ENOBUFS;
+        goto fail;
+    }
+    pfd.fd = t->fd;
+    pfd.events = POLLIN;
+    for(;;) {
+        if(poll(&pfd, 1, -1) < 0) {
+            if(errno != EINTR) goto fail;
+            continue;
+        }
+        n = tee(t->fd, t->keep[1], t->bufferSize, SPLICE_F_NONBLOCK);
+        if(n >= 0) break;
+        if(errno == EINTR || (errno == EAGAIN && t->keepOffset == t->keepEnd)) continue;
+        if(errno != EAGAIN) goto fail;
+        if(compacted) {
+            errno = ENOBUFS;
+            goto fail;
+        }
+        if(Tee_Compact(t) < 0) goto fail;
+        compacted = 1;
+    }
+    if(n == 0) return 0;
+
+    /* Consume the bytes just duplicated */
+    while(got < (size_t)n) {
+        ssize_t r = read(t->fd, t->buf + got, (size_t)n - got);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) {
+            if(!r) errno = EIO;
+            goto fail;
+        }
+        got += (size_t)r;
+    }
+    t->keepEnd += n;
+    *buf = t->buf;
+    *len = got;
+    return 1;
+
+fail:
+    reader->error = errno;
+    return -1;
+}
+
+static void Tee_Close(SplitstreamReader* reader)
+{
+    TeeReader* t = (TeeReader*)reader;
+    close(t->keep[0]);
+    close(t->keep[1]);
+    if(t->devnull >= 0) close(t->devnull);
+    free(t->buf);
+    free(t);
+}
+
+/* Returns NULL if the pipe cannot be duplicated, in which case it is read normally */
+static TeeReader* Tee_New(int fd, size_t bufferSize)
+{
+    TeeReader* t = calloc(1, sizeof(TeeReader));
+    int capacity;
+    if(!t) return NULL;
+    if(pipe(t->keep) < 0) {
+        free(t);
+        return NULL;
+    }
+    fcntl(t->keep[1], F_SETPIPE_SZ, 1024*1024);
+    capacity = fcntl(t->keep[1], F_GETPIPE_SZ);
+    t->devnull = open("/dev/null", O_WRONLY);
+    t->capacity = capacity > 0 ? (size_t)capacity : 65536;
+    /* A read always fits, however many pipe buffers it comes in */
+    t->bufferSize = bufferSize < t->capacity / 4 ? bufferSize : t->capacity / 4;
+    t->buf = malloc(t->bufferSize);
+    t->fd = fd;
+    t->base.read = Tee_Read;
+    t->base.close = Tee_Close;
+    if(!t->buf || t->devnull < 0) {
+        Tee_Close(&t->base);
+        return NULL;
+    }
+    return t;
+}
+
+#endif
+
+/* Sends the input file from stream offset `start` to `end` to `out` */
+static int Cli_SendFile(Cli* c, int out, long long start, long long end)
+{
+    off_t offset = (off_t)(c->start + start);
+    size_t left = (size_t)(end - start);
+    char buf[65536];
+#ifdef __linux__
+    while(left) {
+        ssize_t n = sendfile(out, c->in, &offset, left);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        if(n <= 0) return -1;
+        left -= (size_t)n;
+    }
+#endif
+    /* An output that sendfile(2) cannot write to, such as one opened for appending */
+    while(left) {
+        ssize_t n = pread(c->in, buf, left < sizeof(buf) ? left : sizeof(buf), offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            if(!n) errno = EIO;
+            return -1;
+        }
+        if(Cli_WriteAll(out, buf, (size_t)n) < 0) return -1;
+        offset += n;
+        left -= (size_t)n;
+    }
+    return 0;
+}
+
+static int Cli_Begin(Cli* c)
+{
+    if(c->pattern) {
+        char path[4096];
+        snprintf(path, sizeof(path), c->pattern, c->count);
+        c->current = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(c->current < 0) Cli_Fail(path);
+    } else if(c->outputCount) {
+        c->current = c->outputs[c->next];
+        c->next = (c->next + 1) % c->outputCount;
+    } else {
+        c->current = STDOUT_FILENO;
+    }
+    c->open = 1;
+    return 0;
+}
+
+static int Cli_End(Cli* c)
+{
+    int rc = 0;
+    c->open = 0;
+    if(c->pattern) {
+        rc = close(c->current);
+    } else if(c->separatorLength) {
+        rc = Cli_WriteAll(c->current, c->separator, c->separatorLength);
+    }
+    c->count++;
+    return rc;
+}
+
+/* Writes the document from stream offset `start` to `end`, which ends in the last read */
+static int Cli_Document(Cli* c, long long start, long long end)
+{
+    if(c->max && (unsigned long long)(end - start) > c->max) return 0;
+    if(c->source == Source_File) {
+        Cli_Begin(c);
+        if(Cli_SendFile(c, c->current, start, end) < 0) return -1;
+    }
+#ifdef __linux__
+    else {
+        /* It may have been begun with an earlier read */
+        if(!c->open) {
+            if(Tee_Move(c->tee, c->tee->devnull, start) < 0) return -1;
+            Cli_Begin(c);
+        }
+        if(Tee_Move(c->tee, c->current, end) < 0) return -1;
+    }
+#endif
+    return Cli_End(c);
+}
+
+#ifdef __linux__
+/* Keeps only the unfinished document in the pipe, unless it takes more than half of it */
+static int Cli_Keep(Cli* c, long long pending)
+{
+    TeeReader* t = c->tee;
+    if(pending < 0) return Tee_Move(t, t->devnull, t->keepEnd);
+    if(!c->open && Tee_Move(t, t->devnull, pending) < 0) return -1;
+    if(c->max && (unsigned long long)(t->keepEnd - pending) > c->max) {
+        /* It will be dropped when it ends, so it need not be kept (the maximum is at most
+           half the pipe, so it has not been begun) */
+        return Tee_Move(t, t->devnull, t->keepEnd);
+    }
+    if(c->open || (size_t)(t->keepEnd - t->keepOffset) > t->capacity / 2) {
+        if(!c->open) Cli_Begin(c);
+        return Tee_Move(t, c->current, t->keepEnd);
+    }
+    return 0;
+}
+#endif
+
+/* Splits an input that can be read again by offsets alone. Returns the reader's result. */
+static int Cli_Scan(Cli* c, SplitstreamState* s, SplitstreamReader* reader, SplitstreamScanner scanner)
+{
+    long long starts[256], ends[256], pending;
+    const char* buf;
+    size_t len, pos, n, i;
+    int rc;
+
+    while((rc = reader->read(reader, &buf, &len)) > 0) {
+        pos = 0;
+        do {
+            n = SplitstreamScanStream(s, buf, len, &pos, scanner, starts, ends, 256, &pending);
+            for(i = 0; i < n; ++i) {
+                if(Cli_Document(c, starts[i], ends[i]) < 0) Cli_Fail("write");
+            }
+        } while(n == 256);
+#ifdef __linux__
+        if(c->source == Source_Pipe && Cli_Keep(c, pending) < 0) Cli_Fail("write");
+#endif
+    }
+    return rc;
+}
+
+/* Only allows a single integer conversion, since the pattern is used as a format */
+static int Cli_CheckPattern(const char* pattern)
+{
+    int conversions = 0;
+    const char* p;
+    for(p = pattern; *p; ++p) {
+        if(*p != '%') continue;
+        if(p[1] == '%') { ++p; continue; }
+        ++p;
+        while(*p == '0' || *p == '-' || (*p >= '1' && *p <= '9')) ++p;
+        if(p[0] != 'l' || p[1] != 'l' || (p[2] != 'u' && p[2] != 'd')) return -1;
+        p += 2;
+        ++conversions;
+    }
+    return conversions == 1 ? 0 : -1;
+}
+
+/* Decodes \n, \r, \t, \0 and \\ in place and returns the length */
+static size_t Cli_Unescape(char* s)
+{
+    char* out = s, *start = s;
+    for(; *s; ++s) {
+        if(*s != '\\' || !s[1]) {
+            *out++ = *s;
+            continue;
+        }
+        switch(*++s) {
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case '0': *out++ = '\0'; break;
+            default: *out++ = *s; break;
+        }
+    }
+    return (size_t)(out - start);
+}
+
+static void Cli_Usage(void)
+{
+    fprintf(stderr,
+        "usage: splitstream -f xml|json|ubjson [-d startdepth] [-m maxdocsize] [-b bufsize]\n"
+        "                   [-o pattern | -r output ...] [-s separator] [file]\n\n"
+        "  -f  Document format\n"
+        "  -d  Start depth (skip this many levels of enclosing elements)\n"
+        "  -m  Drop documents larger than this; by default there is no limit\n"
+        "  -b  Read buffer size\n"
+        "  -o  Write every document to its own file, named by a printf pattern\n"
+        "      with one %%llu conversion, e.g. doc-%%06llu.json\n"
+        "  -r  Write documents to these outputs in turn (may be repeated)\n"
+        "  -s  Separator after each document when writing to outputs or standard\n"
+        "      output (default \\n; \\n, \\r, \\t, \\0 and \\\\ are understood)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    Cli c;
+    SplitstreamState s;
+    SplitstreamScanner scanner = NULL;
+    SplitstreamReader* reader = NULL;
+    SplitstreamDocument doc;
+    struct stat st;
+    size_t bufferSize = 65536, max = 0;
+    int startDepth = 0, opt, error;
+    char defaultSeparator[] = "\n";
+
+    memset(&c, 0, sizeof(c));
+    c.in = STDIN_FILENO;
+    c.separator = defaultSeparator;
+    while((opt = getopt(argc, argv, "f:d:m:b:o:r:s:h")) != -1) {
+        switch(opt) {
+            case 'f':
+                if(!strcmp(optarg, "xml")) scanner = SplitstreamXMLScanner;
+                else if(!strcmp(optarg, "json")) scanner = SplitstreamJSONScanner;
+                else if(!strcmp(optarg, "ubjson")) scanner = SplitstreamUBJSONScanner;
+                else Cli_Usage();
+                break;
+            case 'd': startDepth = atoi(optarg); break;
+            case 'm': max = (size_t)strtoull(optarg, NULL, 10); break;
+            case 'b': bufferSize = (size_t)strtoull(optarg, NULL, 10); break;
+            case 'o':
+                if(Cli_CheckPattern(optarg) < 0) Cli_Usage();
+                c.pattern = optarg;
+                break;
+            case 'r':
+                if(c.outputCount == MAX_OUTPUTS) Cli_Usage();
+                c.outputs[c.outputCount] = open(optarg, O_WRONLY | O_CREAT | O_APPEND, 0666);
+                if(c.outputs[c.outputCount] < 0) Cli_Fail(optarg);
+                c.outputCount++;
+                break;
+            case 's': c.separator = optarg; break;
+            default: Cli_Usage();
+        }
+    }
+    if(!scanner || optind + 1 < argc || (c.pattern && c.outputCount)) Cli_Usage();
+    if(!bufferSize || bufferSize > 1024*1024*1024) bufferSize = 65536;
+    c.separatorLength = Cli_Unescape(c.separator);
+    if(optind < argc && strcmp(argv[optind], "-")) {
+        c.in = open(argv[optind], O_RDONLY);
+        if(c.in < 0) Cli_Fail(argv[optind]);
+    }
+
+    SplitstreamInitDepth(&s, startDepth);
+    c.source = Source_Copy;
+    c.max = max;
+    if(!fstat(c.in, &st) && S_ISREG(st.st_mode)) {
+        c.start = (long long)lseek(c.in, 0, SEEK_CUR);
+        if(c.start >= 0) c.source = Source_File;
+        else c.start = 0;
+        reader = SplitstreamReaderOpenFd(c.in, bufferSize, 0);
+    } else {
+#ifdef __linux__
+        if(S_ISFIFO(st.st_mode) && (c.tee = Tee_New(c.in, bufferSize))) {
+            /* A document is only known to be too large once it has been kept that far */
+            if(max > c.tee->capacity / 2) {
+                Tee_Close(&c.tee->base);
+                c.tee = NULL;
+            } else {
+                c.source = Source_Pipe;
+                reader = &c.tee->base;
+            }
+        }
+#endif
+        if(!reader) reader = SplitstreamReaderOpenFd(c.in, bufferSize, 0);
+    }
+    if(!reader) Cli_Fail("open");
+
+    if(c.source != Source_Copy) {
+        Cli_Scan(&c, &s, reader, scanner);
+    } else {
+        if(!max) SplitstreamSetFragmentSize(&s, 1024*1024);
+        while((doc = SplitstreamGetNextDocumentFromReader(&s, max ? max : (size_t)-1, reader, scanner)).buffer) {
+            if(doc.fragment == SPLITSTREAM_FRAGMENT_NONE || doc.fragment == SPLITSTREAM_FRAGMENT_START) Cli_Begin(&c);
+            if(Cli_WriteAll(c.current, doc.buffer, doc.length) < 0) Cli_Fail("write");
+            if(doc.fragment == SPLITSTREAM_FRAGMENT_NONE || doc.fragment == SPLITSTREAM_FRAGMENT_END) {
+                if(Cli_End(&c) < 0) Cli_Fail("write");
+            }
+            SplitstreamDocumentFree(&s, &doc);
+        }
+    }
+    error = SplitstreamReaderError(reader);
+    SplitstreamReaderClose(reader);
+    SplitstreamFree(&s);
+    if(error) {
+        errno = error;
+        Cli_Fail("read");
+    }
+    return 0;
+}
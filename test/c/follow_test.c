@@ -0,0 +1,229 @@
+/*
+ *   follow_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Follows a file that is cut off at every position and then truncated or rotated. After the
+   reader starts over, the documents, keys, hashes and skipped ranges, and finally the saved
+   state, must be the same as those of following the new file from scratch, whatever the
+   filter, key, hash and resync state of the document that was cut off. The writes are made by
+   the idle callback, each time the reader has run out of data, so nothing depends on timing. */
+
+#include "test.h"
+#include <unistd.h>
+
+#define MAX_DOCS    16
+
+typedef struct {
+    long long ranges[MAX_DOCS][2];
+    size_t count;
+} Skipped;
+
+typedef struct {
+    TestDocs docs;
+    int hasKey[MAX_DOCS];
+    unsigned long long keyHash[MAX_DOCS], hash[MAX_DOCS];
+    Skipped skipped;
+} Result;
+
+typedef struct {
+    const char* name;
+    SplitstreamScanner scan;
+    int startDepth;
+    SplitstreamKey key;
+    SplitstreamFilter filter;
+    int lineStart;
+    const char* old;    /* Cut off at every position */
+    const char* data;   /* Then replaces it */
+    size_t count;       /* Documents in `data` */
+} Case;
+
+typedef struct {
+    const char* path, *rotated, *data;
+    int rotate;
+    SplitstreamState* s;
+    Result* result;
+    size_t docs, skipped;   /* Counts when the reader ran out of the old file */
+    char* state;            /* Saved when the reader ran out of the new one */
+    size_t stateLength;
+} Script;
+
+static void OnSkipped(void* arg, long long start, long long end)
+{
+    Skipped* skipped = arg;
+    CHECK(skipped->count < MAX_DOCS);
+    skipped->ranges[skipped->count][0] = start;
+    skipped->ranges[skipped->count++][1] = end;
+}
+
+static void Configure(SplitstreamState* s, const Case* c, SplitstreamResync* resync, Skipped* skipped)
+{
+    SplitstreamInitDepth(s, c->startDepth);
+    memset(resync, 0, sizeof(*resync));
+    resync->lineStart = c->lineStart;
+    resync->skipped = OnSkipped;
+    resync->arg = skipped;
+    if(c->key.type) SplitstreamSetKey(s, &c->key);
+    if(c->filter.type) SplitstreamSetFilter(s, &c->filter);
+    if(c->lineStart) SplitstreamSetResync(s, resync);
+    SplitstreamSetHashing(s, 1);
+}
+
+static void WriteFile(const char* path, const char* data, size_t len)
+{
+    FILE* f = fopen(path, "wb");
+    CHECK(f);
+    CHECK(fwrite(data, 1, len, f) == len);
+    CHECK(fclose(f) == 0);
+}
+
+static void Collect(SplitstreamState* s, SplitstreamReader* reader, const Case* c, Result* r)
+{
+    SplitstreamDocument doc;
+    while((doc = SplitstreamGetNextDocumentFromReader(s, 1 << 20, reader, c->scan)).buffer) {
+        size_t n = r->docs.count;
+        CHECK(n < MAX_DOCS);
+        r->hasKey[n] = doc.hasKey;
+        r->keyHash[n] = doc.keyHash;
+        r->hash[n] = doc.hash;
+        Test_Add(&r->docs, s, &doc);
+        SplitstreamDocumentFree(s, &doc);
+    }
+    CHECK(!SplitstreamReaderError(reader));
+}
+
+/* Replaces the file the first time the reader runs out of data, if there is a replacement,
+   and ends the stream the next */
+static int OnIdle(void* arg)
+{
+    Script* script = arg;
+    if(script->data) {
+        script->docs = script->result->docs.count;
+        script->skipped = script->result->skipped.count;
+        if(script->rotate) CHECK(rename(script->path, script->rotated) == 0);
+        WriteFile(script->path, script->data, strlen(script->data));
+        script->data = NULL;
+        return 0;
+    }
+    script->stateLength = SplitstreamStateSerialize(script->s, NULL, 0);
+    script->state = malloc(script->stateLength);
+    CHECK(script->state);
+    CHECK(SplitstreamStateSerialize(script->s, script->state, script->stateLength) == script->stateLength);
+    return 1;
+}
+
+/* Follows `path` until it runs out, replacing it with `data` on the way if set */
+static void Follow(const Case* c, const char* path, const char* rotated, const char* data, int rotate,
+                   Result* result, Script* script)
+{
+    SplitstreamState s;
+    SplitstreamResync resync;
+    SplitstreamReader* reader;
+
+    memset(result, 0, sizeof(*result));
+    memset(script, 0, sizeof(*script));
+    script->path = path;
+    script->rotated = rotated;
+    script->data = data;
+    script->rotate = rotate;
+    script->s = &s;
+    script->result = result;
+    Configure(&s, c, &resync, &result->skipped);
+    reader = SplitstreamReaderOpenFollow(path, 5, 1, &s, OnIdle, script);
+    CHECK(reader);
+    Collect(&s, reader, c, result);
+    SplitstreamReaderClose(reader);
+    SplitstreamFree(&s);
+    CHECK(!script->data && script->state);
+}
+
+static void Check(const Case* c, const char* path, const char* rotated, size_t cut, int rotate,
+                  const Result* exp, const Script* fresh)
+{
+    Result got;
+    Script script;
+    size_t i;
+
+    WriteFile(path, c->old, cut);
+    Follow(c, path, rotated, c->data, rotate, &got, &script);
+
+    if(got.docs.count - script.docs != exp->docs.count || got.skipped.count - script.skipped != exp->skipped.count) {
+        fprintf(stderr, "%s: %s at %u gives %u documents and %u skipped ranges, not %u and %u\n", c->name,
+                rotate ? "rotated" : "truncated", (unsigned)cut, (unsigned)(got.docs.count - script.docs),
+                (unsigned)(got.skipped.count - script.skipped), (unsigned)exp->docs.count, (unsigned)exp->skipped.count);
+        exit(1);
+    }
+    for(i = 0; i < exp->docs.count; ++i) {
+        size_t n = script.docs + i;
+        CHECK(got.docs.docs[n].length == exp->docs.docs[i].length);
+        CHECK(got.docs.docs[n].offset == exp->docs.docs[i].offset);
+        CHECK(!memcmp(got.docs.docs[n].data, exp->docs.docs[i].data, exp->docs.docs[i].length));
+        CHECK(got.hasKey[n] == exp->hasKey[i] && got.keyHash[n] == exp->keyHash[i]);
+        CHECK(got.hash[n] == exp->hash[i]);
+    }
+    CHECK(!memcmp(got.skipped.ranges + script.skipped, exp->skipped.ranges, sizeof(exp->skipped.ranges[0]) * exp->skipped.count));
+    if(script.stateLength != fresh->stateLength || memcmp(script.state, fresh->state, fresh->stateLength)) {
+        fprintf(stderr, "%s: %s at %u does not leave the state of a fresh start\n", c->name,
+                rotate ? "rotated" : "truncated", (unsigned)cut);
+        exit(1);
+    }
+    free(script.state);
+    Test_FreeDocs(&got.docs);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* const names[] = { "a", "b", NULL };
+    static const Case cases[] = {
+        { "json", SplitstreamJSONScanner, 0, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, { 0 }, 1,
+          "{\"id\":1}\n{\"x\":\"}{\", \"id\":[1,{\"id\":2}],\n{\"id\":\"a\\\"",
+          "{\"id\":\"k\"}\n{\"id\":\"broken}\n{\"n\":[{\"id\":3}], \"id\":4}\n", 2 },
+        { "json emptied", SplitstreamJSONScanner, 0, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, { 0 }, 1,
+          "{\"id\":1}\n{\"x\":\"}{\", \"id\":[1,{\"id\":2}],\n{\"id\":\"a\\\"",
+          " \n", 0 },
+        { "json elements", SplitstreamJSONScanner, 1, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, { 0 }, 0,
+          "[{\"id\":1}, [2, {\"id\":\"]\"}], \"x",
+          "[3, {\"id\":5}, \"]\"]", 3 },
+        { "json filter", SplitstreamJSONScanner, 0, { 0 }, { SPLITSTREAM_FILTER_JSON_KEY, NULL, "t", "\"e" }, 0,
+          "{\"t\":\"e1\"}{\"t\":\"x\"}{\"t\":\"e",
+          "{\"t\":\"ok\"}{\"t\":\"e2\"}{\"t\":\"err\"}", 2 },
+        { "xml", SplitstreamXMLScanner, 0, { SPLITSTREAM_KEY_XML_ATTRIBUTE, "id" }, { SPLITSTREAM_FILTER_XML_ELEMENT, names }, 0,
+          "<a id=\"1\"/><c id=\"2\"><a/></c><b x=\"y\" id=\"",
+          "<b id=\"3\"></b><c/><a><b/></a>", 2 },
+    };
+    const char* dir = argc > 1 ? argv[1] : ".";
+    char* path = Test_Path(dir, "follow.log"), *rotated = Test_Path(dir, "follow.log.1");
+    size_t i, cut;
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const Case* c = &cases[i];
+        Result exp;
+        Script fresh;
+        WriteFile(path, c->data, strlen(c->data));
+        Follow(c, path, rotated, NULL, 0, &exp, &fresh);
+        CHECK(exp.docs.count == c->count);
+        for(cut = 0; cut <= strlen(c->old); ++cut) {
+            Check(c, path, rotated, cut, 1, &exp, &fresh);
+            /* Truncation is only noticed if the file shrinks below what was read */
+            if(cut > strlen(c->data)) Check(c, path, rotated, cut, 0, &exp, &fresh);
+        }
+        free(fresh.state);
+        Test_FreeDocs(&exp.docs);
+    }
+    free(path);
+    free(rotated);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ *   hpp_test.cpp
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* The scanners of splitstream.hpp are a copy of the C scanners, so they are checked against
+   them on the corpora of the Python tests, which test/ctests.py passes as triplets of format,
+   start depth and file. Splitter::split must find the same documents at the same offsets as
+   SplitstreamScanBuffer, and Splitter::feed the same documents as SplitstreamGetNextDocument,
+   however the input is cut into chunks. */
+
+#include <splitstream.h>
+#include <splitstream.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while(0)
+
+namespace {
+
+struct Doc {
+    long long offset;   /* -1 where a streamed document was copied out of its chunks */
+    std::string data;
+
+    bool operator==(const Doc& o) const {
+        return (offset < 0 || o.offset < 0 || offset == o.offset) && data == o.data;
+    }
+};
+
+using Docs = std::vector<Doc>;
+
+const size_t MAX = 1 << 20;
+
+std::string ReadFile(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    std::string data;
+    char buf[4096];
+    size_t n;
+    CHECK(f);
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+    return data;
+}
+
+Docs ScanC(const std::string& input, int startDepth, SplitstreamScanner scanner)
+{
+    SplitstreamState state;
+    size_t starts[16], ends[16], pos = 0, n, i;
+    Docs docs;
+
+    SplitstreamInitDepth(&state, startDepth);
+    do {
+        n = SplitstreamScanBuffer(&state, input.data(), input.size(), &pos, scanner, starts, ends, 16);
+        for(i = 0; i < n; ++i) docs.push_back({ (long long)starts[i], input.substr(starts[i], ends[i] - starts[i]) });
+    } while(n == 16);
+    SplitstreamFree(&state);
+    return docs;
+}
+
+Docs StreamC(const std::string& input, int startDepth, SplitstreamScanner scanner, size_t chunk)
+{
+    SplitstreamState state;
+    SplitstreamDocument doc;
+    Docs docs;
+
+    SplitstreamInitDepth(&state, startDepth);
+    for(size_t at = 0; at < input.size(); at += chunk) {
+        const char* buf = input.data() + at;
+        size_t len = input.size() - at < chunk ? input.size() - at : chunk;
+        while((doc = SplitstreamGetNextDocument(&state, MAX, buf, len, scanner)).buffer) {
+            docs.push_back({ doc.offset, std::string(doc.buffer, doc.length) });
+            SplitstreamDocumentFree(&state, &doc);
+            buf = NULL;
+            len = 0;
+        }
+    }
+    SplitstreamFree(&state);
+    return docs;
+}
+
+template <class S>
+Docs ScanCpp(const std::string& input)
+{
+    Docs docs;
+    for(std::string_view doc : S::split(input)) docs.push_back({ (long long)(doc.data() - input.data()), std::string(doc) });
+    return docs;
+}
+
+template <class S>
+Docs StreamCpp(const std::string& input, size_t chunk)
+{
+    S splitter(MAX);
+    Docs docs;
+    for(size_t at = 0; at < input.size(); at += chunk) {
+        std::string_view piece(input.data() + at, input.size() - at < chunk ? input.size() - at : chunk);
+        for(std::string_view doc : splitter.feed(piece)) {
+            bool inside = doc.data() >= piece.data() && doc.data() < piece.data() + piece.size();
+            docs.push_back({ inside ? (long long)(at + (size_t)(doc.data() - piece.data())) : -1, std::string(doc) });
+        }
+    }
+    return docs;
+}
+
+void CheckSame(const char* path, const char* what, size_t chunk, const Docs& exp, const Docs& got)
+{
+    size_t i;
+    for(i = 0; i < exp.size() && i < got.size() && exp[i] == got[i]; ++i);
+    if(i < exp.size() || i < got.size()) {
+        fprintf(stderr, "%s: %s in chunks of %zu differs at document %zu of %zu (%zu found)\n", path, what, chunk,
+                i, exp.size(), got.size());
+        if(i < exp.size()) fprintf(stderr, "  C:   %lld %s\n", exp[i].offset, exp[i].data.c_str());
+        if(i < got.size()) fprintf(stderr, "  C++: %lld %s\n", got[i].offset, got[i].data.c_str());
+        exit(1);
+    }
+}
+
+template <class Format, int Depth>
+void Compare(const char* path, SplitstreamScanner scanner)
+{
+    using S = splitstream::Splitter<Format, splitstream::StartDepth<Depth>>;
+    std::string input = ReadFile(path);
+    Docs exp = ScanC(input, Depth, scanner);
+
+    CHECK(!exp.empty());
+    CheckSame(path, "split", input.size(), exp, ScanCpp<S>(input));
+    for(size_t chunk = 1; chunk < input.size() + 2; chunk = chunk < 16 ? chunk + 1 : chunk * 3) {
+        Docs c = StreamC(input, Depth, scanner, chunk);
+        CheckSame(path, "the C tokenizer", chunk, exp, c);
+        CheckSame(path, "feed", chunk, c, StreamCpp<S>(input, chunk));
+    }
+}
+
+template <class Format>
+void CompareDepth(const char* path, int depth, SplitstreamScanner scanner)
+{
+    switch(depth) {
+    case 0: Compare<Format, 0>(path, scanner); break;
+    case 1: Compare<Format, 1>(path, scanner); break;
+    case 2: Compare<Format, 2>(path, scanner); break;
+    default: CHECK(!"start depth out of range");
+    }
+}
+
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+    int i;
+    CHECK(argc > 2 && (argc - 2) % 3 == 0);
+    for(i = 2; i < argc; i += 3) {
+        int depth = atoi(argv[i + 1]);
+        if(!strcmp(argv[i], "json")) CompareDepth<splitstream::Json>(argv[i + 2], depth, SplitstreamJSONScanner);
+        else if(!strcmp(argv[i], "xml")) CompareDepth<splitstream::Xml>(argv[i + 2], depth, SplitstreamXMLScanner);
+        else CHECK(!"unknown format");
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ *   index_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Builds indexes while splitting, resumes from every document of them (before and after a
+   save and load), and loads truncated, corrupted and oversized index files. */
+
+#include "test.h"
+
+typedef struct {
+    const char* name;
+    SplitstreamScanner scan;
+    int startDepth;
+    int csvHeader;
+    const char* unit;
+} Case;
+
+static void Init(SplitstreamState* s, const Case* c)
+{
+    SplitstreamInitDepth(s, c->startDepth);
+    if(c->scan == SplitstreamCSVScanner) SplitstreamSetCSV(s, 0, c->csvHeader);
+}
+
+static char* Repeat(const char* header, const char* unit, int times, size_t* len)
+{
+    size_t h = strlen(header), u = strlen(unit);
+    char* buf = malloc(h + u * (size_t)times + 1);
+    int i;
+    CHECK(buf);
+    memcpy(buf, header, h);
+    for(i = 0; i < times; ++i) memcpy(buf + h + u * (size_t)i, unit, u);
+    *len = h + u * (size_t)times;
+    buf[*len] = 0;
+    return buf;
+}
+
+static SplitstreamIndex* Build(const Case* c, const char* buf, size_t len, size_t chunk, TestDocs* docs)
+{
+    SplitstreamState s;
+    SplitstreamDocument doc;
+    SplitstreamIndex* index;
+    size_t pos = 0, n;
+
+    Init(&s, c);
+    index = SplitstreamIndexNew(&s, 40);
+    CHECK(index);
+    while(pos < len) {
+        n = len - pos < chunk ? len - pos : chunk;
+        doc = SplitstreamGetNextDocument(&s, 1 << 20, buf + pos, n, c->scan);
+        while(doc.buffer) {
+            CHECK(SplitstreamIndexAdd(index, &s, &doc) == 0);
+            Test_Add(docs, &s, &doc);
+            SplitstreamDocumentFree(&s, &doc);
+            doc = SplitstreamGetNextDocument(&s, 1 << 20, NULL, 0, c->scan);
+        }
+        pos += n;
+    }
+    SplitstreamFree(&s);
+    return index;
+}
+
+/* Every document resumes to the same documents that a scan from the start finds */
+static void CheckSeek(const Case* c, const SplitstreamIndex* index, const char* buf, size_t len, const TestDocs* exp)
+{
+    SplitstreamState s;
+    TestDocs docs = { NULL, 0 };
+    size_t n, i;
+    long long offset, start, end;
+
+    CHECK(SplitstreamIndexCount(index) == exp->count);
+    for(n = 0; n < exp->count; ++n) {
+        CHECK(SplitstreamIndexGet(index, n, &start, &end) == 0);
+        CHECK(start == exp->docs[n].offset && end - start == (long long)exp->docs[n].length);
+        CHECK(SplitstreamIndexFind(index, start) == n);
+    }
+    CHECK(SplitstreamIndexGet(index, n, &start, &end) < 0);
+    for(n = 0; n <= exp->count; ++n) {
+        Init(&s, c);
+        offset = SplitstreamIndexSeek(index, n, &s);
+        CHECK(offset >= 0 && (size_t)offset <= len);
+        Test_Split(&s, buf + offset, len - (size_t)offset, 5, c->scan, &docs);
+        if(docs.count != exp->count - n) {
+            fprintf(stderr, "%s: resuming at document %u gives %u documents, not %u\n", c->name,
+                    (unsigned)n, (unsigned)docs.count, (unsigned)(exp->count - n));
+            exit(1);
+        }
+        for(i = 0; i < docs.count; ++i) {
+            CHECK(docs.docs[i].offset == exp->docs[n + i].offset);
+            CHECK(docs.docs[i].length == exp->docs[n + i].length);
+            CHECK(!memcmp(docs.docs[i].data, exp->docs[n + i].data, docs.docs[i].length));
+        }
+        Test_FreeDocs(&docs);
+        SplitstreamFree(&s);
+    }
+    Init(&s, c);
+    CHECK(SplitstreamIndexSeek(index, exp->count + 1, &s) < 0);
+    SplitstreamFree(&s);
+}
+
+static void WriteFile(const char* path, const char* data, size_t len)
+{
+    FILE* f = fopen(path, "wb");
+    CHECK(f);
+    CHECK(fwrite(data, 1, len, f) == len);
+    CHECK(fclose(f) == 0);
+}
+
+static char* ReadFile(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    char* data;
+    long size;
+    CHECK(f);
+    CHECK(fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0);
+    data = malloc((size_t)size + 1);
+    CHECK(data && fread(data, 1, (size_t)size, f) == (size_t)size);
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+/* Nothing loaded from a damaged file may be trusted further than it was checked */
+static void CheckDamaged(const char* path, const char* scratch, size_t count)
+{
+    size_t len, i, n;
+    char* data = ReadFile(path, &len);
+    SplitstreamIndex* index;
+    SplitstreamState s;
+    long long start, end;
+
+    for(i = 0; i < len; ++i) {
+        WriteFile(scratch, data, i);
+        CHECK(!SplitstreamIndexLoad(scratch));
+    }
+    data[len] = 0;
+    WriteFile(scratch, data, len + 1);
+    CHECK(!SplitstreamIndexLoad(scratch));
+    for(i = 0; i < len; ++i) {
+        data[i] ^= (char)0xff;
+        WriteFile(scratch, data, len);
+        if((index = SplitstreamIndexLoad(scratch))) {
+            CHECK(SplitstreamIndexCount(index) <= count);
+            for(n = 0; n <= SplitstreamIndexCount(index); ++n) {
+                SplitstreamIndexGet(index, n, &start, &end);
+                SplitstreamInit(&s);
+                SplitstreamIndexSeek(index, n, &s);
+                SplitstreamFree(&s);
+            }
+            SplitstreamIndexFree(index);
+        }
+        data[i] ^= (char)0xff;
+    }
+    free(data);
+}
+
+static void CheckOversized(const char* scratch)
+{
+    /* Version 2, start depth 0, then the document and checkpoint counts */
+    static const char huge[][24] = {
+        "SSIX\x02\x00\xff\xff\xff\xff\xff\xff\xff\xff\x7f\x01",     /* 2^63 - 1 documents */
+        "SSIX\x02\x00\x80\x80\x80\x80\x80\x80\x80\x80\x40\x01",     /* 2^62 documents */
+        "SSIX\x02\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff\x7f",     /* 2^63 - 1 checkpoints */
+        "SSIX\x02\x00\x01\x00\x00\x00",                             /* A document without checkpoints */
+        "SSIX\x02\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01\x00\x00", /* Start depth out of range */
+    };
+    size_t i;
+    for(i = 0; i < sizeof(huge) / sizeof(huge[0]); ++i) {
+        /* Padded with zeros, which would be valid documents */
+        WriteFile(scratch, huge[i], sizeof(huge[i]));
+        CHECK(!SplitstreamIndexLoad(scratch));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const Case cases[] = {
+        { "json", SplitstreamJSONScanner, 0, 0, "{\"a\":1} [2]\n{\"b\":\"}\\\"\"}" },
+        { "json elements", SplitstreamJSONScanner, 1, 0, "[1, \"a\", {\"o\":[1]}, [2,3], -7e3]\n" },
+        { "xml", SplitstreamXMLScanner, 1, 0, "<r x=\">\"><a/><b>t</b><!-- <c> --><c><![CDATA[<]]></c></r>" },
+        { "csv", SplitstreamCSVScanner, 0, 1, "1,2\n\"x\ny\",3\n,\r\n" },
+        { "lines", SplitstreamSeparatorScanner, 0, 0, "a\nbb\n\nccc\n" },
+    };
+    const char* dir = argc > 1 ? argv[1] : ".";
+    char* path = Test_Path(dir, "stream.ssix"), *scratch = Test_Path(dir, "damaged.ssix");
+    size_t i, len, chunk;
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const Case* c = &cases[i];
+        char* buf = Repeat(c->csvHeader ? "h1,h2\n" : "", c->unit, 30, &len);
+        for(chunk = 1; chunk < 64; chunk *= 3) {
+            TestDocs docs = { NULL, 0 };
+            SplitstreamIndex* index = Build(c, buf, len, chunk, &docs), *loaded;
+            CHECK(docs.count > 30);
+            CheckSeek(c, index, buf, len, &docs);
+            CHECK(SplitstreamIndexSave(index, path) == 0);
+            loaded = SplitstreamIndexLoad(path);
+            CHECK(loaded);
+            CheckSeek(c, loaded, buf, len, &docs);
+            if(i == 0 && chunk == 1) CheckDamaged(path, scratch, docs.count);
+            SplitstreamIndexFree(loaded);
+            SplitstreamIndexFree(index);
+            Test_FreeDocs(&docs);
+        }
+        free(buf);
+    }
+    CheckOversized(scratch);
+    free(path);
+    free(scratch);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ *   key_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Extracts keys from documents with nested, escaped, missing and oddly placed keys, feeding
+   them in every pair of pieces and a byte at a time, so that the key is split across buffers
+   at every position, and checks the values, their hashes and the partitions of the documents. */
+
+#include "test.h"
+
+#define MAX_DOCS 16
+
+typedef struct {
+    const char* name;
+    SplitstreamScanner scan;
+    SplitstreamKey key;
+    int startDepth;
+    const char* data;
+    const char* values[MAX_DOCS];   /* The raw value of the key of each document, or NULL */
+} Case;
+
+typedef struct {
+    TestDocs docs;
+    int hasKey[MAX_DOCS];
+    unsigned long long keyHash[MAX_DOCS];
+    size_t keyOffset[MAX_DOCS], keyLength[MAX_DOCS];
+    size_t partition[MAX_DOCS][9];
+} Result;
+
+static unsigned long long Fnv(const char* p, size_t len)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    while(len--) {
+        h ^= (unsigned char)*p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void Take(SplitstreamState* s, SplitstreamDocument* doc, Result* r)
+{
+    size_t n = r->docs.count, parts;
+    CHECK(n < MAX_DOCS);
+    r->hasKey[n] = doc->hasKey;
+    r->keyHash[n] = doc->keyHash;
+    r->keyOffset[n] = doc->keyOffset;
+    r->keyLength[n] = doc->keyLength;
+    for(parts = 0; parts < 9; ++parts) {
+        r->partition[n][parts] = SplitstreamPartition(doc, parts);
+        CHECK(r->partition[n][parts] < (parts ? parts : 1));
+    }
+    Test_Add(&r->docs, s, doc);
+}
+
+/* Feeds the pieces [0, cut) and [cut, len), or one byte at a time if `cut` is past the end */
+static void Split(const Case* c, size_t cut, int segmented, Result* r)
+{
+    SplitstreamState s;
+    SplitstreamDocument doc;
+    size_t len = strlen(c->data), pos = 0, n;
+    memset(r, 0, sizeof(*r));
+    SplitstreamInitDepth(&s, c->startDepth);
+    SplitstreamSetKey(&s, &c->key);
+    SplitstreamSetSegmented(&s, segmented);
+    while(pos < len) {
+        n = cut > len ? 1 : (pos < cut ? cut : len - pos);
+        doc = SplitstreamGetNextDocument(&s, 1 << 20, c->data + pos, n, c->scan);
+        while(doc.buffer) {
+            Take(&s, &doc, r);
+            SplitstreamDocumentFree(&s, &doc);
+            doc = SplitstreamGetNextDocument(&s, 1 << 20, NULL, 0, c->scan);
+        }
+        pos += n;
+    }
+    SplitstreamFree(&s);
+}
+
+static void CheckCase(const Case* c)
+{
+    Result r;
+    size_t len = strlen(c->data), cut, i, count;
+    for(count = 0; count < MAX_DOCS && c->values[count]; ++count);
+    for(cut = 0; cut <= len + 1; ++cut) {
+        Split(c, cut, 0, &r);
+        if(r.docs.count != count) {
+            fprintf(stderr, "%s: cut at %u gives %u documents, not %u\n", c->name, (unsigned)cut,
+                    (unsigned)r.docs.count, (unsigned)count);
+            exit(1);
+        }
+        for(i = 0; i < count; ++i) {
+            const char* value = c->values[i];
+            if(!value || !*value) {
+                /* "" marks a document without the key */
+                CHECK(!r.hasKey[i] && r.partition[i][8] == 0);
+                continue;
+            }
+            if(!r.hasKey[i] || r.keyLength[i] != strlen(value) ||
+               r.keyOffset[i] + r.keyLength[i] > r.docs.docs[i].length ||
+               memcmp(r.docs.docs[i].data + r.keyOffset[i], value, r.keyLength[i])) {
+                fprintf(stderr, "%s: cut at %u gives the wrong key for document %u\n", c->name, (unsigned)cut, (unsigned)i);
+                exit(1);
+            }
+            CHECK(r.keyHash[i] == Fnv(value, strlen(value)));
+        }
+        Test_FreeDocs(&r.docs);
+    }
+}
+
+/* Documents with the same key value are in the same partition, whatever else they contain */
+static void CheckPartitions(void)
+{
+    static const Case c = { "partitions", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "user" }, 0,
+        "{\"user\":\"a\",\"n\":1} {\"n\":2,\"user\":\"b\"} {\"user\" : \"a\"} {\"x\":[{\"user\":\"b\"}],\"user\":\"b\"} {\"n\":5}",
+        { 0 } };
+    Result r;
+    size_t parts;
+    Split(&c, (size_t)-1, 0, &r);
+    CHECK(r.docs.count == 5);
+    CHECK(r.hasKey[0] && r.hasKey[1] && r.hasKey[2] && r.hasKey[3] && !r.hasKey[4]);
+    CHECK(r.keyHash[0] == r.keyHash[2] && r.keyHash[1] == r.keyHash[3] && r.keyHash[0] != r.keyHash[1]);
+    for(parts = 0; parts < 9; ++parts) {
+        CHECK(r.partition[0][parts] == r.partition[2][parts]);
+        CHECK(r.partition[1][parts] == r.partition[3][parts]);
+        CHECK(r.partition[4][parts] == 0);
+        CHECK(parts > 1 || r.partition[0][parts] == 0);
+    }
+    Test_FreeDocs(&r.docs);
+}
+
+/* A key that crosses the boundary between the segments of a segmented document */
+static void CheckSegmented(void)
+{
+    size_t pad, len;
+    for(pad = SPLITSTREAM_SEGMENT_SIZE - 24; pad < SPLITSTREAM_SEGMENT_SIZE; ++pad) {
+        char* data = malloc(pad + 64);
+        Case c = { "segmented", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 0, NULL, { 0 } };
+        Result r;
+        CHECK(data);
+        memcpy(data, "{\"p\":\"", 6);
+        memset(data + 6, 'x', pad);
+        len = 6 + pad;
+        len += (size_t)sprintf(data + len, "\",\"id\":\"0123456789abcdef\"} ");
+        c.data = data;
+        Split(&c, 1000, 1, &r);
+        CHECK(r.docs.count == 1 && r.hasKey[0] && r.keyLength[0] == 18);
+        CHECK(!memcmp(r.docs.docs[0].data + r.keyOffset[0], "\"0123456789abcdef\"", 18));
+        CHECK(r.keyHash[0] == Fnv("\"0123456789abcdef\"", 18));
+        Test_FreeDocs(&r.docs);
+        free(data);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const Case cases[] = {
+        { "json nested", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 0,
+          "{\"a\":{\"id\":\"inner\"},\"b\":[{\"id\":2}],\"id\":\"outer\"} "
+          "{\"id\":{\"x\":\"}\",\"y\":[1,{\"z\":\"]\"}]}, \"id\":\"second\"}\n"
+          "{\"x\":[[\"id\"],{\"id\":[]}],\"id\" : [1, [2]] }",
+          { "\"outer\"", "{\"x\":\"}\",\"y\":[1,{\"z\":\"]\"}]}", "[1, [2]]" } },
+        { "json escaped", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 0,
+          "{\"i\\u0064\":1,\"\\\"id\":2,\"s\":\"\\\"id\\\":3\",\"id\":\"v\\\"\\\\\"} "
+          "{\"id\\\\\":1,\"id\":-4.5e1}"
+          "{\"x\":\"\\\\\",\"id\":true}",
+          { "\"v\\\"\\\\\"", "-4.5e1", "true" } },
+        { "json missing", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 0,
+          "{\"a\":1} [\"id\",{\"id\":1}] {\"ids\":1,\"i\":2,\"b\":{\"id\":3}} {\"id\":null}",
+          { "", "", "", "null" } },
+        { "json elements", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 1,
+          "[{\"id\":1}, \"id\", {\"x\":{\"id\":2}}, {\"id\":\"3\"}, 4]",
+          { "1", "", "", "\"3\"", "" } },
+        { "xml", SplitstreamXMLScanner, { SPLITSTREAM_KEY_XML_ATTRIBUTE, "id" }, 0,
+          "<a x=\"1\" id='k&lt;1'><b id=\"no\"/></a><?pi id=\"no\"?><!-- <a id=\"no\"/> -->"
+          "<a\n  ns:id=\"no\"\n  id = \"k 2\" /><r><e id=\"no\"/></r><ids x=\"id\"/>",
+          { "k&lt;1", "k 2", "", "" } },
+        { "xml prefixed", SplitstreamXMLScanner, { SPLITSTREAM_KEY_XML_ATTRIBUTE, "ns:id" }, 1,
+          "<root><a id=\"no\" ns:id=\"yes\"/><b ns:id='1'>t</b></root>",
+          { "yes", "1" } },
+    };
+    size_t i;
+    (void)argc;
+    (void)argv;
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) CheckCase(&cases[i]);
+    CheckPartitions();
+    CheckSegmented();
+    return 0;
+}
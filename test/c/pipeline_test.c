@@ -0,0 +1,208 @@
+/*
+ *   pipeline_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Runs the pipeline with different numbers of workers, queue sizes and read sizes, with
+   workers that take varying times, and checks what does not depend on the timing: every
+   document is handled exactly once, with its own index and contents, progress only moves
+   forward to the end of the stream, and a partitioned pipeline hands the documents of a
+   partition to one thread in stream order. */
+
+#include "test.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define DOCUMENTS   1000
+#define KEYS        13
+
+typedef struct {
+    SplitstreamReader base;
+    const char* data;
+    size_t len, pos, chunk;
+} MemoryReader;
+
+typedef struct {
+    const char* data;
+    long long starts[DOCUMENTS], ends[DOCUMENTS];
+    int seen[DOCUMENTS];
+    size_t partitions;
+    pthread_t owner[256];
+    long long last[256];
+    int stopAt;
+    unsigned long long progressed;
+    long long progressOffset;
+    pthread_mutex_t lock;
+} Run;
+
+static int Memory_Read(SplitstreamReader* reader, const char** buf, size_t* len)
+{
+    MemoryReader* m = (MemoryReader*)reader;
+    size_t n = m->len - m->pos < m->chunk ? m->len - m->pos : m->chunk;
+    if(!n) return 0;
+    *buf = m->data + m->pos;
+    *len = n;
+    m->pos += n;
+    return 1;
+}
+
+static void Memory_Close(SplitstreamReader* reader)
+{
+    (void)reader;
+}
+
+static void Memory_Open(MemoryReader* m, const char* data, size_t len, size_t chunk)
+{
+    memset(m, 0, sizeof(*m));
+    m->base.read = Memory_Read;
+    m->base.close = Memory_Close;
+    m->data = data;
+    m->len = len;
+    m->chunk = chunk;
+}
+
+static int OnDocument(void* arg, unsigned long long index, const SplitstreamDocument* doc)
+{
+    Run* r = arg;
+    char expect[64];
+    size_t part, spin;
+
+    CHECK(index < DOCUMENTS);
+    CHECK(doc->offset == r->starts[index] && doc->offset + (long long)doc->length == r->ends[index]);
+    CHECK(!memcmp(doc->buffer, r->data + doc->offset, doc->length));
+    sprintf(expect, "\"n\":%u", (unsigned)index);
+    CHECK(strstr(r->data + doc->offset, expect) == r->data + doc->offset + 13);
+
+    /* Make the workers overtake each other */
+    for(spin = (index * 7919) % 13; spin; --spin) sched_yield();
+
+    pthread_mutex_lock(&r->lock);
+    r->seen[index]++;
+    if(r->partitions) {
+        part = SplitstreamPartition(doc, r->partitions);
+        CHECK(doc->hasKey && part < r->partitions);
+        if(r->last[part] >= 0) CHECK(pthread_equal(r->owner[part], pthread_self()));
+        CHECK((long long)index > r->last[part]);
+        r->owner[part] = pthread_self();
+        r->last[part] = (long long)index;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return (int)index == r->stopAt ? 42 : 0;
+}
+
+static void OnProgress(void* arg, unsigned long long documents, long long offset)
+{
+    Run* r = arg;
+    CHECK(documents > r->progressed && documents <= DOCUMENTS);
+    CHECK(offset == r->ends[documents - 1]);
+    r->progressed = documents;
+    r->progressOffset = offset;
+}
+
+/* One document per key in turn, each with its index at a fixed place */
+static char* Generate(Run* r, size_t* len)
+{
+    char* data = malloc(DOCUMENTS * 64), *p = data;
+    int i;
+    CHECK(data);
+    for(i = 0; i < DOCUMENTS; ++i) {
+        r->starts[i] = p - data;
+        p += sprintf(p, "{\"id\":\"k%02d\", \"n\":%u, \"pad\":[%.*s]}", i % KEYS, (unsigned)i, i % 9, "1,2,3,4,5");
+        r->ends[i] = p - data;
+        p += sprintf(p, i % 3 ? "\n" : " ");
+    }
+    *len = (size_t)(p - data);
+    return data;
+}
+
+static void Check(const char* data, size_t len, Run* base, size_t chunk, size_t queueSize, int workers, int partitioned, int stopAt, int progress)
+{
+    static const SplitstreamKey key = { SPLITSTREAM_KEY_JSON_MEMBER, "id" };
+    MemoryReader m;
+    Run* r = malloc(sizeof(Run));
+    int i, rc;
+
+    CHECK(r);
+    memcpy(r, base, sizeof(Run));
+    memset(r->seen, 0, sizeof(r->seen));
+    for(i = 0; i < 256; ++i) r->last[i] = -1;
+    r->partitions = partitioned ? (size_t)workers : 0;
+    r->stopAt = stopAt;
+    r->progressed = 0;
+    r->progressOffset = -1;
+    pthread_mutex_init(&r->lock, NULL);
+
+    Memory_Open(&m, data, len, chunk);
+    if(partitioned) {
+        rc = SplitstreamSplitPartitioned(&m.base, SplitstreamJSONScanner, 0, 0, &key, workers, queueSize,
+                                         OnDocument, progress ? OnProgress : NULL, r);
+    } else {
+        rc = SplitstreamSplitPipeline(&m.base, SplitstreamJSONScanner, 0, 0, queueSize, workers,
+                                      OnDocument, progress ? OnProgress : NULL, r);
+    }
+    if(stopAt < 0) {
+        CHECK(rc == 0);
+        for(i = 0; i < DOCUMENTS; ++i) {
+            if(r->seen[i] != 1) {
+                fprintf(stderr, "document %d handled %d times (read size %u, queue %u, %d workers%s)\n", i, r->seen[i],
+                        (unsigned)chunk, (unsigned)queueSize, workers, partitioned ? ", partitioned" : "");
+                exit(1);
+            }
+        }
+        if(progress) CHECK(r->progressed == DOCUMENTS && r->progressOffset == r->ends[DOCUMENTS - 1]);
+    } else {
+        /* Documents after it may or may not have been handled, but only once */
+        CHECK(rc == 42);
+        CHECK(r->seen[stopAt] == 1);
+        for(i = 0; i < DOCUMENTS; ++i) CHECK(r->seen[i] <= 1);
+        CHECK(r->progressed <= (unsigned long long)stopAt);
+    }
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+int main(int argc, char** argv)
+{
+    static const size_t chunks[] = { 7, 4096 };
+    static const size_t queues[] = { 1, 2, 64 };
+    static const int workers[] = { 1, 2, 3, 8 };
+    Run* base = calloc(1, sizeof(Run));
+    size_t len, c, q, w;
+    char* data;
+    int partitioned;
+    (void)argc;
+    (void)argv;
+
+    CHECK(base);
+    data = Generate(base, &len);
+    base->data = data;
+    for(c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        for(q = 0; q < sizeof(queues) / sizeof(queues[0]); ++q) {
+            for(w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+                for(partitioned = 0; partitioned <= 1; ++partitioned) {
+                    Check(data, len, base, chunks[c], queues[q], workers[w], partitioned, -1, (int)(w + q) % 2);
+                }
+            }
+        }
+    }
+    for(partitioned = 0; partitioned <= 1; ++partitioned) {
+        Check(data, len, base, 4096, 16, 4, partitioned, 0, 1);
+        Check(data, len, base, 4096, 16, 4, partitioned, DOCUMENTS / 2, 1);
+    }
+    free(data);
+    free(base);
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ *   reader_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Reads a file with the pread(2) reader and the io_uring reader, and checks that both hand
+   out the file from where the descriptor was, and leave it after the data handed out. The
+   io_uring reader is built in here with the system call wrapped, so that submissions can be
+   made to fail and the reads fall back to pread(2). A descriptor that was closed and reused
+   before the reader is closed must be left alone. */
+
+#include <splitstream_private.h>
+#include "test.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+static int failSetup;         /* io_uring_setup fails */
+static unsigned failSubmits;  /* Bit n set: the nth submission from now fails, taking nothing */
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <errno.h>
+
+static long Test_Enter(long ring, ...)
+{
+    unsigned toSubmit, minComplete, flags;
+    unsigned fail;
+    va_list ap;
+    va_start(ap, ring);
+    toSubmit = va_arg(ap, unsigned);
+    minComplete = va_arg(ap, unsigned);
+    flags = va_arg(ap, unsigned);
+    va_end(ap);
+    if(toSubmit) {
+        fail = failSubmits & 1;
+        failSubmits >>= 1;
+        if(fail) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    return syscall(__NR_io_uring_enter, ring, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static long Test_Setup(long entries, ...)
+{
+    void* p;
+    va_list ap;
+    va_start(ap, entries);
+    p = va_arg(ap, void*);
+    va_end(ap);
+    if(failSetup) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+#define syscall(nr, ...) ((nr) == __NR_io_uring_enter ? Test_Enter(__VA_ARGS__) : \
+                          (nr) == __NR_io_uring_setup ? Test_Setup(__VA_ARGS__) : syscall(nr, __VA_ARGS__))
+#endif
+
+#define uring_ReaderNew Test_UringReaderNew
+#include "../../src/splitstream_uring.c"
+
+#define SIZE        100000
+#define START       1234
+#define BUFSIZE     4096
+
+static char data[SIZE];
+
+static SplitstreamReader* Open(int fd, int queueDepth)
+{
+    SplitstreamReader* r;
+    if(queueDepth < 2) return SplitstreamReaderOpenFd(fd, BUFSIZE, queueDepth);
+    r = Test_UringReaderNew(fd, BUFSIZE, queueDepth);
+    /* Without io_uring in this kernel there is only the pread(2) reader to test */
+    if(!r && !failSetup && !failSubmits) r = SplitstreamReaderOpenFd(fd, BUFSIZE, 0);
+    return r;
+}
+
+/* Reads `reads` buffers (or to the end when negative) and checks what was handed out */
+static long long Read(SplitstreamReader* r, int reads)
+{
+    const char* buf;
+    size_t len;
+    long long pos = START;
+    int n = 0, rc = 1;
+    while(n != reads && (rc = r->read(r, &buf, &len)) > 0) {
+        CHECK(len > 0 && len <= BUFSIZE && pos + (long long)len <= SIZE);
+        CHECK(!memcmp(buf, data + pos, len));
+        pos += (long long)len;
+        ++n;
+    }
+    CHECK(rc == 0 ? pos == SIZE : n == reads);
+    CHECK(!r->error);
+    return pos;
+}
+
+static void Check(const char* path, int queueDepth, int reads, unsigned submits)
+{
+    int fd = open(path, O_RDONLY);
+    SplitstreamReader* r;
+    long long pos;
+    CHECK(fd >= 0 && lseek(fd, START, SEEK_SET) == START);
+    failSubmits = submits;
+    r = Open(fd, queueDepth);
+    if(!r) {
+        /* Nothing may have been queued or moved */
+        CHECK(failSetup || (submits & 0xf));
+        CHECK(lseek(fd, 0, SEEK_CUR) == START);
+        close(fd);
+        return;
+    }
+    pos = Read(r, reads);
+    SplitstreamReaderClose(r);
+    if(lseek(fd, 0, SEEK_CUR) != pos) {
+        fprintf(stderr, "depth %d, %d reads, failing %x: closed at %lld, not %lld\n", queueDepth, reads,
+                submits, (long long)lseek(fd, 0, SEEK_CUR), pos);
+        exit(1);
+    }
+    failSubmits = 0;
+    close(fd);
+}
+
+/* The reader is closed after its descriptor, whose number now belongs to another file */
+static void CheckReused(const char* path, const char* other, int queueDepth)
+{
+    int fd = open(path, O_RDONLY), fd2;
+    SplitstreamReader* r;
+    CHECK(fd >= 0 && lseek(fd, START, SEEK_SET) == START);
+    r = Open(fd, queueDepth);
+    if(!r) r = SplitstreamReaderOpenFd(fd, BUFSIZE, 0);
+    Read(r, 3);
+    close(fd);
+    fd2 = open(other, O_RDONLY);
+    CHECK(fd2 == fd);
+    SplitstreamReaderClose(r);
+    CHECK(lseek(fd2, 0, SEEK_CUR) == 0);
+    close(fd2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* dir = argc > 1 ? argv[1] : ".";
+    char* path = Test_Path(dir, "input"), *other = Test_Path(dir, "other");
+    FILE* f;
+    unsigned seed = 1;
+    int i, depth, reads;
+
+    for(i = 0; i < SIZE; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (char)(seed >> 16);
+    }
+    CHECK((f = fopen(path, "wb")) && fwrite(data, 1, SIZE, f) == SIZE && !fclose(f));
+    CHECK((f = fopen(other, "wb")) && fwrite(data, 1, SIZE, f) == SIZE && !fclose(f));
+    /* Time out rather than hang on a read that is never completed */
+    alarm(60);
+
+    for(depth = 0; depth <= 8; depth += 4) {
+        for(reads = 0; reads < 30; reads += 7) Check(path, depth, reads, 0);
+        Check(path, depth, -1, 0);
+        CheckReused(path, other, depth);
+    }
+    /* The first submissions fail: the reader is not opened, or falls back where it failed */
+    Check(path, 4, -1, 1);
+    Check(path, 4, -1, 8);
+    /* Reads fall back to pread(2) wherever their submission fails */
+    for(i = 0; i < 32; ++i) {
+        Check(path, 4, -1, (0x55aa33u << i) & ~0xfu);
+        Check(path, 4, i, (0xffffu << i) & ~0xfu);
+    }
+    Check(path, 4, -1, 0xfffffff0u);
+    failSetup = 1;
+    Check(path, 4, -1, 0);
+    failSetup = 0;
+
+    free(path);
+    free(other);
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ *   ring_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Splits into small rings while holding back a few documents, so that the ring wraps and
+   fills up, and compares the documents with a split without a ring. Also drops documents
+   that do not fit in the ring and releases documents out of order. */
+
+#include "test.h"
+
+#define MAX_HELD 8
+
+typedef struct {
+    SplitstreamState s;
+    SplitstreamRing ring;
+    char* buffer;
+    SplitstreamDocument held[MAX_HELD];
+    int count, hold;
+    int wraps;
+    const char* last;
+} Ring;
+
+static void Ring_Begin(Ring* r, size_t size, int hold)
+{
+    memset(r, 0, sizeof(*r));
+    r->buffer = malloc(size);
+    CHECK(r->buffer);
+    SplitstreamInit(&r->s);
+    SplitstreamRingInit(&r->ring, r->buffer, size);
+    SplitstreamSetRing(&r->s, &r->ring);
+    r->hold = hold;
+}
+
+static void Ring_ReleaseOldest(Ring* r)
+{
+    CHECK(r->count > 0);
+    SplitstreamDocumentFree(&r->s, &r->held[0]);
+    memmove(r->held, r->held + 1, (size_t)--r->count * sizeof(r->held[0]));
+}
+
+/* Every document is in the ring; it is kept until `hold` newer ones are */
+static void Ring_Take(Ring* r, SplitstreamDocument* doc, TestDocs* docs)
+{
+    CHECK(doc->buffer >= r->buffer && doc->buffer + doc->length <= r->buffer + r->ring.size);
+    if(r->last && doc->buffer < r->last) r->wraps++;
+    r->last = doc->buffer;
+    Test_Add(docs, &r->s, doc);
+    r->held[r->count++] = *doc;
+    if(r->count > r->hold) Ring_ReleaseOldest(r);
+}
+
+static void Ring_Split(Ring* r, const char* buf, size_t len, size_t chunk, TestDocs* docs)
+{
+    SplitstreamDocument doc;
+    size_t pos = 0, n;
+    while(pos < len) {
+        n = len - pos < chunk ? len - pos : chunk;
+        doc = SplitstreamGetNextDocument(&r->s, 1 << 20, buf + pos, n, SplitstreamJSONScanner);
+        if(!doc.buffer && r->ring.full) {
+            /* Nothing was consumed, so the same input is passed again */
+            Ring_ReleaseOldest(r);
+            continue;
+        }
+        CHECK(!r->ring.full);
+        pos += n;
+        while(doc.buffer) {
+            Ring_Take(r, &doc, docs);
+            doc = SplitstreamGetNextDocument(&r->s, 1 << 20, NULL, 0, SplitstreamJSONScanner);
+        }
+    }
+}
+
+/* Releasing the newest document releases them all, and the ring is empty again */
+static void Ring_End(Ring* r)
+{
+    SplitstreamDocument doc;
+    if(r->count) {
+        doc = r->held[r->count - 1];
+        SplitstreamDocumentFree(&r->s, &doc);
+    }
+    while(r->count) Ring_ReleaseOldest(r);
+    CHECK(r->ring.head == r->ring.tail && !r->ring.wrapped && !r->ring.reserved);
+    SplitstreamFree(&r->s);
+    free(r->buffer);
+}
+
+static void CheckSame(const TestDocs* got, const TestDocs* exp)
+{
+    size_t i;
+    CHECK(got->count == exp->count);
+    for(i = 0; i < exp->count; ++i) {
+        CHECK(got->docs[i].length == exp->docs[i].length);
+        CHECK(got->docs[i].offset == exp->docs[i].offset);
+        CHECK(!memcmp(got->docs[i].data, exp->docs[i].data, exp->docs[i].length));
+    }
+}
+
+static void CheckWrap(void)
+{
+    static const char data[] =
+        "{\"a\":1} [2,[3]]\n{\"s\":\"}]\\\"\"} [] {\"long\":[1,2,3,4,5,6,7,8,9]}"
+        "{\"x\":{\"y\":{}}}  [\"q\"] {\"a\":1} [2,[3]]\n{\"long\":[1,2,3,4,5,6,7,8,9]} {}";
+    static const size_t sizes[] = { 96, 100, 128, 257 };
+    size_t len = strlen(data), i, chunk;
+    int hold, wraps = 0;
+    SplitstreamState plain;
+    TestDocs exp = { NULL, 0 };
+
+    SplitstreamInit(&plain);
+    Test_Split(&plain, data, len, 7, SplitstreamJSONScanner, &exp);
+    SplitstreamFree(&plain);
+    CHECK(exp.count == 11);
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for(chunk = 1; chunk <= 16; chunk *= 2) {
+            for(hold = 0; hold <= 3; ++hold) {
+                Ring r;
+                TestDocs docs = { NULL, 0 };
+                Ring_Begin(&r, sizes[i], hold);
+                Ring_Split(&r, data, len, chunk, &docs);
+                CheckSame(&docs, &exp);
+                wraps += r.wraps;
+                Ring_End(&r);
+                Test_FreeDocs(&docs);
+            }
+        }
+    }
+    CHECK(wraps > 0);
+    Test_FreeDocs(&exp);
+}
+
+/* A document larger than the ring is dropped, and the scan goes on at the start depth: the
+   rest of it only closes containers, which are ignored there */
+static void CheckOversized(void)
+{
+    static const char data[] =
+        "{\"a\":1} {\"k\":[[[1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1]]]}"
+        " {\"b\":2} [3] {\"c\":[4]}";
+    static const char* exp[] = { "{\"a\":1}", "{\"b\":2}", "[3]", "{\"c\":[4]}" };
+    size_t i, chunk;
+    for(chunk = 4; chunk <= 8; ++chunk) {
+        Ring r;
+        TestDocs docs = { NULL, 0 };
+        Ring_Begin(&r, 48, 0);
+        Ring_Split(&r, data, strlen(data), chunk, &docs);
+        CHECK(r.s.depth == 0);
+        CHECK(docs.count == sizeof(exp) / sizeof(exp[0]));
+        for(i = 0; i < docs.count; ++i) CHECK(!strcmp(docs.docs[i].data, exp[i]));
+        Ring_End(&r);
+        Test_FreeDocs(&docs);
+    }
+}
+
+/* Freeing documents that a later release has already released changes nothing, whether
+   the ring has wrapped or not */
+static void CheckOrder(void)
+{
+    static const char data[] = "[1] [22] [333] [4444] [55555] [1] [22] [333] [4444] [55555] [1] [22] ";
+    SplitstreamDocument docs[4];
+    Ring r;
+    size_t n, pos = 0, len = strlen(data), tail;
+    int wrapped = 0;
+
+    /* docs[0] is the newest document of the last round, which is still held */
+    Ring_Begin(&r, 40, 0);
+    memset(docs, 0, sizeof(docs));
+    while(pos < len) {
+        n = 1;
+        while(n < 4 && pos < len) {
+            SplitstreamDocument doc = SplitstreamGetNextDocument(&r.s, 1 << 20, data + pos, 1, SplitstreamJSONScanner);
+            CHECK(!r.ring.full);
+            ++pos;
+            if(doc.buffer) docs[n++] = doc;
+        }
+        if(n < 4) break;
+        wrapped |= r.ring.wrapped;
+        SplitstreamDocumentFree(&r.s, &docs[2]);
+        tail = r.ring.tail;
+        SplitstreamDocumentFree(&r.s, &docs[0]);
+        SplitstreamDocumentFree(&r.s, &docs[1]);
+        SplitstreamDocumentFree(&r.s, &docs[2]);
+        CHECK(r.ring.tail == tail);
+        docs[0] = docs[3];
+    }
+    CHECK(wrapped);
+    SplitstreamDocumentFree(&r.s, &docs[0]);
+    Ring_End(&r);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    CheckWrap();
+    CheckOversized();
+    CheckOrder();
+    return 0;
+}
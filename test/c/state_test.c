@@ -0,0 +1,171 @@
+/*
+ *   state_test.c
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Saves the state at every position of a stream and resumes from it in a new state, which
+   must give the same documents, keys and skipped ranges as scanning it in one go. */
+
+#include "test.h"
+
+typedef struct {
+    long long ranges[64][2];
+    size_t count;
+} Skipped;
+
+typedef struct {
+    TestDocs docs;
+    int hasKey[64];
+    unsigned long long keyHash[64];
+    size_t keyOffset[64], keyLength[64];
+    Skipped skipped;
+} Result;
+
+typedef struct {
+    const char* name;
+    SplitstreamScanner scan;
+    SplitstreamKey key;
+    int lineStart;
+    const char* data;
+} Case;
+
+static void OnSkipped(void* arg, long long start, long long end)
+{
+    Skipped* skipped = arg;
+    CHECK(skipped->count < 64);
+    skipped->ranges[skipped->count][0] = start;
+    skipped->ranges[skipped->count++][1] = end;
+}
+
+static void Configure(SplitstreamState* s, const Case* c, SplitstreamResync* resync, Skipped* skipped)
+{
+    memset(resync, 0, sizeof(*resync));
+    resync->lineStart = c->lineStart;
+    resync->skipped = OnSkipped;
+    resync->arg = skipped;
+    SplitstreamSetKey(s, &c->key);
+    SplitstreamSetHashing(s, 1);
+    if(c->lineStart) SplitstreamSetResync(s, resync);
+}
+
+static void Feed(SplitstreamState* s, const Case* c, const char* buf, size_t len, Result* r)
+{
+    SplitstreamDocument doc = SplitstreamGetNextDocument(s, 1 << 20, buf, len, c->scan);
+    while(doc.buffer) {
+        size_t n = r->docs.count;
+        CHECK(n < 64);
+        r->hasKey[n] = doc.hasKey;
+        r->keyHash[n] = doc.keyHash;
+        r->keyOffset[n] = doc.keyOffset;
+        r->keyLength[n] = doc.keyLength;
+        Test_Add(&r->docs, s, &doc);
+        SplitstreamDocumentFree(s, &doc);
+        doc = SplitstreamGetNextDocument(s, 1 << 20, NULL, 0, c->scan);
+    }
+}
+
+/* Serializes into buffers filled with different bytes, which must come out the same */
+static char* Save(const SplitstreamState* s, size_t* len)
+{
+    size_t needed = SplitstreamStateSerialize(s, NULL, 0);
+    char* a = malloc(needed), *b = malloc(needed);
+    CHECK(a && b);
+    memset(a, 0, needed);
+    memset(b, 0xff, needed);
+    CHECK(SplitstreamStateSerialize(s, a, needed) == needed);
+    CHECK(SplitstreamStateSerialize(s, b, needed) == needed);
+    CHECK(!memcmp(a, b, needed));
+    free(b);
+    *len = needed;
+    return a;
+}
+
+static void CheckSame(const Case* c, size_t cut, const Result* exp, const Result* got)
+{
+    size_t i;
+    if(got->docs.count != exp->docs.count || got->skipped.count != exp->skipped.count) {
+        fprintf(stderr, "%s: cut at %u gives %u documents and %u skipped ranges, not %u and %u\n", c->name,
+                (unsigned)cut, (unsigned)got->docs.count, (unsigned)got->skipped.count,
+                (unsigned)exp->docs.count, (unsigned)exp->skipped.count);
+        exit(1);
+    }
+    for(i = 0; i < exp->docs.count; ++i) {
+        CHECK(got->docs.docs[i].length == exp->docs.docs[i].length);
+        CHECK(got->docs.docs[i].offset == exp->docs.docs[i].offset);
+        CHECK(!memcmp(got->docs.docs[i].data, exp->docs.docs[i].data, exp->docs.docs[i].length));
+        if(got->hasKey[i] != exp->hasKey[i] || got->keyHash[i] != exp->keyHash[i] ||
+           got->keyOffset[i] != exp->keyOffset[i] || got->keyLength[i] != exp->keyLength[i]) {
+            fprintf(stderr, "%s: cut at %u loses the key of document %u (%d %u %u, not %d %u %u)\n", c->name, (unsigned)cut, (unsigned)i, got->hasKey[i], (unsigned)got->keyOffset[i], (unsigned)got->keyLength[i], exp->hasKey[i], (unsigned)exp->keyOffset[i], (unsigned)exp->keyLength[i]);
+            exit(1);
+        }
+    }
+    CHECK(!memcmp(got->skipped.ranges, exp->skipped.ranges, sizeof(exp->skipped.ranges[0]) * exp->skipped.count));
+}
+
+int main(int argc, char** argv)
+{
+    static const Case cases[] = {
+        { "json key", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 0,
+          "{\"pad\":\"x\\\"y\",\"i\":{\"id\":1},\"id\":\"abc\\\"d\"} {\"id\":[1,{\"a\":2}]}\n{\"n\":1}" },
+        { "xml key", SplitstreamXMLScanner, { SPLITSTREAM_KEY_XML_ATTRIBUTE, "id" }, 0,
+          "<a x=\"1\" id='k&lt;1'><b id=\"no\"/></a><!-- c --><a id=\"k2\"/>" },
+        { "json resync", SplitstreamJSONScanner, { SPLITSTREAM_KEY_JSON_MEMBER, "id" }, 1,
+          "{\"id\":1}\n{\"id\":\"broken}\n{\"id\":2,\n  \"x\":[1]}\n[\"unterminated\n{\"id\":3}\n" },
+    };
+    size_t i, cut, len, saved;
+    (void)argc;
+    (void)argv;
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const Case* c = &cases[i];
+        SplitstreamState s;
+        SplitstreamResync resync;
+        Result exp;
+        len = strlen(c->data);
+
+        memset(&exp, 0, sizeof(exp));
+        SplitstreamInit(&s);
+        Configure(&s, c, &resync, &exp.skipped);
+        Feed(&s, c, c->data, len, &exp);
+        SplitstreamFree(&s);
+        CHECK(exp.docs.count >= 2 && exp.hasKey[0] && exp.hasKey[1]);
+        CHECK(!c->lineStart || exp.skipped.count == 2);
+
+        for(cut = 0; cut <= len; ++cut) {
+            Result got;
+            SplitstreamResync resync2;
+            char* state;
+            memset(&got, 0, sizeof(got));
+            SplitstreamInit(&s);
+            Configure(&s, c, &resync, &got.skipped);
+            Feed(&s, c, c->data, cut, &got);
+            state = Save(&s, &saved);
+            SplitstreamFree(&s);
+
+            SplitstreamInit(&s);
+            Configure(&s, c, &resync2, &got.skipped);
+            CHECK(SplitstreamStateDeserialize(&s, state, saved) == 0);
+            Feed(&s, c, c->data + cut, len - cut, &got);
+            free(Save(&s, &saved));
+            SplitstreamFree(&s);
+            free(state);
+            CheckSame(c, cut, &exp, &got);
+            Test_FreeDocs(&got.docs);
+        }
+        Test_FreeDocs(&exp.docs);
+    }
+    return 0;
+}
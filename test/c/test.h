@@ -0,0 +1,101 @@
+/*
+ *   test.h
+ *   splitstream - Stream object splitter
+ *
+ *   Copyright © 2015 Rickard Lyrenius
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Helpers for the C test programs, which are built and run by test/ctests.py. Each program
+   gets a scratch directory as its first argument and exits nonzero on the first failure. */
+
+#ifndef SPLITSTREAM_TEST_H
+#define SPLITSTREAM_TEST_H
+
+#include <splitstream.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while(0)
+
+/* A document copied out of the tokenizer, with its offset */
+typedef struct {
+    char* data;
+    size_t length;
+    long long offset;
+} TestDoc;
+
+typedef struct {
+    TestDoc* docs;
+    size_t count;
+} TestDocs;
+
+static void Test_Add(TestDocs* docs, SplitstreamState* s, SplitstreamDocument* doc)
+{
+    TestDoc* d;
+    docs->docs = realloc(docs->docs, (docs->count + 1) * sizeof(TestDoc));
+    CHECK(docs->docs);
+    d = &docs->docs[docs->count++];
+    CHECK(SplitstreamDocumentFlatten(s, doc) == 0);
+    d->data = malloc(doc->length + 1);
+    CHECK(d->data);
+    memcpy(d->data, doc->buffer, doc->length);
+    d->data[doc->length] = 0;
+    d->length = doc->length;
+    d->offset = doc->offset;
+}
+
+static void Test_FreeDocs(TestDocs* docs)
+{
+    size_t i;
+    for(i = 0; i < docs->count; ++i) free(docs->docs[i].data);
+    free(docs->docs);
+    docs->docs = NULL;
+    docs->count = 0;
+}
+
+/* Feeds `len` bytes to `s` in chunks of `chunk` bytes and collects every document */
+static void Test_Split(SplitstreamState* s, const char* buf, size_t len, size_t chunk, SplitstreamScanner scan, TestDocs* docs)
+{
+    SplitstreamDocument doc;
+    size_t pos = 0, n;
+    while(pos < len) {
+        n = len - pos < chunk ? len - pos : chunk;
+        doc = SplitstreamGetNextDocument(s, 1 << 20, buf + pos, n, scan);
+        while(doc.buffer) {
+            Test_Add(docs, s, &doc);
+            SplitstreamDocumentFree(s, &doc);
+            doc = SplitstreamGetNextDocument(s, 1 << 20, NULL, 0, scan);
+        }
+        pos += n;
+    }
+    doc = SplitstreamGetLastDocument(s, 1 << 20, scan);
+    if(doc.buffer) Test_Add(docs, s, &doc);
+    SplitstreamDocumentFree(s, &doc);
+}
+
+static char* Test_Path(const char* dir, const char* name)
+{
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    CHECK(path);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+#endif
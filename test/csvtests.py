@@ -0,0 +1,72 @@
+import unittest
+try:
+    from StringIO import StringIO
+except ImportError:
+    from io import BytesIO as StringIO
+import tempfile
+import splitstream
+
+class CsvTests(unittest.TestCase):
+    DATA = b"id,name,note\r\n1,a,plain\r\n2,\"b, c\",\"two\nlines\"\r\n\r\n3,\"say \"\"hi\"\"\",x\"y\r\n4,,\n"
+    RECORDS = [b"id,name,note", b"1,a,plain", b"2,\"b, c\",\"two\nlines\"", b"3,\"say \"\"hi\"\"\",x\"y", b"4,,"]
+
+    def _tempfile(self, string):
+        f = tempfile.TemporaryFile()
+        f.write(string)
+        f.seek(0)
+        return f
+
+    def test_SplitRecords(self):
+        for bufsize in [1, 2, 3, 7, 4096]:
+            self.assertEqual(list(splitstream.splitfile(StringIO(self.DATA), "csv", bufsize=bufsize)), self.RECORDS)
+        self.assertEqual(list(splitstream.splitfile(self._tempfile(self.DATA), "csv")), self.RECORDS)
+        self.assertEqual([d.tobytes() for d in splitstream.split_buffer(self.DATA, "csv")], self.RECORDS)
+
+    def test_LastRecord(self):
+        # The end of the input ends the last record, with or without a line break
+        for fmt, data, exp in [("csv", b"a,b\nc,d", [b"a,b", b"c,d"]),
+                               ("csv", b"a,b\r\n\"c\n\",\"d\"\"\"", [b"a,b", b"\"c\n\",\"d\"\"\""]),
+                               ("csv", b"a,b\r\n\r\n", [b"a,b"]),
+                               ("tsv", b"a\tb\nc\td", [b"a\tb", b"c\td"]),
+                               ("tsv", b"a\tb\r\nc\t\"d\te\"", [b"a\tb", b"c\t\"d\te\""])]:
+            for bufsize in [1, 2, 3, 4096]:
+                self.assertEqual(list(splitstream.splitfile(StringIO(data), fmt, bufsize=bufsize)), exp)
+            self.assertEqual(list(splitstream.splitfile(self._tempfile(data), fmt)), exp)
+            self.assertEqual([d.tobytes() for d in splitstream.split_buffer(data, fmt)], exp)
+            sp = splitstream.Splitter(fmt)
+            self.assertEqual(sp.feed(data), exp[:1])
+            self.assertEqual(sp.finish(), exp[1:])
+            self.assertEqual(sp.finish(), [])
+        # A header alone has no records
+        for data in [b"h1,h2", b"h1,h2\n"]:
+            self.assertEqual(list(splitstream.splitfile(StringIO(data), "csv", header=True)), [])
+            self.assertEqual(list(splitstream.splitfile(StringIO(data + b"\n1,2"), "csv", header=True, bufsize=1)), [b"1,2"])
+
+    def test_Header(self):
+        for bufsize in [1, 5, 4096]:
+            g = splitstream.splitfile(StringIO(b"\n" + self.DATA), "csv", bufsize=bufsize, header=True)
+            self.assertEqual(list(g), self.RECORDS[1:])
+        # A quoted line break in the header does not end it
+        data = b"\"a\nb\",c\n1,2\n"
+        self.assertEqual(list(splitstream.splitfile(StringIO(data), "csv", bufsize=1, header=True)), [b"1,2"])
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(data), "json", header=True)
+
+    def test_Delimiter(self):
+        data = b"a;\"b;\nc\";d\n1;2,\"3\n"
+        # The quote after the comma is not at the start of a field
+        exp = [b"a;\"b;\nc\";d", b"1;2,\"3"]
+        self.assertEqual(list(splitstream.splitfile(StringIO(data), "csv", delimiter=";")), exp)
+        self.assertEqual(list(splitstream.splitfile(StringIO(data), "csv", delimiter=b";", bufsize=1)), exp)
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(data), "csv", delimiter="\"")
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(data), "csv", delimiter=";;")
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(data), "json", delimiter=";")
+
+    def test_Tsv(self):
+        data = b"a\tb\n\"x\ty\n z\"\tq\n1\t\"2\n"
+        # The last field opens a quote that is never closed, so the record runs to the end
+        for bufsize in [1, 4096]:
+            self.assertEqual(list(splitstream.splitfile(StringIO(data), "tsv", bufsize=bufsize)), [b"a\tb", b"\"x\ty\n z\"\tq", b"1\t\"2\n"])
+        self.assertEqual(list(splitstream.splitfile(StringIO(b"a,\"b\nc\"\n"), "tsv")), [b"a,\"b", b"c\""])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,155 @@
+import unittest
+import os
+import glob
+import shutil
+import subprocess
+import tempfile
+try:
+    import setuptools
+except ImportError:
+    pass
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TEST_DIR = os.path.join(ROOT_DIR, "test", "c")
+
+class CTests(unittest.TestCase):
+    """Builds the programs in test/c against the library sources and runs them. They cover the
+    parts of the C interface that the Python module does not expose, and fail with a message
+    and a nonzero exit status."""
+
+    @classmethod
+    def setUpClass(cls):
+        cls.tmpdir = tempfile.mkdtemp()
+        cls.objects = cls.error = None
+        try:
+            from distutils.ccompiler import new_compiler
+            from distutils.sysconfig import customize_compiler
+            cls.compiler = new_compiler()
+            customize_compiler(cls.compiler)
+            sources = glob.glob(os.path.join(ROOT_DIR, "src", "*.c"))
+            cls.objects = cls.compiler.compile(sources, output_dir=cls.tmpdir,
+                                               include_dirs=[os.path.join(ROOT_DIR, "include")])
+        except Exception as e:
+            cls.error = e
+
+    @classmethod
+    def tearDownClass(cls):
+        shutil.rmtree(cls.tmpdir, ignore_errors=True)
+
+    def _build(self, source, name):
+        if self.objects is None:
+            self.skipTest("no C compiler: %s" % self.error)
+        flags, libraries = [], ["pthread"]
+        if source.endswith(".cpp"):
+            from distutils.errors import CompileError
+            flags, libraries = ["-std=c++17"], libraries + ["stdc++"]
+            try:
+                objects = self.compiler.compile([source], output_dir=self.tmpdir, extra_postargs=flags,
+                                                include_dirs=[os.path.join(ROOT_DIR, "include")])
+            except CompileError as e:
+                self.skipTest("no C++17 compiler: %s" % e)
+        else:
+            objects = self.compiler.compile([source], output_dir=self.tmpdir,
+                                            include_dirs=[os.path.join(ROOT_DIR, "include")])
+        program = os.path.join(self.tmpdir, name)
+        self.compiler.link_executable(objects + self.objects, program, libraries=libraries)
+        return program
+
+    def _run(self, name, *args, **kwargs):
+        program = self._build(os.path.join(TEST_DIR, name + kwargs.get("ext", ".c")), name)
+        workdir = tempfile.mkdtemp(dir=self.tmpdir)
+        p = subprocess.Popen([program, workdir] + list(args), stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        out = p.communicate()[0]
+        self.assertEqual(p.returncode, 0, out.decode("utf-8", "replace"))
+        return out
+
+    def test_Follow(self):
+        self._run("follow_test")
+
+    def test_Index(self):
+        self._run("index_test")
+
+    def test_State(self):
+        self._run("state_test")
+
+    def test_Reader(self):
+        self._run("reader_test")
+
+    def test_Ring(self):
+        self._run("ring_test")
+
+    def test_Pipeline(self):
+        self._run("pipeline_test")
+
+    def test_Key(self):
+        self._run("key_test")
+
+    def test_Hpp(self):
+        # The templates of splitstream.hpp against the C scanners, on the corpora of the Python tests
+        try:
+            from . import jsontests, xmltests
+        except ImportError:
+            import jsontests, xmltests
+        J, X = jsontests.JsonTests, xmltests.XmlTests
+        corpora = [
+            ("json", 0, J.DATA_JSON * 3),
+            ("json", 0, J.DATA_TYPED),
+            ("json", 0, b"{\"a}\":3}{\"b\\\"}\":3}  {\"a\":3}  \t{\"b\":3}[\"\\\\\"]\n{\"c\":\"\\\\\\\"\"}"),
+            ("json", 1, b"  {  \"a\": [1,2,3], \"b\" : {\"x\" : 3 } }"),
+            ("json", 1, b"[1, \"a\", {\"o\":[1]}, [2,3], -7e3, true, null]\n[\"x\"] [4]"),
+            ("json", 2, b"{\"a\":[{\"type\":1},{\"type\":2},[]]}"),
+            ("xml", 0, X.DATA_XMLRPC * 2),
+            ("xml", 0, X.DATA_LOG_MIXED),
+            ("xml", 0, b"<?xml version=\"1.0\"?><!-- c --><root/><other/>  <root></root>\r\n<root2/>"),
+            ("xml", 0, b"<!doctype misc><root></root>\r\n<root/><!DOCTYPE doc SYSTEM \"001.ent\" [\n<!ELEMENT doc EMPTY>/n]>\n<doc></doc>"),
+            ("xml", 0, b"<root><![CDATA[ <root></root> ]]></root>\r\n<root2><![CDATA[ >> \" ]]></root2><root><!-- Weird <> comment --></root>"),
+            ("xml", 1, X.DATA_LOG + b"</log>"),
+            ("xml", 1, b"  <logfile>  <logent val=\"x\"></logent>\r\n<logent val=\"y\"></logent><logent val=\"z\"></logent>"),
+        ]
+        args = []
+        for i, (fmt, depth, data) in enumerate(corpora):
+            path = os.path.join(self.tmpdir, "corpus%d.%s" % (i, fmt))
+            with open(path, "wb") as f:
+                f.write(data)
+            args += [fmt, str(depth), path]
+        self._run("hpp_test", *args, ext=".cpp")
+
+    def test_Cli(self):
+        # Documents larger than a read and than the pipe, split across reads however they fall
+        program = self._build(os.path.join(ROOT_DIR, "src", "tools", "splitstream_cli.c"), "splitstream")
+        docs = [b"{\"a\":1}", b"[2,\"]\"]", b"{\"big\":\"" + b"x" * 700000 + b"\"}", b"{}"] * 3
+        data = b" \n".join(docs) + b" [\"unfinished"
+        path = os.path.join(self.tmpdir, "input.json")
+        with open(path, "wb") as f:
+            f.write(data)
+        workdir = tempfile.mkdtemp(dir=self.tmpdir)
+
+        def split(args, pipe, skip=0):
+            with open(path, "rb") as f:
+                f.seek(skip)
+                p = subprocess.Popen([program, "-f", "json"] + args, cwd=workdir, stdin=subprocess.PIPE if pipe else f,
+                                     stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+                out, err = p.communicate(data[skip:] if pipe else None)
+            self.assertEqual(p.returncode, 0, err)
+            return out
+
+        for pipe in [False, True]:
+            for bufsize in ["7", "65536"]:
+                self.assertEqual(split(["-b", bufsize], pipe), b"\n".join(docs) + b"\n")
+                self.assertEqual(split(["-b", bufsize, "-s", "\\0"], pipe, len(docs[0]) + 2), b"\0".join(docs[1:]) + b"\0")
+            # Numbered files, and outputs in turn, which are opened for appending
+            split(["-o", "doc-%03llu.json"], pipe)
+            outputs = [os.path.join(workdir, "out%d" % i) for i in range(2)]
+            split(["-r", outputs[0], "-r", outputs[1], "-s", ""], pipe)
+            for i, doc in enumerate(docs):
+                with open(os.path.join(workdir, "doc-%03u.json" % i), "rb") as f:
+                    self.assertEqual(f.read(), doc)
+            for i, name in enumerate(outputs):
+                with open(name, "rb") as f:
+                    self.assertEqual(f.read(), b"".join(docs[i::2]))
+                os.remove(name)
+            # Documents over the maximum size are dropped
+            self.assertEqual(split(["-m", "1000"], pipe), b"".join(d + b"\n" for d in docs if len(d) <= 1000))
+
+if __name__ == '__main__':
+    unittest.main()
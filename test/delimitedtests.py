@@ -0,0 +1,67 @@
+import unittest
+try:
+    from StringIO import StringIO
+except ImportError:
+    from io import BytesIO as StringIO
+import tempfile
+import splitstream
+
+class DelimitedTests(unittest.TestCase):
+    def _tempfile(self, string):
+        f = tempfile.TemporaryFile()
+        f.write(string)
+        f.seek(0)
+        return f
+
+    def _split(self, data, **kwargs):
+        return list(splitstream.splitfile(StringIO(data), "delimited", **kwargs))
+
+    def test_Lines(self):
+        # A line break by default; empty records are skipped
+        data = b"a\nbb\n\n\nc"
+        for bufsize in [1, 2, 4096]:
+            self.assertEqual(self._split(data, bufsize=bufsize), [b"a", b"bb", b"c"])
+        self.assertEqual([d.tobytes() for d in splitstream.split_buffer(data, "delimited")], [b"a", b"bb", b"c"])
+
+    def test_JsonTextSequence(self):
+        data = b"\x1e{\"a\": 1}\n\x1e[1,\n2]\n\x1e\"x\"\n"
+        exp = [b"{\"a\": 1}\n", b"[1,\n2]\n", b"\"x\"\n"]
+        for bufsize in [1, 3, 4096]:
+            self.assertEqual(self._split(data, delimiter=b"\x1e", bufsize=bufsize), exp)
+        self.assertEqual(list(splitstream.splitfile(self._tempfile(data), "delimited", delimiter="\x1e")), exp)
+
+    def test_MultiByte(self):
+        # The separator is found however it is split across reads, also where it overlaps itself
+        data = b"a: 1\n---\nb: 2\n--\n---\n\n---\nc: [\n-\n]\n"
+        exp = [b"a: 1", b"b: 2\n--", b"c: [\n-\n]\n"]
+        for bufsize in range(1, 12):
+            self.assertEqual(self._split(data, delimiter="\n---\n", bufsize=bufsize), exp)
+        self.assertEqual(self._split(b"xxab", delimiter=b"xab", bufsize=1), [b"x"])
+
+    def test_Keep(self):
+        data = b"a\0b\0\0c"
+        for bufsize in [1, 4096]:
+            self.assertEqual(self._split(data, delimiter=b"\0", keepdelimiter=True, bufsize=bufsize), [b"a\0", b"b\0", b"c"])
+        self.assertEqual(self._split(b"1\r\n2\r\n", delimiter=b"\r\n", keepdelimiter=True, bufsize=1), [b"1\r\n", b"2\r\n"])
+
+    def test_LargeRecords(self):
+        # Records that span many buffers and segments, with the separator split between reads
+        records = [b"x" * n for n in (16383, 16384, 16385, 40000)]
+        data = b"<>".join(records)
+        for bufsize in [16383, 16384, 4097]:
+            self.assertEqual(self._split(data, delimiter=b"<>", bufsize=bufsize), records)
+
+    def test_Splitter(self):
+        sp = splitstream.Splitter("delimited")
+        self.assertEqual(sp.feed(b"a\nb"), [b"a"])
+        self.assertEqual(sp.feed(b"c"), [])
+        self.assertEqual(sp.finish(), [b"bc"])
+        self.assertEqual(sp.finish(), [])
+
+    def test_Invalid(self):
+        self.assertRaises(ValueError, self._split, b"a", delimiter=b"")
+        self.assertRaises(ValueError, self._split, b"a", delimiter=b"x" * 33)
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(b"{}"), "json", keepdelimiter=True)
+
+if __name__ == '__main__':
+    unittest.main()
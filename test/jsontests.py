@@ -6,6 +6,11 @@ try:
 except ImportError:
     from io import BytesIO as StringIO
 import tempfile
+import shutil
+import threading
+import time
+import subprocess
+import sys
 import splitstream
 
 class JsonTests(unittest.TestCase):
@@ -41,10 +46,26 @@ class JsonTests(unittest.TestCase):
         f.seek(0)
         return gzip.GzipFile(fileobj=f, mode='rb')
     
-    def _do_split(self, string, startdepth=0):
+    def _gzipmembers(self, string):
+        if bytes != type(string):
+            b = bytes(string, 'utf-8')
+        else:
+            b = string
+        # Two concatenated gzip members, split in the middle of the data
+        half = len(b) // 2
+        return gzip.compress(b[:half]) + gzip.compress(b[half:])
+
+    def _gzipraw(self, string):
+        return self._tempfile(self._gzipmembers(string))
+
+    def _gzipstringio(self, string):
+        return self._stringio(self._gzipmembers(string))
+
+    def _do_split(self, string, startdepth=0, **kw):
         f = self._loadstr(string)
         try:
-            return list(splitstream.splitfile(f, "json", bufsize=self._bufsize, startdepth=startdepth))
+            kw.update(self._extra)
+            return list(splitstream.splitfile(f, "json", bufsize=self._bufsize, startdepth=startdepth, **kw))
         finally:
             f.close()
         
@@ -75,15 +96,379 @@ class JsonTests(unittest.TestCase):
                 b"{\"x\" : 3 }" ]
         assert v == exp, "%r != %r" % (v, exp)
 
+    DATA_TYPED = (b"{\"type\":\"error\",\"m\":1}[1]{\"m\":{\"type\":\"error\"}} { \"type\" : \"errno\"}"
+                  b"{\"type\":\"info\"}{\"typeX\":\"error\"}{\"ty\\\"pe\":\"error\"}{}")
+
+    def def_SplitWithKeyFilter(self):
+        v = self._do_split(self.DATA_TYPED, filter="type")
+        exp = [ b"{\"type\":\"error\",\"m\":1}", b"{ \"type\" : \"errno\"}", b"{\"type\":\"info\"}" ]
+        assert v == exp, "%r != %r" % (v, exp)
+
+    def def_SplitWithKeyValueFilter(self):
+        v = self._do_split(self.DATA_TYPED, filter=("type", "\"err"))
+        exp = [ b"{\"type\":\"error\",\"m\":1}", b"{ \"type\" : \"errno\"}" ]
+        assert v == exp, "%r != %r" % (v, exp)
+        v = self._do_split(b"{\"a\":[{\"type\":1},{\"type\":2},[]]}", startdepth=2, filter=("type", "2"))
+        assert v == [ b"{\"type\":2}" ], "%r" % v
+
+    def def_SampleAndCount(self):
+        docs = [ ("{\"i\":%d}" % i).encode() for i in range(100) ]
+        data = b" ".join(docs)
+        v = self._do_split(data, skip=95)
+        assert v == docs[95:], "%r" % v
+        v = self._do_split(data, skip=10, every=30)
+        assert v == docs[10::30], "%r" % v
+        v = self._do_split(data, sample=5, seed=1)
+        assert len(v) == 5 and len(set(v)) == 5 and all(d in docs for d in v), "%r" % v
+        v = self._do_split(data, sample=500)
+        assert sorted(v) == sorted(docs), "%r" % v
+        f = self._loadstr(data)
+        try:
+            v = splitstream.splitfile(f, "json", bufsize=self._bufsize, count=True, **self._extra)
+        finally:
+            f.close()
+        assert v == (100, sum(len(d) for d in docs)), "%r" % (v,)
+
+    def def_SplitLargeInFragments(self):
+        big = b"{\"a\":[" + b",".join([ b"\"%d\"" % i for i in range(2000) ]) + b"]}"
+        v = self._do_split(b"{\"s\":1}" + big + b" [2]", fragmentsize=100)
+        kinds = [ k for k, d in v ]
+        assert v[0] == (splitstream.FRAGMENT_NONE, b"{\"s\":1}"), "%r" % v[0]
+        assert v[-1] == (splitstream.FRAGMENT_NONE, b"[2]"), "%r" % v[-1]
+        assert kinds[1] == splitstream.FRAGMENT_START and kinds[-2] == splitstream.FRAGMENT_END, "%r" % kinds
+        assert set(kinds[2:-2]) <= set([ splitstream.FRAGMENT_CONTINUE ]), "%r" % kinds
+        assert b"".join(d for k, d in v[1:-1]) == big
+        assert all(len(d) <= 100 + max(self._bufsize, 4096) for k, d in v)
+        # Without fragments the document is discarded
+        v = self._do_split(b"{\"s\":1}" + big, maxdocsize=1000)
+        assert v == [ b"{\"s\":1}" ], "%r" % v
+
+    def test_SplitPathAndFd(self):
+        f = self._tempfile(b"{\"a\":3}{\"b\":3}")
+        exp = [ b"{\"a\":3}", b"{\"b\":3}" ]
+        try:
+            v = list(splitstream.splitfile(f.fileno(), "json"))
+            assert v == exp, "%r != %r" % (v, exp)
+        finally:
+            f.close()
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, b"{\"a\":3}{\"b\":3}")
+            os.close(fd)
+            v = list(splitstream.splitfile(path, "json"))
+            assert v == exp, "%r != %r" % (v, exp)
+        finally:
+            os.remove(path)
+
+    def test_TruncatedGzip(self):
+        if "gzip" not in splitstream.compressions:
+            self.skipTest("built without zlib")
+        f = self._tempfile(gzip.compress(b"{\"a\":3}{\"b\":3}" * 100)[:-20])
+        try:
+            self.assertRaises(IOError, list, splitstream.splitfile(f, "json", compression="gzip"))
+        finally:
+            f.close()
+
+    def test_SplitFiles(self):
+        tmpdir = tempfile.mkdtemp()
+        try:
+            paths, exp = [], []
+            for i in range(20):
+                docs = [ ("{\"f\":%d,\"i\":%d}" % (i, j)).encode() for j in range(50 * (i % 4 + 1)) ]
+                paths.append(os.path.join(tmpdir, "%d.json" % i))
+                exp.append(docs)
+                with open(paths[-1], "wb") as f:
+                    f.write(b"\n".join(docs))
+            paths.append(os.path.join(tmpdir, "missing.json"))
+            v = splitstream.splitfiles(paths, "json", bufsize=7, threads=4)
+            self.assertEqual(v[:-1], exp)
+            self.assertTrue(isinstance(v[-1], IOError))
+            got = {}
+            v = splitstream.splitfiles(paths[:-1], "json", callback=lambda i, doc: got.setdefault(i, []).append(doc))
+            self.assertEqual(v, [ len(docs) for docs in exp ])
+            self.assertEqual([ got[i] for i in range(20) ], exp)
+            def fail(i, doc):
+                raise KeyError(doc)
+            self.assertRaises(KeyError, splitstream.splitfiles, paths, "json", callback=fail)
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def test_FollowGrowingFile(self):
+        # Each change is made before asking for the next document, which the reader only notices
+        # once it has run out of data, so nothing depends on timing
+        tmpdir = tempfile.mkdtemp()
+        path = os.path.join(tmpdir, "log.json")
+        def append(data, name=path, mode="ab"):
+            with open(name, mode) as f:
+                f.write(data)
+        try:
+            append(b"{\"a\":1}{\"b\"")
+            g = splitstream.splitfile(path, "json", follow=True, bufsize=3)
+            self.assertEqual(next(g), b"{\"a\":1}")
+            # The writer completes the document
+            append(b":2}")
+            self.assertEqual(next(g), b"{\"b\":2}")
+            # Truncated: starts over from the beginning
+            append(b"{\"c\":3}", mode="wb")
+            self.assertEqual(next(g), b"{\"c\":3}")
+            # Rotated: the old file is drained, and its incomplete document dropped
+            append(b"[{\"z\"")
+            os.rename(path, path + ".1")
+            append(b"{\"d\":4}")
+            self.assertEqual(next(g), b"{\"d\":4}")
+            self.assertEqual(g.offset, 7)
+            with open(path, "rb") as f:
+                self.assertRaises(ValueError, splitstream.splitfile, f, "json", follow=True)
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def test_FollowRestartsElements(self):
+        # Splitting the elements of an array starts over at the depth of the array, with the
+        # key of the element cut off forgotten
+        tmpdir = tempfile.mkdtemp()
+        path = os.path.join(tmpdir, "log.json")
+        try:
+            with open(path, "wb") as f:
+                f.write(b"[{\"id\":1}, {\"x\":[1,{\"id\":\"")
+            # Read whole, so that the shorter file below is noticed as a truncation
+            g = splitstream.splitfile(path, "json", startdepth=1, follow=True, hash=True)
+            self.assertEqual(next(g)[1], b"{\"id\":1}")
+            with open(path, "wb") as f:
+                f.write(b"[2,{\"id\":3}]")
+            exp = list(splitstream.splitfile(StringIO(b"[2,{\"id\":3}]"), "json", startdepth=1, hash=True))
+            self.assertEqual([next(g), next(g)], exp)
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def test_HashAndDedup(self):
+        data = b"{\"a\":1}{\"b\":2} {\"a\":1}[3]" + b"{\"s\":\"" + b"x" * 50000 + b"\"}" + b"{\"a\":1}"
+        docs = list(splitstream.splitfile(StringIO(data), "json"))
+        hashed = list(splitstream.splitfile(StringIO(data), "json", hash=True, bufsize=7))
+        self.assertEqual([d for h, d in hashed], docs)
+        self.assertEqual(hashed[0][0], hashed[2][0])
+        self.assertEqual(len(set(h for h, d in hashed)), 4)
+        g = splitstream.splitfile(StringIO(data), "json", dedup=16)
+        self.assertEqual(list(g), [docs[0], docs[1], docs[3], docs[4]])
+        self.assertEqual(g.duplicates, 2)
+        self.assertRaises(ValueError, splitstream.splitfile, StringIO(data), "json", hash=True, fragmentsize=1024)
+
+    def test_DedupWindow(self):
+        # Each distinct document is kept once, however it is split across reads
+        docs = [("{\"n\":%d}" % (i % 5)).encode() for i in range(40)]
+        for bufsize in [1, 3, 4096]:
+            g = splitstream.splitfile(StringIO(b"".join(docs)), "json", dedup=64, bufsize=bufsize)
+            self.assertEqual(list(g), docs[:5])
+            self.assertEqual(g.duplicates, 35)
+        # The table size is rounded up to whole buckets
+        g = splitstream.splitfile(StringIO(b"[1][1][2]"), "json", dedup=1)
+        self.assertEqual(list(g), [b"[1]", b"[2]"])
+        self.assertEqual(g.duplicates, 1)
+
+    def test_DedupBounds(self):
+        for dedup in [-1, 2**24 + 1, 2**61, 2**62]:
+            self.assertRaises(ValueError, splitstream.splitfile, StringIO(b"[1]"), "json", dedup=dedup)
+        self.assertEqual(list(splitstream.splitfile(StringIO(b"[1][1]"), "json", dedup=2**24)), [b"[1]"])
+
+    def test_ScalarElements(self):
+        data = b"[1, \"a\", 2.5, true,null ,\"x\\\"]y\", {\"o\":[1]}, [2,3], -7e3]\n[4]"
+        exp = [b"1", b"\"a\"", b"2.5", b"true", b"null", b"\"x\\\"]y\"", b"{\"o\":[1]}", b"[2,3]", b"-7e3", b"4"]
+        for bufsize in [1, 2, 3, 4096]:
+            self.assertEqual(list(splitstream.splitfile(StringIO(data), "json", startdepth=1, bufsize=bufsize)), exp)
+        self.assertEqual([d.tobytes() for d in splitstream.split_buffer(data, "json", 1)], exp)
+        # Only the object and array values of an object are documents
+        data = b"{\"a\":1,\"b\":{\"c\":2},\"d\":\"s\",\"e\":[1, \"f\"]}"
+        self.assertEqual(list(splitstream.splitfile(StringIO(data), "json", startdepth=1)), [b"{\"c\":2}", b"[1, \"f\"]"])
+        self.assertEqual(list(splitstream.splitfile(StringIO(data), "json", startdepth=2)), [b"1", b"\"f\""])
+
+    def test_Resync(self):
+        data = b"{\"a\":1}\n{\"b\":\"x}\n{\"c\":2}\n{\"d\":\"" + b"y" * 100 + b"\"}\n{\"e\":[1,\n  2]}\n"
+        for bufsize in [1, 7, 4096]:
+            g = splitstream.splitfile(StringIO(data), "json", bufsize=bufsize, resync=True, maxtoken=50)
+            self.assertEqual(list(g), [b"{\"a\":1}", b"{\"c\":2}", b"{\"e\":[1,\n  2]}"])
+            self.assertEqual(g.skipped, [(8, 17), (25, 132)])
+        # Without a policy, the stray quote swallows the rest of the stream
+        g = splitstream.splitfile(StringIO(data), "json")
+        self.assertEqual(list(g), [b"{\"a\":1}"])
+        self.assertEqual(g.skipped, [])
+
+    def test_AdaptiveReadSize(self):
+        data = b"".join(b"{\"n\":%d,\"s\":\"%s\"}\n" % (i, b"x" * (i * 997 % 30000)) for i in range(100))
+        exp = list(splitstream.splitfile(StringIO(data), "json"))
+        sizes = []
+        class C(StringIO):
+            def read(self, n):
+                sizes.append(n)
+                return StringIO.read(self, n)
+        self.assertEqual(list(splitstream.splitfile(C(data), "json", adaptive=True)), exp)
+        # Reads start small and grow with the documents, up to bufsize
+        self.assertEqual(sizes[0], 4096)
+        self.assertTrue(4096 < max(sizes) <= 1024 * 1024)
+        del sizes[:]
+        self.assertEqual(list(splitstream.splitfile(C(data), "json", bufsize=16384, adaptive=True)), exp)
+        self.assertEqual(max(sizes), 16384)
+        self.assertEqual(list(splitstream.splitfile(self._tempfile(data), "json", adaptive=True)), exp)
+        self.assertRaises(ValueError, splitstream.splitfile, self._tempfile(data), "json", adaptive=True, readahead=2)
+
+    def test_SplitterFeed(self):
+        data = self.DATA_JSON + b"{\"s\":\"" + b"x" * 50000 + b"\"} [1]"
+        exp = list(splitstream.splitfile(StringIO(data), "json"))
+        for chunk in [1, 7, 4096]:
+            s = splitstream.Splitter("json")
+            got = []
+            view = memoryview(bytearray(data))
+            for i in range(0, len(data), chunk):
+                got.extend(s.feed(view[i:i + chunk]))
+            self.assertEqual(got, exp)
+            self.assertEqual(s.offset, len(data))
+        # A large buffer fed in one call is scanned once, not again after every document
+        data = b"{\"a\":[1,\"x\"]} " * 300000
+        exp = [d.tobytes() for d in splitstream.split_buffer(data, "json")]
+        s = splitstream.Splitter("json")
+        started = time.time()
+        got = s.feed(b"[1] {\"b\":") + s.feed(b"2} " + data[:-7])
+        self.assertLess(time.time() - started, 5)
+        self.assertEqual(got[:2], [b"[1]", b"{\"b\":2}"])
+        self.assertEqual(got[2:], exp[:-1])
+        self.assertEqual(s.feed(data[-7:]), exp[-1:])
+        s = splitstream.Splitter("json", startdepth=1)
+        self.assertEqual(s.feed(b"[{\"a\":1},{\"b\""), [b"{\"a\":1}"])
+        self.assertEqual(s.feed(b":2}]"), [b"{\"b\":2}"])
+        self.assertRaises(ValueError, splitstream.Splitter, "yaml")
+        self.assertRaises(TypeError, splitstream.Splitter("json").feed, u"{}")
+
+    def _threads(self, func, n=4):
+        errors = []
+        def run():
+            try:
+                func()
+            except Exception as e:
+                errors.append(e)
+        threads = [threading.Thread(target=run) for i in range(n)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(errors, [])
+
+    def test_SplitterThreads(self):
+        # A feed either scans its whole buffer or is refused while another thread is in it
+        data = b"[1]" * 20000
+        s = splitstream.Splitter("json")
+        done = []
+        def feed():
+            for i in range(5):
+                try:
+                    done.append(len(s.feed(data)))
+                except RuntimeError:
+                    pass
+        self._threads(feed)
+        self.assertTrue(done)
+        self.assertEqual(done, [20000] * len(done))
+        self.assertEqual(s.offset, len(data) * len(done))
+
+    def test_GeneratorThreads(self):
+        # Every document comes out exactly once, whichever thread gets it
+        exp = [("[%d]" % i).encode() for i in range(5000)]
+        for extra in [{"readahead": 2}, {"compression": "gzip"}, {}]:
+            data = b"".join(exp)
+            if extra.get("compression"):
+                data = gzip.compress(data)
+            f = self._tempfile(data)
+            g = splitstream.splitfile(f, "json", bufsize=256, **extra)
+            got = []
+            def drain():
+                while True:
+                    try:
+                        got.append(next(g))
+                    except RuntimeError:
+                        pass
+                    except StopIteration:
+                        return
+            self._threads(drain)
+            del g
+            f.close()
+            self.assertEqual(sorted(got, key=lambda d: int(d[1:-1])), exp)
+
+    def test_ReadaheadClose(self):
+        # Closing does not wait for a writer that has gone quiet. Before it did, it held the
+        # GIL while it waited, so this runs in another interpreter that a hang can be killed in.
+        script = (
+            "import os, splitstream\n"
+            "r, w = os.pipe()\n"
+            "os.write(w, b'{\"a\":1} {')\n"
+            "g = splitstream.splitfile(os.fdopen(r, 'rb'), 'json', readahead=2)\n"
+            "assert next(g) == b'{\"a\":1}'\n"
+            "del g\n")
+        env = dict(os.environ)
+        env["PYTHONPATH"] = os.pathsep.join([os.path.dirname(os.path.abspath(splitstream.__file__))] +
+                                            ([env["PYTHONPATH"]] if env.get("PYTHONPATH") else []))
+        self.assertEqual(subprocess.call([sys.executable, "-c", script], env=env, timeout=30), 0)
+
+        # A regular file is left after the data handed out, not after what was read ahead
+        f = self._tempfile(b"[1]" * 100)
+        g = splitstream.splitfile(f, "json", bufsize=16, readahead=4)
+        self.assertEqual(next(g), b"[1]")
+        del g
+        self.assertEqual(os.lseek(f.fileno(), 0, os.SEEK_CUR), 16)
+        f.close()
+
+    def test_SplitBuffer(self):
+        data = self.DATA_JSON + b"{\"s\":\"" + b"x" * 50000 + b"\"} [1] {\"unfinished\""
+        exp = list(splitstream.splitfile(StringIO(data), "json"))
+        for obj in [data, bytearray(data), memoryview(data)]:
+            docs = splitstream.split_buffer(obj, "json")
+            self.assertTrue(all(isinstance(d, memoryview) for d in docs))
+            self.assertEqual([d.tobytes() for d in docs], exp)
+        starts, ends = splitstream.split_buffer(data, "json", offsets=True)
+        self.assertEqual((starts.typecode, ends.typecode), ("Q", "Q"))
+        self.assertEqual([data[a:b] for a, b in zip(starts, ends)], exp)
+        docs = splitstream.split_buffer(b"[{\"a\":1},[2]]", "json", startdepth=1)
+        self.assertEqual([d.tobytes() for d in docs], [b"{\"a\":1}", b"[2]"])
+        self.assertRaises(TypeError, splitstream.split_buffer, u"{}", "json")
+
+    @unittest.skipUnless(hasattr(splitstream, "asplit"), "needs asyncio")
+    def test_AsyncSplit(self):
+        import asyncio
+        data = self.DATA_JSON + b"{\"s\":\"" + b"x" * 50000 + b"\"} [1]"
+        exp = list(splitstream.splitfile(StringIO(data), "json"))
+        loop = asyncio.new_event_loop()
+        class Reader(object):
+            # read() completes on a later iteration of the event loop
+            def __init__(self, chunk):
+                self.pos, self.chunk = 0, chunk
+            def read(self, n):
+                f = loop.create_future()
+                n = min(n, self.chunk)
+                loop.call_soon(f.set_result, data[self.pos:self.pos + n])
+                self.pos += n
+                return f
+        def collect(it):
+            out = []
+            while True:
+                try:
+                    out.append(loop.run_until_complete(it.__anext__()))
+                except StopAsyncIteration:
+                    return out
+        try:
+            for chunk in [1, 7, 4096]:
+                self.assertEqual(collect(splitstream.asplit(Reader(chunk), "json")), exp)
+            batches = collect(splitstream.asplit(Reader(4096), "json", batch=True))
+            self.assertEqual(sum(batches, []), exp)
+            self.assertTrue(len(batches) < len(data) // 4096 + 2)
+            self.assertRaises(ValueError, splitstream.asplit, Reader(1), "yaml")
+        finally:
+            loop.close()
+
     def __init__(self, *a, **kw):
         unittest.TestCase.__init__(self, *a, **kw)
         self._loadstr = None
         self._bufsize = 0
+        self._extra = {}
         
 for m in dir(JsonTests):
     if m.startswith("def_"):
         func = getattr(JsonTests, m)
-        for mode in ["str", "file", "gzip"]:
+        for mode in ["str", "file", "gzip", "readahead", "nativegzip", "nativegzipstr"]:
             for bufsize in [1, 2, 7, 4096]:
                 if "SplitHuge" in m and bufsize != 4096: continue
                 def addt(m, mode, bufsize, func):
@@ -94,6 +479,13 @@ for m in dir(JsonTests):
                             self._loadstr = self._gzipfile
                         else:
                             self._loadstr = self._tempfile
+                        if mode == "readahead":
+                            self._extra = { "readahead" : 2 }
+                        elif mode.startswith("nativegzip"):
+                            if "gzip" not in splitstream.compressions:
+                                self.skipTest("built without zlib")
+                            self._loadstr = self._gzipstringio if mode.endswith("str") else self._gzipraw
+                            self._extra = { "compression" : "gzip" }
                         self._bufsize = bufsize
                         return func(self)
                     setattr(JsonTests, "test_%s_buf%04d_%s" % (m[4:], bufsize, mode), ff)
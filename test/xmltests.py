@@ -5,6 +5,7 @@ try:
 except ImportError:
     from io import BytesIO as StringIO
 import tempfile
+import pickle
 import splitstream
 
 class XmlTests(unittest.TestCase):
@@ -33,6 +34,7 @@ class XmlTests(unittest.TestCase):
     def _do_split(self, string, **kw):
         f = self._loadstr(string)
         try:
+            kw.update(self._extra)
             return list(splitstream.splitfile(f, "xml", bufsize=self._bufsize, **kw))
         finally:
             f.close()
@@ -50,10 +52,29 @@ class XmlTests(unittest.TestCase):
         assert len(v) == 3, "%d != 3" % len(v)
         assert v == [ self.DATA_XMLRPC, self.DATA_XMLRPC, self.DATA_XMLRPC ], "%r != %r" % (v, [ self.DATA_XMLRPC, self.DATA_XMLRPC, self.DATA_XMLRPC ])
         
+    DATA_LOG_MIXED = (b"<?xml version=\"1.0\"?><log><!-- a > b --><a:logEntry id=\"1\">one</a:logEntry>"
+                      b"<other/><logEntry/><logEntryX/><b><logEntry/></b><debug>x</debug></log>")
+
+    def def_SplitWithElementFilter(self):
+        v = self._do_split(self.DATA_LOG_MIXED, startdepth=1, filter="logEntry")
+        exp = [ b"<a:logEntry id=\"1\">one</a:logEntry>", b"<logEntry/>" ]
+        assert v == exp, "%r != %r" % (v, exp)
+        v = self._do_split(self.DATA_LOG_MIXED, startdepth=1, filter=["debug", "other"])
+        exp = [ b"<other/>", b"<debug>x</debug>" ]
+        assert v == exp, "%r != %r" % (v, exp)
+        v = self._do_split(b"<?xml version=\"1.0\"?><!-- c --><root/><other/>", filter=["root"])
+        exp = [ b"<?xml version=\"1.0\"?><!-- c --><root/>" ]
+        assert v == exp, "%r != %r" % (v, exp)
+
     def def_SplitTwoSimpleXml(self):
         v = self._do_split(b"<root></root><root2/>")
         assert v == [ b"<root></root>",b"<root2/>" ]
 
+    def def_ShortNameAfterEmptyElement(self):
+        # The slash of an empty element is not taken for one that closes the next element
+        v = self._do_split(b"<log><o/><b>x</b></log><a/><b></b>")
+        assert v == [ b"<log><o/><b>x</b></log>", b"<a/>", b"<b></b>" ], "%r" % v
+
     def def_SplitTwoXmlRpc(self):
         v = self._do_split(self.DATA_XMLRPC + self.DATA_XMLRPC)
         assert v == [ self.DATA_XMLRPC, self.DATA_XMLRPC ]
@@ -104,15 +125,84 @@ class XmlTests(unittest.TestCase):
         assert v == [ b"<root><!-- Weird <> comment --></root>", b"<root2/>" ]
         
         
+    DATA_LOG = b"<log>" + b"".join(b"<logEntry id=\"%d\">Hello <![CDATA[ </logEntry> ]]></logEntry>\n" % i for i in range(20))
+
+    def test_ResumeFromState(self):
+        f = self._tempfile(self.DATA_LOG)
+        try:
+            exp = list(splitstream.splitfile(f, "xml", startdepth=1))
+            f.seek(0)
+            g = splitstream.splitfile(f, "xml", startdepth=1, bufsize=7)
+            v = [ next(g) for i in range(5) ]
+            state, offset = g.getstate(), g.offset
+            del g
+            f.seek(offset)
+            v += list(splitstream.splitfile(f, "xml", bufsize=7, state=state))
+            assert v == exp, "%r != %r" % (v, exp)
+        finally:
+            f.close()
+
+    def test_StateIsDeterministic(self):
+        # The same state always serializes to the same bytes, also in the middle of a document
+        for n in [0, 3, 19]:
+            states = []
+            for i in range(2):
+                g = splitstream.splitfile(StringIO(self.DATA_LOG), "xml", startdepth=1, bufsize=13)
+                for j in range(n):
+                    next(g)
+                states.append(g.getstate())
+                states.append(g.getstate())
+            self.assertEqual(len(set(states)), 1)
+
+    def test_ResumeInsideLargeDocument(self):
+        big = b"<blob>" + b"".join([ self.DATA_XMLRPC ] * 200) + b"</blob>"
+        data = b"<a/>" + big + b"<b/>"
+        f = self._tempfile(data[:len(data) // 2])
+        try:
+            g = splitstream.splitfile(f, "xml", bufsize=1000)
+            v = list(g)
+            state, offset = g.getstate(), g.offset
+        finally:
+            f.close()
+        f = self._tempfile(data)
+        try:
+            f.seek(offset)
+            v += list(splitstream.splitfile(f, "xml", bufsize=1000, state=state))
+        finally:
+            f.close()
+        assert v == [ b"<a/>", big, b"<b/>" ], "%r" % [ len(d) for d in v ]
+
+    def test_PickleGenerator(self):
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, self.DATA_LOG[1:])
+            os.close(fd)
+            exp = list(splitstream.splitfile(path, "xml", startdepth=1, preamble=b"<"))
+            g = splitstream.splitfile(path, "xml", startdepth=1, bufsize=11, preamble=b"<")
+            v = [ next(g) for i in range(7) ]
+            g = pickle.loads(pickle.dumps(g))
+            v += list(g)
+            assert v == exp, "%r != %r" % (v, exp)
+        finally:
+            os.remove(path)
+
+    def test_Resync(self):
+        data = b"<e>1</e>\n<e><![CDATA[ never closed\n<e>2</e>\n<e><b>3</b></e>\n"
+        for bufsize in [1, 5, 4096]:
+            g = splitstream.splitfile(self._stringio(data), "xml", bufsize=bufsize, resync=True)
+            self.assertEqual(list(g), [b"<e>1</e>", b"<e>2</e>", b"<e><b>3</b></e>"])
+            self.assertEqual(g.skipped, [(9, 35)])
+
     def __init__(self, *a, **kw):
         unittest.TestCase.__init__(self, *a, **kw)
         self._loadstr = None
         self._bufsize = 0
+        self._extra = {}
         
 for m in dir(XmlTests):
     if m.startswith("def_"):
         func = getattr(XmlTests, m)
-        for mode in ["str", "file"]:
+        for mode in ["str", "file", "readahead"]:
             for bufsize in [1, 2, 7, 4096]:
                 if "SplitHuge" in m and bufsize != 4096: continue
                 def addt(m, mode, bufsize, func):
@@ -121,6 +211,8 @@ for m in dir(XmlTests):
                             self._loadstr = self._stringio
                         else:
                             self._loadstr = self._tempfile
+                        if mode == "readahead":
+                            self._extra = { "readahead" : 2 }
                         self._bufsize = bufsize
                         return func(self)
                     setattr(XmlTests, "test_%s_buf%04d_%s" % (m[4:], bufsize, mode), ff)